@@ -0,0 +1,250 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "CloneLayer.h"
+
+// Custom
+#include "ConvolutionPyramid.h"
+#include "PackedMask.h"
+#include "Parallel.h"
+
+// ITK
+#include "itkImageRegionConstIterator.h"
+#include "itkImageRegionIterator.h"
+
+// STL
+#include <algorithm>
+
+itk::ImageRegion<2> CloneLayer::GetRegion() const
+{
+  return itk::ImageRegion<2>(this->Corner, this->SourceImage->GetLargestPossibleRegion().GetSize());
+}
+
+namespace CloneLayers
+{
+
+bool Overlap(const itk::ImageRegion<2>& region1, const itk::ImageRegion<2>& region2)
+{
+  itk::ImageRegion<2> paddedRegion = region1;
+  paddedRegion.PadByRadius(1);
+  return paddedRegion.Crop(region2);
+}
+
+std::vector<std::vector<unsigned int> > ComputeWaves(const std::vector<itk::ImageRegion<2> >& regions)
+{
+  std::vector<unsigned int> layerWave(regions.size(), 0);
+  std::vector<std::vector<unsigned int> > waves;
+
+  for(unsigned int layerId = 0; layerId < regions.size(); ++layerId)
+  {
+    unsigned int wave = 0;
+    for(unsigned int lowerLayerId = 0; lowerLayerId < layerId; ++lowerLayerId)
+    {
+      if(Overlap(regions[layerId], regions[lowerLayerId]))
+      {
+        wave = std::max(wave, layerWave[lowerLayerId] + 1);
+      }
+    }
+
+    layerWave[layerId] = wave;
+    if(waves.size() <= wave)
+    {
+      waves.resize(wave + 1);
+    }
+    waves[wave].push_back(layerId);
+  }
+
+  return waves;
+}
+
+void UpdateDirtyFlags(std::vector<CloneLayer>& layers, const bool mixed)
+{
+  for(unsigned int layerId = 0; layerId < layers.size(); ++layerId)
+  {
+    CloneLayer& layer = layers[layerId];
+    layer.Dirty = !layer.SolvedPatch || layer.Corner != layer.SolvedCorner || layer.SolvedMixed != mixed;
+
+    // A layer was solved on top of the layers below it, so it must be solved again if one of
+    // them changes where it is now or where it was.
+    for(unsigned int lowerLayerId = 0; lowerLayerId < layerId && !layer.Dirty; ++lowerLayerId)
+    {
+      const CloneLayer& lowerLayer = layers[lowerLayerId];
+      if(!lowerLayer.Dirty)
+      {
+        continue;
+      }
+
+      if(Overlap(layer.GetRegion(), lowerLayer.GetRegion()) ||
+         (lowerLayer.SolvedPatch &&
+          Overlap(layer.GetRegion(), lowerLayer.SolvedPatch->GetLargestPossibleRegion())))
+      {
+        layer.Dirty = true;
+      }
+    }
+  }
+}
+
+void CopyRegion(const ImageType* const source, ImageType* const target,
+                const itk::ImageRegion<2>& region)
+{
+  Parallel::ForRows(region, 64, [&](const itk::ImageRegion<2>& rows)
+  {
+    itk::ImageRegionConstIterator<ImageType> sourceIterator(source, rows);
+    itk::ImageRegionIterator<ImageType> targetIterator(target, rows);
+
+    while(!sourceIterator.IsAtEnd())
+    {
+      targetIterator.Set(sourceIterator.Get());
+      ++sourceIterator;
+      ++targetIterator;
+    }
+  });
+}
+
+itk::ImageRegion<2> ComputeResultRegion(const std::vector<CloneLayer>& layers,
+                                        const itk::ImageRegion<2>& targetRegion)
+{
+  itk::Index<2> minimum = {{0, 0}};
+  itk::Index<2> maximum = {{0, 0}};
+  bool empty = true;
+
+  for(unsigned int layerId = 0; layerId < layers.size(); ++layerId)
+  {
+    itk::ImageRegion<2> region = layers[layerId].GetRegion();
+    region.PadByRadius(1);
+    if(!region.Crop(targetRegion))
+    {
+      continue;
+    }
+
+    const itk::Index<2> regionMaximum = region.GetUpperIndex();
+    for(unsigned int dimension = 0; dimension < 2; ++dimension)
+    {
+      minimum[dimension] = empty ? region.GetIndex()[dimension] :
+                                   std::min(minimum[dimension], region.GetIndex()[dimension]);
+      maximum[dimension] = empty ? regionMaximum[dimension] :
+                                   std::max(maximum[dimension], regionMaximum[dimension]);
+    }
+    empty = false;
+  }
+
+  if(empty)
+  {
+    itk::Size<2> emptySize = {{0, 0}};
+    return itk::ImageRegion<2>(targetRegion.GetIndex(), emptySize);
+  }
+
+  itk::ImageRegion<2> resultRegion;
+  resultRegion.SetIndex(minimum);
+  resultRegion.SetUpperIndex(maximum);
+  return resultRegion;
+}
+
+void PreviewLayer(CloneLayer& layer, ImageType* const composite)
+{
+  if(!layer.Previewer)
+  {
+    layer.Previewer = std::make_shared<MeanValueCloner>();
+    layer.Previewer->SetMask(layer.MaskImage);
+  }
+
+  const itk::Offset<2> sourceToImage = {{layer.Corner[0], layer.Corner[1]}};
+  layer.Previewer->Clone(layer.SourceImage, composite, sourceToImage, composite);
+}
+
+void ApproximateLayer(const CloneLayer& layer, ImageType* const composite)
+{
+  const itk::Offset<2> sourceToImage = {{layer.Corner[0], layer.Corner[1]}};
+  ConvolutionPyramid::Clone(layer.SourceImage, layer.MaskImage, sourceToImage, composite);
+}
+
+ImageType::Pointer Compose(const ImageType* const target, const ImageType* const result)
+{
+  ImageType::Pointer composed = ImageType::New();
+  composed->SetNumberOfComponentsPerPixel(target->GetNumberOfComponentsPerPixel());
+  composed->SetRegions(target->GetLargestPossibleRegion());
+  composed->Allocate();
+  CopyRegion(target, composed, target->GetLargestPossibleRegion());
+  CopyRegion(result, composed, result->GetBufferedRegion());
+  return composed;
+}
+
+void SolveLayer(CloneLayer& layer, const ImageType* const composite,
+                const itk::ImageRegion<2>& targetRegion, const bool mixed)
+{
+  ImageType::RegionType desiredRegion = layer.GetRegion();
+
+  // The layer is only updated once everything that can throw has succeeded, so a layer whose
+  // solve failed stays dirty and keeps its previous patch.
+  ImageType::Pointer patch = ImageType::New();
+  patch->SetNumberOfComponentsPerPixel(composite->GetNumberOfComponentsPerPixel());
+
+  // Only keep the part of the result that the layer covers. A layer that was dragged
+  // entirely off of the target gets an empty patch.
+  ImageType::RegionType patchRegion = desiredRegion;
+  if(!patchRegion.Crop(targetRegion))
+  {
+    ImageType::SizeType emptySize = {{0, 0}};
+    patch->SetRegions(ImageType::RegionType(desiredRegion.GetIndex(), emptySize));
+  }
+  else
+  {
+    // The factorization and the source guidance only have to be recomputed when the layer moved.
+    const itk::Offset<2> sourceToImage = {{layer.Corner[0], layer.Corner[1]}};
+    if(!layer.Solver || layer.SolverCorner != layer.Corner)
+    {
+      PoissonDomain domain = PoissonDomain::Create(layer.MaskImage, layer.MaskImage->GetLargestPossibleRegion(),
+                                                   sourceToImage, targetRegion);
+      std::shared_ptr<MaskedPoissonSolver> solver = std::make_shared<MaskedPoissonSolver>();
+      solver->SetDomain(domain);
+
+      if(!layer.SourceDivergence)
+      {
+        itk::ImageRegion<2> holeRegion = PackedMask::FromMask(layer.MaskImage).GetHoleBoundingBox();
+        holeRegion.Crop(layer.SourceImage->GetLargestPossibleRegion());
+        layer.SourceDivergence = MaskedGuidanceField::ComputeSourceDivergence(layer.SourceImage, holeRegion);
+      }
+      layer.SourceGuidance = MaskedGuidanceField::FromSourceDivergence(domain, layer.SourceImage, sourceToImage,
+                                                                       layer.SourceDivergence);
+      layer.Solver = solver;
+      layer.SolverCorner = layer.Corner;
+    }
+
+    // The mixed guidance depends on what is under the layer, so it can't be kept.
+    const MaskedGuidanceField* guidance = &layer.SourceGuidance;
+    MaskedGuidanceField mixedGuidance;
+    if(mixed)
+    {
+      mixedGuidance = MaskedGuidanceField::Mixed(layer.Solver->GetDomain(), layer.SourceImage,
+                                                 sourceToImage, composite);
+      guidance = &mixedGuidance;
+    }
+
+    patch->SetRegions(patchRegion);
+    patch->Allocate();
+    CopyRegion(composite, patch, patchRegion);
+    layer.Solver->Solve(composite, guidance->GetTerms(), patch);
+  }
+
+  layer.SolvedPatch = patch;
+  layer.SolvedCorner = layer.Corner;
+  layer.SolvedMixed = mixed;
+  layer.Dirty = false;
+}
+
+} // end namespace
@@ -0,0 +1,137 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+/** A CloneLayer is one object (a source image and its mask) that is composited
+  * into the target image by the cloning widget. Layers are stacked in z-order;
+  * each layer is cloned onto the composite of the target and the layers below it.
+  * The factorization and guidance terms only depend on the layer and its position,
+  * and the last solution is kept until the layer (or something under it) moves.
+  */
+
+#ifndef CloneLayer_H
+#define CloneLayer_H
+
+// ITK
+#include "itkVectorImage.h"
+
+// Custom
+#include "MaskedGuidanceField.h"
+#include "MaskedPoissonSolver.h"
+#include "MeanValueCloner.h"
+
+// Submodules
+#include "Mask/Mask.h"
+
+// STL
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class QGraphicsPixmapItem;
+
+struct CloneLayer
+{
+  typedef itk::VectorImage<float, 2> ImageType;
+
+  std::string SourceImageFileName;
+  std::string MaskImageFileName;
+
+  ImageType::Pointer SourceImage;
+  Mask::Pointer MaskImage;
+
+  /** Hashes of the pixel data, computed when the layer is loaded. */
+  uint64_t SourceHash = 0;
+  uint64_t MaskHash = 0;
+
+  /** The movable item that shows the layer over the target. */
+  QGraphicsPixmapItem* PixmapItem = nullptr;
+
+  /** The position of the layer in the target, read from PixmapItem before each clone. */
+  itk::Index<2> Corner = {{0, 0}};
+
+  /** The factorized system and the source guidance for the placement SolverCorner. They only
+    * depend on the layer and its placement, so they are reused until the layer moves. */
+  std::shared_ptr<MaskedPoissonSolver> Solver;
+  MaskedGuidanceField SourceGuidance;
+  itk::Index<2> SolverCorner = {{0, 0}};
+
+  /** The source guidance over the hole of the mask, independent of the placement. It is computed
+    * the first time the layer is solved, and SourceGuidance is shifted from it when the layer moves.
+    * Reset it whenever SourceImage or MaskImage changes. */
+  ImageType::Pointer SourceDivergence;
+
+  /** The solved target pixels under the layer, and the placement and mode they were solved for. */
+  ImageType::Pointer SolvedPatch;
+  itk::Index<2> SolvedCorner = {{0, 0}};
+  bool SolvedMixed = false;
+
+  /** The mean-value coordinates of the mask, computed the first time the layer is previewed. */
+  std::shared_ptr<MeanValueCloner> Previewer;
+
+  /** Set when the layer has to be solved again. */
+  bool Dirty = true;
+
+  /** The region of the target covered by the layer at its current position. */
+  itk::ImageRegion<2> GetRegion() const;
+};
+
+namespace CloneLayers
+{
+  typedef CloneLayer::ImageType ImageType;
+
+  /** Group layers (given bottom to top) into waves. A layer is in the wave after the highest
+    * wave of any lower layer it overlaps, so the layers of a wave can be solved concurrently
+    * and the waves must be solved in order. */
+  std::vector<std::vector<unsigned int> > ComputeWaves(const std::vector<itk::ImageRegion<2> >& regions);
+
+  /** Do two layer regions interact? A solve reads one pixel beyond its region. */
+  bool Overlap(const itk::ImageRegion<2>& region1, const itk::ImageRegion<2>& region2);
+
+  /** Mark every layer that moved, changed mode or sits on a dirty layer as dirty. */
+  void UpdateDirtyFlags(std::vector<CloneLayer>& layers, const bool mixed);
+
+  /** Copy 'region' of 'source' into the same region of 'target'. */
+  void CopyRegion(const ImageType* const source, ImageType* const target,
+                  const itk::ImageRegion<2>& region);
+
+  /** The part of 'targetRegion' that a clone of 'layers' can change or read: the layer regions
+    * padded by one pixel. Empty (with the index of 'targetRegion') if no layer is on the target. */
+  itk::ImageRegion<2> ComputeResultRegion(const std::vector<CloneLayer>& layers,
+                                          const itk::ImageRegion<2>& targetRegion);
+
+  /** Clone 'layer' into a target whose full region is 'targetRegion' and store the solution in
+    * layer.SolvedPatch. 'composite' only has to cover the layer region padded by one pixel;
+    * it is not modified. */
+  void SolveLayer(CloneLayer& layer, const ImageType* const composite,
+                  const itk::ImageRegion<2>& targetRegion, const bool mixed);
+
+  /** Approximate the clone of 'layer' at layer.Corner with mean-value coordinates and write it
+    * into 'composite', which only has to cover the part of the target to preview. */
+  void PreviewLayer(CloneLayer& layer, ImageType* const composite);
+
+  /** Approximate the clone of 'layer' at layer.Corner with a convolution pyramid and write it
+    * into 'composite', which only has to cover the part of the target to clone into. */
+  void ApproximateLayer(const CloneLayer& layer, ImageType* const composite);
+
+  /** A full size copy of 'target' with the pixels of 'result' (which may cover only part of
+    * 'target') pasted in. */
+  ImageType::Pointer Compose(const ImageType* const target, const ImageType* const result);
+}
+
+#endif
@@ -0,0 +1,215 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "CloneSequence.h"
+
+// Custom
+#include "CloneLayer.h"
+
+// ITK
+#include "itkImageFileReader.h"
+
+// Qt
+#include <QtConcurrentRun>
+
+// STL
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+namespace CloneSequence
+{
+
+namespace
+{
+  /** The images of one frame. The frames are read in the background, so errors are returned
+    * in Error instead of thrown. */
+  struct Frame
+  {
+    ImageType::Pointer Target;
+    ImageType::Pointer Source;
+    std::string Error;
+  };
+
+  ImageType::Pointer ReadImage(const std::string& fileName)
+  {
+    typedef itk::ImageFileReader<ImageType> ReaderType;
+    ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName(fileName);
+    reader->Update();
+
+    ImageType::Pointer image = reader->GetOutput();
+    image->DisconnectPipeline();
+    return image;
+  }
+
+  Frame ReadFrame(const Settings& settings, const unsigned int frame, const bool readSource)
+  {
+    Frame result;
+    try
+    {
+      result.Target = ReadImage(GetFrameFileName(settings.TargetPattern, frame));
+      if(readSource)
+      {
+        result.Source = ReadImage(GetFrameFileName(settings.SourcePattern, frame));
+      }
+    }
+    catch(const std::exception& exception)
+    {
+      result.Error = exception.what();
+    }
+    return result;
+  }
+
+  /** Write 'target' with 'result' pasted in. Returns an error message, or an empty string on success. */
+  std::string WriteFrame(const ImageType* const target, const ImageType* const result,
+                         const std::string& fileName, const ResultExport::Options& options)
+  {
+    try
+    {
+      ResultExport::Write(target, result, fileName, options);
+    }
+    catch(const std::exception& exception)
+    {
+      return exception.what();
+    }
+    return std::string();
+  }
+}
+
+bool IsPattern(const std::string& pattern)
+{
+  return pattern.find('%') != std::string::npos;
+}
+
+std::string GetFrameFileName(const std::string& pattern, const unsigned int frame)
+{
+  if(!IsPattern(pattern))
+  {
+    return pattern;
+  }
+
+  std::vector<char> fileName(pattern.size() + 32);
+  std::snprintf(fileName.data(), fileName.size(), pattern.c_str(), frame);
+  return std::string(fileName.data());
+}
+
+unsigned int Run(const Settings& settings)
+{
+  if(settings.LastFrame < settings.FirstFrame)
+  {
+    throw std::runtime_error("The last frame is before the first frame!");
+  }
+  if(!IsPattern(settings.TargetPattern) || !IsPattern(settings.OutputPattern))
+  {
+    throw std::runtime_error("The target and output file names must be patterns like frame%04d.png!");
+  }
+
+  const bool sourceSequence = IsPattern(settings.SourcePattern);
+
+  CloneLayer layer;
+  layer.MaskImage = Mask::New();
+  layer.MaskImage->Read(settings.MaskFileName);
+  if(!sourceSequence)
+  {
+    layer.SourceImage = ReadImage(settings.SourcePattern);
+  }
+  layer.Corner = settings.Corner;
+  const itk::Offset<2> sourceToImage = {{layer.Corner[0], layer.Corner[1]}};
+
+  // While frame N is solved, frame N + 1 is read and frame N - 1 is written. The images of
+  // the frame being written are held here until its write finishes.
+  QFuture<Frame> nextFrame = QtConcurrent::run(ReadFrame, settings, settings.FirstFrame, sourceSequence);
+  QFuture<std::string> write;
+  bool writing = false;
+  ImageType::Pointer writtenTarget;
+  ImageType::Pointer writtenPatch;
+
+  auto finishWrite = [&]()
+  {
+    if(writing)
+    {
+      writing = false;
+      const std::string error = write.result();
+      if(!error.empty())
+      {
+        throw std::runtime_error(error);
+      }
+    }
+  };
+
+  itk::ImageRegion<2> targetRegion;
+  try
+  {
+    for(unsigned int frame = settings.FirstFrame; frame <= settings.LastFrame; ++frame)
+    {
+      Frame current = nextFrame.result();
+      if(!current.Error.empty())
+      {
+        throw std::runtime_error(current.Error);
+      }
+      if(frame < settings.LastFrame)
+      {
+        nextFrame = QtConcurrent::run(ReadFrame, settings, frame + 1, sourceSequence);
+      }
+
+      // The factorization is kept as long as the frames keep their size.
+      if(current.Target->GetLargestPossibleRegion() != targetRegion)
+      {
+        targetRegion = current.Target->GetLargestPossibleRegion();
+        layer.Solver.reset();
+      }
+
+      // A moving source only needs new guidance, the system stays the same.
+      if(sourceSequence)
+      {
+        layer.SourceImage = current.Source;
+        layer.SourceDivergence = nullptr;
+        if(layer.Solver)
+        {
+          layer.SourceGuidance = MaskedGuidanceField::FromSource(layer.Solver->GetDomain(), layer.SourceImage,
+                                                                 sourceToImage);
+        }
+      }
+
+      CloneLayers::SolveLayer(layer, current.Target, targetRegion, settings.Mixed);
+
+      finishWrite();
+      writtenTarget = current.Target;
+      writtenPatch = layer.SolvedPatch;
+      write = QtConcurrent::run(WriteFrame, writtenTarget.GetPointer(), writtenPatch.GetPointer(),
+                                GetFrameFileName(settings.OutputPattern, frame), settings.ExportOptions);
+      writing = true;
+
+      std::cout << "Cloned frame " << frame << std::endl;
+    }
+    finishWrite();
+  }
+  catch(...)
+  {
+    // Don't let the background tasks outlive the images they use.
+    nextFrame.waitForFinished();
+    write.waitForFinished();
+    throw;
+  }
+
+  return settings.LastFrame - settings.FirstFrame + 1;
+}
+
+} // end namespace
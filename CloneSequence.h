@@ -0,0 +1,77 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+/** These functions clone the same source and mask into every frame of a numbered
+  * sequence of target images. The mask stays at the same place in every frame, so the
+  * factorized system (and, for a still source, the guidance) is computed for the first
+  * frame and reused; every other frame only costs the substitutions. Reading the next
+  * frame and writing the previous one overlap with the solve of the current frame.
+  */
+
+#ifndef CloneSequence_H
+#define CloneSequence_H
+
+// ITK
+#include "itkVectorImage.h"
+
+// Custom
+#include "ResultExport.h"
+
+// STL
+#include <string>
+
+namespace CloneSequence
+{
+  typedef itk::VectorImage<float, 2> ImageType;
+
+  struct Settings
+  {
+    /** A file name, or a printf pattern with one integer conversion (e.g. "source%04d.png")
+      * for a source that changes with the frames. */
+    std::string SourcePattern;
+    std::string MaskFileName;
+
+    /** printf patterns with one integer conversion. */
+    std::string TargetPattern;
+    std::string OutputPattern;
+
+    /** The frames from FirstFrame to LastFrame (inclusive) are cloned. */
+    unsigned int FirstFrame = 0;
+    unsigned int LastFrame = 0;
+
+    /** The position of the source in the target frames. */
+    itk::Index<2> Corner = {{0, 0}};
+
+    bool Mixed = false;
+
+    ResultExport::Options ExportOptions;
+  };
+
+  /** Is 'pattern' a printf pattern rather than a plain file name? */
+  bool IsPattern(const std::string& pattern);
+
+  /** The file name of 'frame' for a pattern; a plain file name is returned unchanged. */
+  std::string GetFrameFileName(const std::string& pattern, const unsigned int frame);
+
+  /** Clone every frame and write it to OutputPattern. Outputs named .png or .tif are written
+    * as 8 bit RGB, everything else as float. Throws std::runtime_error if a frame can't be
+    * read or written. Returns the number of frames written. */
+  unsigned int Run(const Settings& settings);
+}
+
+#endif
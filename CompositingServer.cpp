@@ -0,0 +1,456 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "CompositingServer.h"
+
+// ITK
+#include "itkImageFileReader.h"
+
+// Qt
+#include <QDateTime>
+#include <QFileInfo>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QSharedMemory>
+#include <QtConcurrentRun>
+
+// STL
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <sstream>
+#include <stdexcept>
+
+namespace
+{
+  /** The number of factorized systems of each kind that are kept. */
+  const unsigned int MaximumNumberOfSystems = 16;
+
+  const std::string SharedMemoryPrefix = "shm:";
+
+  bool IsSharedMemory(const std::string& name)
+  {
+    return name.compare(0, SharedMemoryPrefix.size(), SharedMemoryPrefix) == 0;
+  }
+
+  /** Drop the least recently used entries of 'systems' until at most 'maximumSize' are left. */
+  template <typename TSystems>
+  void DropOldSystems(TSystems& systems, const unsigned int maximumSize)
+  {
+    while(systems.size() > maximumSize)
+    {
+      auto oldest = systems.begin();
+      for(auto iterator = systems.begin(); iterator != systems.end(); ++iterator)
+      {
+        if(iterator->second.LastUse < oldest->second.LastUse)
+        {
+          oldest = iterator;
+        }
+      }
+      systems.erase(oldest);
+    }
+  }
+}
+
+CompositingServer::CompositingServer(const unsigned int maximumQueueLength) :
+  MaximumQueueLength(maximumQueueLength), Images(1024 * 1024 * 1024), Masks(256 * 1024 * 1024)
+{
+  this->Server = new QLocalServer(this);
+  connect(this->Server, SIGNAL(newConnection()), this, SLOT(slot_newConnection()));
+  connect(&this->JobWatcher, SIGNAL(finished()), this, SLOT(slot_jobFinished()));
+}
+
+bool CompositingServer::Listen(const QString& socketName)
+{
+  if(this->Server->listen(socketName))
+  {
+    return true;
+  }
+
+  // The name is taken. If nobody answers on it, it was left behind by a server that died.
+  QLocalSocket probe;
+  probe.connectToServer(socketName);
+  if(probe.waitForConnected(100))
+  {
+    return false;
+  }
+
+  QLocalServer::removeServer(socketName);
+  return this->Server->listen(socketName);
+}
+
+QString CompositingServer::GetErrorString() const
+{
+  return this->Server->errorString();
+}
+
+void CompositingServer::slot_newConnection()
+{
+  while(QLocalSocket* socket = this->Server->nextPendingConnection())
+  {
+    connect(socket, SIGNAL(readyRead()), this, SLOT(slot_readyRead()));
+    connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+  }
+}
+
+void CompositingServer::slot_readyRead()
+{
+  QLocalSocket* socket = qobject_cast<QLocalSocket*>(sender());
+  if(!socket)
+  {
+    return;
+  }
+
+  while(socket->canReadLine())
+  {
+    const std::string request = QString(socket->readLine()).trimmed().toStdString();
+    if(request.empty())
+    {
+      continue;
+    }
+
+    // Refuse work instead of queueing without bound, so the clients see the load.
+    if(this->Queue.size() >= this->MaximumQueueLength)
+    {
+      Job* previousJob = FindLastJob(socket);
+      if(previousJob)
+      {
+        previousJob->NumberOfRefusedRequests++;
+      }
+      else
+      {
+        socket->write("busy\n");
+      }
+      continue;
+    }
+
+    Job job;
+    job.Socket = socket;
+    job.Request = request;
+    this->Queue.push_back(job);
+  }
+
+  StartNextJob();
+}
+
+void CompositingServer::StartNextJob()
+{
+  if(this->JobWatcher.isRunning() || this->Queue.empty())
+  {
+    return;
+  }
+
+  // One job at a time: the solvers use all cores by themselves, and the caches are not shared.
+  this->RunningJob = this->Queue.front();
+  this->Queue.pop_front();
+
+  QFuture<std::string> future = QtConcurrent::run(this, &CompositingServer::RunJob, this->RunningJob.Request);
+  this->JobWatcher.setFuture(future);
+}
+
+CompositingServer::Job* CompositingServer::FindLastJob(QLocalSocket* const socket)
+{
+  for(std::deque<Job>::reverse_iterator job = this->Queue.rbegin(); job != this->Queue.rend(); ++job)
+  {
+    if(job->Socket == socket)
+    {
+      return &*job;
+    }
+  }
+
+  // The running job is only cleared once its reply is written.
+  if(this->RunningJob.Socket == socket)
+  {
+    return &this->RunningJob;
+  }
+  return nullptr;
+}
+
+void CompositingServer::slot_jobFinished()
+{
+  // The client may have gone away while its job ran.
+  if(this->RunningJob.Socket)
+  {
+    this->RunningJob.Socket->write((this->JobWatcher.result() + "\n").c_str());
+    for(unsigned int requestId = 0; requestId < this->RunningJob.NumberOfRefusedRequests; ++requestId)
+    {
+      this->RunningJob.Socket->write("busy\n");
+    }
+  }
+  this->RunningJob = Job();
+
+  StartNextJob();
+}
+
+std::string CompositingServer::RunJob(const std::string& request)
+{
+  std::istringstream stream(request);
+  std::vector<std::string> arguments;
+  std::string argument;
+  while(stream >> argument)
+  {
+    arguments.push_back(argument);
+  }
+
+  if(arguments.empty())
+  {
+    return "error empty job";
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  try
+  {
+    if(arguments[0] == "clone")
+    {
+      Clone(arguments);
+    }
+    else if(arguments[0] == "fill")
+    {
+      Fill(arguments);
+    }
+    else
+    {
+      throw std::runtime_error("unknown job " + arguments[0]);
+    }
+  }
+  catch(const std::exception& exception)
+  {
+    std::string message = exception.what();
+    std::replace(message.begin(), message.end(), '\n', ' ');
+    return "error " + message;
+  }
+
+  const auto milliseconds =
+      std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+  std::stringstream reply;
+  reply << "ok " << milliseconds;
+  return reply.str();
+}
+
+void CompositingServer::Clone(const std::vector<std::string>& arguments)
+{
+  if(arguments.size() != 7 && arguments.size() != 8)
+  {
+    throw std::runtime_error("usage: clone <source> <mask> <target> <output> <x> <y> [mixed]");
+  }
+
+  KeyType sourceKey;
+  KeyType maskKey;
+  KeyType targetKey;
+  ImageType::Pointer source = ReadImage(arguments[1], sourceKey);
+  Mask::Pointer mask = ReadMask(arguments[2], maskKey);
+  ImageType::Pointer target = ReadImage(arguments[3], targetKey);
+  const itk::Index<2> corner = {{std::stoi(arguments[5]), std::stoi(arguments[6])}};
+  const bool mixed = (arguments.size() == 8 && arguments[7] == "mixed");
+
+  if(source->GetNumberOfComponentsPerPixel() != target->GetNumberOfComponentsPerPixel())
+  {
+    throw std::runtime_error("the source and the target have different numbers of channels");
+  }
+
+  // The system depends on the mask, the position and the size of the target; the source
+  // guidance also depends on the source.
+  const itk::ImageRegion<2> targetRegion = target->GetLargestPossibleRegion();
+  KeyType systemKey = sourceKey;
+  systemKey.insert(systemKey.end(), maskKey.begin(), maskKey.end());
+  systemKey.push_back(targetRegion.GetSize()[0]);
+  systemKey.push_back(targetRegion.GetSize()[1]);
+  systemKey.push_back(static_cast<uint64_t>(corner[0]));
+  systemKey.push_back(static_cast<uint64_t>(corner[1]));
+
+  CloneSystem& system = this->CloneSystems[systemKey];
+  system.LastUse = ++this->NumberOfJobs;
+  system.Layer.SourceImage = source;
+  system.Layer.MaskImage = mask;
+  system.Layer.Corner = corner;
+
+  CloneLayers::SolveLayer(system.Layer, target, targetRegion, mixed);
+  ImageType::Pointer patch = system.Layer.SolvedPatch;
+  system.Layer.SolvedPatch = nullptr;
+  DropOldSystems(this->CloneSystems, MaximumNumberOfSystems);
+
+  WriteImage(target, patch, arguments[4]);
+}
+
+void CompositingServer::Fill(const std::vector<std::string>& arguments)
+{
+  if(arguments.size() != 4)
+  {
+    throw std::runtime_error("usage: fill <image> <mask> <output>");
+  }
+
+  KeyType imageKey;
+  KeyType maskKey;
+  ImageType::Pointer image = ReadImage(arguments[1], imageKey);
+  Mask::Pointer mask = ReadMask(arguments[2], maskKey);
+
+  const itk::ImageRegion<2> imageRegion = image->GetLargestPossibleRegion();
+  KeyType systemKey = maskKey;
+  systemKey.push_back(imageRegion.GetSize()[0]);
+  systemKey.push_back(imageRegion.GetSize()[1]);
+
+  FillSystem& system = this->FillSystems[systemKey];
+  system.LastUse = ++this->NumberOfJobs;
+  if(!system.Solver)
+  {
+    const itk::Offset<2> maskToImage = {{0, 0}};
+    PoissonDomain domain = PoissonDomain::Create(mask, mask->GetLargestPossibleRegion(), maskToImage, imageRegion);
+    std::shared_ptr<MaskedPoissonSolver> solver = std::make_shared<MaskedPoissonSolver>();
+    solver->SetDomain(domain);
+    system.Solver = solver;
+  }
+  std::shared_ptr<MaskedPoissonSolver> solver = system.Solver;
+  DropOldSystems(this->FillSystems, MaximumNumberOfSystems);
+
+  // Only the bounding box of the hole is solved; it is pasted into the image as it is written.
+  ImageType::Pointer patch;
+  if(solver->GetDomain().GetNumberOfUnknowns() > 0)
+  {
+    patch = ImageType::New();
+    patch->SetNumberOfComponentsPerPixel(image->GetNumberOfComponentsPerPixel());
+    patch->SetRegions(solver->GetDomain().Region);
+    patch->Allocate();
+    CloneLayers::CopyRegion(image, patch, solver->GetDomain().Region);
+    solver->Solve(image, MaskedPoissonSolver::GuidanceTermsType(), patch);
+  }
+
+  WriteImage(image, patch, arguments[3]);
+}
+
+CompositingServer::KeyType CompositingServer::GetFileKey(const std::string& fileName)
+{
+  QFileInfo fileInfo(fileName.c_str());
+  if(!fileInfo.exists())
+  {
+    throw std::runtime_error("there is no file " + fileName);
+  }
+
+  KeyType key;
+  key.push_back(std::hash<std::string>()(fileInfo.absoluteFilePath().toStdString()));
+  key.push_back(static_cast<uint64_t>(fileInfo.lastModified().toMSecsSinceEpoch()));
+  key.push_back(static_cast<uint64_t>(fileInfo.size()));
+  return key;
+}
+
+CompositingServer::ImageType::Pointer CompositingServer::ReadImage(const std::string& name, KeyType& key)
+{
+  if(IsSharedMemory(name))
+  {
+    QSharedMemory memory(name.substr(SharedMemoryPrefix.size()).c_str());
+    if(!memory.attach(QSharedMemory::ReadOnly))
+    {
+      throw std::runtime_error("can't attach to " + name + ": " + memory.errorString().toStdString());
+    }
+
+    memory.lock();
+    SharedImageHeader header;
+    std::memcpy(&header, memory.constData(), sizeof(SharedImageHeader));
+    const std::size_t numberOfValues =
+        static_cast<std::size_t>(header.Width) * header.Height * header.NumberOfComponents;
+    if(sizeof(SharedImageHeader) + numberOfValues * sizeof(float) > static_cast<std::size_t>(memory.size()))
+    {
+      memory.unlock();
+      throw std::runtime_error(name + " is smaller than the image its header describes");
+    }
+
+    ImageType::Pointer image = ImageType::New();
+    itk::Size<2> size = {{header.Width, header.Height}};
+    image->SetNumberOfComponentsPerPixel(header.NumberOfComponents);
+    image->SetRegions(itk::ImageRegion<2>(size));
+    image->Allocate();
+    std::memcpy(image->GetBufferPointer(),
+                static_cast<const char*>(memory.constData()) + sizeof(SharedImageHeader),
+                numberOfValues * sizeof(float));
+    memory.unlock();
+
+    // The client may change the segment between jobs, so its contents are the key.
+    key.assign(1, ImageCache<ImageType>::HashImage(image.GetPointer()));
+    return image;
+  }
+
+  key = GetFileKey(name);
+  ImageType::Pointer image = this->Images.Find(key);
+  if(image)
+  {
+    return image;
+  }
+
+  typedef itk::ImageFileReader<ImageType> ReaderType;
+  ReaderType::Pointer reader = ReaderType::New();
+  reader->SetFileName(name);
+  reader->Update();
+
+  image = reader->GetOutput();
+  image->DisconnectPipeline();
+  this->Images.Insert(key, image);
+  return image;
+}
+
+Mask::Pointer CompositingServer::ReadMask(const std::string& fileName, KeyType& key)
+{
+  key = GetFileKey(fileName);
+  Mask::Pointer mask = this->Masks.Find(key);
+  if(mask)
+  {
+    return mask;
+  }
+
+  mask = Mask::New();
+  mask->Read(fileName);
+  this->Masks.Insert(key, mask);
+  return mask;
+}
+
+void CompositingServer::WriteImage(const ImageType* const target, const ImageType* const result,
+                                   const std::string& name)
+{
+  if(!IsSharedMemory(name))
+  {
+    ResultExport::Write(target, result, name, this->ExportOptions);
+    return;
+  }
+
+  QSharedMemory memory(name.substr(SharedMemoryPrefix.size()).c_str());
+  if(!memory.attach(QSharedMemory::ReadWrite))
+  {
+    throw std::runtime_error("can't attach to " + name + ": " + memory.errorString().toStdString());
+  }
+
+  const itk::Size<2> size = target->GetLargestPossibleRegion().GetSize();
+  SharedImageHeader header;
+  header.Width = size[0];
+  header.Height = size[1];
+  header.NumberOfComponents = target->GetNumberOfComponentsPerPixel();
+  header.Reserved = 0;
+  const std::size_t numberOfValues =
+      static_cast<std::size_t>(header.Width) * header.Height * header.NumberOfComponents;
+  if(sizeof(SharedImageHeader) + numberOfValues * sizeof(float) > static_cast<std::size_t>(memory.size()))
+  {
+    throw std::runtime_error(name + " is too small for the result");
+  }
+
+  ImageType::Pointer composed = result ? CloneLayers::Compose(target, result) : nullptr;
+  const ImageType* image = result ? composed.GetPointer() : target;
+
+  memory.lock();
+  std::memcpy(memory.data(), &header, sizeof(SharedImageHeader));
+  std::memcpy(static_cast<char*>(memory.data()) + sizeof(SharedImageHeader), image->GetBufferPointer(),
+              numberOfValues * sizeof(float));
+  memory.unlock();
+}
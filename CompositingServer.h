@@ -0,0 +1,161 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+/** This class serves clone and fill jobs over a local socket (a QLocalServer, which is a
+  * Unix domain socket on Linux), so that one long running process keeps decoded images and
+  * factorized systems between jobs instead of starting, registering the IO factories and
+  * decoding everything again for every job. A job is one line of text:
+  *
+  *   clone <source> <mask> <target> <output> <x> <y> [mixed]
+  *   fill <image> <mask> <output>
+  *
+  * and is answered with one line: "ok <milliseconds>", "error <message>", or "busy" if the
+  * queue is full. The replies to one connection are in the order of its requests. Images (but not masks) can be file paths or "shm:<key>", a QSharedMemory
+  * segment holding a SharedImageHeader followed by the float pixels, row by row. An output
+  * "shm:<key>" must name an existing segment that is large enough for the result.
+  */
+
+#ifndef CompositingServer_H
+#define CompositingServer_H
+
+// Custom
+#include "CloneLayer.h"
+#include "ImageCache.h"
+#include "MaskedPoissonSolver.h"
+#include "ResultExport.h"
+
+// ITK
+#include "itkVectorImage.h"
+
+// Submodules
+#include "Mask/Mask.h"
+
+// Qt
+#include <QFutureWatcher>
+#include <QObject>
+#include <QPointer>
+#include <QString>
+class QLocalServer;
+class QLocalSocket;
+
+// STL
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+class CompositingServer : public QObject
+{
+  Q_OBJECT
+public:
+  typedef itk::VectorImage<float, 2> ImageType;
+  typedef ImageCache<ImageType>::KeyType KeyType;
+
+  /** The start of a shared memory image. */
+  struct SharedImageHeader
+  {
+    uint32_t Width;
+    uint32_t Height;
+    uint32_t NumberOfComponents;
+    uint32_t Reserved;
+  };
+
+  /** At most 'maximumQueueLength' jobs wait; more are answered with "busy" as soon as the
+    * jobs before them from the same client are answered. */
+  CompositingServer(const unsigned int maximumQueueLength = 32);
+
+  /** Listen on 'socketName'. A socket left behind by a server that is gone is removed, a
+    * live server is not. Returns false if the socket can't be used. */
+  bool Listen(const QString& socketName);
+
+  QString GetErrorString() const;
+
+  /** Run the job described by 'request' and return the reply line (without the newline). */
+  std::string RunJob(const std::string& request);
+
+public slots:
+  void slot_newConnection();
+  void slot_readyRead();
+  void slot_jobFinished();
+
+protected:
+
+  struct Job
+  {
+    QPointer<QLocalSocket> Socket;
+    std::string Request;
+
+    /** Later requests of the same socket that were refused. They are answered with "busy"
+      * after the reply to this job, so that the replies keep the order of the requests. */
+    unsigned int NumberOfRefusedRequests = 0;
+  };
+
+  /** A factorized clone of one source and mask at one position in targets of one size. */
+  struct CloneSystem
+  {
+    CloneLayer Layer;
+    uint64_t LastUse = 0;
+  };
+
+  /** A factorized fill of one mask in images of one size. */
+  struct FillSystem
+  {
+    std::shared_ptr<MaskedPoissonSolver> Solver;
+    uint64_t LastUse = 0;
+  };
+
+  void StartNextJob();
+
+  /** The last job of 'socket' that is queued or running, or null. */
+  Job* FindLastJob(QLocalSocket* const socket);
+
+  void Clone(const std::vector<std::string>& arguments);
+  void Fill(const std::vector<std::string>& arguments);
+
+  /** Read a file (through the cache) or a shared memory image, and the key that identifies its contents. */
+  ImageType::Pointer ReadImage(const std::string& name, KeyType& key);
+  Mask::Pointer ReadMask(const std::string& fileName, KeyType& key);
+
+  /** Write 'target' with 'result' (which may be null) pasted in to a file or a shared memory image. */
+  void WriteImage(const ImageType* const target, const ImageType* const result, const std::string& name);
+
+  /** A key for a file: its absolute path, modification time and size. */
+  static KeyType GetFileKey(const std::string& fileName);
+
+  QLocalServer* Server;
+
+  /** The jobs waiting for the one that is running. */
+  std::deque<Job> Queue;
+  unsigned int MaximumQueueLength;
+
+  QFutureWatcher<std::string> JobWatcher;
+  Job RunningJob;
+
+  /** The caches are only used by the running job, so they need no locking. */
+  ImageCache<ImageType> Images;
+  ImageCache<Mask> Masks;
+  std::map<KeyType, CloneSystem> CloneSystems;
+  std::map<KeyType, FillSystem> FillSystems;
+  uint64_t NumberOfJobs = 0;
+
+  ResultExport::Options ExportOptions;
+};
+
+#endif
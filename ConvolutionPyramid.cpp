@@ -0,0 +1,439 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "ConvolutionPyramid.h"
+
+// Custom
+#include "Parallel.h"
+
+// STL
+#include <algorithm>
+#include <cstring>
+
+namespace ConvolutionPyramid
+{
+
+namespace
+{
+  /** The binomial filter reduces a level; twice that (the zeros inserted between the pixels
+    * halve the density along each axis) expands it back at the same amplitude. All levels are
+    * added with the same weight, so the kernel falls off like 1/r^2, which came closest to the
+    * exact membrane. */
+  const float H[5] = {1.0f / 16.0f, 4.0f / 16.0f, 6.0f / 16.0f, 4.0f / 16.0f, 1.0f / 16.0f};
+  const float ExpandH[5] = {1.0f / 8.0f, 4.0f / 8.0f, 6.0f / 8.0f, 4.0f / 8.0f, 1.0f / 8.0f};
+
+  /** Applied at every level before the coarser levels are added. */
+  const float G[3] = {0.1f, 0.8f, 0.1f};
+
+  /** The rows of a level are filtered in parallel in blocks of this many. */
+  const unsigned int RowsPerBlock = 32;
+
+  const itk::Offset<2> NeighborOffsets[4] = {{{-1, 0}}, {{1, 0}}, {{0, -1}}, {{0, 1}}};
+
+  /** Convolve with H and keep every second row and column. */
+  Plane Reduce(const Plane& plane)
+  {
+    const unsigned int components = plane.NumberOfComponents;
+    const unsigned int width = (plane.Width + 1) / 2;
+    const unsigned int height = (plane.Height + 1) / 2;
+
+    Plane rows(width, plane.Height, components);
+    Parallel::ForBlocks(plane.Height, RowsPerBlock, [&](const unsigned int begin, const unsigned int end)
+    {
+      for(unsigned int y = begin; y < end; ++y)
+      {
+        for(unsigned int x = 0; x < width; ++x)
+        {
+          float* output = rows.GetPixel(x, y);
+          for(int tap = -2; tap <= 2; ++tap)
+          {
+            const int sourceX = 2 * static_cast<int>(x) + tap;
+            if(sourceX < 0 || sourceX >= static_cast<int>(plane.Width))
+            {
+              continue;
+            }
+            const float* input = plane.GetPixel(sourceX, y);
+            for(unsigned int component = 0; component < components; ++component)
+            {
+              output[component] += H[tap + 2] * input[component];
+            }
+          }
+        }
+      }
+    });
+
+    Plane reduced(width, height, components);
+    Parallel::ForBlocks(height, RowsPerBlock, [&](const unsigned int begin, const unsigned int end)
+    {
+      for(unsigned int y = begin; y < end; ++y)
+      {
+        for(int tap = -2; tap <= 2; ++tap)
+        {
+          const int sourceY = 2 * static_cast<int>(y) + tap;
+          if(sourceY < 0 || sourceY >= static_cast<int>(plane.Height))
+          {
+            continue;
+          }
+          const float* input = rows.GetPixel(0, sourceY);
+          float* output = reduced.GetPixel(0, y);
+          for(unsigned int value = 0; value < width * components; ++value)
+          {
+            output[value] += H[tap + 2] * input[value];
+          }
+        }
+      }
+    });
+
+    return reduced;
+  }
+
+  /** Insert zeros between the pixels of 'plane' to get a 'width' by 'height' plane, convolve
+    * with ExpandH and add the result to 'output'. */
+  void ExpandAndAdd(const Plane& plane, Plane& output)
+  {
+    const unsigned int components = plane.NumberOfComponents;
+
+    Plane rows(output.Width, plane.Height, components);
+    Parallel::ForBlocks(plane.Height, RowsPerBlock, [&](const unsigned int begin, const unsigned int end)
+    {
+      for(unsigned int y = begin; y < end; ++y)
+      {
+        for(unsigned int x = 0; x < output.Width; ++x)
+        {
+          // Only the taps that land on a coarse pixel (an even position) contribute.
+          float* result = rows.GetPixel(x, y);
+          for(int tap = -2; tap <= 2; ++tap)
+          {
+            const int fineX = static_cast<int>(x) - tap;
+            if(fineX < 0 || fineX % 2 != 0 || fineX / 2 >= static_cast<int>(plane.Width))
+            {
+              continue;
+            }
+            const float* input = plane.GetPixel(fineX / 2, y);
+            for(unsigned int component = 0; component < components; ++component)
+            {
+              result[component] += ExpandH[tap + 2] * input[component];
+            }
+          }
+        }
+      }
+    });
+
+    Parallel::ForBlocks(output.Height, RowsPerBlock, [&](const unsigned int begin, const unsigned int end)
+    {
+      for(unsigned int y = begin; y < end; ++y)
+      {
+        float* result = output.GetPixel(0, y);
+        for(int tap = -2; tap <= 2; ++tap)
+        {
+          const int fineY = static_cast<int>(y) - tap;
+          if(fineY < 0 || fineY % 2 != 0 || fineY / 2 >= static_cast<int>(plane.Height))
+          {
+            continue;
+          }
+          const float* input = rows.GetPixel(0, fineY / 2);
+          for(unsigned int value = 0; value < output.Width * components; ++value)
+          {
+            result[value] += ExpandH[tap + 2] * input[value];
+          }
+        }
+      }
+    });
+  }
+
+  /** Convolve with G along both axes. */
+  Plane ConvolveG(const Plane& plane)
+  {
+    const unsigned int components = plane.NumberOfComponents;
+    const unsigned int rowLength = plane.Width * components;
+
+    Plane rows(plane.Width, plane.Height, components);
+    Parallel::ForBlocks(plane.Height, RowsPerBlock, [&](const unsigned int begin, const unsigned int end)
+    {
+      for(unsigned int y = begin; y < end; ++y)
+      {
+        const float* input = plane.GetPixel(0, y);
+        float* output = rows.GetPixel(0, y);
+        for(unsigned int value = 0; value < rowLength; ++value)
+        {
+          output[value] = G[1] * input[value];
+          if(value >= components)
+          {
+            output[value] += G[0] * input[value - components];
+          }
+          if(value + components < rowLength)
+          {
+            output[value] += G[2] * input[value + components];
+          }
+        }
+      }
+    });
+
+    Plane convolved(plane.Width, plane.Height, components);
+    Parallel::ForBlocks(plane.Height, RowsPerBlock, [&](const unsigned int begin, const unsigned int end)
+    {
+      for(unsigned int y = begin; y < end; ++y)
+      {
+        float* output = convolved.GetPixel(0, y);
+        for(int tap = -1; tap <= 1; ++tap)
+        {
+          const int sourceY = static_cast<int>(y) + tap;
+          if(sourceY < 0 || sourceY >= static_cast<int>(plane.Height))
+          {
+            continue;
+          }
+          const float* input = rows.GetPixel(0, sourceY);
+          for(unsigned int value = 0; value < rowLength; ++value)
+          {
+            output[value] += G[tap + 1] * input[value];
+          }
+        }
+      }
+    });
+
+    return convolved;
+  }
+
+  /** The bounding box of the hole pixels of 'mask' inside 'region', padded by one pixel (so it
+    * holds the boundary) and cropped to 'region'. Empty if there is no hole pixel. */
+  itk::ImageRegion<2> GetHoleRegion(const Mask* const mask, const itk::ImageRegion<2>& region)
+  {
+    itk::Index<2> lower = region.GetUpperIndex();
+    itk::Index<2> upper = region.GetIndex();
+    bool found = false;
+
+    itk::Index<2> pixel;
+    for(pixel[1] = region.GetIndex()[1]; pixel[1] <= region.GetUpperIndex()[1]; ++pixel[1])
+    {
+      for(pixel[0] = region.GetIndex()[0]; pixel[0] <= region.GetUpperIndex()[0]; ++pixel[0])
+      {
+        if(mask->IsHole(pixel))
+        {
+          found = true;
+          lower[0] = std::min(lower[0], pixel[0]);
+          lower[1] = std::min(lower[1], pixel[1]);
+          upper[0] = std::max(upper[0], pixel[0]);
+          upper[1] = std::max(upper[1], pixel[1]);
+        }
+      }
+    }
+
+    const itk::Size<2> emptySize = {{0, 0}};
+    itk::ImageRegion<2> holeRegion(region.GetIndex(), emptySize);
+    if(found)
+    {
+      holeRegion.SetIndex(lower);
+      holeRegion.SetUpperIndex(upper);
+      holeRegion.PadByRadius(1);
+      holeRegion.Crop(region);
+    }
+    return holeRegion;
+  }
+
+  /** Interpolate boundary values into the hole of 'mask' inside 'region' (mask coordinates).
+    * getBoundaryValue(pixel, values) is asked for the values at the valid pixels next to the
+    * hole and returns false if there are none; setHoleValue(pixel, values) gets the result at
+    * every hole pixel. */
+  template <typename TGetBoundaryValue, typename TSetHoleValue>
+  void InterpolateIntoHole(const Mask* const mask, const itk::ImageRegion<2>& region,
+                           const unsigned int numberOfComponents,
+                           TGetBoundaryValue getBoundaryValue, TSetHoleValue setHoleValue)
+  {
+    const itk::ImageRegion<2> holeRegion = GetHoleRegion(mask, region);
+    if(holeRegion.GetNumberOfPixels() == 0)
+    {
+      return;
+    }
+
+    // The boundary values and their weight, in the last channel.
+    Plane plane(holeRegion.GetSize()[0], holeRegion.GetSize()[1], numberOfComponents + 1);
+    itk::Index<2> pixel;
+    for(unsigned int y = 0; y < plane.Height; ++y)
+    {
+      pixel[1] = holeRegion.GetIndex()[1] + y;
+      for(unsigned int x = 0; x < plane.Width; ++x)
+      {
+        pixel[0] = holeRegion.GetIndex()[0] + x;
+        if(mask->IsHole(pixel))
+        {
+          continue;
+        }
+
+        bool nextToHole = false;
+        for(unsigned int neighbor = 0; neighbor < 4 && !nextToHole; ++neighbor)
+        {
+          const itk::Index<2> neighborPixel = pixel + NeighborOffsets[neighbor];
+          nextToHole = holeRegion.IsInside(neighborPixel) && mask->IsHole(neighborPixel);
+        }
+
+        float* value = plane.GetPixel(x, y);
+        if(nextToHole && getBoundaryValue(pixel, value))
+        {
+          value[numberOfComponents] = 1.0f;
+        }
+        else
+        {
+          std::fill(value, value + numberOfComponents, 0.0f);
+        }
+      }
+    }
+
+    Interpolate(plane);
+
+    for(unsigned int y = 0; y < plane.Height; ++y)
+    {
+      pixel[1] = holeRegion.GetIndex()[1] + y;
+      for(unsigned int x = 0; x < plane.Width; ++x)
+      {
+        pixel[0] = holeRegion.GetIndex()[0] + x;
+        if(mask->IsHole(pixel))
+        {
+          setHoleValue(pixel, plane.GetPixel(x, y));
+        }
+      }
+    }
+  }
+}
+
+Plane::Plane(const unsigned int width, const unsigned int height, const unsigned int numberOfComponents) :
+  Width(width), Height(height), NumberOfComponents(numberOfComponents),
+  Values(width * height * numberOfComponents, 0.0f)
+{
+}
+
+Plane Filter(const Plane& plane)
+{
+  // Analysis: reduce down to a single pixel.
+  std::vector<Plane> levels(1, plane);
+  while(levels.back().Width > 1 || levels.back().Height > 1)
+  {
+    levels.push_back(Reduce(levels.back()));
+  }
+
+  // Synthesis: from the coarsest level up, filter each level with G and add the expanded level below.
+  Plane result = ConvolveG(levels.back());
+  for(int level = static_cast<int>(levels.size()) - 2; level >= 0; --level)
+  {
+    Plane finer = ConvolveG(levels[level]);
+    ExpandAndAdd(result, finer);
+    result = finer;
+  }
+
+  return result;
+}
+
+void Interpolate(Plane& plane)
+{
+  plane = Filter(plane);
+
+  const unsigned int numberOfValues = plane.NumberOfComponents - 1;
+  for(unsigned int pixel = 0; pixel < plane.Width * plane.Height; ++pixel)
+  {
+    float* value = &plane.Values[pixel * plane.NumberOfComponents];
+    const float weight = value[numberOfValues];
+    for(unsigned int component = 0; component < numberOfValues; ++component)
+    {
+      value[component] = weight > 0.0f ? value[component] / weight : 0.0f;
+    }
+  }
+}
+
+void FillImage(const ImageType* const image, const Mask* const mask, ImageType* const result)
+{
+  const itk::ImageRegion<2> imageRegion = image->GetLargestPossibleRegion();
+  const unsigned int numberOfComponents = image->GetNumberOfComponentsPerPixel();
+
+  if(result != image)
+  {
+    result->SetNumberOfComponentsPerPixel(numberOfComponents);
+    result->SetRegions(imageRegion);
+    result->Allocate();
+    std::memcpy(result->GetBufferPointer(), image->GetBufferPointer(),
+                imageRegion.GetNumberOfPixels() * numberOfComponents * sizeof(float));
+  }
+
+  itk::ImageRegion<2> region = mask->GetLargestPossibleRegion();
+  if(!region.Crop(imageRegion))
+  {
+    return;
+  }
+
+  const float* imageBuffer = image->GetBufferPointer();
+  float* resultBuffer = result->GetBufferPointer();
+  InterpolateIntoHole(mask, region, numberOfComponents,
+                      [&](const itk::Index<2>& pixel, float* values)
+  {
+    std::memcpy(values, imageBuffer + image->ComputeOffset(pixel) * numberOfComponents,
+                numberOfComponents * sizeof(float));
+    return true;
+  },
+                      [&](const itk::Index<2>& pixel, const float* values)
+  {
+    std::memcpy(resultBuffer + result->ComputeOffset(pixel) * numberOfComponents, values,
+                numberOfComponents * sizeof(float));
+  });
+}
+
+void Clone(const ImageType* const source, const Mask* const mask, const itk::Offset<2>& sourceToImage,
+           ImageType* const image)
+{
+  const unsigned int numberOfComponents = image->GetNumberOfComponentsPerPixel();
+  const itk::ImageRegion<2> imageRegion = image->GetBufferedRegion();
+  const float* sourceBuffer = source->GetBufferPointer();
+  float* imageBuffer = image->GetBufferPointer();
+
+  itk::ImageRegion<2> region = mask->GetLargestPossibleRegion();
+  if(!region.Crop(source->GetLargestPossibleRegion()))
+  {
+    return;
+  }
+
+  // All the boundary differences are read before the first hole pixel is written.
+  InterpolateIntoHole(mask, region, numberOfComponents,
+                      [&](const itk::Index<2>& pixel, float* values)
+  {
+    const itk::Index<2> imagePixel = pixel + sourceToImage;
+    if(!imageRegion.IsInside(imagePixel))
+    {
+      return false;
+    }
+    const float* sourceValue = sourceBuffer + source->ComputeOffset(pixel) * numberOfComponents;
+    const float* imageValue = imageBuffer + image->ComputeOffset(imagePixel) * numberOfComponents;
+    for(unsigned int component = 0; component < numberOfComponents; ++component)
+    {
+      values[component] = imageValue[component] - sourceValue[component];
+    }
+    return true;
+  },
+                      [&](const itk::Index<2>& pixel, const float* values)
+  {
+    const itk::Index<2> imagePixel = pixel + sourceToImage;
+    if(!imageRegion.IsInside(imagePixel))
+    {
+      return;
+    }
+    const float* sourceValue = sourceBuffer + source->ComputeOffset(pixel) * numberOfComponents;
+    float* imageValue = imageBuffer + image->ComputeOffset(imagePixel) * numberOfComponents;
+    for(unsigned int component = 0; component < numberOfComponents; ++component)
+    {
+      imageValue[component] = sourceValue[component] + values[component];
+    }
+  });
+}
+
+} // end namespace
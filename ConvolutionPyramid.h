@@ -0,0 +1,82 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+/** These functions approximate a membrane (the Poisson solution with a zero guidance field)
+  * with a convolution pyramid (Farbman et al. 2011, "Convolution pyramids"), without solving
+  * a linear system. The boundary values, and a weight of one at every boundary pixel, are
+  * filtered with a multiscale kernel built from small fixed filters; the membrane is the
+  * ratio of the two. The cost is linear in the size of the hole's bounding box.
+  * The result is smooth and matches the boundary, but it is not the exact solution.
+  */
+
+#ifndef ConvolutionPyramid_H
+#define ConvolutionPyramid_H
+
+// ITK
+#include "itkVectorImage.h"
+
+// Submodules
+#include "Mask/Mask.h"
+
+// STL
+#include <vector>
+
+namespace ConvolutionPyramid
+{
+  typedef itk::VectorImage<float, 2> ImageType;
+
+  /** A small float image with interleaved channels, zero outside of its bounds. */
+  struct Plane
+  {
+    Plane(const unsigned int width = 0, const unsigned int height = 0, const unsigned int numberOfComponents = 1);
+
+    float* GetPixel(const unsigned int x, const unsigned int y)
+    {
+      return &this->Values[(y * this->Width + x) * this->NumberOfComponents];
+    }
+
+    const float* GetPixel(const unsigned int x, const unsigned int y) const
+    {
+      return &this->Values[(y * this->Width + x) * this->NumberOfComponents];
+    }
+
+    unsigned int Width;
+    unsigned int Height;
+    unsigned int NumberOfComponents;
+    std::vector<float> Values;
+  };
+
+  /** Convolve every channel of 'plane' with the interpolation kernel of the pyramid. */
+  Plane Filter(const Plane& plane);
+
+  /** The last channel of 'plane' weights the other channels: it is 1 where they hold a
+    * boundary value and 0 elsewhere. Replace the other channels by the interpolation of
+    * the boundary values. */
+  void Interpolate(Plane& plane);
+
+  /** Set 'result' to 'image' with the hole of 'mask' filled by an approximate membrane. */
+  void FillImage(const ImageType* const image, const Mask* const mask, ImageType* const result);
+
+  /** Clone the hole of 'mask' from 'source' into 'image', translated by 'sourceToImage':
+    * the source plus an approximate membrane that takes the boundary differences between
+    * 'image' and 'source'. Only the pixels of the buffered region of 'image' are used. */
+  void Clone(const ImageType* const source, const Mask* const mask, const itk::Offset<2>& sourceToImage,
+             ImageType* const image);
+}
+
+#endif
@@ -0,0 +1,362 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "EditHistory.h"
+
+// Qt
+#include <QtConcurrentRun>
+
+// STL
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+  /** The high bit of a token marks a run of one repeated word; otherwise the token is the
+    * number of literal words that follow it. */
+  const uint32_t RunFlag = 0x80000000u;
+
+  /** Shorter runs are cheaper to store as literals. */
+  const std::size_t MinimumRunLength = 3;
+
+  /** The buffers hold 32 bit words; a packed mask word takes two of them. */
+  const std::size_t BufferWordsPerMaskWord = sizeof(PackedMask::WordType) / sizeof(uint32_t);
+}
+
+EditHistory::EditHistory(const std::size_t memoryBudget) : MemoryBudget(memoryBudget)
+{
+}
+
+void EditHistory::SetReference(const ImageType* const reference)
+{
+  Clear();
+  this->Reference = reference;
+}
+
+void EditHistory::Push(const ImageType* const image, const itk::ImageRegion<2>& region,
+                       const PackedMask* const mask, const bool approximate)
+{
+  // Drop the states that could have been redone.
+  if(!this->States.empty())
+  {
+    this->States.resize(this->Current + 1);
+  }
+
+  State state;
+  state.Region = region;
+  state.Approximate = approximate;
+
+  const unsigned int numberOfComponents = this->Reference->GetNumberOfComponentsPerPixel();
+  const std::size_t rowLength = region.GetSize()[0] * numberOfComponents;
+
+  // The XOR with the reference is taken now, since the image may change after this returns.
+  state.Pixels = std::make_shared<Buffer>();
+  state.Pixels->NumberOfWords = region.GetNumberOfPixels() * numberOfComponents;
+  state.Pixels->Raw.resize(state.Pixels->NumberOfWords);
+  uint32_t* word = state.Pixels->Raw.data();
+  for(unsigned int row = 0; row < region.GetSize()[1]; ++row)
+  {
+    itk::Index<2> rowStart = region.GetIndex();
+    rowStart[1] += row;
+    const float* pixel = image->GetBufferPointer() + image->ComputeOffset(rowStart) * numberOfComponents;
+    const float* referencePixel = this->Reference->GetBufferPointer() +
+                                  this->Reference->ComputeOffset(rowStart) * numberOfComponents;
+    for(std::size_t i = 0; i < rowLength; ++i)
+    {
+      uint32_t value;
+      uint32_t referenceValue;
+      std::memcpy(&value, pixel + i, sizeof(uint32_t));
+      std::memcpy(&referenceValue, referencePixel + i, sizeof(uint32_t));
+      *word++ = value ^ referenceValue;
+    }
+  }
+  Compress(state.Pixels);
+
+  if(mask)
+  {
+    const PackedMask maskPatch = mask->Extract(region);
+    state.MaskPixels = std::make_shared<Buffer>();
+    state.MaskPixels->NumberOfWords = maskPatch.GetNumberOfWords() * BufferWordsPerMaskWord;
+    state.MaskPixels->Raw.resize(state.MaskPixels->NumberOfWords);
+    std::memcpy(state.MaskPixels->Raw.data(), maskPatch.GetBufferPointer(),
+                maskPatch.GetNumberOfWords() * sizeof(PackedMask::WordType));
+    Compress(state.MaskPixels);
+  }
+
+  this->States.push_back(state);
+  this->Current = this->States.size() - 1;
+
+  EnforceBudget();
+}
+
+bool EditHistory::CanUndo() const
+{
+  return !this->States.empty() && this->Current > 0;
+}
+
+bool EditHistory::CanRedo() const
+{
+  return this->Current + 1 < this->States.size();
+}
+
+bool EditHistory::Undo()
+{
+  if(!CanUndo())
+  {
+    return false;
+  }
+  this->Current--;
+  return true;
+}
+
+bool EditHistory::Redo()
+{
+  if(!CanRedo())
+  {
+    return false;
+  }
+  this->Current++;
+  return true;
+}
+
+bool EditHistory::HasMask() const
+{
+  return !this->States.empty() && this->States[this->Current].MaskPixels;
+}
+
+bool EditHistory::IsApproximate() const
+{
+  return !this->States.empty() && this->States[this->Current].Approximate;
+}
+
+itk::ImageRegion<2> EditHistory::GetRegion() const
+{
+  if(this->States.empty())
+  {
+    return itk::ImageRegion<2>();
+  }
+  return this->States[this->Current].Region;
+}
+
+void EditHistory::Restore(ImageType* const image, PackedMask* const mask) const
+{
+  if(this->States.empty())
+  {
+    return;
+  }
+
+  const State& state = this->States[this->Current];
+  const itk::ImageRegion<2>& region = state.Region;
+  if(region.GetNumberOfPixels() == 0)
+  {
+    return;
+  }
+
+  const unsigned int numberOfComponents = this->Reference->GetNumberOfComponentsPerPixel();
+  const std::size_t rowLength = region.GetSize()[0] * numberOfComponents;
+
+  std::vector<uint32_t> words(state.Pixels->NumberOfWords);
+  state.Pixels->Read(words.data());
+
+  const uint32_t* word = words.data();
+  for(unsigned int row = 0; row < region.GetSize()[1]; ++row)
+  {
+    itk::Index<2> rowStart = region.GetIndex();
+    rowStart[1] += row;
+    float* pixel = image->GetBufferPointer() + image->ComputeOffset(rowStart) * numberOfComponents;
+    const float* referencePixel = this->Reference->GetBufferPointer() +
+                                  this->Reference->ComputeOffset(rowStart) * numberOfComponents;
+    for(std::size_t i = 0; i < rowLength; ++i)
+    {
+      uint32_t referenceValue;
+      std::memcpy(&referenceValue, referencePixel + i, sizeof(uint32_t));
+      const uint32_t value = *word++ ^ referenceValue;
+      std::memcpy(pixel + i, &value, sizeof(uint32_t));
+    }
+  }
+
+  if(mask && state.MaskPixels)
+  {
+    std::vector<uint32_t> maskWords(state.MaskPixels->NumberOfWords);
+    state.MaskPixels->Read(maskWords.data());
+
+    PackedMask maskPatch(region);
+    std::memcpy(maskPatch.GetBufferPointer(), maskWords.data(),
+                maskPatch.GetNumberOfWords() * sizeof(PackedMask::WordType));
+    mask->Paste(maskPatch);
+  }
+}
+
+EditHistory::ImageType::Pointer EditHistory::GetImage() const
+{
+  ImageType::Pointer image = ImageType::New();
+  const itk::ImageRegion<2> region = GetRegion();
+  if(region.GetNumberOfPixels() == 0)
+  {
+    return image;
+  }
+
+  image->SetNumberOfComponentsPerPixel(this->Reference->GetNumberOfComponentsPerPixel());
+  image->SetRegions(region);
+  image->Allocate();
+  Restore(image);
+  return image;
+}
+
+void EditHistory::Clear()
+{
+  this->States.clear();
+  this->Current = 0;
+}
+
+void EditHistory::SetMemoryBudget(const std::size_t memoryBudget)
+{
+  this->MemoryBudget = memoryBudget;
+  EnforceBudget();
+}
+
+std::size_t EditHistory::GetMemoryBudget() const
+{
+  return this->MemoryBudget;
+}
+
+std::size_t EditHistory::GetMemoryUsage() const
+{
+  std::size_t memoryUsage = 0;
+  for(unsigned int stateId = 0; stateId < this->States.size(); ++stateId)
+  {
+    memoryUsage += this->States[stateId].Pixels->GetMemorySize();
+    if(this->States[stateId].MaskPixels)
+    {
+      memoryUsage += this->States[stateId].MaskPixels->GetMemorySize();
+    }
+  }
+  return memoryUsage;
+}
+
+void EditHistory::EnforceBudget()
+{
+  // Always keep the current state, even if it is larger than the budget by itself.
+  while(GetMemoryUsage() > this->MemoryBudget && this->Current > 0)
+  {
+    this->States.erase(this->States.begin());
+    this->Current--;
+  }
+  while(GetMemoryUsage() > this->MemoryBudget && this->States.size() > this->Current + 1)
+  {
+    this->States.pop_back();
+  }
+}
+
+void EditHistory::Compress(const std::shared_ptr<Buffer>& buffer)
+{
+  // Only this job changes the buffer, so it can read Raw without the lock.
+  QtConcurrent::run([buffer]()
+  {
+    std::vector<uint32_t> encoded = Encode(buffer->Raw);
+
+    std::lock_guard<std::mutex> lock(buffer->Mutex);
+    buffer->Encoded.swap(encoded);
+    std::vector<uint32_t>().swap(buffer->Raw);
+  });
+}
+
+void EditHistory::Buffer::Read(uint32_t* const words) const
+{
+  std::lock_guard<std::mutex> lock(this->Mutex);
+  if(this->Raw.size() == this->NumberOfWords)
+  {
+    std::copy(this->Raw.begin(), this->Raw.end(), words);
+  }
+  else
+  {
+    Decode(this->Encoded, words, this->NumberOfWords);
+  }
+}
+
+std::size_t EditHistory::Buffer::GetMemorySize() const
+{
+  std::lock_guard<std::mutex> lock(this->Mutex);
+  return (this->Raw.size() + this->Encoded.size()) * sizeof(uint32_t);
+}
+
+std::vector<uint32_t> EditHistory::Encode(const std::vector<uint32_t>& words)
+{
+  std::vector<uint32_t> encoded;
+  encoded.reserve(words.size() / 4 + 2);
+
+  std::size_t literalStart = 0;
+  std::size_t wordId = 0;
+  while(wordId < words.size())
+  {
+    std::size_t runEnd = wordId + 1;
+    while(runEnd < words.size() && words[runEnd] == words[wordId] && runEnd - wordId < ~RunFlag)
+    {
+      ++runEnd;
+    }
+
+    if(runEnd - wordId < MinimumRunLength)
+    {
+      wordId = runEnd;
+      continue;
+    }
+
+    // Flush the literals before the run, then the run itself.
+    if(wordId > literalStart)
+    {
+      encoded.push_back(static_cast<uint32_t>(wordId - literalStart));
+      encoded.insert(encoded.end(), words.begin() + literalStart, words.begin() + wordId);
+    }
+    encoded.push_back(RunFlag | static_cast<uint32_t>(runEnd - wordId));
+    encoded.push_back(words[wordId]);
+
+    wordId = runEnd;
+    literalStart = runEnd;
+  }
+
+  if(words.size() > literalStart)
+  {
+    encoded.push_back(static_cast<uint32_t>(words.size() - literalStart));
+    encoded.insert(encoded.end(), words.begin() + literalStart, words.end());
+  }
+
+  return encoded;
+}
+
+void EditHistory::Decode(const std::vector<uint32_t>& encoded, uint32_t* const words,
+                         const std::size_t numberOfWords)
+{
+  std::size_t wordId = 0;
+  std::size_t position = 0;
+  while(position < encoded.size() && wordId < numberOfWords)
+  {
+    const uint32_t token = encoded[position++];
+    if(token & RunFlag)
+    {
+      const std::size_t length = token & ~RunFlag;
+      std::fill(words + wordId, words + wordId + length, encoded[position++]);
+      wordId += length;
+    }
+    else
+    {
+      std::copy(encoded.begin() + position, encoded.begin() + position + token, words + wordId);
+      position += token;
+      wordId += token;
+    }
+  }
+}
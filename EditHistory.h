@@ -0,0 +1,144 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+/** This class keeps the undo/redo history of an edited image. Instead of full copies, each
+  * state only stores the region in which it differs from a fixed reference image (the input
+  * of the fill, or the target of the clone), as the XOR of its pixels with the reference.
+  * Pixels that equal the reference are zero words, so the run-length encoding, which is done
+  * in the background after a state is pushed, keeps little more than the changed pixels.
+  * A state can also carry the (bit-packed) mask it was computed with. When the states take more than the
+  * memory budget, the oldest ones are dropped.
+  */
+
+#ifndef EditHistory_H
+#define EditHistory_H
+
+// ITK
+#include "itkVectorImage.h"
+
+// Custom
+#include "PackedMask.h"
+
+// STL
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class EditHistory
+{
+public:
+  typedef itk::VectorImage<float, 2> ImageType;
+
+  EditHistory(const std::size_t memoryBudget = 256 * 1024 * 1024);
+
+  /** Clear the history and store the next states relative to 'reference', which must not be
+    * modified while the history uses it. */
+  void SetReference(const ImageType* const reference);
+
+  /** Make 'region' of 'image' (and of 'mask', if given) the current state; any states that
+    * could be redone are dropped. 'image' equals the reference outside 'region'. An empty
+    * region records the reference itself. 'approximate' marks an image that is only close
+    * to the result for 'mask', such as a live preview or an approximate fill. */
+  void Push(const ImageType* const image, const itk::ImageRegion<2>& region,
+            const PackedMask* const mask = nullptr, const bool approximate = false);
+
+  bool CanUndo() const;
+  bool CanRedo() const;
+
+  /** Step to the previous or next state; false if there is none. */
+  bool Undo();
+  bool Redo();
+
+  /** Was the current state pushed with a mask? */
+  bool HasMask() const;
+
+  /** Was the current state pushed as an approximation? */
+  bool IsApproximate() const;
+
+  /** The region of the current state, in which it differs from the reference. */
+  itk::ImageRegion<2> GetRegion() const;
+
+  /** Write the region of the current state into 'image' (and 'mask', if the state has one);
+    * both must cover the region. */
+  void Restore(ImageType* const image, PackedMask* const mask = nullptr) const;
+
+  /** A new image that only covers the region of the current state; without components
+    * if the region is empty. */
+  ImageType::Pointer GetImage() const;
+
+  void Clear();
+
+  void SetMemoryBudget(const std::size_t memoryBudget);
+  std::size_t GetMemoryBudget() const;
+
+  /** The bytes taken by all states, at their uncompressed size until they are compressed. */
+  std::size_t GetMemoryUsage() const;
+
+  unsigned int GetNumberOfStates() const
+  {
+    return this->States.size();
+  }
+
+  /** Run-length encode 'words': repeated words are stored once with their count. */
+  static std::vector<uint32_t> Encode(const std::vector<uint32_t>& words);
+
+  /** Decode 'encoded' into 'numberOfWords' words. */
+  static void Decode(const std::vector<uint32_t>& encoded, uint32_t* const words,
+                     const std::size_t numberOfWords);
+
+protected:
+
+  /** The words of one state, raw until the background encoding replaces them. */
+  struct Buffer
+  {
+    mutable std::mutex Mutex;
+    std::size_t NumberOfWords = 0;
+    std::vector<uint32_t> Raw;
+    std::vector<uint32_t> Encoded;
+
+    /** Copy the words out, decoding them if needed. */
+    void Read(uint32_t* const words) const;
+    std::size_t GetMemorySize() const;
+  };
+
+  struct State
+  {
+    itk::ImageRegion<2> Region;
+    std::shared_ptr<Buffer> Pixels;
+    std::shared_ptr<Buffer> MaskPixels;
+    bool Approximate = false;
+  };
+
+  /** Start encoding 'buffer' in the background. */
+  static void Compress(const std::shared_ptr<Buffer>& buffer);
+
+  void EnforceBudget();
+
+  ImageType::ConstPointer Reference;
+
+  /** Oldest first. */
+  std::vector<State> States;
+
+  /** The index of the current state in States. */
+  unsigned int Current = 0;
+
+  std::size_t MemoryBudget;
+};
+
+#endif
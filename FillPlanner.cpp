@@ -0,0 +1,596 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "FillPlanner.h"
+
+// Custom
+#include "ConvolutionPyramid.h"
+#include "MaskedPoissonSolver.h"
+#include "Parallel.h"
+#include "QuadtreePoissonFill.h"
+#include "SineTransform.h"
+
+// Eigen
+#include <Eigen/Sparse>
+
+// STL
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace FillPlanner
+{
+
+namespace
+{
+  /** The parallel loops of the solvers work on blocks of this many unknowns (or pixels), so
+    * a problem gets at most one thread per block. */
+  const unsigned int UnknownsPerThread = 16384;
+
+  /** The cells of the quadtree are at most this large, as in the editing widget. */
+  const unsigned int MaximumCellSize = 16;
+
+  /** The pyramid holds its levels (a third more than the input plane), the input plane and
+    * two filtered planes at a time. */
+  const double PyramidPlanesPerPixel = 4.5;
+
+  double GetSeconds(const std::chrono::steady_clock::time_point& start)
+  {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  /** The bytes of a compressed sparse matrix of double with 'numberOfColumns' columns. */
+  std::size_t GetSparseMatrixSize(const std::size_t nonZeros, const std::size_t numberOfColumns)
+  {
+    return nonZeros * (sizeof(double) + sizeof(int)) + (numberOfColumns + 1) * sizeof(int);
+  }
+
+  /** The bytes of assembling an n by n system from triplets: the per block buffers and their
+    * concatenation, the matrix, and the transposed copy setFromTriplets() goes through. */
+  std::size_t GetAssemblySize(const std::size_t nonZeros, const std::size_t n)
+  {
+    return 2 * nonZeros * sizeof(Eigen::Triplet<double>) + 2 * GetSparseMatrixSize(nonZeros, n);
+  }
+
+  /** The bytes of a PoissonDomain and its boundary links. */
+  std::size_t GetDomainSize(const Estimate& estimate)
+  {
+    return estimate.NumberOfUnknowns * sizeof(itk::Index<2>) + estimate.NumberOfRegionPixels * sizeof(int) +
+           estimate.NumberOfBoundaryPixels * 2 * sizeof(itk::Index<2>);
+  }
+
+  /** The nonzeros of the factor of a system with n unknowns and 'matrixNonZeros' nonzeros. */
+  std::size_t EstimateFactorNonZeros(const double n, const std::size_t matrixNonZeros,
+                                     const Calibration& calibration)
+  {
+    const double fillIn = calibration.FillInFactor * n * std::log2(std::max(n, 2.0));
+    return std::max(static_cast<std::size_t>(fillIn), matrixNonZeros);
+  }
+
+  void CopyImage(const ImageType* const image, ImageType* const result)
+  {
+    if(result == image)
+    {
+      return;
+    }
+
+    const itk::ImageRegion<2> imageRegion = image->GetLargestPossibleRegion();
+    const unsigned int numberOfComponents = image->GetNumberOfComponentsPerPixel();
+    result->SetNumberOfComponentsPerPixel(numberOfComponents);
+    result->SetRegions(imageRegion);
+    result->Allocate();
+    std::memcpy(result->GetBufferPointer(), image->GetBufferPointer(),
+                imageRegion.GetNumberOfPixels() * numberOfComponents * sizeof(float));
+  }
+
+  /** Solve the hole of 'mask' in place in 'result', whose hole pixels are the initial guess
+    * of the iterative method. Returns the number of iterations (0 for the direct method). */
+  unsigned int SolveExactly(const Mask* const mask, const MaskedPoissonSolver::MethodType method,
+                            ImageType* const result)
+  {
+    const itk::Offset<2> zeroOffset = {{0, 0}};
+    PoissonDomain domain = PoissonDomain::Create(mask, mask->GetLargestPossibleRegion(), zeroOffset,
+                                                 result->GetLargestPossibleRegion());
+
+    MaskedPoissonSolver solver;
+    solver.SetMethod(method);
+    solver.SetDomain(domain);
+    solver.Solve(result, MaskedPoissonSolver::GuidanceTermsType(), result);
+    return solver.GetNumberOfIterations();
+  }
+
+  std::string FormatBytes(const std::size_t bytes)
+  {
+    std::ostringstream stream;
+    stream.precision(3);
+    if(bytes >= static_cast<std::size_t>(1024) * 1024 * 1024)
+    {
+      stream << bytes / (1024.0 * 1024.0 * 1024.0) << " GB";
+    }
+    else
+    {
+      stream << bytes / (1024.0 * 1024.0) << " MB";
+    }
+    return stream.str();
+  }
+}
+
+const char* GetBackendName(const BackendType backend)
+{
+  switch(backend)
+  {
+    case DirectBackend:
+      return "direct";
+    case IterativeBackend:
+      return "iterative";
+    case QuadtreeBackend:
+      return "quadtree";
+    case PyramidBackend:
+      return "pyramid";
+    default:
+      return "unknown";
+  }
+}
+
+Calibration Calibration::Measure()
+{
+  // A disc shaped hole of about 29000 pixels in a smooth gray image. It is not a rectangle,
+  // so the direct backend really factorizes.
+  const unsigned int imageSize = 256;
+  const double radius = 96.0;
+  const itk::Size<2> size = {{imageSize, imageSize}};
+  const itk::ImageRegion<2> region(size);
+
+  ImageType::Pointer image = ImageType::New();
+  image->SetNumberOfComponentsPerPixel(1);
+  image->SetRegions(region);
+  image->Allocate();
+
+  Mask::Pointer mask = Mask::New();
+  mask->SetRegions(region);
+  mask->Allocate();
+
+  float* imageBuffer = image->GetBufferPointer();
+  itk::Index<2> pixel;
+  for(pixel[1] = 0; pixel[1] < static_cast<itk::IndexValueType>(imageSize); ++pixel[1])
+  {
+    for(pixel[0] = 0; pixel[0] < static_cast<itk::IndexValueType>(imageSize); ++pixel[0])
+    {
+      imageBuffer[pixel[1] * imageSize + pixel[0]] = 128.0f + 64.0f * std::sin(0.05 * pixel[0]) *
+                                                     std::cos(0.03 * pixel[1]);
+      const double dx = pixel[0] - imageSize / 2.0;
+      const double dy = pixel[1] - imageSize / 2.0;
+      mask->SetPixel(pixel, dx * dx + dy * dy < radius * radius ? mask->GetHoleValue() :
+                                                                  mask->GetValidValue());
+    }
+  }
+
+  const PackedMask packedMask = PackedMask::FromMask(mask);
+  const double numberOfUnknowns = packedMask.CountHolePixels();
+  const double numberOfBoundaryPixels = packedMask.GetInnerBoundary().CountHolePixels();
+  itk::ImageRegion<2> holeRegion = packedMask.GetHoleBoundingBox();
+  holeRegion.PadByRadius(1);
+  holeRegion.Crop(region);
+
+  // The constants describe a single thread; MakePlan() scales them.
+  Parallel::ThreadLimit threadLimit(1);
+  Calibration calibration;
+  ImageType::Pointer result = ImageType::New();
+
+  // Direct: the fill-in of the factor and the time per factor nonzero.
+  {
+    CopyImage(image, result);
+    const itk::Offset<2> zeroOffset = {{0, 0}};
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    PoissonDomain domain = PoissonDomain::Create(packedMask, zeroOffset, region);
+    MaskedPoissonSolver solver;
+    solver.SetDomain(domain);
+    solver.Solve(result, MaskedPoissonSolver::GuidanceTermsType(), result);
+    const double seconds = GetSeconds(start);
+
+    const double factorNonZeros = solver.GetNumberOfFactorNonZeros();
+    calibration.FillInFactor = factorNonZeros / (numberOfUnknowns * std::log2(numberOfUnknowns));
+    calibration.SecondsPerFactorOperation = seconds / std::pow(numberOfUnknowns, 1.5);
+  }
+
+  // Pyramid: the time per value of the padded hole region (one channel and the weight).
+  {
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    ConvolutionPyramid::FillImage(image, mask, result);
+    calibration.SecondsPerPyramidValue = GetSeconds(start) / (2.0 * holeRegion.GetNumberOfPixels());
+  }
+
+  // Iterative: started from the pyramid result that is now in 'result'.
+  {
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    const unsigned int iterations = std::max(SolveExactly(mask, MaskedPoissonSolver::IterativeMethod, result), 1u);
+    const double seconds = GetSeconds(start);
+
+    calibration.IterationsPerSqrtUnknown = iterations / std::sqrt(numberOfUnknowns);
+    calibration.SecondsPerIterationUnknown = seconds / (iterations * numberOfUnknowns);
+  }
+
+  // Quadtree: the nodes per boundary pixel and the time per node.
+  {
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    const unsigned int numberOfNodes = std::max(QuadtreePoissonFill::FillImage(image, mask, result,
+                                                                               MaximumCellSize), 1u);
+    const double seconds = GetSeconds(start);
+
+    calibration.QuadtreeNodesPerBoundaryPixel = numberOfNodes / numberOfBoundaryPixels;
+    calibration.SecondsPerQuadtreeNode = seconds / numberOfNodes;
+  }
+
+  return calibration;
+}
+
+bool Calibration::Load(const std::string& fileName)
+{
+  std::ifstream file(fileName.c_str());
+  if(!file)
+  {
+    return false;
+  }
+
+  Calibration loaded = *this;
+  std::string key;
+  double value;
+  while(file >> key >> value)
+  {
+    if(!(value > 0.0))
+    {
+      return false;
+    }
+
+    if(key == "FillInFactor")
+    {
+      loaded.FillInFactor = value;
+    }
+    else if(key == "SecondsPerFactorOperation")
+    {
+      loaded.SecondsPerFactorOperation = value;
+    }
+    else if(key == "IterationsPerSqrtUnknown")
+    {
+      loaded.IterationsPerSqrtUnknown = value;
+    }
+    else if(key == "SecondsPerIterationUnknown")
+    {
+      loaded.SecondsPerIterationUnknown = value;
+    }
+    else if(key == "QuadtreeNodesPerBoundaryPixel")
+    {
+      loaded.QuadtreeNodesPerBoundaryPixel = value;
+    }
+    else if(key == "SecondsPerQuadtreeNode")
+    {
+      loaded.SecondsPerQuadtreeNode = value;
+    }
+    else if(key == "SecondsPerPyramidValue")
+    {
+      loaded.SecondsPerPyramidValue = value;
+    }
+  }
+
+  if(!file.eof())
+  {
+    return false;
+  }
+
+  *this = loaded;
+  return true;
+}
+
+void Calibration::Save(const std::string& fileName) const
+{
+  std::ofstream file(fileName.c_str());
+  file.precision(9);
+  file << "FillInFactor " << this->FillInFactor << std::endl
+       << "SecondsPerFactorOperation " << this->SecondsPerFactorOperation << std::endl
+       << "IterationsPerSqrtUnknown " << this->IterationsPerSqrtUnknown << std::endl
+       << "SecondsPerIterationUnknown " << this->SecondsPerIterationUnknown << std::endl
+       << "QuadtreeNodesPerBoundaryPixel " << this->QuadtreeNodesPerBoundaryPixel << std::endl
+       << "SecondsPerQuadtreeNode " << this->SecondsPerQuadtreeNode << std::endl
+       << "SecondsPerPyramidValue " << this->SecondsPerPyramidValue << std::endl;
+  if(!file)
+  {
+    throw std::runtime_error("Could not write the solver calibration to " + fileName);
+  }
+}
+
+std::string Calibration::GetDefaultFileName()
+{
+  const char* fileName = std::getenv("POISSON_EDITING_CALIBRATION");
+  if(fileName && *fileName)
+  {
+    return fileName;
+  }
+
+  const char* home = std::getenv("HOME");
+  if(!home)
+  {
+    home = std::getenv("USERPROFILE");
+  }
+  return std::string(home ? home : ".") + "/.PoissonEditingCalibration";
+}
+
+Calibration Calibration::LoadOrMeasure(const LogFunctionType& log)
+{
+  const std::string fileName = GetDefaultFileName();
+
+  Calibration calibration;
+  if(calibration.Load(fileName))
+  {
+    return calibration;
+  }
+
+  if(log)
+  {
+    log("Calibrating the solvers for this machine...");
+  }
+  calibration = Measure();
+  try
+  {
+    calibration.Save(fileName);
+    if(log)
+    {
+      log("Saved the solver calibration to " + fileName);
+    }
+  }
+  catch(const std::runtime_error& error)
+  {
+    // The measurement is still good for this session.
+    if(log)
+    {
+      log(error.what());
+    }
+  }
+  return calibration;
+}
+
+Estimate EstimateCosts(const PackedMask& mask, const itk::ImageRegion<2>& imageRegion,
+                       const unsigned int numberOfComponents, const Calibration& calibration)
+{
+  Estimate estimate;
+  estimate.NumberOfComponents = numberOfComponents;
+  estimate.NumberOfUnknowns = mask.CountHolePixels();
+  if(estimate.NumberOfUnknowns == 0)
+  {
+    return estimate;
+  }
+
+  const itk::ImageRegion<2> holeRegion = mask.GetHoleBoundingBox();
+  itk::ImageRegion<2> paddedRegion = holeRegion;
+  paddedRegion.PadByRadius(1);
+  estimate.Rectangular = estimate.NumberOfUnknowns == holeRegion.GetNumberOfPixels() &&
+                         imageRegion.IsInside(paddedRegion) &&
+                         SineTransform::IsFast(holeRegion.GetSize()[0]) &&
+                         SineTransform::IsFast(holeRegion.GetSize()[1]);
+  paddedRegion.Crop(imageRegion);
+  estimate.NumberOfRegionPixels = paddedRegion.GetNumberOfPixels();
+  estimate.NumberOfBoundaryPixels = mask.GetInnerBoundary().CountHolePixels();
+
+  const double n = estimate.NumberOfUnknowns;
+  const std::size_t channelBytes = static_cast<std::size_t>(n) * sizeof(double);
+  const std::size_t domainBytes = GetDomainSize(estimate);
+
+  // Every unknown couples to itself and to its (at most four) neighbors.
+  estimate.MatrixNonZeros = static_cast<std::size_t>(5 * n);
+  estimate.FactorNonZeros = EstimateFactorNonZeros(n, estimate.MatrixNonZeros, calibration);
+
+  // Pyramid: planes of the padded hole region with one value per channel and a weight.
+  const double pyramidValues = static_cast<double>(estimate.NumberOfRegionPixels) * (numberOfComponents + 1);
+  estimate.Memory[PyramidBackend] = static_cast<std::size_t>(PyramidPlanesPerPixel * pyramidValues * sizeof(float));
+  estimate.Seconds[PyramidBackend] = calibration.SecondsPerPyramidValue * pyramidValues;
+
+  // Direct: the assembly, the factor (L, D and the ordering), the right hand sides and the
+  // solutions. A rectangle only needs the transforms of one channel at a time, which stream
+  // over the values log2(n) times, much like the pyramid does once.
+  if(estimate.Rectangular)
+  {
+    estimate.FactorNonZeros = 0;
+    estimate.Memory[DirectBackend] = domainBytes + (2 * numberOfComponents + 2) * channelBytes;
+    estimate.Seconds[DirectBackend] = calibration.SecondsPerPyramidValue * n * std::log2(n) * numberOfComponents;
+  }
+  else
+  {
+    estimate.Memory[DirectBackend] = domainBytes + GetAssemblySize(estimate.MatrixNonZeros, n) +
+                                     2 * GetSparseMatrixSize(estimate.FactorNonZeros, n) +
+                                     (2 * numberOfComponents + 2) * channelBytes;
+    estimate.Seconds[DirectBackend] = calibration.SecondsPerFactorOperation * std::pow(n, 1.5);
+  }
+
+  // Iterative: the assembly, the incomplete factor (about as large as A), the work vectors of
+  // the conjugate gradients, the right hand sides, guesses and solutions, after the pyramid.
+  estimate.NumberOfIterations = static_cast<unsigned int>(std::ceil(calibration.IterationsPerSqrtUnknown *
+                                                                    std::sqrt(n)));
+  estimate.Memory[IterativeBackend] = domainBytes + GetAssemblySize(estimate.MatrixNonZeros, n) +
+                                      2 * GetSparseMatrixSize(estimate.MatrixNonZeros, n) +
+                                      (3 * numberOfComponents + 4) * channelBytes;
+  estimate.Memory[IterativeBackend] = std::max(estimate.Memory[IterativeBackend], estimate.Memory[PyramidBackend]);
+  estimate.Seconds[IterativeBackend] = estimate.Seconds[PyramidBackend] + calibration.SecondsPerIterationUnknown *
+                                       estimate.NumberOfIterations * n * numberOfComponents;
+
+  // Quadtree: a direct solve over the nodes, which couple to up to 8 others through the
+  // bilinear cells, plus the node and cell lookups and the hole counts of the region.
+  const double nodes = std::min(n, calibration.QuadtreeNodesPerBoundaryPixel * estimate.NumberOfBoundaryPixels);
+  estimate.NumberOfQuadtreeNodes = static_cast<unsigned int>(nodes);
+  const std::size_t quadtreeNonZeros = static_cast<std::size_t>(9 * nodes);
+  estimate.Memory[QuadtreeBackend] = GetAssemblySize(quadtreeNonZeros, nodes) +
+                                     2 * GetSparseMatrixSize(EstimateFactorNonZeros(nodes, quadtreeNonZeros,
+                                                                                    calibration), nodes) +
+                                     (2 * numberOfComponents + 2) * static_cast<std::size_t>(nodes) * sizeof(double) +
+                                     3 * estimate.NumberOfRegionPixels * sizeof(int);
+  estimate.Seconds[QuadtreeBackend] = calibration.SecondsPerQuadtreeNode * nodes;
+
+  return estimate;
+}
+
+Plan MakePlan(const ImageType* const image, const Mask* const mask, const Options& options,
+              const Calibration& calibration)
+{
+  const itk::ImageRegion<2> imageRegion = image->GetLargestPossibleRegion();
+  itk::ImageRegion<2> region = mask->GetLargestPossibleRegion();
+  const bool overlap = region.Crop(imageRegion);
+
+  Plan plan;
+  plan.Estimates = EstimateCosts(overlap ? PackedMask::FromMask(mask, region) : PackedMask(),
+                                 imageRegion, image->GetNumberOfComponentsPerPixel(), calibration);
+  const Estimate& estimate = plan.Estimates;
+
+  auto fits = [&](const BackendType backend)
+  {
+    return estimate.Memory[backend] <= options.MemoryBudget;
+  };
+  auto inTime = [&](const BackendType backend)
+  {
+    return options.TimeBudget <= 0.0 || estimate.Seconds[backend] <= options.TimeBudget;
+  };
+
+  // The exact backend that fits and is predicted to be faster.
+  bool exact = true;
+  if(fits(DirectBackend) && (!fits(IterativeBackend) ||
+                             estimate.Seconds[DirectBackend] <= estimate.Seconds[IterativeBackend]))
+  {
+    plan.Backend = DirectBackend;
+    plan.Reason = estimate.Rectangular ? "the hole is a rectangle" : "the factor fits the memory budget";
+  }
+  else if(fits(IterativeBackend))
+  {
+    plan.Backend = IterativeBackend;
+    plan.Reason = fits(DirectBackend) ? "it is predicted to be faster than factorizing" :
+                                        "the factor does not fit the memory budget";
+  }
+  else
+  {
+    exact = false;
+    plan.Reason = "no exact solver fits the memory budget";
+  }
+
+  if(exact && !inTime(plan.Backend))
+  {
+    exact = !options.AllowApproximation;
+    if(!exact)
+    {
+      plan.Reason = "the exact solvers are predicted to exceed the time budget";
+    }
+  }
+
+  if(!exact)
+  {
+    if(!options.AllowApproximation)
+    {
+      throw std::runtime_error("FillPlanner: no exact solver fits the memory budget of " +
+                               FormatBytes(options.MemoryBudget) + " and approximations are not allowed.");
+    }
+
+    // The quadtree is the more accurate approximation; the pyramid is the last resort, even
+    // over budget, as it needs the least memory.
+    plan.Backend = fits(QuadtreeBackend) && (inTime(QuadtreeBackend) || !inTime(PyramidBackend)) ?
+                   QuadtreeBackend : PyramidBackend;
+  }
+
+  // One thread per block of work; more would only wait.
+  double work = estimate.NumberOfUnknowns;
+  if(plan.Backend == QuadtreeBackend)
+  {
+    work = estimate.NumberOfQuadtreeNodes;
+  }
+  else if(plan.Backend == PyramidBackend)
+  {
+    work = estimate.NumberOfRegionPixels;
+  }
+  const unsigned int maximumNumberOfThreads = options.MaximumNumberOfThreads ? options.MaximumNumberOfThreads :
+                                              Parallel::GetNumberOfThreads();
+  plan.NumberOfThreads = std::max(1u, std::min(maximumNumberOfThreads,
+                                               static_cast<unsigned int>(std::ceil(work / UnknownsPerThread))));
+
+  return plan;
+}
+
+std::string Plan::Describe() const
+{
+  const Estimate& estimate = this->Estimates;
+
+  std::ostringstream stream;
+  stream.precision(3);
+  stream << estimate.NumberOfUnknowns << " unknowns, " << estimate.MatrixNonZeros << " nonzeros";
+  if(estimate.FactorNonZeros)
+  {
+    stream << ", " << estimate.FactorNonZeros << " in the factor";
+  }
+  stream << ". Estimates:";
+  for(unsigned int backend = 0; backend < NumberOfBackends; ++backend)
+  {
+    stream << (backend ? "," : "") << " " << GetBackendName(static_cast<BackendType>(backend)) << " "
+           << FormatBytes(estimate.Memory[backend]) << " " << estimate.Seconds[backend] << " s";
+  }
+  stream << ". Using " << GetBackendName(this->Backend) << " on " << this->NumberOfThreads
+         << (this->NumberOfThreads == 1 ? " thread" : " threads") << " because " << this->Reason << ".";
+  return stream.str();
+}
+
+void Execute(const Plan& plan, const ImageType* const image, const Mask* const mask,
+             ImageType* const result, const LogFunctionType& log)
+{
+  if(log)
+  {
+    log("FillPlanner: " + plan.Describe());
+  }
+
+  Parallel::ThreadLimit threadLimit(plan.NumberOfThreads);
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  switch(plan.Backend)
+  {
+    case DirectBackend:
+      CopyImage(image, result);
+      SolveExactly(mask, MaskedPoissonSolver::DirectMethod, result);
+      break;
+    case IterativeBackend:
+    {
+      // The approximation is a good start; the iterations only have to remove its error.
+      ConvolutionPyramid::FillImage(image, mask, result);
+      const unsigned int iterations = SolveExactly(mask, MaskedPoissonSolver::IterativeMethod, result);
+      if(log)
+      {
+        log("FillPlanner: converged after " + std::to_string(iterations) + " iterations.");
+      }
+      break;
+    }
+    case QuadtreeBackend:
+      QuadtreePoissonFill::FillImage(image, mask, result, MaximumCellSize);
+      break;
+    default:
+      ConvolutionPyramid::FillImage(image, mask, result);
+  }
+
+  if(log)
+  {
+    std::ostringstream stream;
+    stream << "FillPlanner: " << GetBackendName(plan.Backend) << " fill took " << GetSeconds(start) << " s.";
+    log(stream.str());
+  }
+}
+
+} // end namespace
@@ -0,0 +1,180 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+/** These functions pick the solver for a hole filling problem before anything is solved.
+  * The number of unknowns, the nonzeros of the system and the fill-in of its factor are
+  * estimated from the mask, and turned into memory and time estimates for every backend
+  * with constants measured once per machine (see Calibration). The exact solvers are
+  * preferred as long as they fit the memory budget; otherwise the fill falls back to the
+  * quadtree and finally to the convolution pyramid approximation.
+  */
+
+#ifndef FillPlanner_H
+#define FillPlanner_H
+
+// ITK
+#include "itkVectorImage.h"
+
+// Custom
+#include "PackedMask.h"
+
+// Submodules
+#include "Mask/Mask.h"
+
+// STL
+#include <cstddef>
+#include <functional>
+#include <string>
+
+namespace FillPlanner
+{
+  typedef itk::VectorImage<float, 2> ImageType;
+
+  /** Receives one line of progress (without the newline). An empty function logs nothing. */
+  typedef std::function<void(const std::string&)> LogFunctionType;
+
+  enum BackendType
+  {
+    /** MaskedPoissonSolver with a sparse factorization, or sine transforms for a rectangle. */
+    DirectBackend,
+
+    /** MaskedPoissonSolver with conjugate gradients, started from the pyramid approximation. */
+    IterativeBackend,
+
+    /** QuadtreePoissonFill: a factorization over a reduced number of unknowns. */
+    QuadtreeBackend,
+
+    /** ConvolutionPyramid: an approximation that solves nothing. */
+    PyramidBackend,
+
+    NumberOfBackends
+  };
+
+  const char* GetBackendName(const BackendType backend);
+
+  /** The machine dependent constants of the cost model. The defaults are conservative
+    * guesses for machines that were never measured. */
+  struct Calibration
+  {
+    /** The nonzeros of the factor of a hole with n unknowns, divided by n log2(n). */
+    double FillInFactor = 3.0;
+
+    /** Seconds to factorize and solve, divided by n^1.5 (which the work of factorizing a
+      * planar system grows with, while the factor only grows with n log2(n)). */
+    double SecondsPerFactorOperation = 2e-8;
+
+    /** Conjugate gradient iterations (from the pyramid start), divided by sqrt(n). */
+    double IterationsPerSqrtUnknown = 1.0;
+
+    /** Seconds per iteration, unknown and channel. */
+    double SecondsPerIterationUnknown = 2e-8;
+
+    /** The nodes of the quadtree, per pixel of the boundary of the hole. */
+    double QuadtreeNodesPerBoundaryPixel = 4.0;
+
+    /** Seconds to build and solve the quadtree, per node. */
+    double SecondsPerQuadtreeNode = 2e-6;
+
+    /** Seconds per pixel of the padded hole bounding box and per plane (channel or weight). */
+    double SecondsPerPyramidValue = 2e-8;
+
+    /** Time every backend on a synthetic hole on one thread. Takes about a second. */
+    static Calibration Measure();
+
+    /** Read the constants written by Save(). Returns false (and keeps the defaults) if the
+      * file cannot be read; unknown keys are ignored. */
+    bool Load(const std::string& fileName);
+
+    /** Write one "Key value" line per constant. Throws if the file cannot be written. */
+    void Save(const std::string& fileName) const;
+
+    /** POISSON_EDITING_CALIBRATION if it is set, otherwise a file in the home directory. */
+    static std::string GetDefaultFileName();
+
+    /** Load the default file, or measure and save it the first time on a machine. */
+    static Calibration LoadOrMeasure(const LogFunctionType& log = LogFunctionType());
+  };
+
+  /** What the cost model predicts for one problem. */
+  struct Estimate
+  {
+    unsigned int NumberOfUnknowns = 0;
+    unsigned int NumberOfComponents = 0;
+    unsigned int NumberOfBoundaryPixels = 0;
+
+    /** The padded bounding box of the hole, which the pyramid and the lookup tables cover. */
+    std::size_t NumberOfRegionPixels = 0;
+
+    /** The hole is a rectangle that is solved with sine transforms. */
+    bool Rectangular = false;
+
+    std::size_t MatrixNonZeros = 0;
+    std::size_t FactorNonZeros = 0;
+    unsigned int NumberOfIterations = 0;
+    unsigned int NumberOfQuadtreeNodes = 0;
+
+    /** The peak memory (bytes) and the single thread time (seconds) of every backend. */
+    std::size_t Memory[NumberOfBackends] = {};
+    double Seconds[NumberOfBackends] = {};
+  };
+
+  struct Options
+  {
+    /** The memory a fill may use. */
+    std::size_t MemoryBudget = static_cast<std::size_t>(1024) * 1024 * 1024;
+
+    /** If the exact backends are predicted to take longer than this (in seconds, 0 for no
+      * limit), an approximation is used. */
+    double TimeBudget = 0.0;
+
+    /** May the quadtree and the pyramid be used? If not, MakePlan() throws when no exact
+      * backend fits the budget. */
+    bool AllowApproximation = true;
+
+    /** The most threads to use, 0 for Parallel::GetNumberOfThreads(). */
+    unsigned int MaximumNumberOfThreads = 0;
+  };
+
+  struct Plan
+  {
+    BackendType Backend = DirectBackend;
+    unsigned int NumberOfThreads = 1;
+    Estimate Estimates;
+
+    /** Why the backend was picked. */
+    std::string Reason;
+
+    /** A one line summary of the estimates and the decision, for logs and status bars. */
+    std::string Describe() const;
+  };
+
+  /** Predict the cost of every backend for the hole pixels of 'mask' inside 'imageRegion'. */
+  Estimate EstimateCosts(const PackedMask& mask, const itk::ImageRegion<2>& imageRegion,
+                         const unsigned int numberOfComponents, const Calibration& calibration);
+
+  /** Pick the backend and the number of threads for filling the hole of 'mask' in 'image'. */
+  Plan MakePlan(const ImageType* const image, const Mask* const mask, const Options& options,
+                const Calibration& calibration);
+
+  /** Set 'result' to 'image' with the hole of 'mask' filled by the backend of 'plan', on
+    * plan.NumberOfThreads threads (whatever other threads use at the same time). */
+  void Execute(const Plan& plan, const ImageType* const image, const Mask* const mask,
+               ImageType* const result, const LogFunctionType& log = LogFunctionType());
+}
+
+#endif
@@ -0,0 +1,86 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+/** This class keeps recently computed images, so that going back to inputs that were
+  * already tried does not recompute anything. Images are looked up by a key that
+  * describes everything the image was computed from. When the images take more than
+  * the memory budget, the least recently used ones are dropped.
+  */
+
+#ifndef ImageCache_H
+#define ImageCache_H
+
+// STL
+#include <cstdint>
+#include <list>
+#include <map>
+#include <vector>
+
+template <typename TImage>
+class ImageCache
+{
+public:
+  typedef std::vector<uint64_t> KeyType;
+
+  ImageCache(const std::size_t memoryBudget = 512 * 1024 * 1024);
+
+  /** Get the image stored for 'key' and mark it as the most recently used, or null. */
+  typename TImage::Pointer Find(const KeyType& key);
+
+  /** Store 'image' (without copying it) and drop old images until the budget is met. */
+  void Insert(const KeyType& key, TImage* const image);
+
+  void Clear();
+
+  void SetMemoryBudget(const std::size_t memoryBudget);
+  std::size_t GetMemoryUsage() const;
+  unsigned int GetNumberOfImages() const;
+
+  /** The number of bytes of pixel data held by 'image'. */
+  static std::size_t ComputeMemorySize(const TImage* const image);
+
+  /** A hash of the size and the pixel values of an image (of any type). */
+  template <typename TInputImage>
+  static uint64_t HashImage(const TInputImage* const image);
+
+protected:
+
+  struct Entry
+  {
+    KeyType Key;
+    typename TImage::Pointer Image;
+    std::size_t MemorySize;
+  };
+
+  void EnforceBudget();
+
+  /** A bijection of 64 bit words in which every input bit changes about half of the output
+    * bits (the finalizer of splitmix64). */
+  static uint64_t MixWord(uint64_t word);
+
+  /** Most recently used first. */
+  std::list<Entry> Entries;
+  std::map<KeyType, typename std::list<Entry>::iterator> Lookup;
+
+  std::size_t MemoryBudget;
+  std::size_t MemoryUsage = 0;
+};
+
+#include "ImageCache.hpp"
+
+#endif
@@ -0,0 +1,162 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef ImageCache_HPP
+#define ImageCache_HPP
+
+#include "ImageCache.h" // Appease syntax parser
+
+// STL
+#include <cstring>
+
+template <typename TImage>
+ImageCache<TImage>::ImageCache(const std::size_t memoryBudget) : MemoryBudget(memoryBudget)
+{
+}
+
+template <typename TImage>
+typename TImage::Pointer ImageCache<TImage>::Find(const KeyType& key)
+{
+  auto lookupIterator = this->Lookup.find(key);
+  if(lookupIterator == this->Lookup.end())
+  {
+    return nullptr;
+  }
+
+  // Move the entry to the front without invalidating the iterator held by Lookup.
+  this->Entries.splice(this->Entries.begin(), this->Entries, lookupIterator->second);
+  return lookupIterator->second->Image;
+}
+
+template <typename TImage>
+void ImageCache<TImage>::Insert(const KeyType& key, TImage* const image)
+{
+  auto lookupIterator = this->Lookup.find(key);
+  if(lookupIterator != this->Lookup.end())
+  {
+    this->MemoryUsage -= lookupIterator->second->MemorySize;
+    this->Entries.erase(lookupIterator->second);
+    this->Lookup.erase(lookupIterator);
+  }
+
+  Entry entry;
+  entry.Key = key;
+  entry.Image = image;
+  entry.MemorySize = ComputeMemorySize(image);
+
+  this->Entries.push_front(entry);
+  this->Lookup[key] = this->Entries.begin();
+  this->MemoryUsage += entry.MemorySize;
+
+  EnforceBudget();
+}
+
+template <typename TImage>
+void ImageCache<TImage>::Clear()
+{
+  this->Entries.clear();
+  this->Lookup.clear();
+  this->MemoryUsage = 0;
+}
+
+template <typename TImage>
+void ImageCache<TImage>::SetMemoryBudget(const std::size_t memoryBudget)
+{
+  this->MemoryBudget = memoryBudget;
+  EnforceBudget();
+}
+
+template <typename TImage>
+std::size_t ImageCache<TImage>::GetMemoryUsage() const
+{
+  return this->MemoryUsage;
+}
+
+template <typename TImage>
+unsigned int ImageCache<TImage>::GetNumberOfImages() const
+{
+  return this->Entries.size();
+}
+
+template <typename TImage>
+void ImageCache<TImage>::EnforceBudget()
+{
+  // Always keep the most recent image, even if it is larger than the budget by itself.
+  while(this->MemoryUsage > this->MemoryBudget && this->Entries.size() > 1)
+  {
+    const Entry& oldest = this->Entries.back();
+    this->MemoryUsage -= oldest.MemorySize;
+    this->Lookup.erase(oldest.Key);
+    this->Entries.pop_back();
+  }
+}
+
+template <typename TImage>
+std::size_t ImageCache<TImage>::ComputeMemorySize(const TImage* const image)
+{
+  return image->GetBufferedRegion().GetNumberOfPixels() * image->GetNumberOfComponentsPerPixel() *
+         sizeof(typename TImage::InternalPixelType);
+}
+
+template <typename TImage>
+uint64_t ImageCache<TImage>::MixWord(uint64_t word)
+{
+  word = (word ^ (word >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  word = (word ^ (word >> 27)) * 0x94d049bb133111ebULL;
+  return word ^ (word >> 31);
+}
+
+template <typename TImage>
+template <typename TInputImage>
+uint64_t ImageCache<TImage>::HashImage(const TInputImage* const image)
+{
+  // FNV-1a over the size and the raw pixel data, 8 bytes at a time. A multiply only carries
+  // differences towards the high bits, so every word is mixed first; otherwise images that
+  // differ only in the high bytes of their words would only differ in the top bits.
+  const uint64_t prime = 1099511628211ULL;
+  uint64_t hash = 14695981039346656037ULL;
+
+  typename TInputImage::SizeType size = image->GetBufferedRegion().GetSize();
+  for(unsigned int dimension = 0; dimension < TInputImage::ImageDimension; ++dimension)
+  {
+    hash = (hash ^ MixWord(size[dimension])) * prime;
+  }
+
+  // Mix in 8 bytes at a time, then the remaining bytes as one word.
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(image->GetBufferPointer());
+  const std::size_t numberOfBytes = image->GetBufferedRegion().GetNumberOfPixels() *
+                                    image->GetNumberOfComponentsPerPixel() *
+                                    sizeof(typename TInputImage::InternalPixelType);
+  std::size_t byteId = 0;
+  for(; byteId + sizeof(uint64_t) <= numberOfBytes; byteId += sizeof(uint64_t))
+  {
+    uint64_t word;
+    std::memcpy(&word, bytes + byteId, sizeof(uint64_t));
+    hash = (hash ^ MixWord(word)) * prime;
+  }
+  if(byteId < numberOfBytes)
+  {
+    uint64_t word = 0;
+    std::memcpy(&word, bytes + byteId, numberOfBytes - byteId);
+    hash = (hash ^ MixWord(word)) * prime;
+  }
+
+  return MixWord(hash);
+}
+
+#endif
@@ -0,0 +1,257 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "ImageDisplay.h"
+
+// Custom
+#include "Parallel.h"
+
+// STL
+#include <algorithm>
+#include <vector>
+
+namespace ImageDisplay
+{
+
+namespace
+{
+  unsigned char ToByte(const float value)
+  {
+    return static_cast<unsigned char>(std::min(255.0f, std::max(0.0f, value)));
+  }
+
+  /** Convert 'width' pixels to RGB. The number of channels is TNumberOfComponents, or
+    * 'numberOfComponents' if it is 0. One channel is shown as gray. */
+  template <unsigned int TNumberOfComponents>
+  void ConvertRow(const float* pixel, const unsigned int width, const unsigned int numberOfComponents,
+                  unsigned char* scanLine)
+  {
+    const unsigned int components = TNumberOfComponents ? TNumberOfComponents : numberOfComponents;
+    for(unsigned int column = 0; column < width; ++column, pixel += components)
+    {
+      if(components >= 3)
+      {
+        scanLine[3 * column] = ToByte(pixel[0]);
+        scanLine[3 * column + 1] = ToByte(pixel[1]);
+        scanLine[3 * column + 2] = ToByte(pixel[2]);
+      }
+      else
+      {
+        unsigned char gray = ToByte(pixel[0]);
+        scanLine[3 * column] = gray;
+        scanLine[3 * column + 1] = gray;
+        scanLine[3 * column + 2] = gray;
+      }
+    }
+  }
+
+  /** The offsets of the samples along one side of a block of 'factor' pixels: all of them up
+    * to 4, then 4 evenly spaced ones. */
+  std::vector<unsigned int> GetSampleOffsets(const unsigned int factor)
+  {
+    const unsigned int numberOfSamples = std::min(factor, 4u);
+    std::vector<unsigned int> offsets(numberOfSamples);
+    for(unsigned int sample = 0; sample < numberOfSamples; ++sample)
+    {
+      offsets[sample] = (2 * sample + 1) * factor / (2 * numberOfSamples);
+    }
+    return offsets;
+  }
+
+  /** Fill 'proxyRect' of a mask proxy, whose pixel (x, y) covers the mask block at factor (x, y). */
+  void RenderMaskProxy(QImage& proxy, const Mask* const mask, const QRect& proxyRect, const unsigned int factor,
+                       const unsigned char alpha)
+  {
+    const itk::ImageRegion<2> maskRegion = mask->GetLargestPossibleRegion();
+    const std::vector<unsigned int> offsets = GetSampleOffsets(factor);
+    unsigned char* bits = proxy.bits();
+    const int bytesPerLine = proxy.bytesPerLine();
+
+    Parallel::ForBlocks(proxyRect.height(), 64, [&](const unsigned int begin, const unsigned int end)
+    {
+      for(unsigned int row = begin; row < end; ++row)
+      {
+        const int y = proxyRect.top() + row;
+        QRgb* scanLine = reinterpret_cast<QRgb*>(bits + y * bytesPerLine);
+        for(int x = proxyRect.left(); x <= proxyRect.right(); ++x)
+        {
+          unsigned int numberOfSamples = 0;
+          unsigned int numberOfHoleSamples = 0;
+          for(unsigned int sampleY = 0; sampleY < offsets.size(); ++sampleY)
+          {
+            for(unsigned int sampleX = 0; sampleX < offsets.size(); ++sampleX)
+            {
+              const itk::Index<2> pixel = {{static_cast<itk::IndexValueType>(x * factor + offsets[sampleX]),
+                                            static_cast<itk::IndexValueType>(y * factor + offsets[sampleY])}};
+              if(maskRegion.IsInside(pixel))
+              {
+                ++numberOfSamples;
+                numberOfHoleSamples += mask->IsHole(pixel);
+              }
+            }
+          }
+          scanLine[x] = qRgba(0, 0, 0, numberOfSamples ? alpha * numberOfHoleSamples / numberOfSamples : 0);
+        }
+      }
+    });
+  }
+}
+
+QImage GetQImageColor(const ImageType* const image, const itk::ImageRegion<2>& region)
+{
+  const unsigned int width = region.GetSize()[0];
+  const unsigned int height = region.GetSize()[1];
+  QImage qimage(width, height, QImage::Format_RGB888);
+
+  const unsigned int numberOfComponents = image->GetNumberOfComponentsPerPixel();
+  const float* buffer = image->GetBufferPointer();
+
+  // Take the row pointers from the buffer directly; QImage::scanLine() may detach.
+  unsigned char* bits = qimage.bits();
+  const int bytesPerLine = qimage.bytesPerLine();
+
+  Parallel::ForBlocks(height, 64, [&](const unsigned int begin, const unsigned int end)
+  {
+    for(unsigned int row = begin; row < end; ++row)
+    {
+      itk::Index<2> rowStart = {{region.GetIndex()[0], region.GetIndex()[1] + static_cast<itk::IndexValueType>(row)}};
+      const float* pixel = buffer + image->ComputeOffset(rowStart) * numberOfComponents;
+      unsigned char* scanLine = bits + row * bytesPerLine;
+
+      switch(numberOfComponents)
+      {
+        case 1:
+          ConvertRow<1>(pixel, width, numberOfComponents, scanLine);
+          break;
+        case 3:
+          ConvertRow<3>(pixel, width, numberOfComponents, scanLine);
+          break;
+        case 4:
+          ConvertRow<4>(pixel, width, numberOfComponents, scanLine);
+          break;
+        default:
+          ConvertRow<0>(pixel, width, numberOfComponents, scanLine);
+      }
+    }
+  });
+
+  return qimage;
+}
+
+QImage GetQImageColor(const ImageType* const image)
+{
+  return GetQImageColor(image, image->GetBufferedRegion());
+}
+
+unsigned int ComputeProxyFactor(const itk::Size<2>& size, const QSize& screenSize)
+{
+  if(screenSize.isEmpty())
+  {
+    return 1;
+  }
+
+  const double reduction = std::max(static_cast<double>(size[0]) / screenSize.width(),
+                                    static_cast<double>(size[1]) / screenSize.height());
+  unsigned int factor = 1;
+  while(2 * factor <= reduction)
+  {
+    factor *= 2;
+  }
+  return factor;
+}
+
+QImage GetProxy(const ImageType* const image, const itk::ImageRegion<2>& region, const unsigned int factor,
+                const Mask* const mask)
+{
+  const int width = (region.GetSize()[0] + factor - 1) / factor;
+  const int height = (region.GetSize()[1] + factor - 1) / factor;
+  QImage proxy(width, height, mask ? QImage::Format_ARGB32 : QImage::Format_RGB32);
+
+  const unsigned int numberOfComponents = image->GetNumberOfComponentsPerPixel();
+  const float* buffer = image->GetBufferPointer();
+  const std::vector<unsigned int> offsets = GetSampleOffsets(factor);
+  unsigned char* bits = proxy.bits();
+  const int bytesPerLine = proxy.bytesPerLine();
+
+  Parallel::ForBlocks(height, 64, [&](const unsigned int begin, const unsigned int end)
+  {
+    for(unsigned int row = begin; row < end; ++row)
+    {
+      QRgb* scanLine = reinterpret_cast<QRgb*>(bits + row * bytesPerLine);
+      for(int x = 0; x < width; ++x)
+      {
+        float sum[3] = {0.0f, 0.0f, 0.0f};
+        unsigned int numberOfSamples = 0;
+        unsigned int numberOfUsedSamples = 0;
+        for(unsigned int sampleY = 0; sampleY < offsets.size(); ++sampleY)
+        {
+          for(unsigned int sampleX = 0; sampleX < offsets.size(); ++sampleX)
+          {
+            const itk::Index<2> pixel = {{region.GetIndex()[0] + static_cast<itk::IndexValueType>(x * factor + offsets[sampleX]),
+                                          region.GetIndex()[1] + static_cast<itk::IndexValueType>(row * factor + offsets[sampleY])}};
+            if(!region.IsInside(pixel))
+            {
+              continue;
+            }
+            ++numberOfSamples;
+            if(mask && !mask->IsHole(pixel))
+            {
+              continue;
+            }
+            ++numberOfUsedSamples;
+
+            const float* value = buffer + image->ComputeOffset(pixel) * numberOfComponents;
+            for(unsigned int channel = 0; channel < 3; ++channel)
+            {
+              sum[channel] += value[numberOfComponents >= 3 ? channel : 0];
+            }
+          }
+        }
+
+        const float weight = numberOfUsedSamples ? 1.0f / numberOfUsedSamples : 0.0f;
+        const int alpha = numberOfSamples ? 255 * numberOfUsedSamples / numberOfSamples : 0;
+        scanLine[x] = qRgba(ToByte(sum[0] * weight), ToByte(sum[1] * weight), ToByte(sum[2] * weight), alpha);
+      }
+    }
+  });
+
+  return proxy;
+}
+
+QImage GetMaskProxy(const Mask* const mask, const unsigned int factor, const unsigned char alpha)
+{
+  const itk::Size<2> size = mask->GetLargestPossibleRegion().GetSize();
+  QImage proxy((size[0] + factor - 1) / factor, (size[1] + factor - 1) / factor, QImage::Format_ARGB32);
+  RenderMaskProxy(proxy, mask, proxy.rect(), factor, alpha);
+  return proxy;
+}
+
+void UpdateMaskProxy(QImage& proxy, const Mask* const mask, const QRect& rect, const unsigned int factor,
+                     const unsigned char alpha)
+{
+  if(rect.isEmpty())
+  {
+    return;
+  }
+
+  const QRect proxyRect = QRect(QPoint(rect.left() / factor, rect.top() / factor),
+                                QPoint(rect.right() / factor, rect.bottom() / factor)) & proxy.rect();
+  RenderMaskProxy(proxy, mask, proxyRect, factor, alpha);
+}
+
+} // end namespace
@@ -0,0 +1,71 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+/** These functions convert (parts of) the float images used by the widgets
+  * into QImages for display. Unlike a whole-image conversion they work on a
+  * region, so images whose region does not start at (0,0) - like the result
+  * of a clone, which only covers the pasted region - can be displayed directly.
+  * Display proxies are reduced conversions for items that are only ever seen fit
+  * into a view: they scale with the screen instead of the image.
+  */
+
+#ifndef ImageDisplay_H
+#define ImageDisplay_H
+
+// ITK
+#include "itkVectorImage.h"
+
+// Submodules
+#include "Mask/Mask.h"
+
+// Qt
+#include <QImage>
+#include <QRect>
+#include <QSize>
+
+namespace ImageDisplay
+{
+  typedef itk::VectorImage<float, 2> ImageType;
+
+  /** Convert 'region' of 'image' to an RGB888 QImage whose (0,0) pixel is the corner of
+    * 'region'. The first three channels are used as RGB, a single channel as gray. */
+  QImage GetQImageColor(const ImageType* const image, const itk::ImageRegion<2>& region);
+
+  /** Convert the whole buffered region of 'image'. */
+  QImage GetQImageColor(const ImageType* const image);
+
+  /** The largest power of two an image of 'size' can be reduced by and still have as many
+    * pixels as it covers when it is fit into 'screenSize'. */
+  unsigned int ComputeProxyFactor(const itk::Size<2>& size, const QSize& screenSize);
+
+  /** Convert 'region' of 'image' reduced by 'factor'. A proxy pixel is the mean of up to 4x4
+    * samples of its block. If 'mask' (which must cover 'region') is given, the proxy is ARGB32
+    * and only hole samples count; the alpha is the fraction of hole samples. */
+  QImage GetProxy(const ImageType* const image, const itk::ImageRegion<2>& region, const unsigned int factor,
+                  const Mask* const mask = nullptr);
+
+  /** The hole pixels of 'mask' reduced by 'factor', as an ARGB32 overlay: black, with 'alpha'
+    * times the fraction of hole samples of the block. */
+  QImage GetMaskProxy(const Mask* const mask, const unsigned int factor, const unsigned char alpha);
+
+  /** Recompute the pixels of a mask proxy that cover 'rect' (in mask pixels) after painting. */
+  void UpdateMaskProxy(QImage& proxy, const Mask* const mask, const QRect& rect, const unsigned int factor,
+                       const unsigned char alpha);
+}
+
+#endif
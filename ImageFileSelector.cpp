@@ -24,12 +24,14 @@
 // Custom
 #include "ImageFileSelector.h"
 #include "FileSelectionWidget.h"
+#include "ImageInformation.h"
 
 // Qt
 #include <QPushButton>
 #include <QDialogButtonBox>
 #include <QFileSystemModel>
 #include <QHBoxLayout>
+#include <QLabel>
 #include <QWidget>
 
 // STL
@@ -60,6 +62,9 @@ ImageFileSelector::ImageFileSelector(const std::vector<std::string>& namedImages
   connect(this->ButtonBox->button(QDialogButtonBox::Ok), SIGNAL(clicked()), this, SLOT(slot_buttonBox_accepted()));
   connect(this->ButtonBox->button(QDialogButtonBox::Cancel), SIGNAL(clicked()), this, SLOT(slot_buttonBox_rejected()));
   
+  this->StatusLabel = new QLabel(this);
+  VLayout->addWidget(this->StatusLabel);
+
   VLayout->addWidget(this->ButtonBox);
 
   this->setLayout(VLayout);
@@ -74,16 +79,60 @@ void ImageFileSelector::Verify()
     allLoaded = allLoaded && this->Panels[i]->SelectionWidget->IsValid();
     }
 
-  if(allLoaded)
+  if(!allLoaded)
+    {
+    this->ButtonBox->button(QDialogButtonBox::Ok)->setEnabled(false);
+    return;
+    }
+
+  // Only the headers are read (and they are cached), so this does not hold up the dialog.
+  std::string problem = FindIncompatibility();
+  this->StatusLabel->setText(problem.c_str());
+  this->ButtonBox->button(QDialogButtonBox::Ok)->setEnabled(problem.empty());
+}
+
+std::string ImageFileSelector::FindIncompatibility()
+{
+  std::vector<ImageInformation::Information> information(this->NamedImages.size());
+  for(unsigned int i = 0; i < this->NamedImages.size(); ++i)
+    {
+    information[i] = ImageInformation::Get(this->Panels[i]->SelectionWidget->GetFileName());
+    if(!information[i].Valid)
+      {
+      return this->NamedImages[i] + " can't be read: " + information[i].Error;
+      }
+    }
+
+  // Masks must cover the first image, and all images must have the same number of channels.
+  int firstImage = -1;
+  for(unsigned int i = 0; i < this->NamedImages.size() && firstImage < 0; ++i)
     {
-     this->ButtonBox->button(QDialogButtonBox::Ok)->setEnabled(true);
-//     if(this->Image->GetLargestPossibleRegion() == this->ImageMask->GetLargestPossibleRegion())
-//       {
-//       //this->buttonBox->setEnabled(true);
-//       return;
-//       }
+    if(this->ExtensionFilters[i] != "mask")
+      {
+      firstImage = i;
+      }
     }
-  //this->buttonBox->setEnabled(false);
+  if(firstImage < 0)
+    {
+    return std::string();
+    }
+
+  for(unsigned int i = 0; i < this->NamedImages.size(); ++i)
+    {
+    if(this->ExtensionFilters[i] == "mask" && information[i].Size != information[firstImage].Size)
+      {
+      return this->NamedImages[i] + " (" + ImageInformation::ToString(information[i]) + ") does not have the size of " +
+             this->NamedImages[firstImage] + " (" + ImageInformation::ToString(information[firstImage]) + ").";
+      }
+    if(this->ExtensionFilters[i] != "mask" &&
+       information[i].NumberOfComponents != information[firstImage].NumberOfComponents)
+      {
+      return this->NamedImages[i] + " (" + ImageInformation::ToString(information[i]) + ") does not have the channels of " +
+             this->NamedImages[firstImage] + " (" + ImageInformation::ToString(information[firstImage]) + ").";
+      }
+    }
+
+  return std::string();
 }
 
 std::string ImageFileSelector::GetNamedImageFileName(const std::string& namedImage)
@@ -62,12 +62,18 @@ public slots:
   void slot_buttonBox_rejected();
   
 protected:
+  /** A message about the first selected files that don't fit together (a mask that does not
+    * have the size of the first image, or images with different numbers of channels), or an
+    * empty string. Decided from the file headers alone. */
+  std::string FindIncompatibility();
+
   std::vector<std::string> FileNames; // The results (the selected file names) are stored in this for later retrieval.
   std::vector<std::string> NamedImages; // The identifiers of the images to load
   std::vector<std::string> ExtensionFilters; // The filter for the file extension for each image
 
   std::vector<Panel*> Panels; // Can't store non-pointers because Qt doesn't allow it.
   QDialogButtonBox* ButtonBox;
+  QLabel* StatusLabel; // Says why the selected files can't be used together
 };
 
 #endif // ImageFileSelector_H
@@ -0,0 +1,131 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "ImageInformation.h"
+
+// Submodules
+#include "Helpers/Helpers.h"
+#include "Mask/Mask.h"
+
+// ITK
+#include "itkImageIOFactory.h"
+
+// Qt
+#include <QDateTime>
+#include <QFileInfo>
+
+// STL
+#include <map>
+#include <sstream>
+
+namespace ImageInformation
+{
+
+namespace
+{
+  /** A cached header, with the state of the file it was read from. */
+  struct CacheEntry
+  {
+    QDateTime LastModified;
+    qint64 FileSize;
+    Information Header;
+  };
+
+  /** The headers read so far, by the absolute path of the image file. Only used from the GUI thread. */
+  std::map<std::string, CacheEntry> Cache;
+}
+
+std::string GetImageFileName(const std::string& fileName)
+{
+  if(Helpers::GetFileExtension(fileName) != "mask")
+  {
+    return fileName;
+  }
+
+  QFileInfo fileInfo(fileName.c_str());
+  return fileInfo.absolutePath().toStdString() + "/" + Mask::GetFilenameFromMaskFile(fileName);
+}
+
+Information Read(const std::string& fileName)
+{
+  Information information;
+  const std::string imageFileName = GetImageFileName(fileName);
+
+  try
+  {
+    itk::ImageIOBase::Pointer imageIO =
+        itk::ImageIOFactory::CreateImageIO(imageFileName.c_str(), itk::ImageIOFactory::ReadMode);
+    if(!imageIO)
+    {
+      information.Error = "unknown file format";
+      return information;
+    }
+
+    imageIO->SetFileName(imageFileName);
+    imageIO->ReadImageInformation();
+
+    if(imageIO->GetNumberOfDimensions() < 2)
+    {
+      information.Error = "not a 2D image";
+      return information;
+    }
+
+    information.Size[0] = imageIO->GetDimensions(0);
+    information.Size[1] = imageIO->GetDimensions(1);
+    information.NumberOfComponents = imageIO->GetNumberOfComponents();
+    information.ComponentType = imageIO->GetComponentTypeAsString(imageIO->GetComponentType());
+    information.Valid = true;
+  }
+  catch(const std::exception& exception)
+  {
+    information.Error = exception.what();
+  }
+
+  return information;
+}
+
+Information Get(const std::string& fileName)
+{
+  const std::string imageFileName = GetImageFileName(fileName);
+  QFileInfo fileInfo(imageFileName.c_str());
+  const std::string key = fileInfo.absoluteFilePath().toStdString();
+
+  auto cacheIterator = Cache.find(key);
+  if(cacheIterator != Cache.end() && cacheIterator->second.LastModified == fileInfo.lastModified() &&
+     cacheIterator->second.FileSize == fileInfo.size())
+  {
+    return cacheIterator->second.Header;
+  }
+
+  CacheEntry entry;
+  entry.LastModified = fileInfo.lastModified();
+  entry.FileSize = fileInfo.size();
+  entry.Header = Read(imageFileName);
+  Cache[key] = entry;
+  return entry.Header;
+}
+
+std::string ToString(const Information& information)
+{
+  std::stringstream description;
+  description << information.Size[0] << "x" << information.Size[1] << ", "
+              << information.NumberOfComponents << " x " << information.ComponentType;
+  return description.str();
+}
+
+} // end namespace
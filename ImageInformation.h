@@ -0,0 +1,59 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+/** These functions read the size and pixel type of an image file from its header, without
+  * decoding any pixels, and remember them until the file changes. The file dialogs use
+  * them to check that the selected images fit together before anything is loaded.
+  */
+
+#ifndef ImageInformation_H
+#define ImageInformation_H
+
+// ITK
+#include "itkSize.h"
+
+// STL
+#include <string>
+
+namespace ImageInformation
+{
+  struct Information
+  {
+    /** False if the header could not be read; Error says why. */
+    bool Valid = false;
+    std::string Error;
+
+    itk::Size<2> Size = {{0, 0}};
+    unsigned int NumberOfComponents = 0;
+    std::string ComponentType;
+  };
+
+  /** The image a .mask file refers to, or 'fileName' itself for any other file. */
+  std::string GetImageFileName(const std::string& fileName);
+
+  /** Read the header of 'fileName' (of the image it refers to, for a .mask file). */
+  Information Read(const std::string& fileName);
+
+  /** Like Read(), but a file that has not been modified since it was last read is not read again. */
+  Information Get(const std::string& fileName);
+
+  /** A description like "640x480, 3 x float". */
+  std::string ToString(const Information& information);
+}
+
+#endif
@@ -0,0 +1,160 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "IncrementalPoissonFill.h"
+
+// Custom
+#include "MaskedPoissonSolver.h"
+
+// STL
+#include <algorithm>
+#include <stdexcept>
+
+namespace IncrementalPoissonFill
+{
+
+MaskDifference ComputeMaskDifference(const Mask* const oldMask, const Mask* const newMask)
+{
+  return ComputeMaskDifference(oldMask, newMask, newMask->GetLargestPossibleRegion());
+}
+
+MaskDifference ComputeMaskDifference(const Mask* const oldMask, const Mask* const newMask,
+                                     const itk::ImageRegion<2>& region)
+{
+  if(oldMask->GetLargestPossibleRegion() != newMask->GetLargestPossibleRegion())
+  {
+    throw std::runtime_error("ComputeMaskDifference: the masks must be the same size!");
+  }
+
+  itk::ImageRegion<2> comparedRegion = region;
+  if(!comparedRegion.Crop(newMask->GetLargestPossibleRegion()))
+  {
+    return MaskDifference();
+  }
+  return ComputeMaskDifference(PackedMask::FromMask(oldMask, comparedRegion),
+                               PackedMask::FromMask(newMask, comparedRegion));
+}
+
+MaskDifference ComputeMaskDifference(const PackedMask& oldMask, const Mask* const newMask)
+{
+  return ComputeMaskDifference(oldMask, newMask, newMask->GetLargestPossibleRegion());
+}
+
+MaskDifference ComputeMaskDifference(const PackedMask& oldMask, const Mask* const newMask,
+                                     const itk::ImageRegion<2>& region)
+{
+  if(oldMask.GetRegion() != newMask->GetLargestPossibleRegion())
+  {
+    throw std::runtime_error("ComputeMaskDifference: the masks must be the same size!");
+  }
+
+  itk::ImageRegion<2> comparedRegion = region;
+  if(!comparedRegion.Crop(newMask->GetLargestPossibleRegion()))
+  {
+    return MaskDifference();
+  }
+  return ComputeMaskDifference(oldMask.Extract(comparedRegion), PackedMask::FromMask(newMask, comparedRegion));
+}
+
+MaskDifference ComputeMaskDifference(const PackedMask& oldMask, const PackedMask& newMask)
+{
+  MaskDifference difference;
+  difference.NumberOfHolePixels = newMask.CountHolePixels();
+
+  // Compare 64 pixels at a time; only the changed pixels are visited one by one.
+  const PackedMask changed = newMask.Xor(oldMask);
+  difference.ChangedPixels.reserve(changed.CountHolePixels());
+  changed.ForEachHoleSpan(changed.GetRegion(), [&](const itk::Index<2>& start, const unsigned int length)
+  {
+    itk::Index<2> pixel = start;
+    for(unsigned int column = 0; column < length; ++column, ++pixel[0])
+    {
+      difference.ChangedPixels.push_back(pixel);
+    }
+  });
+
+  if(!difference.ChangedPixels.empty())
+  {
+    difference.BoundingRegion = changed.GetHoleBoundingBox();
+  }
+
+  return difference;
+}
+
+bool IsSmallEdit(const MaskDifference& difference, const float maximumChangedFraction)
+{
+  if(difference.ChangedPixels.empty() || difference.NumberOfHolePixels == 0)
+  {
+    return false;
+  }
+
+  // The window that is actually re-solved is about 9 times the bounding box of the edit.
+  float windowPixels = 9.0f * difference.BoundingRegion.GetNumberOfPixels();
+  return windowPixels < maximumChangedFraction * difference.NumberOfHolePixels;
+}
+
+itk::ImageRegion<2> ComputeWindow(const MaskDifference& difference,
+                                  const itk::ImageRegion<2>& imageRegion,
+                                  const unsigned int minimumPadding)
+{
+  // The correction caused by an edit decays away from it, so re-solving a neighborhood
+  // comparable in size to the edit itself captures nearly all of the change.
+  const itk::Size<2> editSize = difference.BoundingRegion.GetSize();
+  unsigned int padding = std::max<unsigned int>(minimumPadding, std::max(editSize[0], editSize[1]));
+
+  itk::ImageRegion<2> window = difference.BoundingRegion;
+  window.PadByRadius(padding);
+  window.Crop(imageRegion);
+  return window;
+}
+
+void FillWindow(const ImageType* const image, const Mask* const mask,
+                const itk::ImageRegion<2>& window, ImageType* const result)
+{
+  itk::Offset<2> zeroOffset = {{0, 0}};
+  PoissonDomain domain = PoissonDomain::Create(mask, window, zeroOffset,
+                                               image->GetLargestPossibleRegion());
+
+  MaskedPoissonSolver solver;
+  solver.SetDomain(domain);
+  solver.Solve(result, MaskedPoissonSolver::GuidanceTermsType(), result);
+}
+
+void UpdateFill(const ImageType* const image, const MaskDifference& difference,
+                const Mask* const newMask, ImageType* const result)
+{
+  if(difference.ChangedPixels.empty())
+  {
+    return;
+  }
+
+  // Pixels that are no longer in the hole get their original value back.
+  for(unsigned int pixelId = 0; pixelId < difference.ChangedPixels.size(); ++pixelId)
+  {
+    const itk::Index<2>& index = difference.ChangedPixels[pixelId];
+    if(!newMask->IsHole(index))
+    {
+      result->SetPixel(index, image->GetPixel(index));
+    }
+  }
+
+  itk::ImageRegion<2> window = ComputeWindow(difference, image->GetLargestPossibleRegion());
+  FillWindow(image, newMask, window, result);
+}
+
+} // end namespace
@@ -0,0 +1,91 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+/** These functions update a previous hole filling result after a small edit of the
+  * mask. Only the pixels near the edit are re-solved; the previous result is used as
+  * the (fixed) boundary of the local problem, so the cost is proportional to the size
+  * of the edit rather than to the size of the hole.
+  */
+
+#ifndef IncrementalPoissonFill_H
+#define IncrementalPoissonFill_H
+
+// ITK
+#include "itkVectorImage.h"
+
+// Custom
+#include "PackedMask.h"
+
+// Submodules
+#include "Mask/Mask.h"
+
+// STL
+#include <vector>
+
+namespace IncrementalPoissonFill
+{
+  typedef itk::VectorImage<float, 2> ImageType;
+
+  /** The pixels whose hole/valid status differs between two masks. */
+  struct MaskDifference
+  {
+    std::vector<itk::Index<2> > ChangedPixels;
+    itk::ImageRegion<2> BoundingRegion;
+    unsigned int NumberOfHolePixels = 0; // in the compared region of the new mask
+  };
+
+  MaskDifference ComputeMaskDifference(const Mask* const oldMask, const Mask* const newMask);
+
+  /** Only compare the masks inside 'region', for callers that know where the edit happened. */
+  MaskDifference ComputeMaskDifference(const Mask* const oldMask, const Mask* const newMask,
+                                       const itk::ImageRegion<2>& region);
+
+  /** Compare against a packed previous mask, which must cover the whole new mask. */
+  MaskDifference ComputeMaskDifference(const PackedMask& oldMask, const Mask* const newMask);
+  MaskDifference ComputeMaskDifference(const PackedMask& oldMask, const Mask* const newMask,
+                                       const itk::ImageRegion<2>& region);
+
+  /** Compare two packed masks of the same region. */
+  MaskDifference ComputeMaskDifference(const PackedMask& oldMask, const PackedMask& newMask);
+
+  /** Decide if an incremental update is worth it. Large edits are better served by a full solve.
+    * An empty difference is not an edit, so it is never small. */
+  bool IsSmallEdit(const MaskDifference& difference, const float maximumChangedFraction = 0.25f);
+
+  /** The window that is re-solved: the bounding box of the edit, grown by the larger of its
+    * extents (and at least 'minimumPadding' pixels) on every side. */
+  itk::ImageRegion<2> ComputeWindow(const MaskDifference& difference,
+                                    const itk::ImageRegion<2>& imageRegion,
+                                    const unsigned int minimumPadding = 8);
+
+  /** Update 'result', which must hold the fill of 'image' for the mask 'difference' was
+    * computed against, so that it holds the fill for 'newMask'. Pixels that became valid
+    * are copied from 'image', and the hole pixels of 'newMask' inside the window are
+    * re-solved with a zero guidance field.
+    * The result is an approximation of the full fill: the previous values of the hole pixels
+    * just outside of the window are kept fixed as if they were boundary pixels, so a large
+    * correction can leave a faint seam at the window edge. Use a full solve for an exact fill. */
+  void UpdateFill(const ImageType* const image, const MaskDifference& difference,
+                  const Mask* const newMask, ImageType* const result);
+
+  /** Re-solve the hole pixels of 'mask' inside 'window' only, keeping 'result' fixed elsewhere. */
+  void FillWindow(const ImageType* const image, const Mask* const mask,
+                  const itk::ImageRegion<2>& window, ImageType* const result);
+}
+
+#endif
@@ -0,0 +1,166 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "MaskBrush.h"
+
+// Custom
+#include "ImageDisplay.h"
+
+// Qt
+#include <QEvent>
+#include <QGraphicsPixmapItem>
+#include <QGraphicsView>
+#include <QMouseEvent>
+#include <QPainter>
+
+// STL
+#include <cmath>
+
+MaskBrush::MaskBrush(QGraphicsView* const view, QObject* const parent) : QObject(parent), View(view)
+{
+  this->View->viewport()->installEventFilter(this);
+}
+
+void MaskBrush::SetMask(Mask* const mask, QGraphicsPixmapItem* const maskPixmapItem,
+                        const unsigned char alpha, const unsigned int factor)
+{
+  this->MaskImage = mask;
+  this->MaskPixmapItem = maskPixmapItem;
+  this->Alpha = alpha;
+  this->Factor = factor;
+  this->Overlay = ImageDisplay::GetMaskProxy(mask, factor, alpha);
+
+  this->MaskPixmapItem->setPixmap(QPixmap::fromImage(this->Overlay));
+  this->MaskPixmapItem->setScale(factor);
+}
+
+void MaskBrush::SetRadius(const unsigned int radius)
+{
+  this->Radius = radius;
+}
+
+void MaskBrush::SetEnabled(const bool enabled)
+{
+  this->Enabled = enabled;
+  this->Painting = false;
+  this->View->setCursor(enabled ? Qt::CrossCursor : Qt::ArrowCursor);
+}
+
+bool MaskBrush::IsEnabled() const
+{
+  return this->Enabled;
+}
+
+bool MaskBrush::eventFilter(QObject* object, QEvent* event)
+{
+  if(!this->Enabled || !this->MaskImage || !this->MaskPixmapItem)
+  {
+    return QObject::eventFilter(object, event);
+  }
+
+  if(event->type() != QEvent::MouseButtonPress && event->type() != QEvent::MouseMove &&
+     event->type() != QEvent::MouseButtonRelease)
+  {
+    return QObject::eventFilter(object, event);
+  }
+
+  QMouseEvent* mouseEvent = static_cast<QMouseEvent*>(event);
+  QPointF position = this->View->mapToScene(mouseEvent->pos());
+
+  if(event->type() == QEvent::MouseButtonPress)
+  {
+    this->Painting = true;
+    this->PaintingHole = (mouseEvent->button() != Qt::RightButton);
+    this->LastPosition = position;
+  }
+  else if(event->type() == QEvent::MouseButtonRelease)
+  {
+    this->Painting = false;
+    return true;
+  }
+  else if(!this->Painting)
+  {
+    return true;
+  }
+
+  QRect dirtyRect = PaintSegment(this->LastPosition, position, this->PaintingHole);
+  this->LastPosition = position;
+
+  if(!dirtyRect.isEmpty())
+  {
+    ImageDisplay::UpdateMaskProxy(this->Overlay, this->MaskImage, dirtyRect, this->Factor, this->Alpha);
+    this->MaskPixmapItem->setPixmap(QPixmap::fromImage(this->Overlay));
+    emit maskPainted(dirtyRect);
+  }
+
+  return true;
+}
+
+QRect MaskBrush::PaintSegment(const QPointF& start, const QPointF& end, const bool hole)
+{
+  // Stamp discs closely enough that fast mouse movements still produce a continuous stroke.
+  QPointF delta = end - start;
+  float length = std::sqrt(delta.x() * delta.x() + delta.y() * delta.y());
+  float spacing = std::max(1.0f, this->Radius / 2.0f);
+  unsigned int numberOfSteps = static_cast<unsigned int>(length / spacing) + 1;
+
+  QRect dirtyRect;
+  for(unsigned int step = 0; step <= numberOfSteps; ++step)
+  {
+    QPointF center = start + delta * (static_cast<float>(step) / numberOfSteps);
+    dirtyRect |= PaintDisc(center, hole);
+  }
+  return dirtyRect;
+}
+
+QRect MaskBrush::PaintDisc(const QPointF& center, const bool hole)
+{
+  const int radius = this->Radius;
+  QRect discRect(std::floor(center.x()) - radius, std::floor(center.y()) - radius,
+                 2 * radius + 1, 2 * radius + 1);
+
+  itk::ImageRegion<2> maskRegion = this->MaskImage->GetLargestPossibleRegion();
+  QRect maskRect(maskRegion.GetIndex()[0], maskRegion.GetIndex()[1],
+                 maskRegion.GetSize()[0], maskRegion.GetSize()[1]);
+  discRect &= maskRect;
+
+  const unsigned char value = hole ? this->MaskImage->GetHoleValue() : this->MaskImage->GetValidValue();
+
+  QRect changedRect;
+  for(int y = discRect.top(); y <= discRect.bottom(); ++y)
+  {
+    for(int x = discRect.left(); x <= discRect.right(); ++x)
+    {
+      float dx = x + 0.5f - center.x();
+      float dy = y + 0.5f - center.y();
+      if(dx * dx + dy * dy > radius * radius)
+      {
+        continue;
+      }
+
+      itk::Index<2> index = {{x, y}};
+      if(this->MaskImage->GetPixel(index) != value)
+      {
+        this->MaskImage->SetPixel(index, value);
+        changedRect |= QRect(x, y, 1, 1);
+      }
+    }
+  }
+
+  return changedRect;
+}
@@ -0,0 +1,87 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+/** This class lets the user paint a Mask with the mouse in a QGraphicsView.
+  * Dragging with the left button adds to the hole, dragging with the right button
+  * erases it. The mask overlay pixmap is updated as the stroke is drawn, and
+  * maskPainted() is emitted with the pixels that changed. The overlay is a proxy
+  * of the mask reduced by the display factor, so painting on a large mask only
+  * updates and uploads a screen-sized image.
+  */
+
+#ifndef MaskBrush_H
+#define MaskBrush_H
+
+// Submodules
+#include "Mask/Mask.h"
+
+// Qt
+#include <QImage>
+#include <QObject>
+#include <QPointF>
+#include <QRect>
+class QGraphicsPixmapItem;
+class QGraphicsView;
+
+class MaskBrush : public QObject
+{
+  Q_OBJECT
+public:
+  MaskBrush(QGraphicsView* const view, QObject* const parent = 0);
+
+  /** Set the mask to paint into and the item that displays it, reduced by 'factor'.
+    * The item is scaled back up, so scene coordinates stay mask pixels. */
+  void SetMask(Mask* const mask, QGraphicsPixmapItem* const maskPixmapItem,
+               const unsigned char alpha, const unsigned int factor = 1);
+
+  void SetRadius(const unsigned int radius);
+
+  void SetEnabled(const bool enabled);
+  bool IsEnabled() const;
+
+signals:
+  void maskPainted(const QRect& dirtyRect);
+
+protected:
+  bool eventFilter(QObject* object, QEvent* event);
+
+  /** Paint a line of discs from 'start' to 'end' and return the pixels they cover. */
+  QRect PaintSegment(const QPointF& start, const QPointF& end, const bool hole);
+
+  /** Paint a single disc and return the pixels it covers. */
+  QRect PaintDisc(const QPointF& center, const bool hole);
+
+  QGraphicsView* View;
+
+  Mask* MaskImage = nullptr;
+  QGraphicsPixmapItem* MaskPixmapItem = nullptr;
+
+  /** The displayed mask proxy, kept so that only the painted pixels have to be updated. */
+  QImage Overlay;
+  unsigned char Alpha = 122;
+  unsigned int Factor = 1;
+
+  unsigned int Radius = 10;
+  bool Enabled = false;
+
+  bool Painting = false;
+  bool PaintingHole = true;
+  QPointF LastPosition;
+};
+
+#endif
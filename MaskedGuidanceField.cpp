@@ -0,0 +1,327 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "MaskedGuidanceField.h"
+
+// Custom
+#include "Parallel.h"
+
+// STL
+#include <algorithm>
+
+namespace
+{
+  const itk::Offset<2> NeighborOffsets[4] = {{{-1, 0}}, {{1, 0}}, {{0, -1}}, {{0, 1}}};
+  const itk::Offset<2> ForwardOffsets[2] = {{{1, 0}}, {{0, 1}}};
+
+  /** Every unknown only writes its own terms, so blocks of unknowns are computed in parallel. */
+  const unsigned int UnknownsPerBlock = 16384;
+
+  /** The squared norm of the forward difference gradient of 'component' at 'pixel' of 'image'.
+    * Differences that leave 'region' are zero. */
+  float ComputeSquaredGradientNorm(const MaskedGuidanceField::ImageType* const image,
+                                   const itk::ImageRegion<2>& region, const itk::Index<2>& pixel,
+                                   const unsigned int numberOfComponents, const unsigned int component)
+  {
+    if(!region.IsInside(pixel))
+    {
+      return 0.0f;
+    }
+
+    const float* buffer = image->GetBufferPointer();
+    const float value = buffer[image->ComputeOffset(pixel) * numberOfComponents + component];
+    float squaredNorm = 0.0f;
+    for(unsigned int dimension = 0; dimension < 2; ++dimension)
+    {
+      const itk::Index<2> neighborPixel = pixel + ForwardOffsets[dimension];
+      if(region.IsInside(neighborPixel))
+      {
+        const float difference = buffer[image->ComputeOffset(neighborPixel) * numberOfComponents + component] - value;
+        squaredNorm += difference * difference;
+      }
+    }
+    return squaredNorm;
+  }
+
+  /** Accumulate the guidance term of every unknown. If 'target' is null the source
+    * gradient is used, otherwise the source or the target gradient, whichever has the
+    * larger norm at the pixel the edge belongs to (the edge to the right and the edge
+    * below a pixel are its forward differences).
+    * The number of channels is TNumberOfComponents, or read from 'source' if it is 0. */
+  template <unsigned int TNumberOfComponents>
+  MaskedPoissonSolver::GuidanceTermsType ComputeTerms(const PoissonDomain& domain,
+                                                      const MaskedGuidanceField::ImageType* const source,
+                                                      const itk::Offset<2>& sourceToImage,
+                                                      const MaskedGuidanceField::ImageType* const target)
+  {
+    const unsigned int numberOfUnknowns = domain.GetNumberOfUnknowns();
+    const unsigned int numberOfComponents = TNumberOfComponents ? TNumberOfComponents :
+                                            source->GetNumberOfComponentsPerPixel();
+    const itk::ImageRegion<2> sourceRegion = source->GetLargestPossibleRegion();
+    const float* sourceBuffer = source->GetBufferPointer();
+    const float* targetBuffer = target ? target->GetBufferPointer() : nullptr;
+    itk::ImageRegion<2> targetRegion = domain.ImageRegion;
+    if(target)
+    {
+      targetRegion.Crop(target->GetBufferedRegion());
+    }
+
+    MaskedPoissonSolver::GuidanceTermsType terms(numberOfComponents,
+                                                 std::vector<float>(numberOfUnknowns, 0.0f));
+
+    Parallel::ForBlocks(numberOfUnknowns, UnknownsPerBlock, [&](const unsigned int begin, const unsigned int end)
+    {
+      for(unsigned int unknown = begin; unknown < end; ++unknown)
+      {
+        const itk::Index<2>& pixel = domain.Pixels[unknown];
+        const itk::Index<2> sourcePixel = pixel - sourceToImage;
+        const float* sourceValue = sourceBuffer + source->ComputeOffset(sourcePixel) * numberOfComponents;
+        const float* targetValue = targetBuffer ?
+              targetBuffer + target->ComputeOffset(pixel) * numberOfComponents : nullptr;
+
+        for(unsigned int neighbor = 0; neighbor < 4; ++neighbor)
+        {
+          const itk::Index<2> neighborPixel = pixel + NeighborOffsets[neighbor];
+          const itk::Index<2> sourceNeighborPixel = sourcePixel + NeighborOffsets[neighbor];
+          if(!domain.ImageRegion.IsInside(neighborPixel) || !sourceRegion.IsInside(sourceNeighborPixel))
+          {
+            continue;
+          }
+
+          const float* sourceNeighborValue = sourceBuffer +
+                                             source->ComputeOffset(sourceNeighborPixel) * numberOfComponents;
+          const float* targetNeighborValue = targetBuffer ?
+                targetBuffer + target->ComputeOffset(neighborPixel) * numberOfComponents : nullptr;
+
+          // The edges to the left and above belong to the neighbor's gradient.
+          const bool forward = (neighbor % 2 == 1);
+          const itk::Index<2> ownerPixel = forward ? pixel : neighborPixel;
+          const itk::Index<2> sourceOwnerPixel = forward ? sourcePixel : sourceNeighborPixel;
+
+          for(unsigned int component = 0; component < numberOfComponents; ++component)
+          {
+            float difference = sourceValue[component] - sourceNeighborValue[component];
+            if(targetBuffer &&
+               ComputeSquaredGradientNorm(target, targetRegion, ownerPixel, numberOfComponents, component) >
+               ComputeSquaredGradientNorm(source, sourceRegion, sourceOwnerPixel, numberOfComponents, component))
+            {
+              difference = targetValue[component] - targetNeighborValue[component];
+            }
+            terms[component][unknown] += difference;
+          }
+        }
+      }
+    });
+
+    return terms;
+  }
+
+  /** Gray, RGB and RGBA images get loops over a constant number of channels. */
+  MaskedPoissonSolver::GuidanceTermsType ComputeTerms(const PoissonDomain& domain,
+                                                      const MaskedGuidanceField::ImageType* const source,
+                                                      const itk::Offset<2>& sourceToImage,
+                                                      const MaskedGuidanceField::ImageType* const target)
+  {
+    switch(source->GetNumberOfComponentsPerPixel())
+    {
+      case 1:
+        return ComputeTerms<1>(domain, source, sourceToImage, target);
+      case 3:
+        return ComputeTerms<3>(domain, source, sourceToImage, target);
+      case 4:
+        return ComputeTerms<4>(domain, source, sourceToImage, target);
+      default:
+        return ComputeTerms<0>(domain, source, sourceToImage, target);
+    }
+  }
+
+  /** The image of MaskedGuidanceField::ComputeSourceDivergence().
+    * The number of channels is TNumberOfComponents, or read from 'source' if it is 0. */
+  template <unsigned int TNumberOfComponents>
+  MaskedGuidanceField::ImageType::Pointer ComputeDivergence(const MaskedGuidanceField::ImageType* const source,
+                                                            const itk::ImageRegion<2>& region)
+  {
+    const unsigned int numberOfComponents = TNumberOfComponents ? TNumberOfComponents :
+                                            source->GetNumberOfComponentsPerPixel();
+    const itk::ImageRegion<2> sourceRegion = source->GetLargestPossibleRegion();
+    const float* sourceBuffer = source->GetBufferPointer();
+
+    MaskedGuidanceField::ImageType::Pointer divergence = MaskedGuidanceField::ImageType::New();
+    divergence->SetNumberOfComponentsPerPixel(numberOfComponents);
+    divergence->SetRegions(region);
+    divergence->Allocate();
+    float* divergenceBuffer = divergence->GetBufferPointer();
+
+    const unsigned int width = region.GetSize()[0];
+    const unsigned int rowsPerBlock = std::max(1u, UnknownsPerBlock / std::max(1u, width));
+    Parallel::ForBlocks(region.GetSize()[1], rowsPerBlock, [&](const unsigned int begin, const unsigned int end)
+    {
+      for(unsigned int row = begin; row < end; ++row)
+      {
+        for(unsigned int column = 0; column < width; ++column)
+        {
+          const itk::Index<2> pixel = {{region.GetIndex()[0] + static_cast<itk::IndexValueType>(column),
+                                        region.GetIndex()[1] + static_cast<itk::IndexValueType>(row)}};
+          const float* value = sourceBuffer + source->ComputeOffset(pixel) * numberOfComponents;
+          float* term = divergenceBuffer + (static_cast<std::size_t>(row) * width + column) * numberOfComponents;
+          std::fill(term, term + numberOfComponents, 0.0f);
+
+          for(unsigned int neighbor = 0; neighbor < 4; ++neighbor)
+          {
+            const itk::Index<2> neighborPixel = pixel + NeighborOffsets[neighbor];
+            if(!sourceRegion.IsInside(neighborPixel))
+            {
+              continue;
+            }
+
+            const float* neighborValue = sourceBuffer + source->ComputeOffset(neighborPixel) * numberOfComponents;
+            for(unsigned int component = 0; component < numberOfComponents; ++component)
+            {
+              term[component] += value[component] - neighborValue[component];
+            }
+          }
+        }
+      }
+    });
+
+    return divergence;
+  }
+
+  MaskedGuidanceField::ImageType::Pointer ComputeDivergence(const MaskedGuidanceField::ImageType* const source,
+                                                            const itk::ImageRegion<2>& region)
+  {
+    switch(source->GetNumberOfComponentsPerPixel())
+    {
+      case 1:
+        return ComputeDivergence<1>(source, region);
+      case 3:
+        return ComputeDivergence<3>(source, region);
+      case 4:
+        return ComputeDivergence<4>(source, region);
+      default:
+        return ComputeDivergence<0>(source, region);
+    }
+  }
+
+  /** The guidance terms of MaskedGuidanceField::FromSourceDivergence().
+    * The number of channels is TNumberOfComponents, or read from 'source' if it is 0. */
+  template <unsigned int TNumberOfComponents>
+  MaskedPoissonSolver::GuidanceTermsType ComputeDivergenceTerms(const PoissonDomain& domain,
+                                                                const MaskedGuidanceField::ImageType* const source,
+                                                                const itk::Offset<2>& sourceToImage,
+                                                                const MaskedGuidanceField::ImageType* const divergence)
+  {
+    const unsigned int numberOfUnknowns = domain.GetNumberOfUnknowns();
+    const unsigned int numberOfComponents = TNumberOfComponents ? TNumberOfComponents :
+                                            source->GetNumberOfComponentsPerPixel();
+    const itk::ImageRegion<2> sourceRegion = source->GetLargestPossibleRegion();
+    const float* sourceBuffer = source->GetBufferPointer();
+    const float* divergenceBuffer = divergence->GetBufferPointer();
+
+    MaskedPoissonSolver::GuidanceTermsType terms(numberOfComponents,
+                                                 std::vector<float>(numberOfUnknowns, 0.0f));
+
+    Parallel::ForBlocks(numberOfUnknowns, UnknownsPerBlock, [&](const unsigned int begin, const unsigned int end)
+    {
+      for(unsigned int unknown = begin; unknown < end; ++unknown)
+      {
+        const itk::Index<2>& pixel = domain.Pixels[unknown];
+        const itk::Index<2> sourcePixel = pixel - sourceToImage;
+        const float* term = divergenceBuffer + divergence->ComputeOffset(sourcePixel) * numberOfComponents;
+        for(unsigned int component = 0; component < numberOfComponents; ++component)
+        {
+          terms[component][unknown] = term[component];
+        }
+
+        // Take out the edges that the placement moved off of the image.
+        for(unsigned int neighbor = 0; neighbor < 4; ++neighbor)
+        {
+          const itk::Index<2> sourceNeighborPixel = sourcePixel + NeighborOffsets[neighbor];
+          if(domain.ImageRegion.IsInside(pixel + NeighborOffsets[neighbor]) ||
+             !sourceRegion.IsInside(sourceNeighborPixel))
+          {
+            continue;
+          }
+
+          const float* sourceValue = sourceBuffer + source->ComputeOffset(sourcePixel) * numberOfComponents;
+          const float* sourceNeighborValue = sourceBuffer +
+                                             source->ComputeOffset(sourceNeighborPixel) * numberOfComponents;
+          for(unsigned int component = 0; component < numberOfComponents; ++component)
+          {
+            terms[component][unknown] -= sourceValue[component] - sourceNeighborValue[component];
+          }
+        }
+      }
+    });
+
+    return terms;
+  }
+
+  MaskedPoissonSolver::GuidanceTermsType ComputeDivergenceTerms(const PoissonDomain& domain,
+                                                                const MaskedGuidanceField::ImageType* const source,
+                                                                const itk::Offset<2>& sourceToImage,
+                                                                const MaskedGuidanceField::ImageType* const divergence)
+  {
+    switch(source->GetNumberOfComponentsPerPixel())
+    {
+      case 1:
+        return ComputeDivergenceTerms<1>(domain, source, sourceToImage, divergence);
+      case 3:
+        return ComputeDivergenceTerms<3>(domain, source, sourceToImage, divergence);
+      case 4:
+        return ComputeDivergenceTerms<4>(domain, source, sourceToImage, divergence);
+      default:
+        return ComputeDivergenceTerms<0>(domain, source, sourceToImage, divergence);
+    }
+  }
+}
+
+MaskedGuidanceField MaskedGuidanceField::FromSource(const PoissonDomain& domain,
+                                                    const ImageType* const source,
+                                                    const itk::Offset<2>& sourceToImage)
+{
+  MaskedGuidanceField field;
+  field.Terms = ComputeTerms(domain, source, sourceToImage, nullptr);
+  return field;
+}
+
+MaskedGuidanceField MaskedGuidanceField::Mixed(const PoissonDomain& domain,
+                                               const ImageType* const source,
+                                               const itk::Offset<2>& sourceToImage,
+                                               const ImageType* const target)
+{
+  MaskedGuidanceField field;
+  field.Terms = ComputeTerms(domain, source, sourceToImage, target);
+  return field;
+}
+
+MaskedGuidanceField::ImageType::Pointer MaskedGuidanceField::ComputeSourceDivergence(const ImageType* const source,
+                                                                                     const itk::ImageRegion<2>& region)
+{
+  return ComputeDivergence(source, region);
+}
+
+MaskedGuidanceField MaskedGuidanceField::FromSourceDivergence(const PoissonDomain& domain,
+                                                              const ImageType* const source,
+                                                              const itk::Offset<2>& sourceToImage,
+                                                              const ImageType* const divergence)
+{
+  MaskedGuidanceField field;
+  field.Terms = ComputeDivergenceTerms(domain, source, sourceToImage, divergence);
+  return field;
+}
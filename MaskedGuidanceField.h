@@ -0,0 +1,83 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+/** This class stores a guidance field only where a Poisson problem uses it.
+  * Instead of a dense gradient image per channel, it keeps the divergence term
+  * of each unknown of a PoissonDomain: the sum over the neighbors q of p of
+  * v_pq (Perez et al. 2003, eq. 7). The terms are packed per channel in the
+  * order of the unknowns, which is the layout MaskedPoissonSolver consumes.
+  */
+
+#ifndef MaskedGuidanceField_H
+#define MaskedGuidanceField_H
+
+// Custom
+#include "MaskedPoissonSolver.h"
+
+// ITK
+#include "itkVectorImage.h"
+
+// STL
+#include <vector>
+
+class MaskedGuidanceField
+{
+public:
+  typedef itk::VectorImage<float, 2> ImageType;
+
+  /** v_pq = g_p - g_q, the gradient of 'source'. 'sourceToImage' translates source
+    * coordinates into the coordinates of the domain. Edges that leave the source image
+    * get no guidance. */
+  static MaskedGuidanceField FromSource(const PoissonDomain& domain, const ImageType* const source,
+                                        const itk::Offset<2>& sourceToImage);
+
+  /** v_pq is the target gradient f*_p - f*_q where the target gradient has the larger norm
+    * (per pixel and channel), and the source gradient elsewhere, so that strong structures of
+    * the target show through the clone. */
+  static MaskedGuidanceField Mixed(const PoissonDomain& domain, const ImageType* const source,
+                                   const itk::Offset<2>& sourceToImage, const ImageType* const target);
+
+  /** The FromSource term of every pixel of 'region' of 'source' (in source coordinates) as if
+    * the source was placed where none of its edges leave the image. It doesn't depend on the
+    * placement, so it is computed once per source and shifted to wherever the source is placed. */
+  static ImageType::Pointer ComputeSourceDivergence(const ImageType* const source,
+                                                    const itk::ImageRegion<2>& region);
+
+  /** The same terms as FromSource, read from a 'divergence' of ComputeSourceDivergence that covers
+    * the unknowns. Only the edges that leave the domain's image region are recomputed. */
+  static MaskedGuidanceField FromSourceDivergence(const PoissonDomain& domain, const ImageType* const source,
+                                                  const itk::Offset<2>& sourceToImage,
+                                                  const ImageType* const divergence);
+
+  unsigned int GetNumberOfChannels() const
+  {
+    return this->Terms.size();
+  }
+
+  const MaskedPoissonSolver::GuidanceTermsType& GetTerms() const
+  {
+    return this->Terms;
+  }
+
+protected:
+
+  /** One vector per channel, one entry per unknown. */
+  MaskedPoissonSolver::GuidanceTermsType Terms;
+};
+
+#endif
@@ -0,0 +1,527 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "MaskedPoissonSolver.h"
+
+// Custom
+#include "Parallel.h"
+
+// STL
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+
+namespace
+{
+  const itk::Offset<2> NeighborOffsets[4] = {{{-1, 0}}, {{1, 0}}, {{0, -1}}, {{0, 1}}};
+
+  /** The granularity of the parallel loops. Small problems end up in a single block and
+    * are handled by the calling thread alone. */
+  const unsigned int RowsPerBlock = 64;
+  const unsigned int UnknownsPerBlock = 16384;
+
+  /** The IterativeMethod stops when |A x - b| < IterativeTolerance |b|, which is well below
+    * the float rounding of the written pixels. */
+  const double IterativeTolerance = 1e-7;
+}
+
+int PoissonDomain::GetUnknownId(const itk::Index<2>& index) const
+{
+  if(!this->Region.IsInside(index))
+  {
+    return -1;
+  }
+
+  const itk::Index<2> corner = this->Region.GetIndex();
+  const unsigned int width = this->Region.GetSize()[0];
+  return this->Lookup[(index[1] - corner[1]) * width + (index[0] - corner[0])];
+}
+
+PoissonDomain PoissonDomain::Create(const Mask* const mask,
+                                    const itk::ImageRegion<2>& maskRegion,
+                                    const itk::Offset<2>& maskToImage,
+                                    const itk::ImageRegion<2>& imageRegion)
+{
+  // Only pack the mask pixels that land inside of the image.
+  itk::ImageRegion<2> imageRegionInMask(imageRegion.GetIndex() - maskToImage, imageRegion.GetSize());
+  itk::ImageRegion<2> region = maskRegion;
+  if(!region.Crop(mask->GetLargestPossibleRegion()) || !region.Crop(imageRegionInMask))
+  {
+    PoissonDomain domain;
+    domain.ImageRegion = imageRegion;
+    return domain;
+  }
+
+  return Create(PackedMask::FromMask(mask, region), maskToImage, imageRegion);
+}
+
+PoissonDomain PoissonDomain::Create(const PackedMask& mask,
+                                    const itk::Offset<2>& maskToImage,
+                                    const itk::ImageRegion<2>& imageRegion)
+{
+  PoissonDomain domain;
+  domain.ImageRegion = imageRegion;
+
+  // Only visit the mask pixels that land inside of the image.
+  itk::ImageRegion<2> imageRegionInMask(imageRegion.GetIndex() - maskToImage, imageRegion.GetSize());
+  itk::ImageRegion<2> region = mask.GetRegion();
+  if(!region.Crop(imageRegionInMask))
+  {
+    return domain;
+  }
+
+  const itk::Index<2> regionCorner = region.GetIndex();
+  const unsigned int numberOfRows = region.GetSize()[1];
+
+  // The rows of band [begin, end) of 'region'.
+  auto getBand = [&](const unsigned int begin, const unsigned int end)
+  {
+    itk::Index<2> bandCorner = {{regionCorner[0], regionCorner[1] + static_cast<itk::IndexValueType>(begin)}};
+    itk::Size<2> bandSize = {{region.GetSize()[0], end - begin}};
+    return itk::ImageRegion<2>(bandCorner, bandSize);
+  };
+
+  // Count the unknowns of every row, and their column extent. Valid pixels are skipped a word at a time.
+  std::vector<unsigned int> rowStart(numberOfRows + 1, 0);
+  std::vector<itk::IndexValueType> rowLower(numberOfRows, itk::NumericTraits<itk::IndexValueType>::max());
+  std::vector<itk::IndexValueType> rowUpper(numberOfRows, itk::NumericTraits<itk::IndexValueType>::min());
+
+  Parallel::ForBlocks(numberOfRows, RowsPerBlock, [&](const unsigned int begin, const unsigned int end)
+  {
+    mask.ForEachHoleSpan(getBand(begin, end), [&](const itk::Index<2>& start, const unsigned int length)
+    {
+      const unsigned int row = start[1] - regionCorner[1];
+      rowStart[row + 1] += length;
+      rowLower[row] = std::min(rowLower[row], start[0]);
+      rowUpper[row] = start[0] + length - 1;
+    });
+  });
+
+  // The prefix sum gives the id of the first unknown of every row, so the rows can be
+  // numbered independently and the unknowns still come out in row-major order.
+  std::partial_sum(rowStart.begin(), rowStart.end(), rowStart.begin());
+  if(rowStart.back() == 0)
+  {
+    return domain;
+  }
+
+  itk::Index<2> lower = {{itk::NumericTraits<itk::IndexValueType>::max(), 0}};
+  itk::Index<2> upper = {{itk::NumericTraits<itk::IndexValueType>::min(), 0}};
+  bool foundFirstRow = false;
+  for(unsigned int row = 0; row < numberOfRows; ++row)
+  {
+    if(rowStart[row + 1] == rowStart[row])
+    {
+      continue;
+    }
+    if(!foundFirstRow)
+    {
+      lower[1] = regionCorner[1] + row + maskToImage[1];
+      foundFirstRow = true;
+    }
+    upper[1] = regionCorner[1] + row + maskToImage[1];
+    lower[0] = std::min(lower[0], rowLower[row] + maskToImage[0]);
+    upper[0] = std::max(upper[0], rowUpper[row] + maskToImage[0]);
+  }
+
+  itk::Size<2> size = {{static_cast<itk::SizeValueType>(upper[0] - lower[0] + 1),
+                        static_cast<itk::SizeValueType>(upper[1] - lower[1] + 1)}};
+  domain.Region = itk::ImageRegion<2>(lower, size);
+  domain.Pixels.resize(rowStart.back());
+  domain.Lookup.assign(domain.Region.GetNumberOfPixels(), -1);
+
+  Parallel::ForBlocks(numberOfRows, RowsPerBlock, [&](const unsigned int begin, const unsigned int end)
+  {
+    // The spans of a row arrive from left to right, so its unknowns are numbered in order.
+    std::vector<unsigned int> nextUnknown(rowStart.begin() + begin, rowStart.begin() + end);
+    mask.ForEachHoleSpan(getBand(begin, end), [&](const itk::Index<2>& start, const unsigned int length)
+    {
+      unsigned int& unknown = nextUnknown[start[1] - regionCorner[1] - begin];
+      itk::Index<2> pixel = start + maskToImage;
+      int* lookup = &domain.Lookup[(pixel[1] - lower[1]) * size[0] + (pixel[0] - lower[0])];
+      for(unsigned int column = 0; column < length; ++column, ++pixel[0], ++unknown)
+      {
+        domain.Pixels[unknown] = pixel;
+        lookup[column] = unknown;
+      }
+    });
+  });
+
+  return domain;
+}
+
+bool MaskedPoissonSolver::IsRectangularDomain(const PoissonDomain& domain)
+{
+  if(domain.GetNumberOfUnknowns() == 0 ||
+     domain.GetNumberOfUnknowns() != domain.Region.GetNumberOfPixels())
+  {
+    return false;
+  }
+
+  itk::ImageRegion<2> paddedRegion = domain.Region;
+  paddedRegion.PadByRadius(1);
+  return domain.ImageRegion.IsInside(paddedRegion) &&
+         SineTransform::IsFast(domain.Region.GetSize()[0]) &&
+         SineTransform::IsFast(domain.Region.GetSize()[1]);
+}
+
+void MaskedPoissonSolver::SetDomain(const PoissonDomain& domain)
+{
+  this->Domain = domain;
+  this->BoundaryLinks.clear();
+  this->Rectangular = this->UseSineTransforms && IsRectangularDomain(domain);
+
+  const unsigned int numberOfUnknowns = domain.GetNumberOfUnknowns();
+  this->A.resize(numberOfUnknowns, numberOfUnknowns);
+  if(numberOfUnknowns == 0)
+  {
+    return;
+  }
+
+  // Every block of rows of the matrix collects its entries in its own buffers, so the
+  // blocks can be assembled concurrently without locking.
+  const unsigned int numberOfBlocks = (numberOfUnknowns + UnknownsPerBlock - 1) / UnknownsPerBlock;
+  std::vector<std::vector<Eigen::Triplet<double> > > blockTriplets(numberOfBlocks);
+  std::vector<std::vector<BoundaryLink> > blockLinks(numberOfBlocks);
+
+  Parallel::ForBlocks(numberOfUnknowns, UnknownsPerBlock, [&](const unsigned int begin, const unsigned int end)
+  {
+    std::vector<Eigen::Triplet<double> >& triplets = blockTriplets[begin / UnknownsPerBlock];
+    std::vector<BoundaryLink>& links = blockLinks[begin / UnknownsPerBlock];
+    triplets.reserve((end - begin) * 5);
+
+    for(unsigned int unknown = begin; unknown < end; ++unknown)
+    {
+      const itk::Index<2>& pixel = domain.Pixels[unknown];
+      unsigned int numberOfNeighbors = 0;
+      for(unsigned int neighbor = 0; neighbor < 4; ++neighbor)
+      {
+        itk::Index<2> neighborPixel = pixel + NeighborOffsets[neighbor];
+        if(!domain.ImageRegion.IsInside(neighborPixel))
+        {
+          continue;
+        }
+        ++numberOfNeighbors;
+
+        int neighborUnknown = domain.GetUnknownId(neighborPixel);
+        if(neighborUnknown >= 0)
+        {
+          triplets.push_back(Eigen::Triplet<double>(unknown, neighborUnknown, -1.0));
+        }
+        else
+        {
+          BoundaryLink link;
+          link.Unknown = unknown;
+          link.Pixel = neighborPixel;
+          links.push_back(link);
+        }
+      }
+      triplets.push_back(Eigen::Triplet<double>(unknown, unknown, numberOfNeighbors));
+    }
+  });
+
+  // Concatenate the buffers in block order, so the result does not depend on the scheduling.
+  std::vector<unsigned int> tripletStart(numberOfBlocks + 1, 0);
+  std::vector<unsigned int> linkStart(numberOfBlocks + 1, 0);
+  for(unsigned int block = 0; block < numberOfBlocks; ++block)
+  {
+    tripletStart[block + 1] = tripletStart[block] + blockTriplets[block].size();
+    linkStart[block + 1] = linkStart[block] + blockLinks[block].size();
+  }
+
+  std::vector<Eigen::Triplet<double> > triplets(tripletStart.back());
+  this->BoundaryLinks.resize(linkStart.back());
+
+  Parallel::ForBlocks(numberOfBlocks, 1, [&](const unsigned int begin, const unsigned int end)
+  {
+    for(unsigned int block = begin; block < end; ++block)
+    {
+      std::copy(blockTriplets[block].begin(), blockTriplets[block].end(),
+                triplets.begin() + tripletStart[block]);
+      std::copy(blockLinks[block].begin(), blockLinks[block].end(),
+                this->BoundaryLinks.begin() + linkStart[block]);
+    }
+  });
+
+  // A rectangle is the 5 point Laplacian with Dirichlet boundaries, which the 2D sine
+  // transform diagonalizes; no factorization is needed.
+  if(this->Rectangular)
+  {
+    const unsigned int width = domain.Region.GetSize()[0];
+    const unsigned int height = domain.Region.GetSize()[1];
+    this->RowTransform = SineTransform(width);
+    this->ColumnTransform = SineTransform(height);
+    this->Eigenvalues.resize(height, width);
+    for(unsigned int x = 0; x < width; ++x)
+    {
+      for(unsigned int y = 0; y < height; ++y)
+      {
+        this->Eigenvalues(y, x) = 4.0 - 2.0 * std::cos(M_PI * (x + 1) / (width + 1)) -
+                                  2.0 * std::cos(M_PI * (y + 1) / (height + 1));
+      }
+    }
+    return;
+  }
+
+  this->A.setFromTriplets(triplets.begin(), triplets.end());
+
+  if(this->Method == IterativeMethod)
+  {
+    this->IterativeSolver.setTolerance(IterativeTolerance);
+    this->IterativeSolver.compute(this->A);
+    if(this->IterativeSolver.info() != Eigen::Success)
+    {
+      throw std::runtime_error("MaskedPoissonSolver: the system could not be preconditioned.");
+    }
+    return;
+  }
+
+  this->Factorization.compute(this->A);
+  if(this->Factorization.info() != Eigen::Success)
+  {
+    throw std::runtime_error("MaskedPoissonSolver: the system could not be factorized. "
+                             "Does every part of the hole touch a known pixel?");
+  }
+}
+
+std::size_t MaskedPoissonSolver::GetNumberOfFactorNonZeros() const
+{
+  if(this->Rectangular || this->Domain.GetNumberOfUnknowns() == 0)
+  {
+    return 0;
+  }
+
+  if(this->Method == IterativeMethod)
+  {
+    return this->IterativeSolver.preconditioner().matrixL().nonZeros();
+  }
+
+  return this->Factorization.matrixL().nestedExpression().nonZeros();
+}
+
+void MaskedPoissonSolver::Solve(const ImageType* const boundaryImage,
+                                const GuidanceTermsType& guidanceTerms,
+                                ImageType* const output) const
+{
+  // Gray, RGB and RGBA images get loops over a constant number of channels.
+  switch(boundaryImage->GetNumberOfComponentsPerPixel())
+  {
+    case 1:
+      SolveComponents<1>(boundaryImage, guidanceTerms, output);
+      break;
+    case 3:
+      SolveComponents<3>(boundaryImage, guidanceTerms, output);
+      break;
+    case 4:
+      SolveComponents<4>(boundaryImage, guidanceTerms, output);
+      break;
+    default:
+      SolveComponents<0>(boundaryImage, guidanceTerms, output);
+  }
+}
+
+double MaskedPoissonSolver::ComputeResidual(const ImageType* const image,
+                                            const GuidanceTermsType& guidanceTerms) const
+{
+  const unsigned int numberOfComponents = image->GetNumberOfComponentsPerPixel();
+  const float* buffer = image->GetBufferPointer();
+
+  // Row p of A x - b is the sum over the neighbors q of (x_p - f_q), minus the guidance term;
+  // it is evaluated from the stencil, because rectangular domains never assemble A.
+  const unsigned int numberOfUnknowns = this->Domain.GetNumberOfUnknowns();
+  std::vector<double> blockMaxima((numberOfUnknowns + UnknownsPerBlock - 1) / UnknownsPerBlock, 0.0);
+  Parallel::ForBlocks(numberOfUnknowns, UnknownsPerBlock, [&](const unsigned int begin, const unsigned int end)
+  {
+    double& blockMaximum = blockMaxima[begin / UnknownsPerBlock];
+    std::vector<double> residual(numberOfComponents);
+    for(unsigned int unknown = begin; unknown < end; ++unknown)
+    {
+      const itk::Index<2>& pixel = this->Domain.Pixels[unknown];
+      const float* value = buffer + image->ComputeOffset(pixel) * numberOfComponents;
+      for(unsigned int component = 0; component < numberOfComponents; ++component)
+      {
+        residual[component] = guidanceTerms.empty() ? 0.0 : -guidanceTerms[component][unknown];
+      }
+
+      for(unsigned int neighbor = 0; neighbor < 4; ++neighbor)
+      {
+        const itk::Index<2> neighborPixel = pixel + NeighborOffsets[neighbor];
+        if(!this->Domain.ImageRegion.IsInside(neighborPixel))
+        {
+          continue;
+        }
+
+        const float* neighborValue = buffer + image->ComputeOffset(neighborPixel) * numberOfComponents;
+        for(unsigned int component = 0; component < numberOfComponents; ++component)
+        {
+          residual[component] += value[component] - neighborValue[component];
+        }
+      }
+
+      for(unsigned int component = 0; component < numberOfComponents; ++component)
+      {
+        blockMaximum = std::max(blockMaximum, std::fabs(residual[component]));
+      }
+    }
+  });
+
+  const double maximumResidual = blockMaxima.empty() ? 0.0 :
+                                 *std::max_element(blockMaxima.begin(), blockMaxima.end());
+  return maximumResidual;
+}
+
+template <unsigned int TNumberOfComponents>
+void MaskedPoissonSolver::SolveComponents(const ImageType* const boundaryImage,
+                                          const GuidanceTermsType& guidanceTerms,
+                                          ImageType* const output) const
+{
+  const unsigned int numberOfUnknowns = this->Domain.GetNumberOfUnknowns();
+  if(numberOfUnknowns == 0)
+  {
+    return;
+  }
+
+  const unsigned int numberOfComponents = TNumberOfComponents ? TNumberOfComponents :
+                                          boundaryImage->GetNumberOfComponentsPerPixel();
+  const float* boundaryBuffer = boundaryImage->GetBufferPointer();
+  float* outputBuffer = output->GetBufferPointer();
+
+  // One right hand side column per channel.
+  Eigen::MatrixXd b = Eigen::MatrixXd::Zero(numberOfUnknowns, numberOfComponents);
+  if(!guidanceTerms.empty())
+  {
+    Parallel::ForBlocks(numberOfUnknowns, UnknownsPerBlock, [&](const unsigned int begin, const unsigned int end)
+    {
+      for(unsigned int component = 0; component < numberOfComponents; ++component)
+      {
+        const std::vector<float>& terms = guidanceTerms[component];
+        for(unsigned int unknown = begin; unknown < end; ++unknown)
+        {
+          b(unknown, component) = terms[unknown];
+        }
+      }
+    });
+  }
+
+  for(unsigned int linkId = 0; linkId < this->BoundaryLinks.size(); ++linkId)
+  {
+    const BoundaryLink& link = this->BoundaryLinks[linkId];
+    const float* boundaryPixel = boundaryBuffer + boundaryImage->ComputeOffset(link.Pixel) * numberOfComponents;
+    for(unsigned int component = 0; component < numberOfComponents; ++component)
+    {
+      b(link.Unknown, component) += boundaryPixel[component];
+    }
+  }
+
+  // Solve every channel before writing anything, so that 'output' may alias 'boundaryImage'.
+  // The channels share the factorization, so they are solved in one pass.
+  Eigen::MatrixXd solution;
+  if(this->Rectangular)
+  {
+    solution = SolveRectangle(b);
+  }
+  else if(this->Method == IterativeMethod)
+  {
+    solution = SolveIteratively(boundaryImage, b);
+  }
+  else
+  {
+    solution = this->Factorization.solve(b);
+  }
+
+  Parallel::ForBlocks(numberOfUnknowns, UnknownsPerBlock, [&](const unsigned int begin, const unsigned int end)
+  {
+    for(unsigned int unknown = begin; unknown < end; ++unknown)
+    {
+      float* outputPixel = outputBuffer + output->ComputeOffset(this->Domain.Pixels[unknown]) *
+                           numberOfComponents;
+      for(unsigned int component = 0; component < numberOfComponents; ++component)
+      {
+        outputPixel[component] = solution(unknown, component);
+      }
+    }
+  });
+}
+
+Eigen::MatrixXd MaskedPoissonSolver::SolveIteratively(const ImageType* const boundaryImage,
+                                                      const Eigen::MatrixXd& b) const
+{
+  const unsigned int numberOfComponents = b.cols();
+  const float* boundaryBuffer = boundaryImage->GetBufferPointer();
+
+  Eigen::MatrixXd guess(b.rows(), b.cols());
+  Parallel::ForBlocks(b.rows(), UnknownsPerBlock, [&](const unsigned int begin, const unsigned int end)
+  {
+    for(unsigned int unknown = begin; unknown < end; ++unknown)
+    {
+      const float* guessPixel = boundaryBuffer + boundaryImage->ComputeOffset(this->Domain.Pixels[unknown]) *
+                                numberOfComponents;
+      for(unsigned int component = 0; component < numberOfComponents; ++component)
+      {
+        guess(unknown, component) = guessPixel[component];
+      }
+    }
+  });
+
+  // The solver keeps the statistics of the last solve, so the channels are solved one after the other.
+  Eigen::MatrixXd solution(b.rows(), b.cols());
+  this->NumberOfIterations = 0;
+  for(unsigned int component = 0; component < numberOfComponents; ++component)
+  {
+    solution.col(component) = this->IterativeSolver.solveWithGuess(b.col(component), guess.col(component));
+    if(this->IterativeSolver.info() != Eigen::Success)
+    {
+      throw std::runtime_error("MaskedPoissonSolver: the iterative solve did not converge. "
+                               "Does every part of the hole touch a known pixel?");
+    }
+    this->NumberOfIterations = std::max(this->NumberOfIterations,
+                                        static_cast<unsigned int>(this->IterativeSolver.iterations()));
+  }
+
+  return solution;
+}
+
+Eigen::MatrixXd MaskedPoissonSolver::SolveRectangle(const Eigen::MatrixXd& b) const
+{
+  const unsigned int width = this->Domain.Region.GetSize()[0];
+  const unsigned int height = this->Domain.Region.GetSize()[1];
+
+  // The unknowns are in row-major order, so a column of 'b' is a width by height
+  // column-major matrix with one image row per column.
+  // The channels are independent.
+  Eigen::MatrixXd solution(b.rows(), b.cols());
+  Parallel::ForBlocks(b.cols(), 1, [&](const unsigned int component, const unsigned int)
+  {
+    Eigen::MatrixXd values = Eigen::Map<const Eigen::MatrixXd>(b.col(component).data(), width, height);
+
+    // Forward transform along x and y, divide by the eigenvalues, transform back.
+    this->RowTransform.TransformColumns(values);
+    values.transposeInPlace();
+    this->ColumnTransform.TransformColumns(values);
+    values.array() /= this->Eigenvalues.array();
+    this->ColumnTransform.TransformColumns(values);
+    values.transposeInPlace();
+    this->RowTransform.TransformColumns(values);
+
+    Eigen::Map<Eigen::MatrixXd>(solution.col(component).data(), width, height) =
+        values * (4.0 / ((width + 1) * (height + 1)));
+  });
+
+  return solution;
+}
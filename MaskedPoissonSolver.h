@@ -0,0 +1,216 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+/** This class solves the discrete Poisson equation (Perez et al. 2003, eq. 7)
+  * over an arbitrary set of pixels. The linear system depends only on the shape
+  * of the set, so it is assembled and factorized once in SetDomain() and can then
+  * be solved for any number of channels, boundary images and guidance terms.
+  * A domain that is a full rectangle surrounded by fixed pixels is not factorized;
+  * it is solved directly with sine transforms. For domains whose factor would not fit
+  * in memory, the system can instead be solved iteratively with conjugate gradients.
+  */
+
+#ifndef MaskedPoissonSolver_H
+#define MaskedPoissonSolver_H
+
+// ITK
+#include "itkVectorImage.h"
+
+// Custom
+#include "PackedMask.h"
+#include "SineTransform.h"
+
+// Submodules
+#include "Mask/Mask.h"
+
+// Eigen
+#include <Eigen/Sparse>
+
+// STL
+#include <cstddef>
+#include <vector>
+
+/** The pixels that are unknowns of a Poisson problem, in row-major order. */
+struct PoissonDomain
+{
+  /** The region of the image the problem lives in. Neighbors outside of it are ignored. */
+  itk::ImageRegion<2> ImageRegion;
+
+  /** The bounding box of the unknowns. */
+  itk::ImageRegion<2> Region;
+
+  /** The unknown pixels, in image coordinates. */
+  std::vector<itk::Index<2> > Pixels;
+
+  /** For each pixel of Region (row-major), the id of its unknown or -1. */
+  std::vector<int> Lookup;
+
+  unsigned int GetNumberOfUnknowns() const
+  {
+    return this->Pixels.size();
+  }
+
+  /** Get the id of the unknown at 'index', or -1 if 'index' is not an unknown. */
+  int GetUnknownId(const itk::Index<2>& index) const;
+
+  /** Collect the hole pixels of 'maskRegion' as unknowns. 'maskToImage' translates
+    * mask coordinates into image coordinates; hole pixels that land outside of
+    * 'imageRegion' are dropped. */
+  static PoissonDomain Create(const Mask* const mask,
+                              const itk::ImageRegion<2>& maskRegion,
+                              const itk::Offset<2>& maskToImage,
+                              const itk::ImageRegion<2>& imageRegion);
+
+  /** The same for the hole pixels of a packed mask, which only has to cover the part of the
+    * mask that is searched. Valid pixels are skipped 64 at a time. */
+  static PoissonDomain Create(const PackedMask& mask,
+                              const itk::Offset<2>& maskToImage,
+                              const itk::ImageRegion<2>& imageRegion);
+};
+
+class MaskedPoissonSolver
+{
+public:
+  typedef itk::VectorImage<float, 2> ImageType;
+  typedef Eigen::SparseMatrix<double> MatrixType;
+
+  /** One guidance term per unknown, one vector per channel. An empty container
+    * means a zero guidance field (a membrane interpolation). */
+  typedef std::vector<std::vector<float> > GuidanceTermsType;
+
+  /** How SetDomain() prepares a domain that is not rectangular. */
+  enum MethodType
+  {
+    /** Factorize A once, so that every solve is two triangular solves. The factor holds
+      * many more nonzeros than A. */
+    DirectMethod,
+
+    /** Keep A and an incomplete factorization of it (about as large as A), and solve with
+      * preconditioned conjugate gradients, starting from the values in the boundary image. */
+    IterativeMethod
+  };
+
+  /** Takes effect at the next SetDomain(). */
+  void SetMethod(const MethodType method)
+  {
+    this->Method = method;
+  }
+
+  MethodType GetMethod() const
+  {
+    return this->Method;
+  }
+
+  /** Solve rectangular domains with sine transforms (the default) or like any other domain.
+    * Takes effect at the next SetDomain(); turned off to check the transforms against the
+    * factorization. */
+  void SetUseSineTransforms(const bool useSineTransforms)
+  {
+    this->UseSineTransforms = useSineTransforms;
+  }
+
+  /** Assemble and factorize the system for 'domain'. Throws if the system is singular,
+    * which happens when a connected part of the domain touches no fixed pixel (with the
+    * IterativeMethod, this is only detected by Solve()). */
+  void SetDomain(const PoissonDomain& domain);
+
+  /** Whether the domain is solved with sine transforms instead of the factorization. */
+  bool IsRectangular() const
+  {
+    return this->Rectangular;
+  }
+
+  /** Can 'domain' be solved with sine transforms? It has to fill its bounding box, every
+    * unknown must have four neighbors in the image, and the transforms must be cheap. */
+  static bool IsRectangularDomain(const PoissonDomain& domain);
+
+  const PoissonDomain& GetDomain() const
+  {
+    return this->Domain;
+  }
+
+  /** The number of nonzeros of the (incomplete) factor built by SetDomain(), 0 for rectangular domains. */
+  std::size_t GetNumberOfFactorNonZeros() const;
+
+  /** The number of iterations the last solve with the IterativeMethod took for its slowest channel. */
+  unsigned int GetNumberOfIterations() const
+  {
+    return this->NumberOfIterations;
+  }
+
+  /** Solve every channel. Values of the fixed neighbors are read from 'boundaryImage' and
+    * the solution is written into 'output' at the domain pixels only. 'output' may be
+    * the same image as 'boundaryImage'. With the IterativeMethod, the values of
+    * 'boundaryImage' at the domain pixels are the initial guess, and a solve that does
+    * not converge throws. */
+  void Solve(const ImageType* const boundaryImage, const GuidanceTermsType& guidanceTerms,
+             ImageType* const output) const;
+
+  /** The largest absolute entry of A x - b over all unknowns and channels, where the unknowns x
+    * and the fixed neighbors are both read from 'image'. A solution written by Solve() gives a
+    * residual at the level of the float rounding of the written pixels; anything larger means
+    * the solve went wrong. */
+  double ComputeResidual(const ImageType* const image, const GuidanceTermsType& guidanceTerms) const;
+
+protected:
+
+  /** Solve with the number of channels known at compile time, or read from 'boundaryImage'
+    * if TNumberOfComponents is 0. */
+  template <unsigned int TNumberOfComponents>
+  void SolveComponents(const ImageType* const boundaryImage, const GuidanceTermsType& guidanceTerms,
+                       ImageType* const output) const;
+
+  /** Solve A x = b for each column of 'b' with conjugate gradients, starting from the values
+    * of 'boundaryImage' at the unknowns (IterativeMethod only). */
+  Eigen::MatrixXd SolveIteratively(const ImageType* const boundaryImage, const Eigen::MatrixXd& b) const;
+
+  /** Solve A x = b for each column of 'b' with sine transforms (Rectangular domains only). */
+  Eigen::MatrixXd SolveRectangle(const Eigen::MatrixXd& b) const;
+
+  /** A fixed pixel adjacent to an unknown. Its value is moved to the right hand side. */
+  struct BoundaryLink
+  {
+    unsigned int Unknown;
+    itk::Index<2> Pixel;
+  };
+
+  PoissonDomain Domain;
+
+  std::vector<BoundaryLink> BoundaryLinks;
+
+  MatrixType A;
+
+  MethodType Method = DirectMethod;
+
+  bool UseSineTransforms = true;
+
+  Eigen::SimplicialLDLT<MatrixType> Factorization;
+
+  Eigen::ConjugateGradient<MatrixType, Eigen::Lower | Eigen::Upper,
+                           Eigen::IncompleteCholesky<double> > IterativeSolver;
+  mutable unsigned int NumberOfIterations = 0;
+
+  /** For Rectangular domains, the transforms along the rows and the columns of Domain.Region
+    * and the eigenvalues of A (one per pair of frequencies, height by width). */
+  bool Rectangular = false;
+  SineTransform RowTransform;
+  SineTransform ColumnTransform;
+  Eigen::MatrixXd Eigenvalues;
+};
+
+#endif
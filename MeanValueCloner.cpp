@@ -0,0 +1,336 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "MeanValueCloner.h"
+
+// Custom
+#include "Parallel.h"
+
+// STL
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+  /** The 8 neighbors in clockwise order (with y pointing down), starting east. */
+  const itk::Offset<2> Directions[8] = {{{1, 0}}, {{1, 1}}, {{0, 1}}, {{-1, 1}},
+                                        {{-1, 0}}, {{-1, -1}}, {{0, -1}}, {{1, -1}}};
+
+  const unsigned int West = 4;
+
+  unsigned int GetDirection(const itk::Offset<2>& offset)
+  {
+    for(unsigned int direction = 0; direction < 8; ++direction)
+    {
+      if(Directions[direction][0] == offset[0] && Directions[direction][1] == offset[1])
+      {
+        return direction;
+      }
+    }
+    return 0;
+  }
+
+  /** The quadtree cells are no larger than this. */
+  const unsigned int MaximumCellSize = 16;
+
+  /** The cells are disjoint, so they are cloned in parallel in blocks of this many. */
+  const unsigned int CellsPerBlock = 256;
+}
+
+std::vector<std::vector<itk::Index<2> > > MeanValueCloner::TraceContours(const Mask* const mask)
+{
+  const itk::ImageRegion<2> region = mask->GetLargestPossibleRegion();
+  const unsigned int width = region.GetSize()[0];
+  auto isHole = [&](const itk::Index<2>& index)
+  {
+    return region.IsInside(index) && mask->IsHole(index);
+  };
+  auto getOffset = [&](const itk::Index<2>& index)
+  {
+    return (index[1] - region.GetIndex()[1]) * width + (index[0] - region.GetIndex()[0]);
+  };
+
+  std::vector<std::vector<itk::Index<2> > > contours;
+  std::vector<bool> traced(region.GetNumberOfPixels(), false);
+  const unsigned int maximumLength = 4 * region.GetNumberOfPixels() + 8;
+
+  itk::Index<2> start;
+  for(start[1] = region.GetIndex()[1]; start[1] <= region.GetUpperIndex()[1]; ++start[1])
+  {
+    for(start[0] = region.GetIndex()[0]; start[0] <= region.GetUpperIndex()[0]; ++start[0])
+    {
+      // A contour starts at every hole pixel whose west neighbor is not in the hole.
+      if(!isHole(start) || traced[getOffset(start)] || isHole(start + Directions[West]))
+      {
+        continue;
+      }
+
+      // Moore neighbor tracing, stopping when the step out of the start pixel is about to repeat.
+      std::vector<itk::Index<2> > contour;
+      itk::Index<2> current = start;
+      unsigned int backtrack = West;
+      int firstStep = -1;
+      while(contour.size() < maximumLength)
+      {
+        int next = -1;
+        for(unsigned int step = 1; step <= 8 && next < 0; ++step)
+        {
+          const unsigned int direction = (backtrack + step) % 8;
+          if(isHole(current + Directions[direction]))
+          {
+            next = direction;
+          }
+        }
+
+        if(!contour.empty() && current == start && next == firstStep)
+        {
+          break;
+        }
+        if(contour.empty())
+        {
+          firstStep = next;
+        }
+        contour.push_back(current);
+        traced[getOffset(current)] = true;
+        if(next < 0)
+        {
+          break; // an isolated pixel
+        }
+
+        // Continue from the neighbor that was found, backtracking to the last pixel that was not.
+        const itk::Index<2> previous = current + Directions[(next + 7) % 8];
+        current = current + Directions[next];
+        backtrack = GetDirection(previous - current);
+      }
+
+      contours.push_back(contour);
+    }
+  }
+
+  return contours;
+}
+
+void MeanValueCloner::SetMask(const Mask* const mask, const unsigned int maximumNumberOfVertices)
+{
+  this->BoundaryPixels.clear();
+  this->Vertices.clear();
+  this->ContourStart.assign(1, 0);
+
+  std::vector<std::vector<itk::Index<2> > > contours = TraceContours(mask);
+  unsigned int totalLength = 0;
+  for(unsigned int contourId = 0; contourId < contours.size(); ++contourId)
+  {
+    totalLength += contours[contourId].size();
+  }
+  const unsigned int pixelsPerVertex =
+      std::max(1u, (totalLength + maximumNumberOfVertices - 1) / std::max(1u, maximumNumberOfVertices));
+
+  for(unsigned int contourId = 0; contourId < contours.size(); ++contourId)
+  {
+    const std::vector<itk::Index<2> >& contour = contours[contourId];
+    const unsigned int contourStart = this->BoundaryPixels.size();
+    this->BoundaryPixels.insert(this->BoundaryPixels.end(), contour.begin(), contour.end());
+
+    for(unsigned int first = 0; first < contour.size(); first += pixelsPerVertex)
+    {
+      Vertex vertex;
+      vertex.FirstPixel = contourStart + first;
+      vertex.NumberOfPixels = std::min<unsigned int>(pixelsPerVertex, contour.size() - first);
+      vertex.Position = contour[first + vertex.NumberOfPixels / 2];
+      this->Vertices.push_back(vertex);
+    }
+    this->ContourStart.push_back(this->Vertices.size());
+  }
+
+  this->Grid = QuadtreePoissonFill::NodeGrid(
+        QuadtreePoissonFill::BuildQuadtree(mask, mask->GetLargestPossibleRegion(), MaximumCellSize));
+  const unsigned int numberOfNodes = this->Grid.GetNumberOfNodes();
+
+  this->NodeBoundaryPixel.assign(numberOfNodes, -1);
+  for(unsigned int pixelId = 0; pixelId < this->BoundaryPixels.size(); ++pixelId)
+  {
+    int node = this->Grid.GetNodeId(this->BoundaryPixels[pixelId]);
+    if(node >= 0)
+    {
+      this->NodeBoundaryPixel[node] = pixelId;
+    }
+  }
+
+  // The mean-value coordinates of the nodes inside the hole. For a node x and the vertices
+  // v_i of a contour, w_i = (tan(a_(i-1) / 2) + tan(a_i / 2)) / |v_i - x|, where a_i is the
+  // signed angle between v_i - x and v_(i+1) - x. The weights of all contours are normalized together.
+  const unsigned int numberOfVertices = this->Vertices.size();
+  this->Coordinates = Eigen::MatrixXf::Zero(numberOfNodes, numberOfVertices);
+  std::vector<double> distances(numberOfVertices);
+  std::vector<double> halfAngleTangents(numberOfVertices);
+  Eigen::VectorXd weights(numberOfVertices);
+
+  for(unsigned int node = 0; node < numberOfNodes; ++node)
+  {
+    if(this->NodeBoundaryPixel[node] >= 0)
+    {
+      continue;
+    }
+
+    const itk::Index<2>& position = this->Grid.GetNodePosition(node);
+    weights.setZero();
+    int onVertex = -1;
+
+    for(unsigned int contourId = 0; contourId + 1 < this->ContourStart.size() && onVertex < 0; ++contourId)
+    {
+      const unsigned int begin = this->ContourStart[contourId];
+      const unsigned int end = this->ContourStart[contourId + 1];
+      if(end - begin < 3)
+      {
+        continue;
+      }
+
+      for(unsigned int vertex = begin; vertex < end; ++vertex)
+      {
+        const double dx = this->Vertices[vertex].Position[0] - position[0];
+        const double dy = this->Vertices[vertex].Position[1] - position[1];
+        distances[vertex] = std::sqrt(dx * dx + dy * dy);
+        if(distances[vertex] < 1e-6)
+        {
+          onVertex = vertex;
+          break;
+        }
+      }
+      if(onVertex >= 0)
+      {
+        break;
+      }
+
+      for(unsigned int vertex = begin; vertex < end; ++vertex)
+      {
+        const unsigned int nextVertex = (vertex + 1 < end) ? vertex + 1 : begin;
+        const double ax = this->Vertices[vertex].Position[0] - position[0];
+        const double ay = this->Vertices[vertex].Position[1] - position[1];
+        const double bx = this->Vertices[nextVertex].Position[0] - position[0];
+        const double by = this->Vertices[nextVertex].Position[1] - position[1];
+        const double cross = ax * by - ay * bx;
+        const double denominator = distances[vertex] * distances[nextVertex] + ax * bx + ay * by;
+        // tan(a/2) = sin(a) / (1 + cos(a)); a node on an edge (a = pi) gets a large weight on its ends.
+        halfAngleTangents[vertex] = cross / std::max(denominator, 1e-9 * distances[vertex] * distances[nextVertex]);
+      }
+
+      for(unsigned int vertex = begin; vertex < end; ++vertex)
+      {
+        const unsigned int previousVertex = (vertex > begin) ? vertex - 1 : end - 1;
+        weights[vertex] = (halfAngleTangents[previousVertex] + halfAngleTangents[vertex]) / distances[vertex];
+      }
+    }
+
+    if(onVertex >= 0)
+    {
+      this->Coordinates(node, onVertex) = 1.0f;
+      continue;
+    }
+
+    const double sum = weights.sum();
+    if(std::fabs(sum) > 1e-12)
+    {
+      this->Coordinates.row(node) = (weights / sum).cast<float>().transpose();
+    }
+  }
+}
+
+void MeanValueCloner::Clone(const ImageType* const source, const ImageType* const target,
+                            const itk::Offset<2>& sourceToImage, ImageType* const output) const
+{
+  const unsigned int numberOfComponents = source->GetNumberOfComponentsPerPixel();
+  const itk::ImageRegion<2> targetRegion = target->GetBufferedRegion();
+  const itk::ImageRegion<2> outputRegion = output->GetBufferedRegion();
+  const float* sourceBuffer = source->GetBufferPointer();
+  const float* targetBuffer = target->GetBufferPointer();
+  float* outputBuffer = output->GetBufferPointer();
+
+  // The difference between target and source at every boundary pixel. Pixels that are not
+  // over the target keep the source.
+  Eigen::MatrixXf boundaryDifferences = Eigen::MatrixXf::Zero(this->BoundaryPixels.size(), numberOfComponents);
+  for(unsigned int pixelId = 0; pixelId < this->BoundaryPixels.size(); ++pixelId)
+  {
+    const itk::Index<2>& pixel = this->BoundaryPixels[pixelId];
+    const itk::Index<2> targetPixel = pixel + sourceToImage;
+    if(!targetRegion.IsInside(targetPixel))
+    {
+      continue;
+    }
+
+    const float* sourceValue = sourceBuffer + source->ComputeOffset(pixel) * numberOfComponents;
+    const float* targetValue = targetBuffer + target->ComputeOffset(targetPixel) * numberOfComponents;
+    for(unsigned int component = 0; component < numberOfComponents; ++component)
+    {
+      boundaryDifferences(pixelId, component) = targetValue[component] - sourceValue[component];
+    }
+  }
+
+  Eigen::MatrixXf vertexDifferences(this->Vertices.size(), numberOfComponents);
+  for(unsigned int vertex = 0; vertex < this->Vertices.size(); ++vertex)
+  {
+    vertexDifferences.row(vertex) =
+        boundaryDifferences.middleRows(this->Vertices[vertex].FirstPixel, this->Vertices[vertex].NumberOfPixels)
+        .colwise().mean();
+  }
+
+  // Interpolate the differences at the nodes; the nodes on the boundary take their own difference.
+  Eigen::MatrixXf nodeDifferences = this->Coordinates * vertexDifferences;
+  for(unsigned int node = 0; node < this->NodeBoundaryPixel.size(); ++node)
+  {
+    if(this->NodeBoundaryPixel[node] >= 0)
+    {
+      nodeDifferences.row(node) = boundaryDifferences.row(this->NodeBoundaryPixel[node]);
+    }
+  }
+
+  const std::vector<QuadtreePoissonFill::Cell>& cells = this->Grid.GetCells();
+  Parallel::ForBlocks(cells.size(), CellsPerBlock, [&](const unsigned int begin, const unsigned int end)
+  {
+    for(unsigned int cellId = begin; cellId < end; ++cellId)
+    {
+      const QuadtreePoissonFill::Cell& cell = cells[cellId];
+      itk::Index<2> pixel;
+      for(unsigned int y = 0; y < cell.Size; ++y)
+      {
+        pixel[1] = cell.Corner[1] + y;
+        for(unsigned int x = 0; x < cell.Size; ++x)
+        {
+          pixel[0] = cell.Corner[0] + x;
+          const itk::Index<2> outputPixel = pixel + sourceToImage;
+          if(!outputRegion.IsInside(outputPixel))
+          {
+            continue;
+          }
+
+          const QuadtreePoissonFill::Interpolation interpolation = this->Grid.Interpolate(pixel);
+          const float* sourceValue = sourceBuffer + source->ComputeOffset(pixel) * numberOfComponents;
+          float* outputValue = outputBuffer + output->ComputeOffset(outputPixel) * numberOfComponents;
+          for(unsigned int component = 0; component < numberOfComponents; ++component)
+          {
+            float difference = 0.0f;
+            for(unsigned int entry = 0; entry < interpolation.NumberOfNodes; ++entry)
+            {
+              difference += interpolation.Weights[entry] * nodeDifferences(interpolation.Nodes[entry], component);
+            }
+            outputValue[component] = sourceValue[component] + difference;
+          }
+        }
+      }
+    }
+  });
+}
@@ -0,0 +1,98 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+/** This class clones without solving a linear system, with mean-value coordinates
+  * (Farbman et al. 2009, "Coordinates for instant image cloning"). The membrane that the
+  * Poisson clone adds to the source is approximated by interpolating the differences
+  * between target and source along the boundary of the hole with mean-value coordinates.
+  * The coordinates only depend on the mask, so SetMask() computes them once for the
+  * nodes of a QuadtreePoissonFill quadtree, and every placement only evaluates the
+  * boundary differences and interpolates.
+  */
+
+#ifndef MeanValueCloner_H
+#define MeanValueCloner_H
+
+// Custom
+#include "QuadtreePoissonFill.h"
+
+// ITK
+#include "itkVectorImage.h"
+
+// Submodules
+#include "Mask/Mask.h"
+
+// Eigen
+#include <Eigen/Dense>
+
+// STL
+#include <vector>
+
+class MeanValueCloner
+{
+public:
+  typedef itk::VectorImage<float, 2> ImageType;
+
+  /** Trace the boundary of the hole of 'mask' and compute the coordinates. The boundary is
+    * sampled with at most about 'maximumNumberOfVertices' polygon vertices. */
+  void SetMask(const Mask* const mask, const unsigned int maximumNumberOfVertices = 512);
+
+  /** Write the clone of the hole of 'source' into 'target', translated by 'sourceToImage',
+    * into the pixels of 'output' it covers. 'output' may be 'target' or a part of it. */
+  void Clone(const ImageType* const source, const ImageType* const target,
+             const itk::Offset<2>& sourceToImage, ImageType* const output) const;
+
+  unsigned int GetNumberOfVertices() const
+  {
+    return this->Vertices.size();
+  }
+
+  /** The outer and inner boundaries of the hole of 'mask', as closed chains of 8-connected
+    * hole pixels. Outer and inner boundaries run in opposite directions. */
+  static std::vector<std::vector<itk::Index<2> > > TraceContours(const Mask* const mask);
+
+protected:
+
+  /** A polygon vertex stands for a run of consecutive boundary pixels; the boundary
+    * difference at the vertex is the average over the run. */
+  struct Vertex
+  {
+    itk::Index<2> Position;
+    unsigned int FirstPixel;
+    unsigned int NumberOfPixels;
+  };
+
+  /** The traced boundary pixels of all contours, one after another. */
+  std::vector<itk::Index<2> > BoundaryPixels;
+
+  /** The vertices of all contours, one after another. */
+  std::vector<Vertex> Vertices;
+
+  /** The vertices of contour c are [ContourStart[c], ContourStart[c + 1]). */
+  std::vector<unsigned int> ContourStart;
+
+  QuadtreePoissonFill::NodeGrid Grid;
+
+  /** For each node, the boundary pixel it is on, or -1 for nodes inside the hole. */
+  std::vector<int> NodeBoundaryPixel;
+
+  /** The mean-value coordinates of each node (rows) with respect to the vertices (columns). */
+  Eigen::MatrixXf Coordinates;
+};
+
+#endif
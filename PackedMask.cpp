@@ -0,0 +1,486 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "PackedMask.h"
+
+// Custom
+#include "Parallel.h"
+
+// STL
+#include <algorithm>
+#include <bitset>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+  typedef PackedMask::WordType WordType;
+  const unsigned int BitsPerWord = PackedMask::BitsPerWord;
+
+  /** Rows are packed and combined in bands of this many rows on all threads. */
+  const unsigned int RowsPerBlock = 64;
+
+  const WordType AllBits = ~WordType(0);
+
+  /** 'word' must not be 0. */
+  unsigned int CountTrailingZeros(WordType word)
+  {
+#if defined(__GNUC__)
+    return __builtin_ctzll(word);
+#else
+    unsigned int count = 0;
+    for(; !(word & 1); word >>= 1)
+    {
+      ++count;
+    }
+    return count;
+#endif
+  }
+
+  /** 'word' must not be 0. */
+  unsigned int CountLeadingZeros(WordType word)
+  {
+#if defined(__GNUC__)
+    return __builtin_clzll(word);
+#else
+    unsigned int count = 0;
+    for(; !(word >> (BitsPerWord - 1)); word <<= 1)
+    {
+      ++count;
+    }
+    return count;
+#endif
+  }
+
+  /** The 'numberOfBits' (at most 64) lowest bits. */
+  WordType LowBits(const std::size_t numberOfBits)
+  {
+    return numberOfBits >= BitsPerWord ? AllBits : (WordType(1) << numberOfBits) - 1;
+  }
+
+  /** The 64 bits of 'row' starting at column 'bit'; columns past the row read as 0. */
+  WordType ReadBits(const WordType* const row, const std::size_t wordsPerRow, const std::size_t bit)
+  {
+    const std::size_t word = bit / BitsPerWord;
+    const unsigned int shift = bit % BitsPerWord;
+    WordType value = row[word] >> shift;
+    if(shift && word + 1 < wordsPerRow)
+    {
+      value |= row[word + 1] << (BitsPerWord - shift);
+    }
+    return value;
+  }
+
+  /** Pack the pixels of a row segment of at most 64 pixels: bit b is set if pixel b is 'holeValue'. */
+  template <typename TPixel>
+  WordType PackPixels(const TPixel* const pixels, const unsigned int numberOfPixels, const TPixel holeValue)
+  {
+    WordType word = 0;
+    for(unsigned int bit = 0; bit < numberOfPixels; ++bit)
+    {
+      word |= static_cast<WordType>(pixels[bit] == holeValue) << bit;
+    }
+    return word;
+  }
+
+#if defined(_MSC_VER) || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+  /** One byte pixels are compared 8 at a time: the bytes that equal the hole value become 0
+    * after the XOR, their high bits are isolated, and the multiplication gathers the 8 high bits
+    * into the top byte in column order. */
+  WordType PackPixels(const unsigned char* const pixels, const unsigned int numberOfPixels,
+                      const unsigned char holeValue)
+  {
+    const uint64_t low = 0x7f7f7f7f7f7f7f7fULL;
+    const uint64_t holeBytes = 0x0101010101010101ULL * holeValue;
+
+    WordType word = 0;
+    unsigned int bit = 0;
+    for(; bit + 8 <= numberOfPixels; bit += 8)
+    {
+      uint64_t bytes;
+      std::memcpy(&bytes, pixels + bit, sizeof(bytes));
+      const uint64_t difference = bytes ^ holeBytes;
+      const uint64_t zeroBytes = ~(((difference & low) + low) | difference | low);
+      word |= ((zeroBytes >> 7) * 0x0102040810204080ULL >> 56) << bit;
+    }
+    for(; bit < numberOfPixels; ++bit)
+    {
+      word |= static_cast<WordType>(pixels[bit] == holeValue) << bit;
+    }
+    return word;
+  }
+#endif
+
+  /** Overwrite the bits of 'row' starting at column 'bit' that are set in 'valueMask'. */
+  void WriteBits(WordType* const row, const std::size_t bit, const WordType value, const WordType valueMask)
+  {
+    const std::size_t word = bit / BitsPerWord;
+    const unsigned int shift = bit % BitsPerWord;
+    row[word] = (row[word] & ~(valueMask << shift)) | ((value & valueMask) << shift);
+    if(shift && (valueMask >> (BitsPerWord - shift)))
+    {
+      const unsigned int backShift = BitsPerWord - shift;
+      row[word + 1] = (row[word + 1] & ~(valueMask >> backShift)) | ((value & valueMask) >> backShift);
+    }
+  }
+}
+
+const unsigned int PackedMask::BitsPerWord;
+
+PackedMask::PackedMask()
+{
+}
+
+PackedMask::PackedMask(const itk::ImageRegion<2>& region) : Region(region)
+{
+  this->WordsPerRow = (region.GetSize()[0] + BitsPerWord - 1) / BitsPerWord;
+  this->Words.assign(this->WordsPerRow * region.GetSize()[1], 0);
+}
+
+PackedMask PackedMask::FromMask(const Mask* const mask, const itk::ImageRegion<2>& region)
+{
+  if(!mask->GetLargestPossibleRegion().IsInside(region) && region.GetNumberOfPixels() > 0)
+  {
+    throw std::runtime_error("PackedMask::FromMask: the region must be inside of the mask!");
+  }
+
+  PackedMask packed(region);
+  const unsigned int width = region.GetSize()[0];
+  const Mask::PixelType holeValue = mask->GetHoleValue();
+
+  Parallel::ForBlocks(region.GetSize()[1], RowsPerBlock, [&](const unsigned int begin, const unsigned int end)
+  {
+    for(unsigned int row = begin; row < end; ++row)
+    {
+      itk::Index<2> rowStart = {{region.GetIndex()[0], region.GetIndex()[1] + static_cast<itk::IndexValueType>(row)}};
+      const Mask::PixelType* pixel = mask->GetBufferPointer() + mask->ComputeOffset(rowStart);
+      WordType* words = packed.GetRow(rowStart[1]);
+
+      for(unsigned int column = 0; column < width; column += BitsPerWord)
+      {
+        words[column / BitsPerWord] = PackPixels(pixel + column, std::min(BitsPerWord, width - column), holeValue);
+      }
+    }
+  });
+
+  return packed;
+}
+
+PackedMask PackedMask::FromMask(const Mask* const mask)
+{
+  return FromMask(mask, mask->GetLargestPossibleRegion());
+}
+
+PackedMask PackedMask::FromBuffer(const unsigned char* const buffer, const std::ptrdiff_t rowStride,
+                                  const itk::ImageRegion<2>& region, const unsigned char holeValue)
+{
+  PackedMask packed(region);
+  const unsigned int width = region.GetSize()[0];
+
+  Parallel::ForBlocks(region.GetSize()[1], RowsPerBlock, [&](const unsigned int begin, const unsigned int end)
+  {
+    for(unsigned int row = begin; row < end; ++row)
+    {
+      const unsigned char* pixel = buffer + row * rowStride;
+      WordType* words = packed.GetRow(region.GetIndex()[1] + row);
+
+      for(unsigned int column = 0; column < width; column += BitsPerWord)
+      {
+        words[column / BitsPerWord] = PackPixels(pixel + column, std::min(BitsPerWord, width - column), holeValue);
+      }
+    }
+  });
+
+  return packed;
+}
+
+void PackedMask::SetHole(const itk::Index<2>& index, const bool hole)
+{
+  const std::size_t bit = index[0] - this->Region.GetIndex()[0];
+  WordType& word = GetRow(index[1])[bit / BitsPerWord];
+  const WordType bitMask = WordType(1) << (bit % BitsPerWord);
+  word = hole ? (word | bitMask) : (word & ~bitMask);
+}
+
+void PackedMask::Assign(const Mask* const mask, const itk::ImageRegion<2>& region)
+{
+  Paste(FromMask(mask, region));
+}
+
+PackedMask PackedMask::Extract(const itk::ImageRegion<2>& region) const
+{
+  if(!this->Region.IsInside(region) && region.GetNumberOfPixels() > 0)
+  {
+    throw std::runtime_error("PackedMask::Extract: the region must be inside of the mask!");
+  }
+
+  PackedMask patch(region);
+  if(region.GetNumberOfPixels() == 0)
+  {
+    return patch;
+  }
+
+  const std::size_t offset = region.GetIndex()[0] - this->Region.GetIndex()[0];
+  const WordType lastWordMask = patch.GetLastWordMask();
+  for(unsigned int row = 0; row < region.GetSize()[1]; ++row)
+  {
+    const itk::IndexValueType y = region.GetIndex()[1] + row;
+    const WordType* source = GetRow(y);
+    WordType* target = patch.GetRow(y);
+    for(std::size_t word = 0; word < patch.WordsPerRow; ++word)
+    {
+      target[word] = ReadBits(source, this->WordsPerRow, offset + word * BitsPerWord);
+    }
+    target[patch.WordsPerRow - 1] &= lastWordMask;
+  }
+
+  return patch;
+}
+
+void PackedMask::Paste(const PackedMask& patch)
+{
+  const itk::ImageRegion<2>& region = patch.GetRegion();
+  if(region.GetNumberOfPixels() == 0)
+  {
+    return;
+  }
+  if(!this->Region.IsInside(region))
+  {
+    throw std::runtime_error("PackedMask::Paste: the patch must be inside of the mask!");
+  }
+
+  const std::size_t offset = region.GetIndex()[0] - this->Region.GetIndex()[0];
+  const WordType lastWordMask = patch.GetLastWordMask();
+  for(unsigned int row = 0; row < region.GetSize()[1]; ++row)
+  {
+    const itk::IndexValueType y = region.GetIndex()[1] + row;
+    const WordType* source = patch.GetRow(y);
+    WordType* target = GetRow(y);
+    for(std::size_t word = 0; word < patch.WordsPerRow; ++word)
+    {
+      const WordType valueMask = word + 1 == patch.WordsPerRow ? lastWordMask : AllBits;
+      WriteBits(target, offset + word * BitsPerWord, source[word], valueMask);
+    }
+  }
+}
+
+unsigned int PackedMask::CountHolePixels() const
+{
+  unsigned int count = 0;
+  for(std::size_t word = 0; word < this->Words.size(); ++word)
+  {
+    count += std::bitset<BitsPerWord>(this->Words[word]).count();
+  }
+  return count;
+}
+
+itk::ImageRegion<2> PackedMask::GetHoleBoundingBox() const
+{
+  std::size_t lowerColumn = this->Region.GetSize()[0];
+  std::size_t upperColumn = 0;
+  itk::IndexValueType lowerRow = 0;
+  itk::IndexValueType upperRow = 0;
+  bool found = false;
+
+  for(unsigned int row = 0; row < this->Region.GetSize()[1]; ++row)
+  {
+    const WordType* words = this->Words.data() + row * this->WordsPerRow;
+    const WordType* first = std::find_if(words, words + this->WordsPerRow,
+                                         [](const WordType word) { return word != 0; });
+    if(first == words + this->WordsPerRow)
+    {
+      continue;
+    }
+
+    const WordType* last = words + this->WordsPerRow - 1;
+    while(*last == 0)
+    {
+      --last;
+    }
+
+    lowerColumn = std::min<std::size_t>(lowerColumn, (first - words) * BitsPerWord + CountTrailingZeros(*first));
+    upperColumn = std::max<std::size_t>(upperColumn,
+                                        (last - words) * BitsPerWord + BitsPerWord - 1 - CountLeadingZeros(*last));
+    if(!found)
+    {
+      lowerRow = row;
+      found = true;
+    }
+    upperRow = row;
+  }
+
+  if(!found)
+  {
+    return itk::ImageRegion<2>(this->Region.GetIndex(), itk::Size<2>({{0, 0}}));
+  }
+
+  itk::Index<2> corner = {{this->Region.GetIndex()[0] + static_cast<itk::IndexValueType>(lowerColumn),
+                           this->Region.GetIndex()[1] + lowerRow}};
+  itk::Size<2> size = {{static_cast<itk::SizeValueType>(upperColumn - lowerColumn + 1),
+                        static_cast<itk::SizeValueType>(upperRow - lowerRow + 1)}};
+  return itk::ImageRegion<2>(corner, size);
+}
+
+void PackedMask::ForEachHoleSpan(const itk::ImageRegion<2>& region,
+                                 const std::function<void(const itk::Index<2>&, const unsigned int)>& function) const
+{
+  itk::ImageRegion<2> scannedRegion = region;
+  if(!scannedRegion.Crop(this->Region))
+  {
+    return;
+  }
+
+  const std::size_t begin = scannedRegion.GetIndex()[0] - this->Region.GetIndex()[0];
+  const std::size_t end = begin + scannedRegion.GetSize()[0];
+
+  for(unsigned int row = 0; row < scannedRegion.GetSize()[1]; ++row)
+  {
+    const itk::IndexValueType y = scannedRegion.GetIndex()[1] + row;
+    const WordType* words = GetRow(y);
+
+    std::size_t column = begin;
+    while(column < end)
+    {
+      // Skip valid pixels a word at a time.
+      WordType holes = ReadBits(words, this->WordsPerRow, column) & LowBits(end - column);
+      if(!holes)
+      {
+        column += BitsPerWord;
+        continue;
+      }
+      column += CountTrailingZeros(holes);
+
+      // Then measure the run of hole pixels the same way.
+      const std::size_t spanStart = column;
+      while(column < end)
+      {
+        const WordType valid = ~ReadBits(words, this->WordsPerRow, column) & LowBits(end - column);
+        if(valid)
+        {
+          column += CountTrailingZeros(valid);
+          break;
+        }
+        column = std::min(end, column + BitsPerWord);
+      }
+
+      itk::Index<2> start = {{this->Region.GetIndex()[0] + static_cast<itk::IndexValueType>(spanStart), y}};
+      function(start, column - spanStart);
+    }
+  }
+}
+
+PackedMask PackedMask::Xor(const PackedMask& other) const
+{
+  if(this->Region != other.Region)
+  {
+    throw std::runtime_error("PackedMask::Xor: the masks must have the same region!");
+  }
+
+  PackedMask result(this->Region);
+  for(std::size_t word = 0; word < this->Words.size(); ++word)
+  {
+    result.Words[word] = this->Words[word] ^ other.Words[word];
+  }
+  return result;
+}
+
+namespace
+{
+  /** Combine the four neighbors of every pixel with AND ('intersect') or OR. Pixels outside of
+    * the mask are holes for AND and valid for OR, so they never change the result. */
+  PackedMask CombineNeighbors(const PackedMask& mask, const std::size_t wordsPerRow,
+                              const WordType lastWordMask, const bool intersect)
+  {
+    const itk::ImageRegion<2>& region = mask.GetRegion();
+    const unsigned int height = region.GetSize()[1];
+    const WordType outside = intersect ? AllBits : 0;
+    const WordType* words = mask.GetBufferPointer();
+
+    // The words of a row, with the bits past its end read as 'outside'.
+    auto readWord = [&](const long long row, const long long word) -> WordType
+    {
+      if(row < 0 || row >= static_cast<long long>(height) || word < 0 || word >= static_cast<long long>(wordsPerRow))
+      {
+        return outside;
+      }
+      WordType value = words[row * wordsPerRow + word];
+      if(word + 1 == static_cast<long long>(wordsPerRow))
+      {
+        value |= outside & ~lastWordMask;
+      }
+      return value;
+    };
+
+    PackedMask combined(region);
+    WordType* combinedWords = combined.GetBufferPointer();
+
+    Parallel::ForBlocks(height, RowsPerBlock, [&](const unsigned int begin, const unsigned int end)
+    {
+      for(long long row = begin; row < static_cast<long long>(end); ++row)
+      {
+        for(long long word = 0; word < static_cast<long long>(wordsPerRow); ++word)
+        {
+          const WordType center = readWord(row, word);
+          const WordType left = (center << 1) | (readWord(row, word - 1) >> (BitsPerWord - 1));
+          const WordType right = (center >> 1) | (readWord(row, word + 1) << (BitsPerWord - 1));
+          const WordType up = readWord(row - 1, word);
+          const WordType down = readWord(row + 1, word);
+
+          WordType value = intersect ? (left & right & up & down) : (left | right | up | down);
+          if(word + 1 == static_cast<long long>(wordsPerRow))
+          {
+            value &= lastWordMask;
+          }
+          combinedWords[row * wordsPerRow + word] = value;
+        }
+      }
+    });
+
+    return combined;
+  }
+}
+
+PackedMask PackedMask::GetInnerBoundary() const
+{
+  PackedMask boundary = CombineNeighbors(*this, this->WordsPerRow, GetLastWordMask(), true);
+  for(std::size_t word = 0; word < this->Words.size(); ++word)
+  {
+    boundary.Words[word] = this->Words[word] & ~boundary.Words[word];
+  }
+  return boundary;
+}
+
+PackedMask PackedMask::GetOuterBoundary() const
+{
+  PackedMask boundary = CombineNeighbors(*this, this->WordsPerRow, GetLastWordMask(), false);
+  for(std::size_t word = 0; word < this->Words.size(); ++word)
+  {
+    boundary.Words[word] &= ~this->Words[word];
+  }
+  return boundary;
+}
+
+std::size_t PackedMask::GetMemorySize() const
+{
+  return this->Words.size() * sizeof(WordType);
+}
+
+PackedMask::WordType PackedMask::GetLastWordMask() const
+{
+  return LowBits(this->Region.GetSize()[0] - (this->WordsPerRow - 1) * BitsPerWord);
+}
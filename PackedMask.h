@@ -0,0 +1,143 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+/** This class stores the hole pixels of a Mask with one bit per pixel. Every row of
+  * Region is packed into whole 64 bit words (bit b of word w is column 64 w + b), so
+  * counting, comparing and scanning for hole pixels work on 64 pixels at a time and
+  * valid areas are skipped a word at a time. It takes 1/8 of the memory of a Mask.
+  * Bits beyond the end of a row are always zero.
+  */
+
+#ifndef PackedMask_H
+#define PackedMask_H
+
+// ITK
+#include "itkImageRegion.h"
+
+// Submodules
+#include "Mask/Mask.h"
+
+// STL
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+class PackedMask
+{
+public:
+  typedef uint64_t WordType;
+  static const unsigned int BitsPerWord = 64;
+
+  /** An empty mask. */
+  PackedMask();
+
+  /** A mask of 'region' without any hole pixels. */
+  explicit PackedMask(const itk::ImageRegion<2>& region);
+
+  /** Pack the hole pixels of 'region' of 'mask', which must be inside of the mask. */
+  static PackedMask FromMask(const Mask* const mask, const itk::ImageRegion<2>& region);
+
+  /** Pack the whole mask. */
+  static PackedMask FromMask(const Mask* const mask);
+
+  /** Pack a caller's buffer of one byte pixels, 'rowStride' bytes apart, whose first pixel is
+    * the corner of 'region'. Pixels equal to 'holeValue' are holes. */
+  static PackedMask FromBuffer(const unsigned char* const buffer, const std::ptrdiff_t rowStride,
+                               const itk::ImageRegion<2>& region, const unsigned char holeValue);
+
+  const itk::ImageRegion<2>& GetRegion() const
+  {
+    return this->Region;
+  }
+
+  bool IsHole(const itk::Index<2>& index) const
+  {
+    const std::size_t bit = index[0] - this->Region.GetIndex()[0];
+    return (GetRow(index[1])[bit / BitsPerWord] >> (bit % BitsPerWord)) & 1;
+  }
+
+  void SetHole(const itk::Index<2>& index, const bool hole);
+
+  /** Set the pixels of 'region' (inside of both masks) from 'mask'. */
+  void Assign(const Mask* const mask, const itk::ImageRegion<2>& region);
+
+  /** Copy 'region' (inside of Region) into a mask of its own. */
+  PackedMask Extract(const itk::ImageRegion<2>& region) const;
+
+  /** Overwrite the pixels of patch.GetRegion(), which must be inside of Region, with 'patch'. */
+  void Paste(const PackedMask& patch);
+
+  unsigned int CountHolePixels() const;
+
+  /** The bounding box of the hole pixels; empty (with the index of Region) if there are none. */
+  itk::ImageRegion<2> GetHoleBoundingBox() const;
+
+  /** Call function(start, length) for every horizontal run of hole pixels of 'region'
+    * (clipped to Region), row by row from left to right. */
+  void ForEachHoleSpan(const itk::ImageRegion<2>& region,
+                       const std::function<void(const itk::Index<2>&, const unsigned int)>& function) const;
+
+  /** The pixels that are a hole in exactly one of the two masks, which must have the same region. */
+  PackedMask Xor(const PackedMask& other) const;
+
+  /** The hole pixels that have a valid 4-neighbor. Neighbors outside of Region are not valid. */
+  PackedMask GetInnerBoundary() const;
+
+  /** The valid pixels that have a hole 4-neighbor: the fixed pixels of a fill of the hole. */
+  PackedMask GetOuterBoundary() const;
+
+  std::size_t GetMemorySize() const;
+
+  /** The packed rows, WordsPerRow words each. */
+  WordType* GetBufferPointer()
+  {
+    return this->Words.data();
+  }
+
+  const WordType* GetBufferPointer() const
+  {
+    return this->Words.data();
+  }
+
+  std::size_t GetNumberOfWords() const
+  {
+    return this->Words.size();
+  }
+
+protected:
+
+  const WordType* GetRow(const itk::IndexValueType row) const
+  {
+    return this->Words.data() + (row - this->Region.GetIndex()[1]) * this->WordsPerRow;
+  }
+
+  WordType* GetRow(const itk::IndexValueType row)
+  {
+    return this->Words.data() + (row - this->Region.GetIndex()[1]) * this->WordsPerRow;
+  }
+
+  /** The bits of the last word of a row that are inside of the row. */
+  WordType GetLastWordMask() const;
+
+  itk::ImageRegion<2> Region;
+  std::size_t WordsPerRow = 0;
+  std::vector<WordType> Words;
+};
+
+#endif
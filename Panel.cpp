@@ -67,11 +67,15 @@ void Panel::LoadAndDisplay()
                           .toString().toStdString();
   std::cout << "Loading file " << filename << std::endl;
 
-  if(Helpers::GetFileExtension(filename) == "mask")
+  // A .mask file is previewed with the image it refers to. Files whose header can't be read
+  // are not loaded at all.
+  this->Information = ImageInformation::Get(filename);
+  filename = ImageInformation::GetImageFileName(filename);
+  if(!this->Information.Valid)
   {
-    QFileInfo fileInfo(filename.c_str());
-    QString filePath = fileInfo.absolutePath();
-    filename = filePath.toStdString() + "/" + Mask::GetFilenameFromMaskFile(filename);
+    this->GraphicsScene->clear();
+    this->GraphicsScene->addText(QString("Can't read this file: %1").arg(this->Information.Error.c_str()));
+    return;
   }
 
   reader->SetFileName(filename);
@@ -23,6 +23,7 @@
 
 // Custom
 #include "FileSelectionWidget.h"
+#include "ImageInformation.h"
 
 // Qt
 #include <QDialog>
@@ -48,6 +49,9 @@ public:
 
   ImageType::Pointer Image;
 
+  /** The header of the selected file, read when it was selected. */
+  ImageInformation::Information Information;
+
   QGraphicsView* GraphicsView;
   QVBoxLayout* Layout;
   QLabel* Label;
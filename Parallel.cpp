@@ -0,0 +1,395 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "Parallel.h"
+
+#if defined(PARALLEL_BACKEND_TBB)
+  // TBB
+  #include <tbb/blocked_range.h>
+  #include <tbb/parallel_for.h>
+  #include <tbb/task_arena.h>
+#elif defined(PARALLEL_BACKEND_ITK)
+  // ITK
+  #include "itkVersion.h"
+  #if ITK_VERSION_MAJOR >= 5
+    #include "itkMultiThreaderBase.h"
+  #else
+    #include "itkMultiThreader.h"
+  #endif
+#endif
+
+// STL
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace Parallel
+{
+
+namespace
+{
+  std::atomic<unsigned int> NumberOfThreadsSetting(0);
+
+  /** The number of threads of the innermost ThreadLimit of the thread, or 0. */
+  thread_local unsigned int ThreadLimitSetting = 0;
+
+  /** Set while the thread runs a block or a task, so that nested loops run serially. */
+  thread_local bool InsideParallelRegion = false;
+
+  class ParallelRegionScope
+  {
+  public:
+    ParallelRegionScope() : Previous(InsideParallelRegion)
+    {
+      InsideParallelRegion = true;
+    }
+
+    ~ParallelRegionScope()
+    {
+      InsideParallelRegion = this->Previous;
+    }
+
+  private:
+    bool Previous;
+  };
+
+  /** Keeps the first exception thrown by any of the threads. */
+  class ErrorCollector
+  {
+  public:
+    void Capture()
+    {
+      std::lock_guard<std::mutex> lock(this->Mutex);
+      if(!this->Error)
+      {
+        this->Error = std::current_exception();
+      }
+    }
+
+    void Rethrow() const
+    {
+      if(this->Error)
+      {
+        std::rethrow_exception(this->Error);
+      }
+    }
+
+  private:
+    std::mutex Mutex;
+    std::exception_ptr Error;
+  };
+
+  unsigned int GetDefaultNumberOfThreads()
+  {
+    const char* environmentThreads = std::getenv("POISSON_EDITING_THREADS");
+    if(environmentThreads && std::atoi(environmentThreads) > 0)
+    {
+      return std::atoi(environmentThreads);
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+  }
+
+#if defined(PARALLEL_BACKEND_ITK) && ITK_VERSION_MAJOR < 5
+  ITK_THREAD_RETURN_TYPE RunWorker(void* argument)
+  {
+    itk::MultiThreader::ThreadInfoStruct* threadInfo =
+        static_cast<itk::MultiThreader::ThreadInfoStruct*>(argument);
+    (*static_cast<const std::function<void()>*>(threadInfo->UserData))();
+    return ITK_THREAD_RETURN_VALUE;
+  }
+#elif !defined(PARALLEL_BACKEND_TBB) && !defined(PARALLEL_BACKEND_OPENMP) && !defined(PARALLEL_BACKEND_ITK)
+  /** Threads that are started once and run the helpers of every parallel loop, since most
+    * loops are too short to pay for starting threads. */
+  class ThreadPool
+  {
+  public:
+    ~ThreadPool()
+    {
+      {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        this->Stopping = true;
+      }
+      this->TaskAdded.notify_all();
+      for(unsigned int thread = 0; thread < this->Threads.size(); ++thread)
+      {
+        this->Threads[thread].join();
+      }
+    }
+
+    /** Run 'task' on 'numberOfThreads' threads of the pool, starting more threads if needed. */
+    void Run(const std::function<void()>& task, const unsigned int numberOfThreads)
+    {
+      {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        while(this->Threads.size() < numberOfThreads)
+        {
+          this->Threads.push_back(std::thread(&ThreadPool::RunThread, this));
+        }
+        this->Tasks.insert(this->Tasks.end(), numberOfThreads, task);
+      }
+      this->TaskAdded.notify_all();
+    }
+
+  private:
+    void RunThread()
+    {
+      std::unique_lock<std::mutex> lock(this->Mutex);
+      while(true)
+      {
+        this->TaskAdded.wait(lock, [this]() { return this->Stopping || !this->Tasks.empty(); });
+        if(this->Stopping)
+        {
+          return;
+        }
+
+        const std::function<void()> task = this->Tasks.front();
+        this->Tasks.pop_front();
+        lock.unlock();
+        task();
+        lock.lock();
+      }
+    }
+
+    std::mutex Mutex;
+    std::condition_variable TaskAdded;
+    std::deque<std::function<void()> > Tasks;
+    std::vector<std::thread> Threads;
+    bool Stopping = false;
+  };
+
+  ThreadPool& GetThreadPool()
+  {
+    static ThreadPool threadPool;
+    return threadPool;
+  }
+
+  /** The helpers of one loop. The pool may be busy with another loop, so a helper can start
+    * after the loop has finished; it then returns without touching the loop, which is gone. */
+  class Helpers
+  {
+  public:
+    explicit Helpers(const std::function<void()>& worker) : Worker(&worker)
+    {
+    }
+
+    void RunHelper()
+    {
+      {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        if(this->Finished)
+        {
+          return;
+        }
+        this->NumberOfRunningHelpers++;
+      }
+
+      (*this->Worker)();
+
+      std::lock_guard<std::mutex> lock(this->Mutex);
+      if(--this->NumberOfRunningHelpers == 0)
+      {
+        this->HelpersDone.notify_all();
+      }
+    }
+
+    /** Keep helpers from starting, and wait for the ones that have started. */
+    void Finish()
+    {
+      std::unique_lock<std::mutex> lock(this->Mutex);
+      this->Finished = true;
+      this->HelpersDone.wait(lock, [this]() { return this->NumberOfRunningHelpers == 0; });
+    }
+
+  private:
+    const std::function<void()>* Worker;
+    std::mutex Mutex;
+    std::condition_variable HelpersDone;
+    unsigned int NumberOfRunningHelpers = 0;
+    bool Finished = false;
+  };
+#endif
+}
+
+void SetNumberOfThreads(const unsigned int numberOfThreads)
+{
+  NumberOfThreadsSetting = numberOfThreads;
+}
+
+unsigned int GetNumberOfThreads()
+{
+  if(ThreadLimitSetting > 0)
+  {
+    return ThreadLimitSetting;
+  }
+
+  static const unsigned int defaultNumberOfThreads = GetDefaultNumberOfThreads();
+  const unsigned int numberOfThreads = NumberOfThreadsSetting;
+  return numberOfThreads > 0 ? numberOfThreads : defaultNumberOfThreads;
+}
+
+ThreadLimit::ThreadLimit(const unsigned int numberOfThreads) : Previous(ThreadLimitSetting)
+{
+  ThreadLimitSetting = numberOfThreads;
+}
+
+ThreadLimit::~ThreadLimit()
+{
+  ThreadLimitSetting = this->Previous;
+}
+
+const char* GetBackendName()
+{
+#if defined(PARALLEL_BACKEND_TBB)
+  return "TBB";
+#elif defined(PARALLEL_BACKEND_OPENMP)
+  return "OpenMP";
+#elif defined(PARALLEL_BACKEND_ITK)
+  return "ITK";
+#else
+  return "Threads";
+#endif
+}
+
+void ForBlocks(const unsigned int numberOfItems, const unsigned int blockSize,
+               const std::function<void(const unsigned int, const unsigned int)>& function)
+{
+  const unsigned int numberOfBlocks = (numberOfItems + blockSize - 1) / blockSize;
+  const unsigned int numberOfThreads = std::min(GetNumberOfThreads(), numberOfBlocks);
+
+  bool serial = numberOfThreads <= 1;
+#if !defined(PARALLEL_BACKEND_TBB)
+  serial = serial || InsideParallelRegion;
+#endif
+
+  if(serial)
+  {
+    for(unsigned int block = 0; block < numberOfBlocks; ++block)
+    {
+      function(block * blockSize, std::min(numberOfItems, (block + 1) * blockSize));
+    }
+    return;
+  }
+
+  ErrorCollector errors;
+  auto runBlock = [&](const unsigned int block)
+  {
+    ParallelRegionScope scope;
+    try
+    {
+      function(block * blockSize, std::min(numberOfItems, (block + 1) * blockSize));
+    }
+    catch(...)
+    {
+      errors.Capture();
+    }
+  };
+
+#if defined(PARALLEL_BACKEND_TBB)
+  tbb::task_arena arena(numberOfThreads);
+  arena.execute([&]()
+  {
+    tbb::parallel_for(tbb::blocked_range<unsigned int>(0, numberOfBlocks, 1),
+                      [&](const tbb::blocked_range<unsigned int>& blocks)
+    {
+      for(unsigned int block = blocks.begin(); block < blocks.end(); ++block)
+      {
+        runBlock(block);
+      }
+    });
+  });
+#elif defined(PARALLEL_BACKEND_OPENMP)
+  #pragma omp parallel for schedule(dynamic, 1) num_threads(numberOfThreads)
+  for(int block = 0; block < static_cast<int>(numberOfBlocks); ++block)
+  {
+    runBlock(block);
+  }
+#elif defined(PARALLEL_BACKEND_ITK) && ITK_VERSION_MAJOR >= 5
+  itk::MultiThreaderBase::Pointer threader = itk::MultiThreaderBase::New();
+  threader->SetMaximumNumberOfThreads(numberOfThreads);
+  threader->SetNumberOfWorkUnits(numberOfThreads);
+  threader->ParallelizeArray(0, numberOfBlocks, [&](const itk::SizeValueType block)
+  {
+    runBlock(block);
+  }, nullptr);
+#else
+  // The threads take the next block until there are none left.
+  std::atomic<unsigned int> nextBlock(0);
+  const std::function<void()> worker = [&]()
+  {
+    for(unsigned int block = nextBlock++; block < numberOfBlocks; block = nextBlock++)
+    {
+      runBlock(block);
+    }
+  };
+
+  #if defined(PARALLEL_BACKEND_ITK)
+  itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+  threader->SetNumberOfThreads(numberOfThreads);
+  threader->SetSingleMethod(RunWorker, const_cast<std::function<void()>*>(&worker));
+  threader->SingleMethodExecute();
+  #else
+  // This thread works on the blocks too, helped by threads of the pool.
+  std::shared_ptr<Helpers> helpers = std::make_shared<Helpers>(worker);
+  GetThreadPool().Run([helpers]() { helpers->RunHelper(); }, numberOfThreads - 1);
+  worker();
+  helpers->Finish();
+  #endif
+#endif
+
+  errors.Rethrow();
+}
+
+void ForRows(const itk::ImageRegion<2>& region, const unsigned int rowsPerBlock,
+             const std::function<void(const itk::ImageRegion<2>&)>& function)
+{
+  ForBlocks(region.GetSize()[1], rowsPerBlock, [&](const unsigned int begin, const unsigned int end)
+  {
+    itk::Index<2> rowsCorner = region.GetIndex();
+    rowsCorner[1] += begin;
+    itk::Size<2> rowsSize = region.GetSize();
+    rowsSize[1] = end - begin;
+    function(itk::ImageRegion<2>(rowsCorner, rowsSize));
+  });
+}
+
+void TaskGroup::Run(const std::function<void()>& task)
+{
+  this->Tasks.push_back(task);
+}
+
+void TaskGroup::Wait()
+{
+  std::vector<std::function<void()> > tasks;
+  tasks.swap(this->Tasks);
+
+  ForBlocks(tasks.size(), 1, [&](const unsigned int begin, const unsigned int end)
+  {
+    for(unsigned int taskId = begin; taskId < end; ++taskId)
+    {
+      tasks[taskId]();
+    }
+  });
+}
+
+} // end namespace
@@ -0,0 +1,88 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+/** The execution backend of the pipeline. Every stage that works on independent rows,
+  * unknowns or layers goes through these functions, so that one setting decides how many
+  * cores the whole pipeline uses. The backend (std::thread, OpenMP, TBB or the ITK
+  * MultiThreader) is chosen with PoissonEditing_PARALLEL_BACKEND when configuring; the
+  * std::thread backend starts its threads once and reuses them for every loop.
+  * Loops started from inside a parallel loop or task run serially on the calling thread,
+  * except with TBB, which schedules nested work itself.
+  */
+
+#ifndef Parallel_H
+#define Parallel_H
+
+// ITK
+#include "itkImageRegion.h"
+
+// STL
+#include <functional>
+#include <vector>
+
+namespace Parallel
+{
+  /** The number of threads every parallel loop may use. 0 (the default) means one per core,
+    * unless the environment variable POISSON_EDITING_THREADS is set. Within a ThreadLimit,
+    * GetNumberOfThreads() returns the limit of the calling thread. */
+  void SetNumberOfThreads(const unsigned int numberOfThreads);
+  unsigned int GetNumberOfThreads();
+
+  /** While it exists, the loops started by the calling thread use 'numberOfThreads' threads
+    * (0 for the setting above). Loops started by other threads are not affected, so concurrent
+    * solves can each run on their own number of threads. */
+  class ThreadLimit
+  {
+  public:
+    explicit ThreadLimit(const unsigned int numberOfThreads);
+    ~ThreadLimit();
+
+  private:
+    unsigned int Previous;
+  };
+
+  /** The name of the backend this was built with. */
+  const char* GetBackendName();
+
+  /** Call function(begin, end) for consecutive blocks of [0, numberOfItems) on all threads.
+    * The output of a block must only depend on its range, which keeps results deterministic.
+    * The first exception thrown by a block is rethrown once all blocks have finished. */
+  void ForBlocks(const unsigned int numberOfItems, const unsigned int blockSize,
+                 const std::function<void(const unsigned int, const unsigned int)>& function);
+
+  /** Call function(rows) for bands of at most 'rowsPerBlock' rows of 'region' on all threads. */
+  void ForRows(const itk::ImageRegion<2>& region, const unsigned int rowsPerBlock,
+               const std::function<void(const itk::ImageRegion<2>&)>& function);
+
+  /** Independent tasks that are run concurrently by Wait(). */
+  class TaskGroup
+  {
+  public:
+    /** Add a task. Tasks that were not waited for are dropped with the group. */
+    void Run(const std::function<void()>& task);
+
+    /** Run the tasks added since the last Wait() and return when all of them are done.
+      * The first exception thrown by a task is rethrown. */
+    void Wait();
+
+  protected:
+    std::vector<std::function<void()> > Tasks;
+  };
+}
+
+#endif
@@ -0,0 +1,62 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+/** This application clones a source image into every frame of a numbered image sequence,
+  * with the source at the same position in every frame. It is the batch counterpart of
+  * PoissonCloningInteractive: find the position there, then run the whole sequence here.
+  *
+  * PoissonCloningSequence source.png mask.mask target%04d.png output%04d.png firstFrame lastFrame x y [mixed]
+  *
+  * The source may also be a pattern, to clone a moving source frame by frame.
+  */
+
+// Custom
+#include "CloneSequence.h"
+
+// STL
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+int main(int argc, char** argv)
+{
+  std::cout << "PoissonCloningSequence" << std::endl;
+  if(argc != 9 && argc != 10)
+  {
+    std::cerr << "Required arguments: source mask targetPattern outputPattern firstFrame lastFrame x y [mixed]"
+              << std::endl;
+    throw std::runtime_error("Invalid arguments!");
+  }
+
+  CloneSequence::Settings settings;
+  settings.SourcePattern = argv[1];
+  settings.MaskFileName = argv[2];
+  settings.TargetPattern = argv[3];
+  settings.OutputPattern = argv[4];
+  settings.FirstFrame = std::atoi(argv[5]);
+  settings.LastFrame = std::atoi(argv[6]);
+  settings.Corner[0] = std::atoi(argv[7]);
+  settings.Corner[1] = std::atoi(argv[8]);
+  settings.Mixed = (argc == 10 && std::string(argv[9]) == "mixed");
+
+  unsigned int numberOfFrames = CloneSequence::Run(settings);
+  std::cout << "Wrote " << numberOfFrames << " frames." << std::endl;
+
+  return EXIT_SUCCESS;
+}
@@ -19,17 +19,18 @@
 #include "PoissonCloningWidget.h"
 
 // Custom
+#include "ConvolutionPyramid.h"
+#include "EditHistory.h"
+#include "ImageDisplay.h"
 #include "ImageFileSelector.h"
+#include "Parallel.h"
+#include "TiledImageItem.h"
 
 // Submodules
 #include "Helpers/Helpers.h"
 #include "QtHelpers/QtHelpers.h"
-#include "ITKQtHelpers/ITKQtHelpers.h"
 #include "ITKHelpers/ITKHelpers.h"
 #include "Mask/Mask.h"
-#include "Mask/MaskQt.h"
-#include "PoissonEditing/PoissonEditing.h"
-#include "PoissonEditing/PoissonEditingWrappers.h"
 
 // ITK
 #include "itkImageFileReader.h"
@@ -37,9 +38,12 @@
 #include "itkPasteImageFilter.h"
 
 // Qt
+#include <QApplication>
+#include <QDesktopWidget>
 #include <QIcon>
 #include <QFileDialog>
 #include <QGraphicsPixmapItem>
+#include <QInputDialog>
 #include <QTimer>
 #include <QtConcurrentRun>
 
@@ -65,14 +69,18 @@ PoissonCloningWidget::PoissonCloningWidget() : QMainWindow()
 
   connect(&this->FutureWatcher, SIGNAL(finished()), this, SLOT(slot_finished()));
   connect(&this->FutureWatcher, SIGNAL(finished()), this->ProgressDialog , SLOT(cancel()));
+  connect(&this->ExportWatcher, SIGNAL(finished()), this, SLOT(slot_exportFinished()));
+
+  this->DragPreviewTimer.setSingleShot(true);
+  this->DragPreviewTimer.setInterval(30);
+  connect(&this->DragPreviewTimer, SIGNAL(timeout()), this, SLOT(slot_dragPreview()));
   
-  this->SourceImage = ImageType::New();
   this->TargetImage = ImageType::New();
-  this->MaskImage = Mask::New();
   this->ResultImage = ImageType::New();
 
   this->InputScene = new QGraphicsScene;
   this->graphicsViewInputImage->setScene(this->InputScene);
+  connect(this->InputScene, SIGNAL(changed(const QList<QRectF>&)), this, SLOT(slot_inputSceneChanged()));
 
   this->ResultScene = new QGraphicsScene;
   this->graphicsViewResultImage->setScene(this->ResultScene);
@@ -80,22 +88,22 @@ PoissonCloningWidget::PoissonCloningWidget() : QMainWindow()
 
 void PoissonCloningWidget::showEvent(QShowEvent* )
 {
-  if(SourceImagePixmapItem && TargetImagePixmapItem)
+  if(!this->Layers.empty() && this->TargetImageItem)
   {
-    this->graphicsViewInputImage->fitInView(this->TargetImagePixmapItem,
+    this->graphicsViewInputImage->fitInView(this->TargetImageItem,
                                             Qt::KeepAspectRatio);
-    this->graphicsViewResultImage->fitInView(this->TargetImagePixmapItem,
+    this->graphicsViewResultImage->fitInView(this->TargetImageItem,
                                             Qt::KeepAspectRatio);
   }
 }
 
 void PoissonCloningWidget::resizeEvent(QResizeEvent* )
 {
-  if(this->SourceImagePixmapItem && this->TargetImagePixmapItem)
+  if(!this->Layers.empty() && this->TargetImageItem)
   {
-    this->graphicsViewInputImage->fitInView(this->TargetImagePixmapItem,
+    this->graphicsViewInputImage->fitInView(this->TargetImageItem,
                                             Qt::KeepAspectRatio);
-    this->graphicsViewResultImage->fitInView(this->TargetImagePixmapItem,
+    this->graphicsViewResultImage->fitInView(this->TargetImageItem,
                                             Qt::KeepAspectRatio);
   }
 }
@@ -104,179 +112,269 @@ void PoissonCloningWidget::OpenImages(const std::string& sourceImageFileName,
                                       const std::string& targetImageFileName,
                                       const std::string& maskFileName)
 {
-  // Load the mask
-  this->MaskImage->Read(maskFileName);
-
-  // Load and display source image
-  typedef itk::ImageFileReader<ImageType> ImageReaderType;
-  ImageReaderType::Pointer sourceImageReader =
-      ImageReaderType::New();
-  sourceImageReader->SetFileName(sourceImageFileName);
-  sourceImageReader->Update();
-
-  ITKHelpers::DeepCopy(sourceImageReader->GetOutput(),
-                       this->SourceImage.GetPointer());
+  // Opening new images starts a new composition.
+  this->InputScene->clear();
+  this->ResultScene->clear();
+  this->TargetImageItem = nullptr;
+  this->ResultTargetItem = nullptr;
+  this->ResultPixmapItem = nullptr;
+  this->Layers.clear();
 
-  QImage qimageSourceImage =
-//      ITKQtHelpers::GetQImageColor(this->SourceImage.GetPointer(), QImage::Format_RGB888);
-      ITKQtHelpers::GetQImageColor(this->SourceImage.GetPointer(),
-                                   QImage::Format_ARGB32);
-  qimageSourceImage =
-      MaskQt::SetPixelsToTransparent(qimageSourceImage,
-                                     this->MaskImage, HoleMaskPixelTypeEnum::VALID);
-  this->SourceImagePixmapItem =
-    this->InputScene->addPixmap(QPixmap::fromImage(qimageSourceImage));
-  this->SourceImagePixmapItem->setFlag(QGraphicsItem::ItemIsMovable);
+  this->TargetImageFileName = targetImageFileName;
 
   // Load and display target image
+  typedef itk::ImageFileReader<ImageType> ImageReaderType;
   ImageReaderType::Pointer targetImageReader = ImageReaderType::New();
   targetImageReader->SetFileName(targetImageFileName);
   targetImageReader->Update();
 
+  // A new image, so that a result that is still being saved keeps the previous target.
+  this->TargetImage = ImageType::New();
   ITKHelpers::DeepCopy(targetImageReader->GetOutput(),
                        this->TargetImage.GetPointer());
+  this->TargetHash = ImageCache<ImageType>::HashImage(this->TargetImage.GetPointer());
+  this->DisplayFactor =
+      ImageDisplay::ComputeProxyFactor(this->TargetImage->GetLargestPossibleRegion().GetSize(),
+                                       QApplication::desktop()->screenGeometry(this).size());
+
+  // TargetImage is never modified, so its tiles stay valid until the next image is opened.
+  this->TargetImageItem = new TiledImageItem(this->TargetImage);
+  this->InputScene->addItem(this->TargetImageItem);
+  this->InputScene->setSceneRect(this->TargetImageItem->boundingRect());
+
+  // The result scene shows the target, with the cloned region drawn over it after each clone.
+  this->ResultTargetItem = new TiledImageItem(this->TargetImage);
+  this->ResultScene->addItem(this->ResultTargetItem);
+  this->ResultScene->setSceneRect(this->ResultTargetItem->boundingRect());
+
+  // The history is stored relative to the target and starts with the target itself.
+  this->ResultImage = ImageType::New();
+  this->History.SetReference(this->TargetImage);
+  this->History.Push(this->TargetImage, itk::ImageRegion<2>());
+  this->HistoryResult = this->ResultImage;
 
-  QImage qimageTargetImage =
-      ITKQtHelpers::GetQImageColor(this->TargetImage.GetPointer(),
-                                   QImage::Format_RGB888);
-  this->TargetImagePixmapItem =
-      this->InputScene->addPixmap(QPixmap::fromImage(qimageTargetImage));
-  this->InputScene->setSceneRect(qimageTargetImage.rect());
-
-  // Size the result image
-  this->ResultScene->setSceneRect(qimageTargetImage.rect());
-
-  this->SourceImagePixmapItem->setZValue(this->TargetImagePixmapItem->zValue()+1); // make sure the source image is on top of the target image
+  AddLayer(sourceImageFileName, maskFileName);
 }
 
-void PoissonCloningWidget::on_btnClone_clicked()
+void PoissonCloningWidget::AddLayer(const std::string& sourceImageFileName,
+                                    const std::string& maskFileName)
 {
-  // Extract the portion of the target image the user has selected.
-  
-  this->SelectedRegionCorner[0] = this->SourceImagePixmapItem->pos().x();
-  this->SelectedRegionCorner[1] = this->SourceImagePixmapItem->pos().y();
-  
-  ImageType::RegionType desiredRegion(this->SelectedRegionCorner,
-                                      this->SourceImage->GetLargestPossibleRegion().GetSize());
+  this->SourceImageFileName = sourceImageFileName;
+  this->MaskImageFileName = maskFileName;
 
-  std::vector<PoissonEditingParent::GuidanceFieldType::Pointer> guidanceFields =
-      PoissonEditingParent::ComputeGuidanceField(this->SourceImage.GetPointer());
+  CloneLayer layer;
+  layer.SourceImageFileName = sourceImageFileName;
+  layer.MaskImageFileName = maskFileName;
 
-  ITKHelpers::WriteImage(this->SourceImage.GetPointer(), "source.mha");
-  ITKHelpers::WriteImage(guidanceFields[0].GetPointer(), "guidanceField.mha");
+  // Load the mask
+  layer.MaskImage = Mask::New();
+  layer.MaskImage->Read(maskFileName);
 
-  // We must get a function pointer to the overload that would be chosen by the compiler
-  // to pass to run().
+  // Load and display source image
+  typedef itk::ImageFileReader<ImageType> ImageReaderType;
+  ImageReaderType::Pointer sourceImageReader =
+      ImageReaderType::New();
+  sourceImageReader->SetFileName(sourceImageFileName);
+  sourceImageReader->Update();
 
-  void (*functionPointer)(const std::remove_pointer<decltype(this->TargetImage.GetPointer())>::type*,
-                          const std::remove_pointer<decltype(this->MaskImage.GetPointer())>::type*,
-                          const decltype(guidanceFields)&,
-                          decltype(this->ResultImage.GetPointer()),
-                          const itk::ImageRegion<2>&,
-                          const std::remove_pointer<decltype(this->SourceImage.GetPointer())>::type*)
-      = FillImage;
+  layer.SourceImage = ImageType::New();
+  ITKHelpers::DeepCopy(sourceImageReader->GetOutput(),
+                       layer.SourceImage.GetPointer());
 
-  auto functionToRun = std::bind(functionPointer,
-                                 this->TargetImage.GetPointer(),
-                                 this->MaskImage.GetPointer(),
-                                 guidanceFields,
-                                 this->ResultImage.GetPointer(),
-                                 desiredRegion,
-                                 this->SourceImage.GetPointer());
+  layer.SourceHash = ImageCache<ImageType>::HashImage(layer.SourceImage.GetPointer());
+  layer.MaskHash = ImageCache<ImageType>::HashImage(layer.MaskImage.GetPointer());
 
-  QFuture<void> future =
-      QtConcurrent::run(functionToRun);
+  // Only the hole of the source is shown; the valid pixels are transparent.
+  QImage qimageSourceImage =
+      ImageDisplay::GetProxy(layer.SourceImage.GetPointer(), layer.SourceImage->GetLargestPossibleRegion(),
+                             this->DisplayFactor, layer.MaskImage.GetPointer());
+  layer.PixmapItem =
+    this->InputScene->addPixmap(QPixmap::fromImage(qimageSourceImage));
+  layer.PixmapItem->setScale(this->DisplayFactor);
+  layer.PixmapItem->setFlag(QGraphicsItem::ItemIsMovable);
 
-  this->FutureWatcher.setFuture(future);
+  // make sure the new layer is on top of the target image and of the previous layers
+  layer.PixmapItem->setZValue(this->TargetImageItem->zValue() + this->Layers.size() + 1);
 
-  this->ProgressDialog->exec();
+  this->Layers.push_back(layer);
+  this->statusBar()->showMessage(QString("%1 layer(s).").arg(this->Layers.size()));
 }
 
+void PoissonCloningWidget::on_btnClone_clicked()
+{
+  StartClone(false);
+}
 
 void PoissonCloningWidget::on_btnMixedClone_clicked()
 {
-  // Extract the portion of the target image the user has selected.
+  StartClone(true);
+}
 
-  this->SelectedRegionCorner[0] = this->SourceImagePixmapItem->pos().x();
-  this->SelectedRegionCorner[1] = this->SourceImagePixmapItem->pos().y();
+void PoissonCloningWidget::StartClone(const bool mixed)
+{
+  if(this->Layers.empty())
+  {
+    return;
+  }
 
-  ImageType::RegionType desiredRegion(this->SelectedRegionCorner,
-                                      this->SourceImage->GetLargestPossibleRegion().GetSize());
+  // Read the positions here, the graphics items must not be touched from the worker thread.
+  for(unsigned int layerId = 0; layerId < this->Layers.size(); ++layerId)
+  {
+    this->Layers[layerId].Corner[0] = this->Layers[layerId].PixmapItem->pos().x();
+    this->Layers[layerId].Corner[1] = this->Layers[layerId].PixmapItem->pos().y();
+  }
 
-  std::vector<PoissonEditingParent::GuidanceFieldType::Pointer> sourceGuidanceFields =
-      PoissonEditingParent::ComputeGuidanceField(this->SourceImage.GetPointer());
+  // The pyramid only approximates the plain source guidance, Mixed Clone is always solved.
+  const bool approximate = this->chkApproximateClone->isChecked() && !mixed;
 
-  std::vector<PoissonEditingParent::GuidanceFieldType::Pointer> targetGuidanceFields =
-      PoissonEditingParent::ComputeGuidanceField(this->TargetImage.GetPointer());
+  ImageCache<ImageType>::KeyType resultKey = ComputeResultKey(mixed, approximate);
+  ImageType::Pointer cachedResult = this->ResultCache.Find(resultKey);
+  if(cachedResult)
+  {
+    this->ResultImage = cachedResult;
+    ShowResult();
+    this->statusBar()->showMessage("Reused a previous result.");
+    return;
+  }
+  this->PendingResultKey = resultKey;
+
+  QFuture<std::string> future;
+  if(approximate)
+  {
+    future = QtConcurrent::run(this, &PoissonCloningWidget::ApproximateLayers);
+  }
+  else
+  {
+    CloneLayers::UpdateDirtyFlags(this->Layers, mixed);
+    future = QtConcurrent::run(this, &PoissonCloningWidget::SolveLayers, mixed);
+  }
 
-  // Create a container for the new guidance fields
-  std::vector<PoissonEditingParent::GuidanceFieldType::Pointer> mixedGuidanceFields(sourceGuidanceFields.size());
+  this->FutureWatcher.setFuture(future);
 
-  ImageType::RegionType targetDesiredRegion = desiredRegion;
-  targetDesiredRegion.Crop(this->TargetImage->GetLargestPossibleRegion());
-  ImageType::RegionType sourceDesiredRegion = this->SourceImage->GetLargestPossibleRegion();
-  ITKHelpers::CropRegionAtPosition(sourceDesiredRegion, this->TargetImage->GetLargestPossibleRegion(), desiredRegion);
+  this->ProgressDialog->exec();
+}
 
-  for(unsigned int channel = 0; channel < sourceGuidanceFields.size(); ++channel)
+std::string PoissonCloningWidget::SolveLayers(const bool mixed)
+{
+  try
   {
-    // Initialize the mixed field with the source field
-    mixedGuidanceFields[channel] = PoissonEditingParent::GuidanceFieldType::New();
-    ITKHelpers::DeepCopy(sourceGuidanceFields[channel].GetPointer(), mixedGuidanceFields[channel].GetPointer());
+    // Only the pixels under the layers (and the ring of boundary pixels around them) are
+    // read or written, so the solve works on a copy of just that region of the target.
+    const itk::ImageRegion<2> targetRegion = this->TargetImage->GetLargestPossibleRegion();
+    const itk::ImageRegion<2> resultRegion = CloneLayers::ComputeResultRegion(this->Layers, targetRegion);
+
+    ImageType::Pointer composite = ImageType::New();
+    composite->SetNumberOfComponentsPerPixel(this->TargetImage->GetNumberOfComponentsPerPixel());
+    composite->SetRegions(resultRegion);
+    composite->Allocate();
+    CloneLayers::CopyRegion(this->TargetImage.GetPointer(), composite, resultRegion);
+
+    std::vector<itk::ImageRegion<2> > regions(this->Layers.size());
+    for(unsigned int layerId = 0; layerId < this->Layers.size(); ++layerId)
+    {
+      regions[layerId] = this->Layers[layerId].GetRegion();
+    }
 
-    itk::ImageRegionIterator<PoissonEditingParent::GuidanceFieldType>
-        sourceGuidanceIterator(sourceGuidanceFields[channel], sourceDesiredRegion);
-    itk::ImageRegionIterator<PoissonEditingParent::GuidanceFieldType>
-        targetGuidanceIterator(targetGuidanceFields[channel], targetDesiredRegion);
-    itk::ImageRegionIterator<PoissonEditingParent::GuidanceFieldType>
-        mixedGuidanceIterator(mixedGuidanceFields[channel], sourceDesiredRegion);
+    std::vector<std::vector<unsigned int> > waves = CloneLayers::ComputeWaves(regions);
 
-    while(!sourceGuidanceIterator.IsAtEnd())
+    for(unsigned int waveId = 0; waveId < waves.size(); ++waveId)
     {
-      float sourceMagnitude = sourceGuidanceIterator.Get().GetNorm();
-      float targetMagnitude = targetGuidanceIterator.Get().GetNorm();
+      // The layers of a wave do not overlap, so they only read the composite of the previous waves.
+      std::vector<CloneLayer*> dirtyLayers;
+      for(unsigned int i = 0; i < waves[waveId].size(); ++i)
+      {
+        CloneLayer& layer = this->Layers[waves[waveId][i]];
+        if(layer.Dirty)
+        {
+          dirtyLayers.push_back(&layer);
+        }
+      }
 
-      if(targetMagnitude > sourceMagnitude)
+      const ImageType* const waveComposite = composite.GetPointer();
+      Parallel::TaskGroup wave;
+      for(unsigned int i = 0; i < dirtyLayers.size(); ++i)
       {
-        mixedGuidanceIterator.Set(targetGuidanceIterator.Get());
+        CloneLayer* const layer = dirtyLayers[i];
+        wave.Run([layer, waveComposite, targetRegion, mixed]()
+        {
+          CloneLayers::SolveLayer(*layer, waveComposite, targetRegion, mixed);
+        });
       }
+      wave.Wait();
 
-      ++sourceGuidanceIterator;
-      ++targetGuidanceIterator;
-      ++mixedGuidanceIterator;
+      for(unsigned int i = 0; i < waves[waveId].size(); ++i)
+      {
+        const CloneLayer& layer = this->Layers[waves[waveId][i]];
+        CloneLayers::CopyRegion(layer.SolvedPatch, composite,
+                                layer.SolvedPatch->GetLargestPossibleRegion());
+      }
     }
-  }
 
-//  ITKHelpers::WriteImage(this->SourceImage.GetPointer(), "source.mha");
-//  ITKHelpers::WriteImage(sourceGuidanceFields[0].GetPointer(), "sourceGuidanceField.mha");
+    // A new image every time, so that previous results can be kept in the cache. It only covers
+    // resultRegion; the display and the save composite it onto the target.
+    this->ResultImage = composite;
+  }
+  catch(const std::exception& exception)
+  {
+    return exception.what();
+  }
+  return std::string();
+}
 
-  // We must get a function pointer to the overload that would be chosen by the compiler
-  // to pass to run().
-  void (*functionPointer)(const std::remove_pointer<decltype(this->TargetImage.GetPointer())>::type*,
-                          const std::remove_pointer<decltype(this->MaskImage.GetPointer())>::type*,
-                          const decltype(mixedGuidanceFields)&,
-                          decltype(this->ResultImage.GetPointer()),
-                          const itk::ImageRegion<2>&,
-                          const std::remove_pointer<decltype(this->SourceImage.GetPointer())>::type*)
-      = FillImage;
+std::string PoissonCloningWidget::ApproximateLayers()
+{
+  try
+  {
+    const itk::ImageRegion<2> targetRegion = this->TargetImage->GetLargestPossibleRegion();
+    const itk::ImageRegion<2> resultRegion = CloneLayers::ComputeResultRegion(this->Layers, targetRegion);
 
-  auto functionToRun = std::bind(functionPointer,
-                                 this->TargetImage.GetPointer(),
-                                 this->MaskImage.GetPointer(),
-                                 mixedGuidanceFields,
-                                 this->ResultImage.GetPointer(),
-                                 desiredRegion,
-                                 this->SourceImage.GetPointer());
+    ImageType::Pointer composite = ImageType::New();
+    composite->SetNumberOfComponentsPerPixel(this->TargetImage->GetNumberOfComponentsPerPixel());
+    composite->SetRegions(resultRegion);
+    composite->Allocate();
+    CloneLayers::CopyRegion(this->TargetImage.GetPointer(), composite, resultRegion);
 
-  QFuture<void> future =
-      QtConcurrent::run(functionToRun);
+    // Each layer reads its boundary from the composite of the layers below it.
+    for(unsigned int layerId = 0; layerId < this->Layers.size(); ++layerId)
+    {
+      CloneLayers::ApproximateLayer(this->Layers[layerId], composite);
+    }
 
-  this->FutureWatcher.setFuture(future);
+    this->ResultImage = composite;
+  }
+  catch(const std::exception& exception)
+  {
+    return exception.what();
+  }
+  return std::string();
+}
 
-  this->ProgressDialog->exec();
+ImageCache<PoissonCloningWidget::ImageType>::KeyType
+PoissonCloningWidget::ComputeResultKey(const bool mixed, const bool approximate) const
+{
+  ImageCache<ImageType>::KeyType key;
+  key.push_back(this->TargetHash);
+  key.push_back(mixed);
+  key.push_back(approximate);
+  for(unsigned int layerId = 0; layerId < this->Layers.size(); ++layerId)
+  {
+    const CloneLayer& layer = this->Layers[layerId];
+    key.push_back(layer.SourceHash);
+    key.push_back(layer.MaskHash);
+    key.push_back(static_cast<uint64_t>(layer.Corner[0]));
+    key.push_back(static_cast<uint64_t>(layer.Corner[1]));
+  }
+  return key;
 }
 
 void PoissonCloningWidget::on_actionSaveResult_triggered()
 {
+  if(this->ExportWatcher.isRunning())
+  {
+    this->statusBar()->showMessage("Still saving the previous result.");
+    return;
+  }
+
   // Get a filename to save
   QString fileName =
       QFileDialog::getSaveFileName(this, "Save File", ".",
@@ -288,11 +386,65 @@ void PoissonCloningWidget::on_actionSaveResult_triggered()
     return;
   }
 
-  ITKHelpers::WriteImage(this->ResultImage.GetPointer(),
-                         fileName.toStdString());
-  ITKHelpers::WriteRGBImage(this->ResultImage.GetPointer(),
-                            fileName.toStdString() + ".png");
-  this->statusBar()->showMessage("Saved result.");
+  // Neither image is modified after it is created, so holding on to them is enough to save
+  // them while new clones are computed. The result only covers the cloned region, it is
+  // pasted into the target as the rows are written.
+  this->ExportedTarget = this->TargetImage;
+  this->ExportedResult = nullptr;
+  if(this->ResultImage->GetNumberOfComponentsPerPixel() > 0)
+  {
+    this->ExportedResult = this->ResultImage;
+  }
+
+  QFuture<std::string> future =
+      QtConcurrent::run(this, &PoissonCloningWidget::ExportResult, fileName.toStdString(), this->ExportOptions);
+  this->ExportWatcher.setFuture(future);
+  this->statusBar()->showMessage("Saving result...");
+}
+
+std::string PoissonCloningWidget::ExportResult(const std::string& fileName, const ResultExport::Options& options)
+{
+  try
+  {
+    ResultExport::Export(this->ExportedTarget.GetPointer(), this->ExportedResult.GetPointer(), fileName, options);
+  }
+  catch(const std::exception& exception)
+  {
+    return exception.what();
+  }
+  return std::string();
+}
+
+void PoissonCloningWidget::slot_exportFinished()
+{
+  const std::string error = this->ExportWatcher.result();
+  this->ExportedTarget = nullptr;
+  this->ExportedResult = nullptr;
+
+  if(error.empty())
+  {
+    this->statusBar()->showMessage("Saved result.");
+  }
+  else
+  {
+    this->statusBar()->showMessage(QString("Could not save the result: %1").arg(error.c_str()));
+  }
+}
+
+void PoissonCloningWidget::on_actionExportCompression_triggered()
+{
+  bool ok = false;
+  int level = QInputDialog::getInt(this, "Compression Level", "Compression level (0 = none, 9 = smallest files):",
+                                   this->ExportOptions.CompressionLevel, 0, 9, 1, &ok);
+  if(ok)
+  {
+    this->ExportOptions.CompressionLevel = level;
+  }
+}
+
+void PoissonCloningWidget::on_actionExportTiledTIFF_toggled(bool tiled)
+{
+  this->ExportOptions.TiledTIFF = tiled;
 }
 
 void PoissonCloningWidget::on_actionOpenImages_triggered()
@@ -324,16 +476,197 @@ void PoissonCloningWidget::on_actionOpenImages_triggered()
   }
 }
 
+void PoissonCloningWidget::on_actionAddLayer_triggered()
+{
+  if(!this->TargetImageItem)
+  {
+    this->statusBar()->showMessage("Open a target image before adding layers.");
+    return;
+  }
+
+  std::vector<std::string> namedImages;
+  namedImages.push_back("SourceImage");
+  namedImages.push_back("MaskImage");
+
+  std::vector<std::string> extensionFilters;
+  extensionFilters.push_back("png");
+  extensionFilters.push_back("mask");
+
+  ImageFileSelector* fileSelector(new ImageFileSelector(namedImages, extensionFilters));
+  fileSelector->exec();
+
+  int result = fileSelector->result();
+  if(result) // The user clicked 'ok'
+  {
+    AddLayer(fileSelector->GetNamedImageFileName("SourceImage"),
+             fileSelector->GetNamedImageFileName("MaskImage"));
+  }
+}
+
 void PoissonCloningWidget::slot_finished()
+{
+  // A failed clone leaves ResultImage as it was, which must not be cached under the new key.
+  const std::string error = this->FutureWatcher.result();
+  if(!error.empty())
+  {
+    this->PendingResultKey.clear();
+    this->statusBar()->showMessage(QString("Could not clone: %1").arg(error.c_str()));
+    return;
+  }
+
+  ShowResult();
+}
+
+void PoissonCloningWidget::ShowResult()
 {
   if(this->ResultImage->GetNumberOfComponentsPerPixel() == 0)
   {
     return;
   }
 
-  QImage qimage = ITKQtHelpers::GetQImageColor(this->ResultImage.GetPointer(),
-                                               QImage::Format_RGB888);
+  if(!this->PendingResultKey.empty())
+  {
+    this->ResultCache.Insert(this->PendingResultKey, this->ResultImage);
+    this->PendingResultKey.clear();
+  }
+
+  if(this->ResultImage != this->HistoryResult)
+  {
+    this->History.Push(this->ResultImage, this->ResultImage->GetBufferedRegion());
+    this->HistoryResult = this->ResultImage;
+  }
+
+  DisplayResult(this->ResultImage);
+}
+
+void PoissonCloningWidget::DisplayResult(const ImageType* const result)
+{
+  // Only convert the cloned region; it is drawn over the unchanged target at its offset.
+  QImage qimage = ImageDisplay::GetProxy(result, result->GetBufferedRegion(), this->DisplayFactor);
+
+  if(this->ResultPixmapItem)
+  {
+    this->ResultPixmapItem->setPixmap(QPixmap::fromImage(qimage));
+  }
+  else
+  {
+    this->ResultPixmapItem = this->ResultScene->addPixmap(QPixmap::fromImage(qimage));
+    this->ResultPixmapItem->setZValue(this->ResultTargetItem->zValue() + 1);
+  }
+  this->ResultPixmapItem->setScale(this->DisplayFactor);
+  const itk::Index<2> resultCorner = result->GetBufferedRegion().GetIndex();
+  this->ResultPixmapItem->setPos(resultCorner[0], resultCorner[1]);
+  this->ResultPixmapItem->setVisible(true);
+  this->graphicsViewResultImage->fitInView(this->ResultTargetItem, Qt::KeepAspectRatio);
+}
+
+void PoissonCloningWidget::on_actionUndo_triggered()
+{
+  if(this->FutureWatcher.isRunning() || !this->History.Undo())
+  {
+    this->statusBar()->showMessage("Nothing to undo.");
+    return;
+  }
+  RestoreHistory();
+}
+
+void PoissonCloningWidget::on_actionRedo_triggered()
+{
+  if(this->FutureWatcher.isRunning() || !this->History.Redo())
+  {
+    this->statusBar()->showMessage("Nothing to redo.");
+    return;
+  }
+  RestoreHistory();
+}
+
+void PoissonCloningWidget::on_actionHistoryMemory_triggered()
+{
+  bool ok = false;
+  int megabytes = QInputDialog::getInt(this, "History Memory", "Memory for undo/redo (MB):",
+                                       this->History.GetMemoryBudget() / (1024 * 1024), 1, 65536, 64, &ok);
+  if(ok)
+  {
+    this->History.SetMemoryBudget(static_cast<std::size_t>(megabytes) * 1024 * 1024);
+  }
+}
+
+void PoissonCloningWidget::RestoreHistory()
+{
+  this->ResultImage = this->History.GetImage();
+  this->HistoryResult = this->ResultImage;
+
+  // The first state is the target itself.
+  if(this->ResultImage->GetNumberOfComponentsPerPixel() == 0)
+  {
+    if(this->ResultPixmapItem)
+    {
+      this->ResultPixmapItem->setVisible(false);
+    }
+    return;
+  }
+
+  DisplayResult(this->ResultImage);
+}
+
+bool PoissonCloningWidget::LayersMoved() const
+{
+  for(unsigned int layerId = 0; layerId < this->Layers.size(); ++layerId)
+  {
+    const CloneLayer& layer = this->Layers[layerId];
+    const itk::Index<2> position = {{static_cast<itk::IndexValueType>(layer.PixmapItem->pos().x()),
+                                     static_cast<itk::IndexValueType>(layer.PixmapItem->pos().y())}};
+    if(position != layer.Corner)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+void PoissonCloningWidget::slot_inputSceneChanged()
+{
+  // The scene also changes whenever a tile of the target arrives, which is not a drag.
+  if(this->chkDragPreview->isChecked() && LayersMoved())
+  {
+    this->DragPreviewTimer.start();
+  }
+}
+
+void PoissonCloningWidget::slot_dragPreview()
+{
+  // The layers belong to the solver while a clone is running.
+  if(this->FutureWatcher.isRunning() || !LayersMoved())
+  {
+    return;
+  }
+
+  for(unsigned int layerId = 0; layerId < this->Layers.size(); ++layerId)
+  {
+    this->Layers[layerId].Corner[0] = this->Layers[layerId].PixmapItem->pos().x();
+    this->Layers[layerId].Corner[1] = this->Layers[layerId].PixmapItem->pos().y();
+  }
+
+  const itk::ImageRegion<2> targetRegion = this->TargetImage->GetLargestPossibleRegion();
+  const itk::ImageRegion<2> previewRegion = CloneLayers::ComputeResultRegion(this->Layers, targetRegion);
+  if(previewRegion.GetNumberOfPixels() == 0)
+  {
+    return;
+  }
+
+  ImageType::Pointer preview = ImageType::New();
+  preview->SetNumberOfComponentsPerPixel(this->TargetImage->GetNumberOfComponentsPerPixel());
+  preview->SetRegions(previewRegion);
+  preview->Allocate();
+  CloneLayers::CopyRegion(this->TargetImage.GetPointer(), preview, previewRegion);
+
+  // Bottom to top, each layer is previewed over the layers below it.
+  for(unsigned int layerId = 0; layerId < this->Layers.size(); ++layerId)
+  {
+    CloneLayers::PreviewLayer(this->Layers[layerId], preview);
+  }
 
-  this->ResultPixmapItem = this->ResultScene->addPixmap(QPixmap::fromImage(qimage));
-  this->graphicsViewResultImage->fitInView(this->ResultPixmapItem, Qt::KeepAspectRatio);
+  // The preview is only displayed; ResultImage (and so the saved result) stays the exact clone.
+  DisplayResult(preview);
+  this->statusBar()->showMessage("Approximate preview. Click Clone for the exact result.");
 }
@@ -25,13 +25,19 @@
 #include "itkVectorImage.h"
 
 // Custom
+#include "CloneLayer.h"
+#include "EditHistory.h"
+#include "ImageCache.h"
 #include "Mask.h"
+#include "ResultExport.h"
 
 // Qt
 #include <QMainWindow>
 #include <QFutureWatcher>
 #include <QProgressDialog>
+#include <QTimer>
 class QGraphicsPixmapItem;
+class TiledImageItem;
 
 class PoissonCloningWidget : public QMainWindow, public Ui::PoissonCloningWidget
 {
@@ -47,32 +53,96 @@ public:
 public slots:
 
   void on_actionOpenImages_triggered();
+  void on_actionAddLayer_triggered();
   void on_actionSaveResult_triggered();
+  void on_actionExportCompression_triggered();
+  void on_actionExportTiledTIFF_toggled(bool tiled);
   
+  void on_actionUndo_triggered();
+  void on_actionRedo_triggered();
+  void on_actionHistoryMemory_triggered();
+
   void on_btnClone_clicked();
   void on_btnMixedClone_clicked();
 
   void slot_finished();
+  void slot_exportFinished();
+
+  /** Preview the clone shortly after a layer is dragged, if chkDragPreview is checked. */
+  void slot_inputSceneChanged();
+  void slot_dragPreview();
   
 protected:
 
-  itk::Index<2> SelectedRegionCorner;
-
   void OpenImages(const std::string& sourceImageFileName,
                   const std::string& maskFileName,
                   const std::string& targetImageFileName);
 
+  /** Load a source image and its mask and put them on top of the layer stack. */
+  void AddLayer(const std::string& sourceImageFileName, const std::string& maskFileName);
+
+  /** Read the layer positions and start solving the layers that need it in the background. */
+  void StartClone(const bool mixed);
+
+  /** Has any layer item been moved since its position was last read into its Corner? */
+  bool LayersMoved() const;
+
+  /** Solve the dirty layers wave by wave and composite all layers into ResultImage, which
+    * only covers the region of the target that the layers change. Runs in the background;
+    * returns an error message (and leaves ResultImage as it was), or an empty string on success. */
+  std::string SolveLayers(const bool mixed);
+
+  /** Approximate every layer with a convolution pyramid, bottom to top, into ResultImage.
+    * Nothing is factorized and the solved layers are left as they are. Returns like SolveLayers. */
+  std::string ApproximateLayers();
+
+  /** Cache, record and display ResultImage. */
+  void ShowResult();
+
+  /** Write ExportedTarget with ExportedResult pasted in. Runs in the background; returns an
+    * error message, or an empty string on success. */
+  std::string ExportResult(const std::string& fileName, const ResultExport::Options& options);
+
+  /** Show 'result', which covers part of the target, over the target in the result view. */
+  void DisplayResult(const ImageType* const result);
+
+  /** Make the current state of the history the result and show it. */
+  void RestoreHistory();
+
+  /** Everything the result depends on: the inputs, the layer positions and the mode. */
+  ImageCache<ImageType>::KeyType ComputeResultKey(const bool mixed, const bool approximate) const;
+
   void showEvent ( QShowEvent * event );
   void resizeEvent ( QResizeEvent * event );
   
+  /** The cloned region of the target; its buffered region gives its position in the target. */
   ImageType::Pointer ResultImage;
-  ImageType::Pointer SourceImage;
   ImageType::Pointer TargetImage;
-  Mask::Pointer MaskImage;
+  uint64_t TargetHash = 0;
+
+  /** Previously computed results, so that going back to a placement is instant. */
+  ImageCache<ImageType> ResultCache;
+
+  /** The results that were shown, stored relative to TargetImage, and the result of the
+    * current state of the history. */
+  EditHistory History;
+  ImageType::Pointer HistoryResult;
+
+  /** The key of the result that is being computed. */
+  ImageCache<ImageType>::KeyType PendingResultKey;
 
-  QGraphicsPixmapItem* SourceImagePixmapItem = nullptr;
-  QGraphicsPixmapItem* TargetImagePixmapItem = nullptr;
+  /** The objects to composite into the target, from bottom to top. */
+  std::vector<CloneLayer> Layers;
+
+  /** The target is drawn in tiles in both scenes. The layers and the cloned region only cover
+    * part of it and change while dragging, so they stay pixmaps. */
+  TiledImageItem* TargetImageItem = nullptr;
+  TiledImageItem* ResultTargetItem = nullptr;
   QGraphicsPixmapItem* ResultPixmapItem = nullptr;
+
+  /** The layer and result pixmaps are proxies reduced by this factor (chosen from the target
+    * and the screen), scaled back up so that scene coordinates stay target pixels. */
+  unsigned int DisplayFactor = 1;
   
   QGraphicsScene* InputScene;
   QGraphicsScene* ResultScene;
@@ -81,8 +151,18 @@ protected:
   std::string TargetImageFileName;
   std::string MaskImageFileName;
 
-  QFutureWatcher<void> FutureWatcher;
+  /** Coalesces the scene changes of a drag into one preview. */
+  QTimer DragPreviewTimer;
+
+  QFutureWatcher<std::string> FutureWatcher;
   QProgressDialog* ProgressDialog;
+
+  /** The images being saved, held until the export finishes. */
+  ImageType::Pointer ExportedTarget;
+  ImageType::Pointer ExportedResult;
+
+  ResultExport::Options ExportOptions;
+  QFutureWatcher<std::string> ExportWatcher;
 };
 
 #endif // PoissonEditingWidget_H
@@ -0,0 +1,63 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+/** This application keeps running and serves clone and fill jobs over a local socket
+  * (see CompositingServer for the protocol), so that services don't pay for starting a
+  * process and decoding the same images for every job.
+  *
+  * PoissonCompositingServer [socketName] [maximumQueueLength] [numberOfThreads]
+  */
+
+// Custom
+#include "CompositingServer.h"
+#include "Parallel.h"
+
+// Qt
+#include <QCoreApplication>
+
+// STL
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+int main(int argc, char** argv)
+{
+  QCoreApplication app(argc, argv);
+
+  std::cout << "PoissonCompositingServer" << std::endl;
+  const std::string socketName = (argc > 1) ? argv[1] : "PoissonCompositing";
+  const unsigned int maximumQueueLength = (argc > 2) ? std::atoi(argv[2]) : 32;
+
+  // Jobs run one at a time, each on all of these threads.
+  if(argc > 3)
+  {
+    Parallel::SetNumberOfThreads(std::atoi(argv[3]));
+  }
+  std::cout << "Using " << Parallel::GetNumberOfThreads() << " " << Parallel::GetBackendName()
+            << " threads" << std::endl;
+
+  CompositingServer server(maximumQueueLength);
+  if(!server.Listen(socketName.c_str()))
+  {
+    std::cerr << "Can't listen on " << socketName << ": " << server.GetErrorString().toStdString() << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::cout << "Listening on " << socketName << std::endl;
+
+  return app.exec();
+}
@@ -0,0 +1,296 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "PoissonEditingAPI.h"
+
+// Custom
+#include "MaskedGuidanceField.h"
+#include "MaskedPoissonSolver.h"
+#include "PackedMask.h"
+#include "Parallel.h"
+
+// ITK
+#include "itkVectorImage.h"
+
+// STL
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+  typedef itk::VectorImage<float, 2> ImageType;
+
+  thread_local std::string LastError;
+
+  /** Thrown for arguments the caller got wrong, as opposed to problems that cannot be solved. */
+  class InvalidArgument : public std::runtime_error
+  {
+  public:
+    InvalidArgument(const std::string& message) : std::runtime_error(message)
+    {
+    }
+  };
+
+  void CheckImage(const PoissonEditingImage* const image, const char* const name)
+  {
+    if(!image || !image->Data || image->Width <= 0 || image->Height <= 0 || image->NumberOfComponents <= 0)
+    {
+      throw InvalidArgument(std::string(name) + " must be a non-empty image.");
+    }
+    if(image->PixelStride < static_cast<ptrdiff_t>(image->NumberOfComponents * sizeof(float)))
+    {
+      throw InvalidArgument(std::string(name) + " has pixels that overlap.");
+    }
+    if(image->RowStride < image->Width * image->PixelStride)
+    {
+      throw InvalidArgument(std::string(name) + " has rows that overlap.");
+    }
+  }
+
+  void CheckMask(const PoissonEditingMask* const mask, const int width, const int height)
+  {
+    if(!mask || !mask->Data)
+    {
+      throw InvalidArgument("The mask must not be null.");
+    }
+    if(mask->Width != width || mask->Height != height)
+    {
+      throw InvalidArgument("The mask must have the size of the image it belongs to.");
+    }
+    if(mask->RowStride < mask->Width)
+    {
+      throw InvalidArgument("The mask has rows that overlap.");
+    }
+  }
+
+  itk::ImageRegion<2> GetRegion(const int width, const int height)
+  {
+    const itk::Size<2> size = {{static_cast<itk::SizeValueType>(width), static_cast<itk::SizeValueType>(height)}};
+    return itk::ImageRegion<2>(size);
+  }
+
+  PackedMask PackMask(const PoissonEditingMask* const mask)
+  {
+    return PackedMask::FromBuffer(mask->Data, mask->RowStride, GetRegion(mask->Width, mask->Height),
+                                  mask->HoleValue);
+  }
+
+  float* GetPixel(const PoissonEditingImage* const image, const itk::Index<2>& pixel)
+  {
+    return reinterpret_cast<float*>(reinterpret_cast<char*>(image->Data) + pixel[1] * image->RowStride +
+                                    pixel[0] * image->PixelStride);
+  }
+
+  /** Copy 'region' of a caller's image into an image of its own (with the same region), which
+    * is all a solve reads. */
+  ImageType::Pointer CopyRegion(const PoissonEditingImage* const image, const itk::ImageRegion<2>& region)
+  {
+    const unsigned int numberOfComponents = image->NumberOfComponents;
+
+    ImageType::Pointer copy = ImageType::New();
+    copy->SetNumberOfComponentsPerPixel(numberOfComponents);
+    copy->SetRegions(region);
+    copy->Allocate();
+
+    Parallel::ForRows(region, 64, [&](const itk::ImageRegion<2>& rows)
+    {
+      itk::Index<2> pixel;
+      for(pixel[1] = rows.GetIndex()[1]; pixel[1] <= rows.GetUpperIndex()[1]; ++pixel[1])
+      {
+        pixel[0] = rows.GetIndex()[0];
+        float* copyPixel = copy->GetBufferPointer() + copy->ComputeOffset(pixel) * numberOfComponents;
+        for(; pixel[0] <= rows.GetUpperIndex()[0]; ++pixel[0], copyPixel += numberOfComponents)
+        {
+          std::memcpy(copyPixel, GetPixel(image, pixel), numberOfComponents * sizeof(float));
+        }
+      }
+    });
+
+    return copy;
+  }
+
+  /** Write the domain pixels of 'solution' back into the caller's image. */
+  void WriteDomain(const ImageType* const solution, const PoissonDomain& domain, PoissonEditingImage* const image)
+  {
+    const unsigned int numberOfComponents = image->NumberOfComponents;
+    Parallel::ForBlocks(domain.GetNumberOfUnknowns(), 16384, [&](const unsigned int begin, const unsigned int end)
+    {
+      for(unsigned int unknown = begin; unknown < end; ++unknown)
+      {
+        const itk::Index<2>& pixel = domain.Pixels[unknown];
+        std::memcpy(GetPixel(image, pixel),
+                    solution->GetBufferPointer() + solution->ComputeOffset(pixel) * numberOfComponents,
+                    numberOfComponents * sizeof(float));
+      }
+    });
+  }
+
+  /** The part of 'imageRegion' a solve over 'domain' reads: its bounding box and the fixed
+    * pixels around it. */
+  itk::ImageRegion<2> GetSolveRegion(const PoissonDomain& domain, const itk::ImageRegion<2>& imageRegion)
+  {
+    itk::ImageRegion<2> region = domain.Region;
+    region.PadByRadius(1);
+    region.Crop(imageRegion);
+    return region;
+  }
+
+  /** Run 'function', turning exceptions into error codes and messages. */
+  template <typename TFunction>
+  int Call(TFunction function)
+  {
+    LastError.clear();
+    try
+    {
+      function();
+      return POISSON_EDITING_SUCCESS;
+    }
+    catch(const InvalidArgument& error)
+    {
+      LastError = error.what();
+      return POISSON_EDITING_INVALID_ARGUMENT;
+    }
+    catch(const std::bad_alloc&)
+    {
+      LastError = "Out of memory.";
+      return POISSON_EDITING_OUT_OF_MEMORY;
+    }
+    catch(const std::exception& error)
+    {
+      LastError = error.what();
+      return POISSON_EDITING_SOLVE_FAILED;
+    }
+    catch(...)
+    {
+      LastError = "Unknown error.";
+      return POISSON_EDITING_SOLVE_FAILED;
+    }
+  }
+
+  void Clone(const PoissonEditingImage* const source, const PoissonEditingMask* const mask,
+             const int cornerX, const int cornerY, PoissonEditingImage* const target, const bool mixed)
+  {
+    CheckImage(source, "The source");
+    CheckImage(target, "The target");
+    CheckMask(mask, source->Width, source->Height);
+    if(source->NumberOfComponents != target->NumberOfComponents)
+    {
+      throw InvalidArgument("The source and the target must have the same number of channels.");
+    }
+
+    // The domain lives in target coordinates; source pixels are target pixels minus the corner.
+    const itk::Offset<2> sourceToTarget = {{cornerX, cornerY}};
+    const itk::ImageRegion<2> targetRegion = GetRegion(target->Width, target->Height);
+    PoissonDomain domain = PoissonDomain::Create(PackMask(mask), sourceToTarget, targetRegion);
+    if(domain.GetNumberOfUnknowns() == 0)
+    {
+      return;
+    }
+
+    // Only the windows around the hole are copied. Neighbors outside of them are outside of the
+    // images as well, so solving over the windows is the same as solving over the images. A
+    // mixed clone compares the forward gradients of those neighbors too, which reach one pixel
+    // further. The source window is not cut where the target ends, since the source gradients
+    // there are still read.
+    itk::ImageRegion<2> hull = domain.Region;
+    hull.PadByRadius(mixed ? 2 : 1);
+    itk::ImageRegion<2> window = hull;
+    window.Crop(targetRegion);
+    domain.ImageRegion = window;
+    ImageType::Pointer targetWindow = CopyRegion(target, window);
+
+    itk::ImageRegion<2> sourceWindow(hull.GetIndex() - sourceToTarget, hull.GetSize());
+    sourceWindow.Crop(GetRegion(source->Width, source->Height));
+    ImageType::Pointer sourcePatch = CopyRegion(source, sourceWindow);
+
+    const MaskedGuidanceField guidance = mixed ?
+          MaskedGuidanceField::Mixed(domain, sourcePatch, sourceToTarget, targetWindow) :
+          MaskedGuidanceField::FromSource(domain, sourcePatch, sourceToTarget);
+
+    MaskedPoissonSolver solver;
+    solver.SetDomain(domain);
+    solver.Solve(targetWindow, guidance.GetTerms(), targetWindow);
+    WriteDomain(targetWindow, domain, target);
+  }
+}
+
+extern "C"
+{
+
+int PoissonEditingGetVersion(void)
+{
+  return POISSON_EDITING_API_VERSION;
+}
+
+const char* PoissonEditingGetLastError(void)
+{
+  return LastError.c_str();
+}
+
+void PoissonEditingSetNumberOfThreads(unsigned int numberOfThreads)
+{
+  Parallel::SetNumberOfThreads(numberOfThreads);
+}
+
+int PoissonEditingFill(PoissonEditingImage* image, const PoissonEditingMask* mask)
+{
+  return Call([&]()
+  {
+    CheckImage(image, "The image");
+    CheckMask(mask, image->Width, image->Height);
+
+    const itk::Offset<2> zeroOffset = {{0, 0}};
+    const itk::ImageRegion<2> imageRegion = GetRegion(image->Width, image->Height);
+    PoissonDomain domain = PoissonDomain::Create(PackMask(mask), zeroOffset, imageRegion);
+    if(domain.GetNumberOfUnknowns() == 0)
+    {
+      return;
+    }
+
+    const itk::ImageRegion<2> window = GetSolveRegion(domain, imageRegion);
+    domain.ImageRegion = window;
+    ImageType::Pointer imageWindow = CopyRegion(image, window);
+
+    MaskedPoissonSolver solver;
+    solver.SetDomain(domain);
+    solver.Solve(imageWindow, MaskedPoissonSolver::GuidanceTermsType(), imageWindow);
+    WriteDomain(imageWindow, domain, image);
+  });
+}
+
+int PoissonEditingClone(const PoissonEditingImage* source, const PoissonEditingMask* mask,
+                        int cornerX, int cornerY, PoissonEditingImage* target)
+{
+  return Call([&]()
+  {
+    Clone(source, mask, cornerX, cornerY, target, false);
+  });
+}
+
+int PoissonEditingMixedClone(const PoissonEditingImage* source, const PoissonEditingMask* mask,
+                             int cornerX, int cornerY, PoissonEditingImage* target)
+{
+  return Call([&]()
+  {
+    Clone(source, mask, cornerX, cornerY, target, true);
+  });
+}
+
+} // end extern "C"
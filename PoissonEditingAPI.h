@@ -0,0 +1,114 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+/* A C interface to the solvers, for callers in other languages and processes that must not
+ * link Qt. Every function works in place on buffers owned by the caller: nothing is copied
+ * except the pixels around the hole, and only the hole pixels of the output are written.
+ * Functions return POISSON_EDITING_SUCCESS or an error code, and the message of the last
+ * error of the calling thread is available from PoissonEditingGetLastError().
+ * The structures below only ever get new fields at their end, together with a new
+ * POISSON_EDITING_API_VERSION.
+ */
+
+#ifndef PoissonEditingAPI_H
+#define PoissonEditingAPI_H
+
+#include <stddef.h>
+
+#if defined(POISSON_EDITING_STATIC)
+  #define POISSON_EDITING_API
+#elif defined(_WIN32)
+  #if defined(PoissonEditingAPI_EXPORTS)
+    #define POISSON_EDITING_API __declspec(dllexport)
+  #else
+    #define POISSON_EDITING_API __declspec(dllimport)
+  #endif
+#else
+  #define POISSON_EDITING_API __attribute__((visibility("default")))
+#endif
+
+#define POISSON_EDITING_API_VERSION 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum
+{
+  POISSON_EDITING_SUCCESS = 0,
+  POISSON_EDITING_INVALID_ARGUMENT = 1,
+  /* The problem could not be solved, e.g. a part of the hole touches no known pixel. */
+  POISSON_EDITING_SOLVE_FAILED = 2,
+  POISSON_EDITING_OUT_OF_MEMORY = 3
+};
+
+/* An image of float pixels with interleaved channels. The strides are in bytes, so that
+ * channels of a larger pixel, rows with padding and sub-images can be passed as they are.
+ * Pixels and rows must not overlap: PixelStride is at least NumberOfComponents floats and
+ * RowStride at least Width pixels. */
+typedef struct PoissonEditingImage
+{
+  /* The first channel of the pixel at (0, 0). Only written by functions that modify the image. */
+  float* Data;
+  int Width;
+  int Height;
+  int NumberOfComponents;
+  ptrdiff_t PixelStride;
+  ptrdiff_t RowStride;
+} PoissonEditingImage;
+
+/* A mask of one byte per pixel, rows RowStride (at least Width) bytes apart. Pixels equal to
+ * HoleValue are the hole, all others are known. */
+typedef struct PoissonEditingMask
+{
+  const unsigned char* Data;
+  int Width;
+  int Height;
+  ptrdiff_t RowStride;
+  unsigned char HoleValue;
+} PoissonEditingMask;
+
+/* The POISSON_EDITING_API_VERSION the library was built with. */
+POISSON_EDITING_API int PoissonEditingGetVersion(void);
+
+/* The message of the last error of the calling thread, or an empty string. */
+POISSON_EDITING_API const char* PoissonEditingGetLastError(void);
+
+/* The number of threads the solvers may use; 0 means one per core. */
+POISSON_EDITING_API void PoissonEditingSetNumberOfThreads(unsigned int numberOfThreads);
+
+/* Replace the hole pixels of 'image' by a membrane interpolation of their boundary
+ * (a Poisson fill with a zero guidance field). 'mask' must have the size of 'image'. */
+POISSON_EDITING_API int PoissonEditingFill(PoissonEditingImage* image, const PoissonEditingMask* mask);
+
+/* Clone the hole of 'mask' (which has the size of 'source') from 'source' into 'target',
+ * whose pixel (x + cornerX, y + cornerY) receives source pixel (x, y). Hole pixels that land
+ * outside of 'target' are dropped. */
+POISSON_EDITING_API int PoissonEditingClone(const PoissonEditingImage* source, const PoissonEditingMask* mask,
+                                            int cornerX, int cornerY, PoissonEditingImage* target);
+
+/* The same, but guided by whichever of the source and target gradients is stronger, so that
+ * strong structures of the target show through the clone. */
+POISSON_EDITING_API int PoissonEditingMixedClone(const PoissonEditingImage* source, const PoissonEditingMask* mask,
+                                                 int cornerX, int cornerY, PoissonEditingImage* target);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
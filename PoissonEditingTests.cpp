@@ -0,0 +1,899 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+/** This program checks the solvers on synthetic inputs whose solutions are known, either in
+  * closed form or from another solver, and prints one line per check. With --performance it
+  * checks that problems of fixed sizes are solved within their time budgets instead. It returns
+  * a failure if any check fails; ctest runs both modes. With --benchmark it prints the time and
+  * the error of the approximate fills against the exact fill for a few image sizes.
+  *
+  * PoissonEditingTests [--performance | --benchmark]
+  */
+
+// Custom
+#include "ConvolutionPyramid.h"
+#include "ImageCache.h"
+#include "MaskedGuidanceField.h"
+#include "MaskedPoissonSolver.h"
+#include "PoissonEditingAPI.h"
+#include "QuadtreePoissonFill.h"
+
+// Submodules
+#include "Mask/Mask.h"
+
+// ITK
+#include "itkVectorImage.h"
+
+// STL
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <set>
+#include <string>
+
+namespace
+{
+  typedef itk::VectorImage<float, 2> ImageType;
+
+  /** The value of channel 'component' at 'pixel'. */
+  typedef std::function<float(const itk::Index<2>&, const unsigned int)> PixelFunctionType;
+
+  const itk::Offset<2> NeighborOffsets[4] = {{{-1, 0}}, {{1, 0}}, {{0, -1}}, {{0, 1}}};
+
+  unsigned int NumberOfFailures = 0;
+
+  void CheckBelow(const std::string& name, const double value, const double limit)
+  {
+    const bool passed = (value <= limit);
+    std::cout << (passed ? "PASS " : "FAIL ") << name << ": " << value << " (limit " << limit << ")" << std::endl;
+    if(!passed)
+    {
+      NumberOfFailures++;
+    }
+  }
+
+  void CheckTrue(const std::string& name, const bool passed)
+  {
+    std::cout << (passed ? "PASS " : "FAIL ") << name << std::endl;
+    if(!passed)
+    {
+      NumberOfFailures++;
+    }
+  }
+
+  ImageType::Pointer CreateImage(const itk::Size<2>& size, const unsigned int numberOfComponents,
+                                 const PixelFunctionType& function)
+  {
+    ImageType::Pointer image = ImageType::New();
+    image->SetNumberOfComponentsPerPixel(numberOfComponents);
+    image->SetRegions(itk::ImageRegion<2>(size));
+    image->Allocate();
+
+    float* buffer = image->GetBufferPointer();
+    for(unsigned int y = 0; y < size[1]; ++y)
+    {
+      for(unsigned int x = 0; x < size[0]; ++x)
+      {
+        const itk::Index<2> pixel = {{static_cast<itk::IndexValueType>(x), static_cast<itk::IndexValueType>(y)}};
+        for(unsigned int component = 0; component < numberOfComponents; ++component)
+        {
+          *buffer++ = function(pixel, component);
+        }
+      }
+    }
+    return image;
+  }
+
+  /** A smooth image in the range of 8 bit pixels: a few sines of random frequency and phase per channel. */
+  PixelFunctionType CreateRandomFunction(const unsigned int seed)
+  {
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<float> frequency(0.01f, 0.2f);
+    std::uniform_real_distribution<float> phase(0.0f, 6.28f);
+
+    std::vector<float> parameters(3 * 4 * 3);
+    for(unsigned int parameterId = 0; parameterId < parameters.size(); parameterId += 3)
+    {
+      parameters[parameterId] = frequency(generator);
+      parameters[parameterId + 1] = frequency(generator);
+      parameters[parameterId + 2] = phase(generator);
+    }
+
+    return [parameters](const itk::Index<2>& pixel, const unsigned int component)
+    {
+      float value = 128.0f;
+      for(unsigned int wave = 0; wave < 4; ++wave)
+      {
+        const float* parameter = &parameters[3 * (4 * (component % 3) + wave)];
+        value += 30.0f * std::sin(parameter[0] * pixel[0] + parameter[1] * pixel[1] + parameter[2]);
+      }
+      return value;
+    };
+  }
+
+  Mask::Pointer CreateMask(const itk::Size<2>& size, const std::function<bool(const itk::Index<2>&)>& isHole)
+  {
+    Mask::Pointer mask = Mask::New();
+    mask->SetRegions(itk::ImageRegion<2>(size));
+    mask->Allocate();
+    for(unsigned int y = 0; y < size[1]; ++y)
+    {
+      for(unsigned int x = 0; x < size[0]; ++x)
+      {
+        const itk::Index<2> pixel = {{static_cast<itk::IndexValueType>(x), static_cast<itk::IndexValueType>(y)}};
+        mask->SetPixel(pixel, isHole(pixel) ? mask->GetHoleValue() : mask->GetValidValue());
+      }
+    }
+    return mask;
+  }
+
+  Mask::Pointer CreateDiscMask(const itk::Size<2>& size, const float radius)
+  {
+    const float centerX = size[0] / 2.0f;
+    const float centerY = size[1] / 2.0f;
+    return CreateMask(size, [=](const itk::Index<2>& pixel)
+    {
+      const float dx = pixel[0] + 0.5f - centerX;
+      const float dy = pixel[1] + 0.5f - centerY;
+      return dx * dx + dy * dy < radius * radius;
+    });
+  }
+
+  /** Random discs and rectangles, which may overlap, at least 2 pixels away from the border. */
+  Mask::Pointer CreateRandomMask(const itk::Size<2>& size, const unsigned int seed)
+  {
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    struct Shape
+    {
+      bool Disc;
+      float X, Y, Width, Height;
+    };
+    std::vector<Shape> shapes(12);
+    for(unsigned int shapeId = 0; shapeId < shapes.size(); ++shapeId)
+    {
+      shapes[shapeId].Disc = unit(generator) < 0.5f;
+      shapes[shapeId].X = size[0] * unit(generator);
+      shapes[shapeId].Y = size[1] * unit(generator);
+      shapes[shapeId].Width = 4.0f + size[0] / 6.0f * unit(generator);
+      shapes[shapeId].Height = 4.0f + size[1] / 6.0f * unit(generator);
+    }
+
+    return CreateMask(size, [&](const itk::Index<2>& pixel)
+    {
+      if(pixel[0] < 2 || pixel[1] < 2 || pixel[0] + 2 >= static_cast<itk::IndexValueType>(size[0]) ||
+         pixel[1] + 2 >= static_cast<itk::IndexValueType>(size[1]))
+      {
+        return false;
+      }
+      for(unsigned int shapeId = 0; shapeId < shapes.size(); ++shapeId)
+      {
+        const Shape& shape = shapes[shapeId];
+        const float dx = (pixel[0] - shape.X) / shape.Width;
+        const float dy = (pixel[1] - shape.Y) / shape.Height;
+        if(shape.Disc ? dx * dx + dy * dy < 1.0f : std::fabs(dx) < 1.0f && std::fabs(dy) < 1.0f)
+        {
+          return true;
+        }
+      }
+      return false;
+    });
+  }
+
+  /** A copy of 'image' with the unknowns of 'domain' set to 0, so that nothing of the expected
+    * solution is left in them. */
+  ImageType::Pointer CreateHoledImage(const ImageType* const image, const PoissonDomain& domain)
+  {
+    const unsigned int numberOfComponents = image->GetNumberOfComponentsPerPixel();
+    ImageType::Pointer holedImage = CreateImage(image->GetLargestPossibleRegion().GetSize(), numberOfComponents,
+                                                [image](const itk::Index<2>& pixel, const unsigned int component)
+                                                {
+                                                  return image->GetPixel(pixel)[component];
+                                                });
+    for(unsigned int unknown = 0; unknown < domain.GetNumberOfUnknowns(); ++unknown)
+    {
+      float* value = holedImage->GetBufferPointer() +
+                     holedImage->ComputeOffset(domain.Pixels[unknown]) * numberOfComponents;
+      std::fill(value, value + numberOfComponents, 0.0f);
+    }
+    return holedImage;
+  }
+
+  /** The largest difference between 'image1' and 'image2' at the unknowns of 'domain'. */
+  double ComputeMaximumDifference(const ImageType* const image1, const ImageType* const image2,
+                                  const PoissonDomain& domain)
+  {
+    const unsigned int numberOfComponents = image1->GetNumberOfComponentsPerPixel();
+    double maximumDifference = 0.0;
+    for(unsigned int unknown = 0; unknown < domain.GetNumberOfUnknowns(); ++unknown)
+    {
+      const float* value1 = image1->GetBufferPointer() +
+                            image1->ComputeOffset(domain.Pixels[unknown]) * numberOfComponents;
+      const float* value2 = image2->GetBufferPointer() +
+                            image2->ComputeOffset(domain.Pixels[unknown]) * numberOfComponents;
+      for(unsigned int component = 0; component < numberOfComponents; ++component)
+      {
+        maximumDifference = std::max(maximumDifference, static_cast<double>(std::fabs(value1[component] -
+                                                                                      value2[component])));
+      }
+    }
+    return maximumDifference;
+  }
+
+  /** The mean difference between 'image1' and 'image2' at the unknowns of 'domain'. */
+  double ComputeMeanDifference(const ImageType* const image1, const ImageType* const image2,
+                               const PoissonDomain& domain)
+  {
+    const unsigned int numberOfComponents = image1->GetNumberOfComponentsPerPixel();
+    double sumOfDifferences = 0.0;
+    for(unsigned int unknown = 0; unknown < domain.GetNumberOfUnknowns(); ++unknown)
+    {
+      const float* value1 = image1->GetBufferPointer() +
+                            image1->ComputeOffset(domain.Pixels[unknown]) * numberOfComponents;
+      const float* value2 = image2->GetBufferPointer() +
+                            image2->ComputeOffset(domain.Pixels[unknown]) * numberOfComponents;
+      for(unsigned int component = 0; component < numberOfComponents; ++component)
+      {
+        sumOfDifferences += std::fabs(value1[component] - value2[component]);
+      }
+    }
+    return sumOfDifferences / std::max(1u, domain.GetNumberOfUnknowns() * numberOfComponents);
+  }
+
+  /** The largest difference between any two channels of 'image1' and 'image2'. */
+  double ComputeMaximumDifference(const ImageType* const image1, const ImageType* const image2)
+  {
+    const std::size_t numberOfValues = image1->GetLargestPossibleRegion().GetNumberOfPixels() *
+                                       image1->GetNumberOfComponentsPerPixel();
+    double maximumDifference = 0.0;
+    for(std::size_t valueId = 0; valueId < numberOfValues; ++valueId)
+    {
+      maximumDifference = std::max(maximumDifference, static_cast<double>(std::fabs(image1->GetBufferPointer()[valueId] -
+                                                                                    image2->GetBufferPointer()[valueId])));
+    }
+    return maximumDifference;
+  }
+
+  /** A copy of an image in a buffer of the caller's, with one unused float after every pixel
+    * and five after every row, as the C interface gets it. */
+  struct StridedImage
+  {
+    std::vector<float> Buffer;
+    PoissonEditingImage View;
+  };
+
+  const float PaddingValue = -12345.0f;
+
+  StridedImage CreateStridedImage(const ImageType* const image)
+  {
+    const itk::Size<2> size = image->GetLargestPossibleRegion().GetSize();
+    const unsigned int numberOfComponents = image->GetNumberOfComponentsPerPixel();
+    const std::size_t floatsPerPixel = numberOfComponents + 1;
+    const std::size_t floatsPerRow = size[0] * floatsPerPixel + 5;
+
+    StridedImage stridedImage;
+    stridedImage.Buffer.assign(floatsPerRow * size[1], PaddingValue);
+    for(std::size_t pixelId = 0; pixelId < size[0] * size[1]; ++pixelId)
+    {
+      std::memcpy(&stridedImage.Buffer[(pixelId / size[0]) * floatsPerRow + (pixelId % size[0]) * floatsPerPixel],
+                  image->GetBufferPointer() + pixelId * numberOfComponents, numberOfComponents * sizeof(float));
+    }
+
+    stridedImage.View.Data = stridedImage.Buffer.data();
+    stridedImage.View.Width = size[0];
+    stridedImage.View.Height = size[1];
+    stridedImage.View.NumberOfComponents = numberOfComponents;
+    stridedImage.View.PixelStride = floatsPerPixel * sizeof(float);
+    stridedImage.View.RowStride = floatsPerRow * sizeof(float);
+    return stridedImage;
+  }
+
+  /** The pixels of 'stridedImage' in an image of their own. */
+  ImageType::Pointer ReadStridedImage(const StridedImage& stridedImage)
+  {
+    const PoissonEditingImage& view = stridedImage.View;
+    const itk::Size<2> size = {{static_cast<itk::SizeValueType>(view.Width), static_cast<itk::SizeValueType>(view.Height)}};
+    return CreateImage(size, view.NumberOfComponents, [&](const itk::Index<2>& pixel, const unsigned int component)
+    {
+      return stridedImage.Buffer[(pixel[1] * view.RowStride + pixel[0] * view.PixelStride) / sizeof(float) + component];
+    });
+  }
+
+  /** Did nothing write into the padding of 'stridedImage'? */
+  bool PaddingIsUnchanged(const StridedImage& stridedImage)
+  {
+    const PoissonEditingImage& view = stridedImage.View;
+    unsigned int numberOfPaddingValues = 0;
+    for(std::size_t valueId = 0; valueId < stridedImage.Buffer.size(); ++valueId)
+    {
+      numberOfPaddingValues += (stridedImage.Buffer[valueId] == PaddingValue);
+    }
+    const std::size_t valuesPerRow = view.RowStride / sizeof(float);
+    const std::size_t paddingPerRow = valuesPerRow - view.Width * view.NumberOfComponents;
+    return numberOfPaddingValues == paddingPerRow * view.Height;
+  }
+
+  /** A copy of 'mask' with 13 padding bytes after every row and a hole value of 200, which the
+    * padding holds as well. */
+  struct StridedMask
+  {
+    std::vector<unsigned char> Buffer;
+    PoissonEditingMask View;
+  };
+
+  StridedMask CreateStridedMask(const Mask* const mask)
+  {
+    const itk::Size<2> size = mask->GetLargestPossibleRegion().GetSize();
+    const std::size_t rowStride = size[0] + 13;
+    const unsigned char holeValue = 200;
+
+    StridedMask stridedMask;
+    stridedMask.Buffer.assign(rowStride * size[1], holeValue);
+    for(std::size_t pixelId = 0; pixelId < size[0] * size[1]; ++pixelId)
+    {
+      const bool hole = mask->GetBufferPointer()[pixelId] == mask->GetHoleValue();
+      stridedMask.Buffer[(pixelId / size[0]) * rowStride + pixelId % size[0]] = hole ? holeValue : 0;
+    }
+
+    stridedMask.View.Data = stridedMask.Buffer.data();
+    stridedMask.View.Width = size[0];
+    stridedMask.View.Height = size[1];
+    stridedMask.View.RowStride = rowStride;
+    stridedMask.View.HoleValue = holeValue;
+    return stridedMask;
+  }
+
+  template <typename TFunction>
+  double MeasureSeconds(TFunction function)
+  {
+    const auto start = std::chrono::steady_clock::now();
+    function();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+}
+
+/** Linear functions and x^2 - y^2 have a zero (discrete) Laplacian, so a membrane fill of a hole
+  * in them gives them back exactly. */
+void TestHarmonicFill()
+{
+  const itk::Size<2> size = {{200, 160}};
+  ImageType::Pointer image = CreateImage(size, 3, [](const itk::Index<2>& pixel, const unsigned int component)
+  {
+    const float x = pixel[0];
+    const float y = pixel[1];
+    const float values[3] = {20.0f + 0.5f * x + 0.25f * y, 128.0f + (x * x - y * y) / 400.0f, 60.0f - 0.3f * x};
+    return values[component];
+  });
+
+  const Mask::Pointer masks[2] = {CreateDiscMask(size, 60.0f), CreateRandomMask(size, 7)};
+  const char* maskNames[2] = {"disc", "random"};
+  const itk::Offset<2> zeroOffset = {{0, 0}};
+
+  for(unsigned int maskId = 0; maskId < 2; ++maskId)
+  {
+    const PoissonDomain domain = PoissonDomain::Create(masks[maskId], masks[maskId]->GetLargestPossibleRegion(),
+                                                       zeroOffset, image->GetLargestPossibleRegion());
+    for(unsigned int method = 0; method < 2; ++method)
+    {
+      MaskedPoissonSolver solver;
+      solver.SetMethod(method == 0 ? MaskedPoissonSolver::DirectMethod : MaskedPoissonSolver::IterativeMethod);
+      solver.SetDomain(domain);
+
+      ImageType::Pointer result = CreateHoledImage(image, domain);
+      solver.Solve(result, MaskedPoissonSolver::GuidanceTermsType(), result);
+
+      CheckBelow(std::string("Harmonic fill of a ") + maskNames[maskId] + " hole, " +
+                 (method == 0 ? "direct" : "iterative"),
+                 ComputeMaximumDifference(result, image, domain), method == 0 ? 1e-3 : 1e-2);
+    }
+  }
+}
+
+/** A rectangular domain is solved with sine transforms; the factorization of the same system
+  * must give the same solution. */
+void TestRectangleMatchesFactorization()
+{
+  const itk::Size<2> size = {{160, 100}};
+  const itk::Index<2> holeCorner = {{16, 16}};
+  const itk::Size<2> holeSize = {{127, 63}};
+  const itk::ImageRegion<2> holeRegion(holeCorner, holeSize);
+  Mask::Pointer mask = CreateMask(size, [&](const itk::Index<2>& pixel)
+  {
+    return holeRegion.IsInside(pixel);
+  });
+
+  ImageType::Pointer target = CreateImage(size, 3, CreateRandomFunction(1));
+  ImageType::Pointer source = CreateImage(size, 3, CreateRandomFunction(2));
+
+  const itk::Offset<2> zeroOffset = {{0, 0}};
+  const PoissonDomain domain = PoissonDomain::Create(mask, mask->GetLargestPossibleRegion(), zeroOffset,
+                                                     target->GetLargestPossibleRegion());
+  const MaskedGuidanceField guidance = MaskedGuidanceField::FromSource(domain, source, zeroOffset);
+
+  MaskedPoissonSolver sineSolver;
+  sineSolver.SetDomain(domain);
+  ImageType::Pointer sineResult = CreateHoledImage(target, domain);
+  sineSolver.Solve(sineResult, guidance.GetTerms(), sineResult);
+
+  MaskedPoissonSolver sparseSolver;
+  sparseSolver.SetUseSineTransforms(false);
+  sparseSolver.SetDomain(domain);
+  ImageType::Pointer sparseResult = CreateHoledImage(target, domain);
+  sparseSolver.Solve(sparseResult, guidance.GetTerms(), sparseResult);
+
+  CheckTrue("Rectangle is solved with sine transforms", sineSolver.IsRectangular());
+  CheckTrue("Rectangle is factorized when the transforms are off", !sparseSolver.IsRectangular());
+  CheckBelow("Sine transforms match the factorization", ComputeMaximumDifference(sineResult, sparseResult, domain),
+             1e-3);
+}
+
+/** Cloning a source into a target that already holds the (shifted) source gives the target
+  * back, whichever guidance is used: the solution is the source itself. */
+void TestKnownGradientField()
+{
+  const itk::Size<2> sourceSize = {{120, 100}};
+  const itk::Size<2> targetSize = {{200, 160}};
+  const itk::Offset<2> sourceToTarget = {{30, 40}};
+
+  const PixelFunctionType sourceFunction = CreateRandomFunction(3);
+  const PixelFunctionType otherFunction = CreateRandomFunction(4);
+  const itk::ImageRegion<2> sourceRegion(sourceSize);
+
+  ImageType::Pointer source = CreateImage(sourceSize, 3, sourceFunction);
+  ImageType::Pointer target = CreateImage(targetSize, 3, [&](const itk::Index<2>& pixel, const unsigned int component)
+  {
+    const itk::Index<2> sourcePixel = pixel - sourceToTarget;
+    return sourceRegion.IsInside(sourcePixel) ? sourceFunction(sourcePixel, component) :
+                                                otherFunction(pixel, component);
+  });
+
+  Mask::Pointer mask = CreateRandomMask(sourceSize, 5);
+  const PoissonDomain domain = PoissonDomain::Create(mask, mask->GetLargestPossibleRegion(), sourceToTarget,
+                                                     target->GetLargestPossibleRegion());
+  MaskedPoissonSolver solver;
+  solver.SetDomain(domain);
+
+  ImageType::Pointer divergence =
+      MaskedGuidanceField::ComputeSourceDivergence(source, source->GetLargestPossibleRegion());
+  const MaskedGuidanceField guidances[3] =
+  {
+    MaskedGuidanceField::FromSource(domain, source, sourceToTarget),
+    MaskedGuidanceField::FromSourceDivergence(domain, source, sourceToTarget, divergence),
+    MaskedGuidanceField::Mixed(domain, source, sourceToTarget, target)
+  };
+  const char* guidanceNames[3] = {"source", "source divergence", "mixed"};
+
+  for(unsigned int guidanceId = 0; guidanceId < 3; ++guidanceId)
+  {
+    ImageType::Pointer result = CreateHoledImage(target, domain);
+    solver.Solve(result, guidances[guidanceId].GetTerms(), result);
+    CheckBelow(std::string("Clone of a known gradient field, ") + guidanceNames[guidanceId] + " guidance",
+               ComputeMaximumDifference(result, target, domain), 1e-3);
+  }
+}
+
+/** On random holes, whatever the guidance, the solution has to satisfy its equations. */
+void TestRandomMasks()
+{
+  const itk::Size<2> size = {{256, 192}};
+  const itk::Offset<2> zeroOffset = {{0, 0}};
+
+  for(unsigned int seed = 1; seed <= 5; ++seed)
+  {
+    Mask::Pointer mask = CreateRandomMask(size, 100 + seed);
+    ImageType::Pointer target = CreateImage(size, 3, CreateRandomFunction(200 + seed));
+    ImageType::Pointer source = CreateImage(size, 3, CreateRandomFunction(300 + seed));
+
+    const PoissonDomain domain = PoissonDomain::Create(mask, mask->GetLargestPossibleRegion(), zeroOffset,
+                                                       target->GetLargestPossibleRegion());
+    MaskedPoissonSolver solver;
+    solver.SetDomain(domain);
+
+    for(unsigned int mixed = 0; mixed < 2; ++mixed)
+    {
+      const MaskedGuidanceField guidance = mixed ? MaskedGuidanceField::Mixed(domain, source, zeroOffset, target) :
+                                                   MaskedGuidanceField::FromSource(domain, source, zeroOffset);
+      ImageType::Pointer result = CreateHoledImage(target, domain);
+      solver.Solve(result, guidance.GetTerms(), result);
+
+      CheckBelow("Residual on random mask " + std::to_string(seed) + (mixed ? ", mixed" : ", clone"),
+                 solver.ComputeResidual(result, guidance.GetTerms()), 1e-3);
+    }
+  }
+}
+
+/** The packed mask works on 64 pixels at a time; every query must give what the pixels of the
+  * Mask give, also for rows that end inside of a word and for holes on the image border. */
+void TestPackedMask()
+{
+  const unsigned int widths[5] = {1, 63, 64, 65, 200};
+  const itk::Offset<2> maskToImage = {{5, -3}};
+
+  for(unsigned int widthId = 0; widthId < 5; ++widthId)
+  {
+    const itk::Size<2> size = {{widths[widthId], 37}};
+    const itk::ImageRegion<2> maskRegion(size);
+    for(unsigned int seed = 0; seed < 3; ++seed)
+    {
+      // Noise holes, which touch every border; the last mask is a hole everywhere.
+      std::mt19937 generator(500 + 10 * widthId + seed);
+      Mask::Pointer mask = CreateMask(size, [&](const itk::Index<2>&)
+      {
+        return seed == 2 || generator() % 3 == 0;
+      });
+      const std::string name = "Packed mask " + std::to_string(size[0]) + "x" + std::to_string(size[1]) +
+                                ", mask " + std::to_string(seed) + ": ";
+
+      const PackedMask packedMask = PackedMask::FromMask(mask);
+      const PackedMask bufferMask = PackedMask::FromBuffer(mask->GetBufferPointer(), size[0], maskRegion,
+                                                           mask->GetHoleValue());
+      const PackedMask innerBoundary = packedMask.GetInnerBoundary();
+      const PackedMask outerBoundary = packedMask.GetOuterBoundary();
+
+      // A sub-region that starts and ends inside of words.
+      const itk::Index<2> subCorner = {{size[0] > 2 ? 1 : 0, 1}};
+      const itk::Size<2> subSize = {{size[0] > 2 ? size[0] - 2 : size[0], size[1] - 2}};
+      const itk::ImageRegion<2> subRegion(subCorner, subSize);
+      const PackedMask subMask = PackedMask::FromMask(mask, subRegion);
+
+      unsigned int numberOfHolePixels = 0;
+      bool holesMatch = true;
+      bool innerBoundaryMatches = true;
+      bool outerBoundaryMatches = true;
+      itk::Index<2> lower = {{static_cast<itk::IndexValueType>(size[0]), static_cast<itk::IndexValueType>(size[1])}};
+      itk::Index<2> upper = {{-1, -1}};
+      std::vector<itk::Index<2> > expectedPixels;
+
+      // The image the domain is created for cuts off holes on three sides of the translated mask.
+      const itk::Index<2> imageCorner = {{7, 0}};
+      const itk::Size<2> imageSize = {{size[0], 30}};
+      const itk::ImageRegion<2> imageRegion(imageCorner, imageSize);
+
+      for(unsigned int pixelId = 0; pixelId < maskRegion.GetNumberOfPixels(); ++pixelId)
+      {
+        const itk::Index<2> pixel = {{static_cast<itk::IndexValueType>(pixelId % size[0]),
+                                      static_cast<itk::IndexValueType>(pixelId / size[0])}};
+        const bool hole = mask->IsHole(pixel);
+        bool validNeighbor = false;
+        bool holeNeighbor = false;
+        for(unsigned int neighbor = 0; neighbor < 4; ++neighbor)
+        {
+          const itk::Index<2> neighborPixel = pixel + NeighborOffsets[neighbor];
+          if(maskRegion.IsInside(neighborPixel))
+          {
+            validNeighbor = validNeighbor || !mask->IsHole(neighborPixel);
+            holeNeighbor = holeNeighbor || mask->IsHole(neighborPixel);
+          }
+        }
+
+        holesMatch = holesMatch && packedMask.IsHole(pixel) == hole && bufferMask.IsHole(pixel) == hole &&
+                     (!subRegion.IsInside(pixel) || subMask.IsHole(pixel) == hole);
+        innerBoundaryMatches = innerBoundaryMatches && innerBoundary.IsHole(pixel) == (hole && validNeighbor);
+        outerBoundaryMatches = outerBoundaryMatches && outerBoundary.IsHole(pixel) == (!hole && holeNeighbor);
+
+        if(hole)
+        {
+          numberOfHolePixels++;
+          for(unsigned int dimension = 0; dimension < 2; ++dimension)
+          {
+            lower[dimension] = std::min(lower[dimension], pixel[dimension]);
+            upper[dimension] = std::max(upper[dimension], pixel[dimension]);
+          }
+          if(imageRegion.IsInside(pixel + maskToImage))
+          {
+            expectedPixels.push_back(pixel + maskToImage);
+          }
+        }
+      }
+
+      CheckTrue(name + "holes", holesMatch);
+      CheckTrue(name + "hole count", packedMask.CountHolePixels() == numberOfHolePixels);
+      CheckTrue(name + "inner boundary", innerBoundaryMatches);
+      CheckTrue(name + "outer boundary", outerBoundaryMatches);
+
+      const itk::ImageRegion<2> boundingBox = packedMask.GetHoleBoundingBox();
+      CheckTrue(name + "hole bounding box",
+                numberOfHolePixels == 0 ? boundingBox.GetNumberOfPixels() == 0 :
+                boundingBox.GetIndex() == lower &&
+                boundingBox.GetUpperIndex() == upper);
+
+      const PoissonDomain domain = PoissonDomain::Create(mask, maskRegion, maskToImage, imageRegion);
+      bool lookupMatches = true;
+      for(unsigned int unknown = 0; unknown < domain.GetNumberOfUnknowns(); ++unknown)
+      {
+        lookupMatches = lookupMatches && domain.GetUnknownId(domain.Pixels[unknown]) == static_cast<int>(unknown);
+      }
+      CheckTrue(name + "domain", domain.Pixels == expectedPixels && lookupMatches);
+    }
+  }
+}
+
+/** The C interface works in place on strided buffers; it has to give what the solver gives on
+  * images of its own, leave the padding alone, and report wrong arguments. */
+void TestCInterface()
+{
+  // A fill of random holes.
+  {
+    const itk::Size<2> size = {{90, 70}};
+    const itk::Offset<2> zeroOffset = {{0, 0}};
+    Mask::Pointer mask = CreateRandomMask(size, 61);
+    ImageType::Pointer image = CreateImage(size, 3, CreateRandomFunction(62));
+    const PoissonDomain domain = PoissonDomain::Create(mask, mask->GetLargestPossibleRegion(), zeroOffset,
+                                                       image->GetLargestPossibleRegion());
+
+    MaskedPoissonSolver solver;
+    solver.SetDomain(domain);
+    ImageType::Pointer expected = CreateHoledImage(image, domain);
+    solver.Solve(expected, MaskedPoissonSolver::GuidanceTermsType(), expected);
+
+    StridedImage stridedImage = CreateStridedImage(image);
+    const StridedMask stridedMask = CreateStridedMask(mask);
+    CheckTrue("C interface fill succeeds",
+              PoissonEditingFill(&stridedImage.View, &stridedMask.View) == POISSON_EDITING_SUCCESS);
+    CheckBelow("C interface fill matches the solver",
+               ComputeMaximumDifference(ReadStridedImage(stridedImage), expected), 1e-3);
+    CheckTrue("C interface fill leaves the padding alone", PaddingIsUnchanged(stridedImage));
+  }
+
+  // Clones of random holes, partly placed outside of the target.
+  const itk::Size<2> sourceSize = {{60, 50}};
+  const itk::Size<2> targetSize = {{100, 80}};
+  const itk::Offset<2> sourceToTarget = {{55, 45}};
+  Mask::Pointer mask = CreateRandomMask(sourceSize, 63);
+  ImageType::Pointer source = CreateImage(sourceSize, 3, CreateRandomFunction(64));
+  ImageType::Pointer target = CreateImage(targetSize, 3, CreateRandomFunction(65));
+  const PoissonDomain domain = PoissonDomain::Create(mask, mask->GetLargestPossibleRegion(), sourceToTarget,
+                                                     target->GetLargestPossibleRegion());
+  MaskedPoissonSolver solver;
+  solver.SetDomain(domain);
+
+  const StridedImage stridedSource = CreateStridedImage(source);
+  const StridedMask stridedMask = CreateStridedMask(mask);
+  for(unsigned int mixed = 0; mixed < 2; ++mixed)
+  {
+    const MaskedGuidanceField guidance = mixed ? MaskedGuidanceField::Mixed(domain, source, sourceToTarget, target) :
+                                                 MaskedGuidanceField::FromSource(domain, source, sourceToTarget);
+    ImageType::Pointer expected = CreateHoledImage(target, domain);
+    solver.Solve(expected, guidance.GetTerms(), expected);
+
+    StridedImage stridedTarget = CreateStridedImage(target);
+    const int status = mixed ?
+          PoissonEditingMixedClone(&stridedSource.View, &stridedMask.View, sourceToTarget[0], sourceToTarget[1],
+                                   &stridedTarget.View) :
+          PoissonEditingClone(&stridedSource.View, &stridedMask.View, sourceToTarget[0], sourceToTarget[1],
+                              &stridedTarget.View);
+    const std::string name = mixed ? "C interface mixed clone" : "C interface clone";
+    CheckTrue(name + " succeeds", status == POISSON_EDITING_SUCCESS);
+    CheckBelow(name + " matches the solver", ComputeMaximumDifference(ReadStridedImage(stridedTarget), expected),
+               1e-3);
+    CheckTrue(name + " leaves the padding alone", PaddingIsUnchanged(stridedTarget));
+  }
+
+  // Wrong arguments are reported, and the next successful call clears the message.
+  StridedImage image = CreateStridedImage(target);
+  PoissonEditingImage view = image.View;
+  auto isInvalid = [](const int status)
+  {
+    return status == POISSON_EDITING_INVALID_ARGUMENT && std::strlen(PoissonEditingGetLastError()) > 0;
+  };
+  CheckTrue("C interface rejects a null image", isInvalid(PoissonEditingFill(nullptr, &stridedMask.View)));
+  CheckTrue("C interface rejects a null mask", isInvalid(PoissonEditingFill(&view, nullptr)));
+  CheckTrue("C interface rejects a mask of another size", isInvalid(PoissonEditingFill(&view, &stridedMask.View)));
+
+  view.RowStride = view.Width * view.PixelStride - 1;
+  CheckTrue("C interface rejects overlapping rows",
+            isInvalid(PoissonEditingClone(&stridedSource.View, &stridedMask.View, 0, 0, &view)));
+  view = image.View;
+  view.PixelStride = sizeof(float);
+  CheckTrue("C interface rejects overlapping pixels",
+            isInvalid(PoissonEditingClone(&stridedSource.View, &stridedMask.View, 0, 0, &view)));
+  view = image.View;
+  view.NumberOfComponents = 2;
+  CheckTrue("C interface rejects a source and target with other channels",
+            isInvalid(PoissonEditingClone(&stridedSource.View, &stridedMask.View, 0, 0, &view)));
+
+  PoissonEditingMask overlappingMask = stridedMask.View;
+  overlappingMask.RowStride = overlappingMask.Width - 1;
+  CheckTrue("C interface rejects overlapping mask rows",
+            isInvalid(PoissonEditingClone(&stridedSource.View, &overlappingMask, 0, 0, &image.View)));
+
+  CheckTrue("C interface clears the error after a success",
+            PoissonEditingClone(&stridedSource.View, &stridedMask.View, 0, 0, &image.View) ==
+            POISSON_EDITING_SUCCESS && std::strlen(PoissonEditingGetLastError()) == 0);
+}
+
+/** The convolution pyramid only approximates the membrane, but it has to stay close to it. */
+void TestConvolutionPyramid()
+{
+  const itk::Size<2> size = {{256, 256}};
+  const itk::Offset<2> zeroOffset = {{0, 0}};
+  Mask::Pointer mask = CreateDiscMask(size, 64.0f);
+  ImageType::Pointer image = CreateImage(size, 3, CreateRandomFunction(21));
+  const PoissonDomain domain = PoissonDomain::Create(mask, mask->GetLargestPossibleRegion(), zeroOffset,
+                                                     image->GetLargestPossibleRegion());
+
+  MaskedPoissonSolver solver;
+  solver.SetDomain(domain);
+  ImageType::Pointer exactResult = CreateHoledImage(image, domain);
+  solver.Solve(exactResult, MaskedPoissonSolver::GuidanceTermsType(), exactResult);
+
+  ImageType::Pointer pyramidResult = ImageType::New();
+  ConvolutionPyramid::FillImage(image, mask, pyramidResult);
+
+  CheckBelow("Convolution pyramid fill, largest error", ComputeMaximumDifference(pyramidResult, exactResult, domain),
+             12.0);
+  CheckBelow("Convolution pyramid fill, mean error", ComputeMeanDifference(pyramidResult, exactResult, domain),
+             3.0);
+}
+
+/** The time of the exact fill and of the approximate fills of a disc that covers a quarter of
+  * the image, with the largest and the mean error of the approximations (in a 0-255 range). */
+void Benchmark()
+{
+  const itk::Offset<2> zeroOffset = {{0, 0}};
+  const unsigned int sizes[3] = {256, 600, 1200};
+
+  for(unsigned int sizeId = 0; sizeId < 3; ++sizeId)
+  {
+    const itk::Size<2> size = {{sizes[sizeId], sizes[sizeId]}};
+    Mask::Pointer mask = CreateDiscMask(size, 0.28f * sizes[sizeId]);
+    ImageType::Pointer image = CreateImage(size, 3, CreateRandomFunction(31));
+    const PoissonDomain domain = PoissonDomain::Create(mask, mask->GetLargestPossibleRegion(), zeroOffset,
+                                                       image->GetLargestPossibleRegion());
+
+    ImageType::Pointer exactResult = CreateHoledImage(image, domain);
+    const double exactSeconds = MeasureSeconds([&]()
+    {
+      MaskedPoissonSolver solver;
+      solver.SetDomain(domain);
+      solver.Solve(exactResult, MaskedPoissonSolver::GuidanceTermsType(), exactResult);
+    });
+
+    ImageType::Pointer pyramidResult = ImageType::New();
+    const double pyramidSeconds = MeasureSeconds([&]()
+    {
+      ConvolutionPyramid::FillImage(image, mask, pyramidResult);
+    });
+
+    ImageType::Pointer quadtreeResult = ImageType::New();
+    const double quadtreeSeconds = MeasureSeconds([&]()
+    {
+      QuadtreePoissonFill::FillImage(image, mask, quadtreeResult, 16u);
+    });
+
+    std::cout << sizes[sizeId] << "^2: exact " << exactSeconds << " s, pyramid " << pyramidSeconds << " s ("
+              << ComputeMaximumDifference(pyramidResult, exactResult, domain) << " / "
+              << ComputeMeanDifference(pyramidResult, exactResult, domain) << "), quadtree "
+              << quadtreeSeconds << " s ("
+              << ComputeMaximumDifference(quadtreeResult, exactResult, domain) << " / "
+              << ComputeMeanDifference(quadtreeResult, exactResult, domain) << ")" << std::endl;
+  }
+}
+
+/** The hash keys the result caches, so masks that differ anywhere must get different hashes,
+  * also if they only differ in the high bytes of the words the hash reads. */
+void TestImageHash()
+{
+  const itk::Size<2> size = {{64, 48}};
+  std::mt19937 generator(41);
+  std::set<uint64_t> hashes;
+  const unsigned int numberOfMasks = 2000;
+  for(unsigned int maskId = 0; maskId < numberOfMasks; ++maskId)
+  {
+    Mask::Pointer mask = CreateMask(size, [&](const itk::Index<2>& pixel)
+    {
+      return pixel[0] % 8 == 7 && generator() % 2 == 0;
+    });
+    hashes.insert(ImageCache<ImageType>::HashImage(mask.GetPointer()));
+  }
+  CheckTrue("Masks that differ in the last byte of every word get different hashes",
+            hashes.size() == numberOfMasks);
+}
+
+/** The budgets are for a Release build; on a current desktop each case takes a third of its
+  * budget or less. */
+void TestPerformance()
+{
+  const itk::Offset<2> zeroOffset = {{0, 0}};
+
+  // A 512x512 image with a disc of about 126000 unknowns: the factorization and one solve.
+  {
+    const itk::Size<2> size = {{512, 512}};
+    Mask::Pointer mask = CreateDiscMask(size, 200.0f);
+    ImageType::Pointer image = CreateImage(size, 3, CreateRandomFunction(11));
+    const PoissonDomain domain = PoissonDomain::Create(mask, mask->GetLargestPossibleRegion(), zeroOffset,
+                                                       image->GetLargestPossibleRegion());
+
+    MaskedGuidanceField guidance;
+    CheckBelow("Guidance of a 512x512 disc (s)", MeasureSeconds([&]()
+    {
+      guidance = MaskedGuidanceField::FromSource(domain, image, zeroOffset);
+    }), 0.25);
+
+    MaskedPoissonSolver solver;
+    CheckBelow("Factorization of a 512x512 disc (s)", MeasureSeconds([&]()
+    {
+      solver.SetDomain(domain);
+    }), 3.0);
+
+    CheckBelow("Solve of a 512x512 disc (s)", MeasureSeconds([&]()
+    {
+      solver.Solve(image, guidance.GetTerms(), image);
+    }), 1.0);
+  }
+
+  // A 1023x1023 rectangle, solved with sine transforms.
+  {
+    const itk::Size<2> size = {{1025, 1025}};
+    Mask::Pointer mask = CreateMask(size, [](const itk::Index<2>& pixel)
+    {
+      return pixel[0] > 0 && pixel[1] > 0 && pixel[0] < 1024 && pixel[1] < 1024;
+    });
+    ImageType::Pointer image = CreateImage(size, 3, CreateRandomFunction(12));
+    const PoissonDomain domain = PoissonDomain::Create(mask, mask->GetLargestPossibleRegion(), zeroOffset,
+                                                       image->GetLargestPossibleRegion());
+
+    MaskedPoissonSolver solver;
+    CheckBelow("Sine transform setup and solve of a 1023x1023 rectangle (s)", MeasureSeconds([&]()
+    {
+      solver.SetDomain(domain);
+      solver.Solve(image, MaskedPoissonSolver::GuidanceTermsType(), image);
+    }), 2.0);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  const std::string mode = (argc > 1 ? argv[1] : "");
+
+  if(mode == "--benchmark")
+  {
+    Benchmark();
+    return EXIT_SUCCESS;
+  }
+
+  if(mode == "--performance")
+  {
+    TestPerformance();
+  }
+  else
+  {
+    TestHarmonicFill();
+    TestRectangleMatchesFactorization();
+    TestKnownGradientField();
+    TestRandomMasks();
+    TestPackedMask();
+    TestCInterface();
+    TestConvolutionPyramid();
+    TestImageHash();
+  }
+
+  if(NumberOfFailures > 0)
+  {
+    std::cout << NumberOfFailures << " check(s) failed." << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::cout << "All checks passed." << std::endl;
+  return EXIT_SUCCESS;
+}
@@ -19,26 +19,73 @@
 #include "PoissonEditingWidget.h"
 
 // Custom
+#include "ConvolutionPyramid.h"
+#include "EditHistory.h"
+#include "FillPlanner.h"
+#include "ImageDisplay.h"
 #include "ImageFileSelector.h"
+#include "IncrementalPoissonFill.h"
+#include "MaskBrush.h"
+#include "PoissonEditingAPI.h"
+#include "QuadtreePoissonFill.h"
+#include "TiledImageItem.h"
 
 // Submodules
 #include "ITKHelpers/ITKHelpers.h"
 #include "QtHelpers/QtHelpers.h"
-#include "ITKQtHelpers/ITKQtHelpers.h"
 #include "Mask/Mask.h"
-#include "Mask/MaskQt.h"
-#include "PoissonEditing/PoissonEditingWrappers.h"
 
 // ITK
 #include "itkImageFileReader.h"
 #include "itkImageFileWriter.h"
+#include "itkImageRegionConstIterator.h"
+#include "itkImageRegionIterator.h"
 
 // Qt
+#include <QApplication>
+#include <QDesktopWidget>
 #include <QIcon>
 #include <QFileDialog>
 #include <QGraphicsPixmapItem>
+#include <QInputDialog>
 #include <QtConcurrentRun>
 
+// STL
+#include <algorithm>
+
+namespace
+{
+  /** Fill the hole of 'mask' in 'image' through the C interface of the solver library, which
+    * works on the buffers of the images without copying them. Returns an error message, or an
+    * empty string on success. */
+  std::string FillResult(PoissonEditingWidget::ImageType* const image, const Mask* const mask)
+  {
+    const itk::ImageRegion<2> region = image->GetLargestPossibleRegion();
+    const int numberOfComponents = image->GetNumberOfComponentsPerPixel();
+
+    PoissonEditingImage imageView;
+    imageView.Data = image->GetBufferPointer();
+    imageView.Width = region.GetSize()[0];
+    imageView.Height = region.GetSize()[1];
+    imageView.NumberOfComponents = numberOfComponents;
+    imageView.PixelStride = numberOfComponents * sizeof(float);
+    imageView.RowStride = imageView.Width * imageView.PixelStride;
+
+    PoissonEditingMask maskView;
+    maskView.Data = mask->GetBufferPointer();
+    maskView.Width = mask->GetLargestPossibleRegion().GetSize()[0];
+    maskView.Height = mask->GetLargestPossibleRegion().GetSize()[1];
+    maskView.RowStride = maskView.Width;
+    maskView.HoleValue = mask->GetHoleValue();
+
+    if(PoissonEditingFill(&imageView, &maskView) != POISSON_EDITING_SUCCESS)
+    {
+      return PoissonEditingGetLastError();
+    }
+    return std::string();
+  }
+}
+
 PoissonEditingWidget::PoissonEditingWidget()
 {
   this->setupUi(this);
@@ -51,6 +98,7 @@ PoissonEditingWidget::PoissonEditingWidget()
 
   connect(&this->FutureWatcher, SIGNAL(finished()), this, SLOT(slot_IterationComplete()));
   connect(&this->FutureWatcher, SIGNAL(finished()), this->ProgressDialog , SLOT(cancel()));
+  connect(&this->ExportWatcher, SIGNAL(finished()), this, SLOT(slot_ExportFinished()));
 
   this->Image = ImageType::New();
   this->MaskImage = Mask::New();
@@ -58,6 +106,24 @@ PoissonEditingWidget::PoissonEditingWidget()
 
   this->Scene = new QGraphicsScene;
   this->graphicsView->setScene(this->Scene);
+
+  // Only the tiles that are visible at the current zoom are ever converted for display.
+  this->ImageItem = new TiledImageItem(this->Image);
+  this->ImageItem->setVisible(this->chkShowInput->isChecked());
+  this->Scene->addItem(this->ImageItem);
+
+  this->ResultItem = new TiledImageItem(this->Result);
+  this->ResultItem->setVisible(this->chkShowOutput->isChecked());
+  this->Scene->addItem(this->ResultItem);
+
+  this->Brush = new MaskBrush(this->graphicsView, this);
+  this->Brush->SetRadius(this->spinBrushRadius->value());
+  connect(this->Brush, SIGNAL(maskPainted(const QRect&)), this, SLOT(slot_MaskPainted(const QRect&)));
+
+  this->PreviewTimer.setSingleShot(true);
+  this->PreviewTimer.setInterval(150);
+  connect(&this->PreviewTimer, SIGNAL(timeout()), this, SLOT(slot_UpdatePreview()));
+  connect(&this->PreviewWatcher, SIGNAL(finished()), this, SLOT(slot_PreviewComplete()));
 }
 
 PoissonEditingWidget::PoissonEditingWidget(const std::string& imageFileName,
@@ -72,59 +138,180 @@ PoissonEditingWidget::PoissonEditingWidget(const std::string& imageFileName,
 
 void PoissonEditingWidget::showEvent ( QShowEvent * )
 {
-  if(this->ImagePixmapItem)
+  if(this->ImageItem)
   {
-    this->graphicsView->fitInView(this->ImagePixmapItem, Qt::KeepAspectRatio);
+    this->graphicsView->fitInView(this->ImageItem, Qt::KeepAspectRatio);
   }
 }
 
 void PoissonEditingWidget::resizeEvent ( QResizeEvent * )
 {
-  if(this->ImagePixmapItem)
+  if(this->ImageItem)
   {
-    this->graphicsView->fitInView(this->ImagePixmapItem, Qt::KeepAspectRatio);
+    this->graphicsView->fitInView(this->ImageItem, Qt::KeepAspectRatio);
   }
 }
 
 void PoissonEditingWidget::on_btnFill_clicked()
 {
-  typedef PoissonEditing<float> PoissonEditingType;
+  FinishPreview();
+
+  // Keep the state before the fill, so that the fill can be undone.
+  if(!this->HistoryIsCurrent)
+  {
+    PushHistory();
+  }
 
-  typedef PoissonEditingType::GuidanceFieldType GuidanceFieldType;
+  // Keep a copy of the mask being filled so that later edits can be compared against it.
+  this->PendingMask = Mask::New();
+  this->PendingMask->DeepCopyFrom(this->MaskImage);
 
-  GuidanceFieldType::Pointer zeroGuidanceField =
-      PoissonEditing<float>::CreateZeroGuidanceField(this->Image.GetPointer());
+  // Every fill writes into Result, so its tiles must not be generated until the fill is done.
+  this->ResultItem->BeginUpdate();
 
-  std::vector<GuidanceFieldType::Pointer> guidanceFields(3, zeroGuidanceField);
+  this->PendingMethod = GetSelectedFillMethod();
 
-  // We must get a function pointer to the overload that would be chosen by the compiler
-  // to pass to run().
-  void (*functionPointer)(const std::remove_pointer<decltype(this->Image.GetPointer())>::type*,
-                          const std::remove_pointer<decltype(this->MaskImage.GetPointer())>::type*,
-                          const std::remove_pointer<decltype(zeroGuidanceField.GetPointer())>::type*,
-                          decltype(this->Result.GetPointer()),
-                          decltype(this->Image->GetLargestPossibleRegion()),
-                          const std::remove_pointer<decltype(this->Image.GetPointer())>::type*)
-          = FillImage;
+  // If only a small part of the mask changed since the last exact fill, only re-solve around the
+  // change. A window takes its boundary values from the previous result, so the update is only
+  // approximate; it is never the base of another one, which keeps the errors from adding up.
+  if(this->PendingMethod == ExactFill && this->FilledMethod == ExactFill && this->FilledMask &&
+     this->FilledMask->GetRegion() == this->MaskImage->GetLargestPossibleRegion())
+  {
+    IncrementalPoissonFill::MaskDifference difference =
+        IncrementalPoissonFill::ComputeMaskDifference(*this->FilledMask, this->MaskImage);
+
+    if(IncrementalPoissonFill::IsSmallEdit(difference))
+    {
+      std::cout << "Incremental fill of " << difference.ChangedPixels.size()
+                << " changed mask pixels." << std::endl;
+      this->PendingMethod = IncrementalFill;
+
+      auto functionToCall = std::bind(IncrementalPoissonFill::UpdateFill,
+                                      this->Image.GetPointer(),
+                                      difference,
+                                      this->PendingMask.GetPointer(),
+                                      this->Result.GetPointer());
+
+      QFuture<void> future = QtConcurrent::run(functionToCall);
+      this->FutureWatcher.setFuture(future);
+      this->ProgressDialog->exec();
+      return;
+    }
+  }
 
-  auto functionToCall =
-      std::bind(functionPointer,
-                        this->Image.GetPointer(),
-                        this->MaskImage.GetPointer(),
-                        zeroGuidanceField,
-                        this->Result.GetPointer(),
-                        this->Image->GetLargestPossibleRegion(), nullptr);
+  // Let the planner pick the solver that fits the memory budget for this hole.
+  if(this->PendingMethod == AutomaticFill)
+  {
+    if(!this->FillCalibration)
+    {
+      this->statusBar()->showMessage("Calibrating the solvers for this machine...");
+    }
+
+    QFuture<void> future = QtConcurrent::run(this, &PoissonEditingWidget::FillAutomatically);
+    this->FutureWatcher.setFuture(future);
+    this->ProgressDialog->exec();
+    return;
+  }
 
-  QFuture<void> future =
-        QtConcurrent::run(functionToCall);
+  // For previews and bulk work, the membrane can be approximated without solving anything.
+  if(this->PendingMethod == ApproximateFill)
+  {
+    auto functionToCall = std::bind(ConvolutionPyramid::FillImage,
+                                    this->Image.GetPointer(),
+                                    this->PendingMask.GetPointer(),
+                                    this->Result.GetPointer());
+
+    QFuture<void> future = QtConcurrent::run(functionToCall);
+    this->FutureWatcher.setFuture(future);
+    this->ProgressDialog->exec();
+    return;
+  }
 
-  this->FutureWatcher.setFuture(future);
+  // The membrane is smooth away from the boundary, so a large hole can be solved on a quadtree.
+  if(this->PendingMethod == AdaptiveFill)
+  {
+    auto functionToCall = std::bind(QuadtreePoissonFill::FillImage,
+                                    this->Image.GetPointer(),
+                                    this->PendingMask.GetPointer(),
+                                    this->Result.GetPointer(),
+                                    16u);
+
+    QFuture<void> future = QtConcurrent::run(functionToCall);
+    this->FutureWatcher.setFuture(future);
+    this->ProgressDialog->exec();
+    return;
+  }
+
+  // The exact membrane is solved by the solver library, in place in Result.
+  ITKHelpers::DeepCopy(this->Image.GetPointer(), this->Result.GetPointer());
 
+  QFuture<void> future = QtConcurrent::run(this, &PoissonEditingWidget::FillExactly);
+  this->FutureWatcher.setFuture(future);
   this->ProgressDialog->exec();
 }
 
+void PoissonEditingWidget::FillExactly()
+{
+  this->FillError = FillResult(this->Result.GetPointer(), this->PendingMask.GetPointer());
+}
+
+void PoissonEditingWidget::FillAutomatically()
+{
+  const FillPlanner::LogFunctionType log = [](const std::string& line)
+  {
+    std::cout << line << std::endl;
+  };
+
+  try
+  {
+    // Measuring the solvers takes a while the first time on a machine, so it is not done in the GUI.
+    if(!this->FillCalibration)
+    {
+      this->FillCalibration = std::make_shared<FillPlanner::Calibration>(FillPlanner::Calibration::LoadOrMeasure(log));
+    }
+
+    const FillPlanner::Plan plan = FillPlanner::MakePlan(this->Image.GetPointer(), this->PendingMask.GetPointer(),
+                                                         this->FillOptions, *this->FillCalibration);
+    this->FillStatus = QString("Automatic fill: %1 on %2 thread(s), %3.")
+                       .arg(FillPlanner::GetBackendName(plan.Backend))
+                       .arg(plan.NumberOfThreads)
+                       .arg(plan.Reason.c_str());
+
+    FillPlanner::Execute(plan, this->Image.GetPointer(), this->PendingMask.GetPointer(), this->Result.GetPointer(),
+                         log);
+  }
+  catch(const std::exception& exception)
+  {
+    this->FillStatus.clear();
+    this->FillError = exception.what();
+  }
+}
+
+PoissonEditingWidget::FillMethod PoissonEditingWidget::GetSelectedFillMethod() const
+{
+  if(this->chkAutomaticFill->isChecked())
+  {
+    return AutomaticFill;
+  }
+  if(this->chkApproximateFill->isChecked())
+  {
+    return ApproximateFill;
+  }
+  if(this->chkAdaptiveFill->isChecked())
+  {
+    return AdaptiveFill;
+  }
+  return ExactFill;
+}
+
 void PoissonEditingWidget::on_actionSaveResult_triggered()
 {
+  if(this->ExportWatcher.isRunning())
+  {
+    this->statusBar()->showMessage("Still saving the previous result.");
+    return;
+  }
+
   // Get a filename to save
   QString fileName = QFileDialog::getSaveFileName(this, "Save File", ".",
                                                   "Image Files (*.jpg *.jpeg *.bmp *.png *.mha)");
@@ -135,36 +322,218 @@ void PoissonEditingWidget::on_actionSaveResult_triggered()
     return;
   }
 
-  ITKHelpers::WriteImage(this->Result.GetPointer(), fileName.toStdString());
-  ITKHelpers::WriteRGBImage(this->Result.GetPointer(), fileName.toStdString() + ".png");
-  this->statusBar()->showMessage("Saved result.");
+  FinishPreview();
+  this->ExportedResult = ImageType::New();
+  ITKHelpers::DeepCopy(this->Result.GetPointer(), this->ExportedResult.GetPointer());
+
+  QFuture<std::string> future =
+      QtConcurrent::run(this, &PoissonEditingWidget::ExportResult, fileName.toStdString(), this->ExportOptions);
+  this->ExportWatcher.setFuture(future);
+  this->statusBar()->showMessage("Saving result...");
+}
+
+std::string PoissonEditingWidget::ExportResult(const std::string& fileName, const ResultExport::Options& options)
+{
+  try
+  {
+    ResultExport::Export(this->ExportedResult.GetPointer(), nullptr, fileName, options);
+  }
+  catch(const std::exception& exception)
+  {
+    return exception.what();
+  }
+  return std::string();
+}
+
+void PoissonEditingWidget::slot_ExportFinished()
+{
+  const std::string error = this->ExportWatcher.result();
+  this->ExportedResult = nullptr;
+
+  if(error.empty())
+  {
+    this->statusBar()->showMessage("Saved result.");
+  }
+  else
+  {
+    this->statusBar()->showMessage(QString("Could not save the result: %1").arg(error.c_str()));
+  }
+}
+
+void PoissonEditingWidget::on_actionExportCompression_triggered()
+{
+  bool ok = false;
+  int level = QInputDialog::getInt(this, "Compression Level", "Compression level (0 = none, 9 = smallest files):",
+                                   this->ExportOptions.CompressionLevel, 0, 9, 1, &ok);
+  if(ok)
+  {
+    this->ExportOptions.CompressionLevel = level;
+  }
+}
+
+void PoissonEditingWidget::on_actionUndo_triggered()
+{
+  FinishPreview();
+
+  // Previewed edits become a state of their own, so that they can be redone.
+  if(!this->HistoryIsCurrent && this->History.GetNumberOfStates() > 0)
+  {
+    PushHistory();
+  }
+
+  const itk::ImageRegion<2> previousRegion = this->History.GetRegion();
+  if(!this->History.Undo())
+  {
+    this->statusBar()->showMessage("Nothing to undo.");
+    return;
+  }
+  RestoreHistory(previousRegion);
+}
+
+void PoissonEditingWidget::on_actionRedo_triggered()
+{
+  FinishPreview();
+
+  // A preview after an undo starts a new branch of the history.
+  const itk::ImageRegion<2> previousRegion = this->History.GetRegion();
+  if(!this->HistoryIsCurrent || !this->History.Redo())
+  {
+    this->statusBar()->showMessage("Nothing to redo.");
+    return;
+  }
+  RestoreHistory(previousRegion);
+}
+
+void PoissonEditingWidget::on_actionHistoryMemory_triggered()
+{
+  bool ok = false;
+  int megabytes = QInputDialog::getInt(this, "History Memory", "Memory for undo/redo (MB):",
+                                       this->History.GetMemoryBudget() / (1024 * 1024), 1, 65536, 64, &ok);
+  if(ok)
+  {
+    this->History.SetMemoryBudget(static_cast<std::size_t>(megabytes) * 1024 * 1024);
+  }
+}
+
+void PoissonEditingWidget::on_actionFillMemory_triggered()
+{
+  bool ok = false;
+  int megabytes = QInputDialog::getInt(this, "Fill Memory", "Memory for an automatic fill (MB):",
+                                       this->FillOptions.MemoryBudget / (1024 * 1024), 1, 1048576, 256, &ok);
+  if(ok)
+  {
+    this->FillOptions.MemoryBudget = static_cast<std::size_t>(megabytes) * 1024 * 1024;
+  }
+}
+
+void PoissonEditingWidget::PushHistory()
+{
+  // Every fill leaves the image unchanged outside the hole, so only the hole is stored.
+  const PackedMask* const mask = this->FilledMask ? this->FilledMask.get() : this->PreviewedMask.get();
+  itk::ImageRegion<2> region;
+  if(mask && this->Result->GetLargestPossibleRegion() == this->Image->GetLargestPossibleRegion())
+  {
+    region = mask->GetHoleBoundingBox();
+  }
+
+  const bool approximate = this->FilledMask ? this->FilledMethod != ExactFill : this->PreviewedMask != nullptr;
+  this->History.Push(this->Result, region, mask, approximate);
+  this->HistoryIsCurrent = true;
+}
+
+void PoissonEditingWidget::RestoreHistory(const itk::ImageRegion<2>& previousRegion)
+{
+  this->ResultItem->BeginUpdate();
+
+  // Go back to the image where the previous state differed from it, then apply the new state.
+  if(this->Result->GetLargestPossibleRegion() != this->Image->GetLargestPossibleRegion())
+  {
+    ITKHelpers::DeepCopy(this->Image.GetPointer(), this->Result.GetPointer());
+  }
+  else if(previousRegion.GetNumberOfPixels() > 0)
+  {
+    itk::ImageRegionConstIterator<ImageType> imageIterator(this->Image, previousRegion);
+    itk::ImageRegionIterator<ImageType> resultIterator(this->Result, previousRegion);
+    while(!imageIterator.IsAtEnd())
+    {
+      resultIterator.Set(imageIterator.Get());
+      ++imageIterator;
+      ++resultIterator;
+    }
+  }
+
+  // The state only stores the mask inside of its region; the rest is valid.
+  std::shared_ptr<PackedMask> restoredMask;
+  if(this->History.HasMask())
+  {
+    restoredMask = std::make_shared<PackedMask>(this->MaskImage->GetLargestPossibleRegion());
+  }
+  this->History.Restore(this->Result, restoredMask.get());
+
+  // A restored preview or approximate fill can't be the base of an incremental fill.
+  this->FilledMask = this->History.IsApproximate() ? nullptr : restoredMask;
+  this->FilledMethod = ExactFill;
+  this->PreviewedMask = this->History.IsApproximate() ? restoredMask : nullptr;
+  this->FilledImageFileName = this->SourceImageFileName;
+  this->HistoryIsCurrent = true;
+
+  DisplayResult(this->Result->GetLargestPossibleRegion());
+}
+
+void PoissonEditingWidget::on_actionExportTiledTIFF_toggled(bool tiled)
+{
+  this->ExportOptions.TiledTIFF = tiled;
 }
 
 void PoissonEditingWidget::OpenImageAndMask(const std::string& imageFileName,
                                             const std::string& maskFileName)
 {
+  FinishPreview();
+  this->PreviewDirtyRect = QRect();
+
+  this->SourceImageFileName = imageFileName;
+  this->MaskImageFileName = maskFileName;
+
+  // The previous result can only be updated incrementally if it was computed from this image.
+  if(imageFileName != this->FilledImageFileName)
+  {
+    this->FilledMask = nullptr;
+    this->PreviewedMask = nullptr;
+  }
+
   // Load and display image
   typedef itk::ImageFileReader<ImageType> ImageReaderType;
   ImageReaderType::Pointer imageReader = ImageReaderType::New();
   imageReader->SetFileName(imageFileName);
   imageReader->Update();
 
+  // Drop the tiles of the previous image before it is overwritten.
+  this->ImageItem->SetImage(nullptr);
   ITKHelpers::DeepCopy(imageReader->GetOutput(), this->Image.GetPointer());
+  this->ImageItem->SetImage(this->Image);
 
-  QImage qimageImage = ITKQtHelpers::GetQImageColor(this->Image.GetPointer(),
-                                                    QImage::Format_RGB888);
-  this->ImagePixmapItem = this->Scene->addPixmap(QPixmap::fromImage(qimageImage));
-  this->graphicsView->fitInView(this->ImagePixmapItem);
-  this->ImagePixmapItem->setVisible(this->chkShowInput->isChecked());
+  this->graphicsView->fitInView(this->ImageItem);
 
   // Load and display mask
   this->MaskImage->Read(maskFileName);
 
-  QImage qimageMask = MaskQt::GetQtImage(this->MaskImage, 122);
-  QPixmap maskPixmap = QPixmap::fromImage(qimageMask);
+  // The overlay only needs as many pixels as the view can show, and is scaled back up.
+  const unsigned int displayFactor =
+      ImageDisplay::ComputeProxyFactor(this->MaskImage->GetLargestPossibleRegion().GetSize(),
+                                       QApplication::desktop()->screenGeometry(this).size());
 
-  this->MaskImagePixmapItem = this->Scene->addPixmap(maskPixmap);
+  if(!this->MaskImagePixmapItem)
+  {
+    this->MaskImagePixmapItem = this->Scene->addPixmap(QPixmap());
+  }
+  this->MaskImagePixmapItem->setZValue(1); // keep brush strokes visible over the result
   this->MaskImagePixmapItem->setVisible(this->chkShowMask->isChecked());
+
+  this->Brush->SetMask(this->MaskImage, this->MaskImagePixmapItem, 122, displayFactor);
+
+  // The history is stored relative to the image, so it starts over.
+  this->History.SetReference(this->Image);
+  this->HistoryIsCurrent = false;
 }
 
 void PoissonEditingWidget::on_actionOpenImageAndMask_triggered()
@@ -196,35 +565,180 @@ void PoissonEditingWidget::on_actionOpenImageAndMask_triggered()
 
 void PoissonEditingWidget::on_chkShowInput_clicked()
 {
-  if(!this->ImagePixmapItem)
+  this->ImageItem->setVisible(this->chkShowInput->isChecked());
+}
+
+void PoissonEditingWidget::on_chkShowOutput_clicked()
+{
+  this->ResultItem->setVisible(this->chkShowOutput->isChecked());
+}
+
+void PoissonEditingWidget::on_chkShowMask_clicked()
+{
+  if(!this->MaskImagePixmapItem)
   {
     return;
   }
-  this->ImagePixmapItem->setVisible(this->chkShowInput->isChecked());
+  this->MaskImagePixmapItem->setVisible(this->chkShowMask->isChecked());
 }
 
-void PoissonEditingWidget::on_chkShowOutput_clicked()
+void PoissonEditingWidget::slot_IterationComplete()
 {
-  if(!this->ResultPixmapItem)
+  // A fill that failed may have left Result anywhere between the image and the fill, so the
+  // state before the fill (which was pushed to the history) is shown again.
+  if(!this->FillError.empty())
   {
+    const QString message = QString("Fill failed: %1").arg(this->FillError.c_str());
+    this->FillError.clear();
+    this->FillStatus.clear();
+    this->PendingMask = nullptr;
+    this->ResultItem->EndUpdate(itk::ImageRegion<2>());
+    RestoreHistory(this->Result->GetLargestPossibleRegion());
+    this->statusBar()->showMessage(message);
     return;
   }
-  this->ResultPixmapItem->setVisible(this->chkShowOutput->isChecked());
+
+  if(!this->FillStatus.isEmpty())
+  {
+    this->statusBar()->showMessage(this->FillStatus);
+    this->FillStatus.clear();
+  }
+
+  this->FilledMask = std::make_shared<PackedMask>(PackedMask::FromMask(this->PendingMask));
+  this->FilledMethod = this->PendingMethod;
+  this->PreviewedMask = nullptr;
+  this->PendingMask = nullptr;
+  this->FilledImageFileName = this->SourceImageFileName;
+
+  PushHistory();
+  DisplayResult(this->Result->GetLargestPossibleRegion());
 }
 
-void PoissonEditingWidget::on_chkShowMask_clicked()
+void PoissonEditingWidget::DisplayResult(const itk::ImageRegion<2>& changedRegion)
 {
-  if(!this->MaskImagePixmapItem)
+  // Only the visible tiles of the changed region are converted again.
+  this->ResultItem->EndUpdate(changedRegion);
+  this->ResultItem->setVisible(this->chkShowOutput->isChecked());
+}
+
+void PoissonEditingWidget::on_chkPaintMask_clicked()
+{
+  this->Brush->SetEnabled(this->chkPaintMask->isChecked());
+}
+
+void PoissonEditingWidget::on_spinBrushRadius_valueChanged(int radius)
+{
+  this->Brush->SetRadius(radius);
+}
+
+void PoissonEditingWidget::slot_MaskPainted(const QRect& dirtyRect)
+{
+  this->PreviewDirtyRect |= dirtyRect;
+
+  // Don't restart a running timer, so that a long stroke still updates regularly.
+  if(this->chkLivePreview->isChecked() && !this->PreviewTimer.isActive())
+  {
+    this->PreviewTimer.start();
+  }
+}
+
+void PoissonEditingWidget::slot_UpdatePreview()
+{
+  if(this->PreviewDirtyRect.isEmpty())
   {
     return;
   }
-  this->MaskImagePixmapItem->setVisible(this->chkShowMask->isChecked());
+
+  if(this->PreviewWatcher.isRunning())
+  {
+    this->PreviewTimer.start();
+    return;
+  }
+
+  // The first preview after a fill starts from the filled mask. Without a previous result,
+  // start from the unfilled image, which is the exact result for a mask without a hole.
+  if(!this->PreviewedMask)
+  {
+    if(this->FilledMask)
+    {
+      this->PreviewedMask = std::make_shared<PackedMask>(*this->FilledMask);
+    }
+    else
+    {
+      this->ResultItem->BeginUpdate();
+      ITKHelpers::DeepCopy(this->Image.GetPointer(), this->Result.GetPointer());
+      DisplayResult(this->Result->GetLargestPossibleRegion());
+
+      this->PreviewedMask = std::make_shared<PackedMask>(this->MaskImage->GetLargestPossibleRegion());
+      this->FilledImageFileName = this->SourceImageFileName;
+    }
+  }
+
+  itk::Index<2> dirtyCorner = {{this->PreviewDirtyRect.x(), this->PreviewDirtyRect.y()}};
+  itk::Size<2> dirtySize = {{static_cast<itk::SizeValueType>(this->PreviewDirtyRect.width()),
+                             static_cast<itk::SizeValueType>(this->PreviewDirtyRect.height())}};
+  this->PreviewRegion = itk::ImageRegion<2>(dirtyCorner, dirtySize);
+  this->PreviewDirtyRect = QRect();
+
+  this->PreviewMask = Mask::New();
+  this->PreviewMask->DeepCopyFrom(this->MaskImage);
+
+  IncrementalPoissonFill::MaskDifference difference =
+      IncrementalPoissonFill::ComputeMaskDifference(*this->PreviewedMask, this->PreviewMask,
+                                                    this->PreviewRegion);
+  if(difference.ChangedPixels.empty())
+  {
+    this->PreviewMask = nullptr;
+    return;
+  }
+
+  this->PreviewWindow = IncrementalPoissonFill::ComputeWindow(difference,
+                                                              this->Image->GetLargestPossibleRegion());
+
+  // Ended by slot_PreviewComplete(), which only refreshes the tiles of the window.
+  this->ResultItem->BeginUpdate();
+
+  auto functionToCall = std::bind(IncrementalPoissonFill::UpdateFill,
+                                  this->Image.GetPointer(),
+                                  difference,
+                                  this->PreviewMask.GetPointer(),
+                                  this->Result.GetPointer());
+
+  this->PreviewWatcher.setFuture(QtConcurrent::run(functionToCall));
 }
 
-void PoissonEditingWidget::slot_IterationComplete()
+void PoissonEditingWidget::FinishPreview()
 {
-  QImage qimage = ITKQtHelpers::GetQImageColor(this->Result.GetPointer(),
-                                               QImage::Format_RGB888);
-  this->ResultPixmapItem = this->Scene->addPixmap(QPixmap::fromImage(qimage));
-  this->ResultPixmapItem->setVisible(this->chkShowOutput->isChecked());
+  this->PreviewTimer.stop();
+  this->PreviewWatcher.waitForFinished();
+  slot_PreviewComplete();
+}
+
+void PoissonEditingWidget::slot_PreviewComplete()
+{
+  // The preview may already have been collected by FinishPreview().
+  if(!this->PreviewMask)
+  {
+    return;
+  }
+
+  this->HistoryIsCurrent = false;
+
+  // Result now approximates the fill of the previewed mask inside the compared region, and
+  // is no longer the exact fill of any mask.
+  itk::ImageRegion<2> comparedRegion = this->PreviewRegion;
+  if(comparedRegion.Crop(this->PreviewMask->GetLargestPossibleRegion()))
+  {
+    this->PreviewedMask->Assign(this->PreviewMask, comparedRegion);
+  }
+  this->FilledMask = nullptr;
+  this->PreviewMask = nullptr;
+
+  DisplayResult(this->PreviewWindow);
+
+  // Pick up whatever was painted while this preview was running.
+  if(!this->PreviewDirtyRect.isEmpty() && this->chkLivePreview->isChecked())
+  {
+    this->PreviewTimer.start();
+  }
 }
@@ -24,6 +24,12 @@
 // ITK
 #include "itkVectorImage.h"
 
+// Custom
+#include "EditHistory.h"
+#include "FillPlanner.h"
+#include "PackedMask.h"
+#include "ResultExport.h"
+
 // Submodules
 #include "Mask/Mask.h"
 
@@ -31,7 +37,13 @@
 #include <QMainWindow>
 #include <QFutureWatcher>
 #include <QProgressDialog>
+#include <QTimer>
 class QGraphicsPixmapItem;
+class MaskBrush;
+class TiledImageItem;
+
+// STL
+#include <memory>
 
 
 class PoissonEditingWidget : public QMainWindow, public Ui::PoissonEditingWidget
@@ -49,7 +61,14 @@ public slots:
 
   void on_actionOpenImageAndMask_triggered();
   void on_actionSaveResult_triggered();
+  void on_actionExportCompression_triggered();
+  void on_actionExportTiledTIFF_toggled(bool tiled);
   
+  void on_actionUndo_triggered();
+  void on_actionRedo_triggered();
+  void on_actionHistoryMemory_triggered();
+  void on_actionFillMemory_triggered();
+
   void on_btnFill_clicked();
   
   void on_chkShowInput_clicked();
@@ -58,21 +77,86 @@ public slots:
 
   void slot_IterationComplete();
 
+  void on_chkPaintMask_clicked();
+  void on_spinBrushRadius_valueChanged(int radius);
+
+  void slot_MaskPainted(const QRect& dirtyRect);
+  void slot_UpdatePreview();
+  void slot_PreviewComplete();
+
+  void slot_ExportFinished();
+
 private:
-    
+
+  /** The ways a fill can compute Result, as selected by the fill checkboxes. An exact fill
+    * of a mask that differs only a little from the last exact fill is an IncrementalFill. */
+  enum FillMethod {ExactFill, AutomaticFill, ApproximateFill, AdaptiveFill, IncrementalFill};
+
+  /** The fill method that the checkboxes currently select. */
+  FillMethod GetSelectedFillMethod() const;
+
   void showEvent(QShowEvent* event);
   void resizeEvent(QResizeEvent* event);
   
   void OpenImageAndMask(const std::string& imageFileName,
                         const std::string& maskFileName);
 
+  /** Wait for a running preview and record what it filled. */
+  void FinishPreview();
+
+  /** Make Result and the mask it holds the fill of (FilledMask, or PreviewedMask after a
+    * preview) the current state of the history. */
+  void PushHistory();
+
+  /** Show the current state of the history after an undo or redo, whose previous state
+    * differed from the image in 'previousRegion'. */
+  void RestoreHistory(const itk::ImageRegion<2>& previousRegion);
+
+  /** Show Result after 'changedRegion' was written, ending the update of ResultItem that was
+    * begun before writing. */
+  void DisplayResult(const itk::ImageRegion<2>& changedRegion);
+
+  /** Fill PendingMask in Result, which holds a copy of Image, with the exact solver. Runs in
+    * the background; sets FillError if the fill fails. */
+  void FillExactly();
+
+  /** Plan the fill of PendingMask into Result and run it, measuring the solvers first if they
+    * were never measured. Runs in the background; sets FillStatus to the plan, or FillError if
+    * no plan fits or the fill fails. */
+  void FillAutomatically();
+
+  /** Write ExportedResult. Runs in the background; returns an error message, or an empty
+    * string on success. */
+  std::string ExportResult(const std::string& fileName, const ResultExport::Options& options);
+
   ImageType::Pointer Result;
   ImageType::Pointer Image;
   Mask::Pointer MaskImage;
 
-  QGraphicsPixmapItem* ImagePixmapItem = nullptr;
+  /** The mask that 'Result' is the fill of, bit-packed (null if there is no such result).
+    * If it was filled exactly (not incrementally), a new mask that differs from it only a
+    * little is filled incrementally. */
+  std::shared_ptr<PackedMask> FilledMask;
+
+  /** The method that filled FilledMask, and the method of the running fill. */
+  FillMethod FilledMethod = ExactFill;
+  FillMethod PendingMethod = ExactFill;
+
+  /** The mask that the live preview has approximated in 'Result', or null if there was no
+    * preview since the last fill. A preview re-solves windows around the strokes, so it clears
+    * FilledMask and the next fill is solved from scratch. */
+  std::shared_ptr<PackedMask> PreviewedMask;
+
+  /** A copy of the mask being filled by the running computation. */
+  Mask::Pointer PendingMask;
+
+  /** The image that 'Result' was computed from. */
+  std::string FilledImageFileName;
+
+  /** Image and Result are drawn in tiles; the mask stays a pixmap because MaskBrush paints into it. */
+  TiledImageItem* ImageItem = nullptr;
   QGraphicsPixmapItem* MaskImagePixmapItem = nullptr;
-  QGraphicsPixmapItem* ResultPixmapItem = nullptr;
+  TiledImageItem* ResultItem = nullptr;
   
   QGraphicsScene* Scene;
 
@@ -81,6 +165,43 @@ private:
 
   QFutureWatcher<void> FutureWatcher;
   QProgressDialog* ProgressDialog;
+
+  /** Paints into MaskImage when "Paint Mask" is checked. */
+  MaskBrush* Brush;
+
+  /** While painting, the dirty region is re-filled at most once per timeout of this timer. */
+  QTimer PreviewTimer;
+
+  /** The mask pixels painted since the last preview was started. */
+  QRect PreviewDirtyRect;
+
+  /** The region the running preview compares, the window it re-solves, and its copy of the mask. */
+  itk::ImageRegion<2> PreviewRegion;
+  itk::ImageRegion<2> PreviewWindow;
+  Mask::Pointer PreviewMask;
+
+  QFutureWatcher<void> PreviewWatcher;
+
+  /** A copy of Result taken when saving started, since fills and previews modify Result in place. */
+  ImageType::Pointer ExportedResult;
+
+  /** The results of previous fills. Each state is stored relative to Image. */
+  EditHistory History;
+
+  /** False when Result was changed (by a preview) since it was last pushed to History. */
+  bool HistoryIsCurrent = false;
+
+  ResultExport::Options ExportOptions;
+  QFutureWatcher<std::string> ExportWatcher;
+
+  /** The budget "Automatic Fill" plans with, and the constants of this machine, which are
+    * loaded (or measured) in the background the first time an automatic fill is planned. */
+  FillPlanner::Options FillOptions;
+  std::shared_ptr<FillPlanner::Calibration> FillCalibration;
+
+  /** Set by the running fill, and shown when it is complete. */
+  QString FillStatus;
+  std::string FillError;
 };
 
 #endif // PoissonEditingWidget_H
@@ -0,0 +1,485 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "QuadtreePoissonFill.h"
+
+// Custom
+#include "PackedMask.h"
+
+// Eigen
+#include <Eigen/Sparse>
+
+// STL
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+
+namespace QuadtreePoissonFill
+{
+
+namespace
+{
+  /** Counts the hole pixels of any rectangle of 'Region' in constant time. */
+  class HoleCounter
+  {
+  public:
+    HoleCounter(const PackedMask& mask, const itk::ImageRegion<2>& region) : Region(region)
+    {
+      const unsigned int width = region.GetSize()[0];
+      const unsigned int height = region.GetSize()[1];
+      this->Sums.assign((width + 1) * (height + 1), 0);
+
+      itk::Index<2> index;
+      for(unsigned int y = 0; y < height; ++y)
+      {
+        index[1] = region.GetIndex()[1] + y;
+        unsigned int rowSum = 0;
+        for(unsigned int x = 0; x < width; ++x)
+        {
+          index[0] = region.GetIndex()[0] + x;
+          rowSum += mask.IsHole(index);
+          this->Sums[(y + 1) * (width + 1) + x + 1] = this->Sums[y * (width + 1) + x + 1] + rowSum;
+        }
+      }
+    }
+
+    /** 'region' must be inside of Region. */
+    unsigned int Count(const itk::ImageRegion<2>& region) const
+    {
+      const unsigned int stride = this->Region.GetSize()[0] + 1;
+      const unsigned int x0 = region.GetIndex()[0] - this->Region.GetIndex()[0];
+      const unsigned int y0 = region.GetIndex()[1] - this->Region.GetIndex()[1];
+      const unsigned int x1 = x0 + region.GetSize()[0];
+      const unsigned int y1 = y0 + region.GetSize()[1];
+      return this->Sums[y1 * stride + x1] - this->Sums[y0 * stride + x1] -
+             this->Sums[y1 * stride + x0] + this->Sums[y0 * stride + x0];
+    }
+
+  private:
+    itk::ImageRegion<2> Region;
+    std::vector<unsigned int> Sums;
+  };
+
+  void Subdivide(const itk::Index<2>& corner, const unsigned int size, const itk::ImageRegion<2>& holeRegion,
+                 const HoleCounter& counter, const unsigned int maximumCellSize, std::vector<Cell>& cells)
+  {
+    itk::Size<2> cellSize = {{size, size}};
+    itk::ImageRegion<2> cellRegion(corner, cellSize);
+    itk::ImageRegion<2> croppedRegion = cellRegion;
+    if(!croppedRegion.Crop(holeRegion) || counter.Count(croppedRegion) == 0)
+    {
+      return;
+    }
+
+    Cell cell;
+    cell.Corner = corner;
+    cell.Size = size;
+    if(size == 1)
+    {
+      cells.push_back(cell);
+      return;
+    }
+
+    // A cell can be interpolated if it is at least half its size away from the boundary, so
+    // that the cells grow gradually towards the interior. The hole region is the bounding box
+    // of the hole, so a ring outside of it can not be all hole.
+    itk::ImageRegion<2> paddedRegion = cellRegion;
+    paddedRegion.PadByRadius(size / 2);
+    if(size <= maximumCellSize && holeRegion.IsInside(paddedRegion) &&
+       counter.Count(paddedRegion) == paddedRegion.GetNumberOfPixels())
+    {
+      cells.push_back(cell);
+      return;
+    }
+
+    const unsigned int half = size / 2;
+    for(unsigned int child = 0; child < 4; ++child)
+    {
+      itk::Index<2> childCorner = {{corner[0] + static_cast<itk::IndexValueType>((child % 2) * half),
+                                    corner[1] + static_cast<itk::IndexValueType>((child / 2) * half)}};
+      Subdivide(childCorner, half, holeRegion, counter, maximumCellSize, cells);
+    }
+  }
+
+  /** The membrane energy of the edges between the pixels of a cell of 'size', as a
+    * quadratic form in its four corner values. */
+  Eigen::Matrix4d ComputeCellEnergy(const unsigned int size)
+  {
+    Eigen::Matrix4d energy = Eigen::Matrix4d::Zero();
+    for(unsigned int y = 0; y < size; ++y)
+    {
+      for(unsigned int x = 0; x < size; ++x)
+      {
+        const double u = static_cast<double>(x) / size;
+        const double v = static_cast<double>(y) / size;
+        const Eigen::Vector4d weights((1.0 - u) * (1.0 - v), u * (1.0 - v), (1.0 - u) * v, u * v);
+
+        // The edges to the right and down stay inside of the cell.
+        if(x + 1 < size)
+        {
+          const double nextU = static_cast<double>(x + 1) / size;
+          const Eigen::Vector4d difference =
+              Eigen::Vector4d((1.0 - nextU) * (1.0 - v), nextU * (1.0 - v), (1.0 - nextU) * v, nextU * v) - weights;
+          energy += difference * difference.transpose();
+        }
+        if(y + 1 < size)
+        {
+          const double nextV = static_cast<double>(y + 1) / size;
+          const Eigen::Vector4d difference =
+              Eigen::Vector4d((1.0 - u) * (1.0 - nextV), u * (1.0 - nextV), (1.0 - u) * nextV, u * nextV) - weights;
+          energy += difference * difference.transpose();
+        }
+      }
+    }
+    return energy;
+  }
+}
+
+std::vector<Cell> BuildQuadtree(const Mask* const mask, const itk::ImageRegion<2>& imageRegion,
+                                const unsigned int maximumCellSize)
+{
+  std::vector<Cell> cells;
+
+  itk::ImageRegion<2> maskRegion = mask->GetLargestPossibleRegion();
+  if(!maskRegion.Crop(imageRegion))
+  {
+    return cells;
+  }
+
+  // The bounding box of the hole, found a word of the packed mask at a time.
+  const PackedMask packedMask = PackedMask::FromMask(mask, maskRegion);
+  const itk::ImageRegion<2> holeRegion = packedMask.GetHoleBoundingBox();
+  if(holeRegion.GetNumberOfPixels() == 0)
+  {
+    return cells;
+  }
+
+  unsigned int rootSize = 1;
+  while(rootSize < std::max(holeRegion.GetSize()[0], holeRegion.GetSize()[1]))
+  {
+    rootSize *= 2;
+  }
+
+  HoleCounter counter(packedMask, holeRegion);
+  Subdivide(holeRegion.GetIndex(), rootSize, holeRegion, counter, maximumCellSize, cells);
+  return cells;
+}
+
+void Interpolation::Add(const int node, const double weight)
+{
+  for(unsigned int entry = 0; entry < this->NumberOfNodes; ++entry)
+  {
+    if(this->Nodes[entry] == node)
+    {
+      this->Weights[entry] += weight;
+      return;
+    }
+  }
+  this->Nodes[this->NumberOfNodes] = node;
+  this->Weights[this->NumberOfNodes] = weight;
+  ++this->NumberOfNodes;
+}
+
+NodeGrid::NodeGrid(const std::vector<Cell>& cells) : Cells(cells)
+{
+  if(cells.empty())
+  {
+    return;
+  }
+
+  // All the cells and their corners are inside the bounding box of the cells.
+  itk::Index<2> lower = cells[0].Corner;
+  itk::Index<2> upper = cells[0].Corner;
+  for(unsigned int cellId = 0; cellId < cells.size(); ++cellId)
+  {
+    for(unsigned int dimension = 0; dimension < 2; ++dimension)
+    {
+      lower[dimension] = std::min(lower[dimension], cells[cellId].Corner[dimension]);
+      upper[dimension] = std::max(upper[dimension], cells[cellId].Corner[dimension] +
+                                  static_cast<itk::IndexValueType>(cells[cellId].Size) - 1);
+    }
+  }
+  this->Region.SetIndex(lower);
+  this->Region.SetUpperIndex(upper);
+
+  this->NodeLookup.assign(this->Region.GetNumberOfPixels(), -1);
+  this->CellLookup.assign(this->Region.GetNumberOfPixels(), -1);
+
+  // Number the nodes in cell order, so that the system does not depend on anything else.
+  for(unsigned int cellId = 0; cellId < cells.size(); ++cellId)
+  {
+    const Cell& cell = cells[cellId];
+    if(cell.Size == 1)
+    {
+      AddNode(cell.Corner);
+    }
+    else
+    {
+      for(unsigned int corner = 0; corner < 4; ++corner)
+      {
+        AddNode(GetCellCorner(cell, corner));
+      }
+    }
+
+    for(unsigned int y = 0; y < cell.Size; ++y)
+    {
+      int* cellLookup = &this->CellLookup[GetOffset(cell.Corner) + y * this->Region.GetSize()[0]];
+      std::fill(cellLookup, cellLookup + cell.Size, static_cast<int>(cellId));
+    }
+  }
+}
+
+int NodeGrid::GetCellId(const itk::Index<2>& index) const
+{
+  return this->Region.IsInside(index) ? this->CellLookup[GetOffset(index)] : -1;
+}
+
+int NodeGrid::GetNodeId(const itk::Index<2>& index) const
+{
+  return this->Region.IsInside(index) ? this->NodeLookup[GetOffset(index)] : -1;
+}
+
+itk::Index<2> NodeGrid::GetCellCorner(const Cell& cell, const unsigned int corner)
+{
+  itk::Index<2> index = {{cell.Corner[0] + static_cast<itk::IndexValueType>((corner % 2) * cell.Size),
+                          cell.Corner[1] + static_cast<itk::IndexValueType>((corner / 2) * cell.Size)}};
+  return index;
+}
+
+Interpolation NodeGrid::Interpolate(const itk::Index<2>& index) const
+{
+  const Cell& cell = this->Cells[GetCellId(index)];
+  Interpolation interpolation;
+  if(cell.Size == 1)
+  {
+    interpolation.NumberOfNodes = 1;
+    interpolation.Nodes[0] = this->NodeLookup[GetOffset(index)];
+    interpolation.Weights[0] = 1.0;
+    return interpolation;
+  }
+
+  const double u = static_cast<double>(index[0] - cell.Corner[0]) / cell.Size;
+  const double v = static_cast<double>(index[1] - cell.Corner[1]) / cell.Size;
+  const double weights[4] = {(1.0 - u) * (1.0 - v), u * (1.0 - v), (1.0 - u) * v, u * v};
+  for(unsigned int corner = 0; corner < 4; ++corner)
+  {
+    if(weights[corner] > 0.0)
+    {
+      interpolation.Nodes[interpolation.NumberOfNodes] =
+          this->NodeLookup[GetOffset(GetCellCorner(cell, corner))];
+      interpolation.Weights[interpolation.NumberOfNodes] = weights[corner];
+      ++interpolation.NumberOfNodes;
+    }
+  }
+  return interpolation;
+}
+
+void NodeGrid::GetCornerNodes(const Cell& cell, int nodes[4]) const
+{
+  for(unsigned int corner = 0; corner < 4; ++corner)
+  {
+    nodes[corner] = this->NodeLookup[GetOffset(GetCellCorner(cell, corner))];
+  }
+}
+
+unsigned int NodeGrid::GetOffset(const itk::Index<2>& index) const
+{
+  return (index[1] - this->Region.GetIndex()[1]) * this->Region.GetSize()[0] +
+         (index[0] - this->Region.GetIndex()[0]);
+}
+
+void NodeGrid::AddNode(const itk::Index<2>& index)
+{
+  int& node = this->NodeLookup[GetOffset(index)];
+  if(node < 0)
+  {
+    node = this->NodePositions.size();
+    this->NodePositions.push_back(index);
+  }
+}
+
+unsigned int FillImage(const ImageType* const image, const Mask* const mask, ImageType* const result,
+                       const unsigned int maximumCellSize)
+{
+  const itk::ImageRegion<2> imageRegion = image->GetLargestPossibleRegion();
+  const unsigned int numberOfComponents = image->GetNumberOfComponentsPerPixel();
+
+  if(result != image)
+  {
+    result->SetNumberOfComponentsPerPixel(numberOfComponents);
+    result->SetRegions(imageRegion);
+    result->Allocate();
+    std::memcpy(result->GetBufferPointer(), image->GetBufferPointer(),
+                imageRegion.GetNumberOfPixels() * numberOfComponents * sizeof(float));
+  }
+
+  std::vector<Cell> cells = BuildQuadtree(mask, imageRegion, maximumCellSize);
+  if(cells.empty())
+  {
+    return 0;
+  }
+
+  NodeGrid grid(cells);
+  const unsigned int numberOfNodes = grid.GetNumberOfNodes();
+
+  std::vector<Eigen::Triplet<double> > triplets;
+  Eigen::MatrixXd b = Eigen::MatrixXd::Zero(numberOfNodes, numberOfComponents);
+  const float* imageBuffer = image->GetBufferPointer();
+
+  // The energy of the edges inside of the large cells only depends on the size of the cell.
+  std::map<unsigned int, Eigen::Matrix4d> cellEnergies;
+  for(unsigned int cellId = 0; cellId < cells.size(); ++cellId)
+  {
+    const Cell& cell = cells[cellId];
+    if(cell.Size == 1)
+    {
+      continue;
+    }
+
+    if(cellEnergies.find(cell.Size) == cellEnergies.end())
+    {
+      cellEnergies[cell.Size] = ComputeCellEnergy(cell.Size);
+    }
+    const Eigen::Matrix4d& energy = cellEnergies[cell.Size];
+
+    int nodes[4];
+    grid.GetCornerNodes(cell, nodes);
+    for(unsigned int row = 0; row < 4; ++row)
+    {
+      for(unsigned int column = 0; column < 4; ++column)
+      {
+        triplets.push_back(Eigen::Triplet<double>(nodes[row], nodes[column], energy(row, column)));
+      }
+    }
+  }
+
+  // Add the squared difference f_p - f_q of every other edge that touches the hole. The
+  // value of a fixed pixel moves to the right hand side.
+  auto addEdge = [&](const itk::Index<2>& pixel, const itk::Index<2>& neighbor)
+  {
+    Interpolation difference = grid.Interpolate(pixel);
+    const float* fixedValue = nullptr;
+    if(grid.GetCellId(neighbor) >= 0)
+    {
+      Interpolation neighborInterpolation = grid.Interpolate(neighbor);
+      for(unsigned int entry = 0; entry < neighborInterpolation.NumberOfNodes; ++entry)
+      {
+        difference.Add(neighborInterpolation.Nodes[entry], -neighborInterpolation.Weights[entry]);
+      }
+    }
+    else
+    {
+      fixedValue = imageBuffer + image->ComputeOffset(neighbor) * numberOfComponents;
+    }
+
+    for(unsigned int row = 0; row < difference.NumberOfNodes; ++row)
+    {
+      for(unsigned int column = 0; column < difference.NumberOfNodes; ++column)
+      {
+        triplets.push_back(Eigen::Triplet<double>(difference.Nodes[row], difference.Nodes[column],
+                                                  difference.Weights[row] * difference.Weights[column]));
+      }
+      if(fixedValue)
+      {
+        for(unsigned int component = 0; component < numberOfComponents; ++component)
+        {
+          b(difference.Nodes[row], component) += difference.Weights[row] * fixedValue[component];
+        }
+      }
+    }
+  };
+
+  const itk::Offset<2> right = {{1, 0}};
+  const itk::Offset<2> down = {{0, 1}};
+  const itk::Offset<2> neighborOffsets[4] = {{{-1, 0}}, {{1, 0}}, {{0, -1}}, {{0, 1}}};
+  for(unsigned int cellId = 0; cellId < cells.size(); ++cellId)
+  {
+    const Cell& cell = cells[cellId];
+    if(cell.Size == 1)
+    {
+      // Edges to fixed pixels in every direction, edges between hole pixels only once.
+      for(unsigned int neighbor = 0; neighbor < 4; ++neighbor)
+      {
+        const itk::Index<2> neighborPixel = cell.Corner + neighborOffsets[neighbor];
+        if(imageRegion.IsInside(neighborPixel) &&
+           (grid.GetCellId(neighborPixel) < 0 || neighborOffsets[neighbor] == right ||
+            neighborOffsets[neighbor] == down))
+        {
+          addEdge(cell.Corner, neighborPixel);
+        }
+      }
+      continue;
+    }
+
+    // A large cell is surrounded by hole pixels, so only the edges leaving its last column
+    // and its last row are not counted yet.
+    for(unsigned int i = 0; i < cell.Size; ++i)
+    {
+      itk::Index<2> lastColumnPixel = {{cell.Corner[0] + static_cast<itk::IndexValueType>(cell.Size) - 1,
+                                        cell.Corner[1] + static_cast<itk::IndexValueType>(i)}};
+      addEdge(lastColumnPixel, lastColumnPixel + right);
+
+      itk::Index<2> lastRowPixel = {{cell.Corner[0] + static_cast<itk::IndexValueType>(i),
+                                     cell.Corner[1] + static_cast<itk::IndexValueType>(cell.Size) - 1}};
+      addEdge(lastRowPixel, lastRowPixel + down);
+    }
+  }
+
+  Eigen::SparseMatrix<double> A(numberOfNodes, numberOfNodes);
+  A.setFromTriplets(triplets.begin(), triplets.end());
+
+  Eigen::SimplicialLDLT<Eigen::SparseMatrix<double> > factorization(A);
+  if(factorization.info() != Eigen::Success)
+  {
+    throw std::runtime_error("QuadtreePoissonFill: the system could not be factorized. "
+                             "Does every part of the hole touch a known pixel?");
+  }
+  const Eigen::MatrixXd nodeValues = factorization.solve(b);
+
+  // Interpolate the pixels from the nodes.
+  float* resultBuffer = result->GetBufferPointer();
+  for(unsigned int cellId = 0; cellId < cells.size(); ++cellId)
+  {
+    const Cell& cell = cells[cellId];
+    itk::Index<2> pixel;
+    for(unsigned int y = 0; y < cell.Size; ++y)
+    {
+      pixel[1] = cell.Corner[1] + y;
+      for(unsigned int x = 0; x < cell.Size; ++x)
+      {
+        pixel[0] = cell.Corner[0] + x;
+        const Interpolation interpolation = grid.Interpolate(pixel);
+        float* resultPixel = resultBuffer + result->ComputeOffset(pixel) * numberOfComponents;
+        for(unsigned int component = 0; component < numberOfComponents; ++component)
+        {
+          double value = 0.0;
+          for(unsigned int entry = 0; entry < interpolation.NumberOfNodes; ++entry)
+          {
+            value += interpolation.Weights[entry] * nodeValues(interpolation.Nodes[entry], component);
+          }
+          resultPixel[component] = value;
+        }
+      }
+    }
+  }
+
+  return numberOfNodes;
+}
+
+} // end namespace
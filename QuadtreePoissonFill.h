@@ -0,0 +1,126 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+/** These functions fill a hole with a membrane (a zero guidance field) without one
+  * unknown per pixel. Far from the boundary of the hole the membrane is smooth, so the
+  * hole is covered by a quadtree whose cells are single pixels along the boundary and
+  * grow towards the interior. A large cell is interpolated bilinearly from its four
+  * corners, and the membrane energy of the pixels is minimized over the corner values
+  * (Agarwala 2007, "Efficient gradient-domain compositing using quadtrees"). The number
+  * of unknowns grows with the length of the boundary rather than the area of the hole.
+  */
+
+#ifndef QuadtreePoissonFill_H
+#define QuadtreePoissonFill_H
+
+// ITK
+#include "itkVectorImage.h"
+
+// Submodules
+#include "Mask/Mask.h"
+
+// STL
+#include <vector>
+
+namespace QuadtreePoissonFill
+{
+  typedef itk::VectorImage<float, 2> ImageType;
+
+  /** A square leaf of the quadtree. A cell of size 1 is a single hole pixel; a larger
+    * cell is all hole, and so are the pixels within half its size around it. */
+  struct Cell
+  {
+    itk::Index<2> Corner;
+    unsigned int Size;
+  };
+
+  /** A linear combination of node values. A pixel uses at most four nodes, the difference
+    * of two pixels at most eight. */
+  struct Interpolation
+  {
+    unsigned int NumberOfNodes = 0;
+    int Nodes[8];
+    double Weights[8];
+
+    void Add(const int node, const double weight);
+  };
+
+  /** The nodes of a set of cells (the pixel of a cell of size 1, the corners of a larger
+    * cell) and the interpolation of the pixels of the cells from them. */
+  class NodeGrid
+  {
+  public:
+    NodeGrid(const std::vector<Cell>& cells = std::vector<Cell>());
+
+    unsigned int GetNumberOfNodes() const
+    {
+      return this->NodePositions.size();
+    }
+
+    const itk::Index<2>& GetNodePosition(const unsigned int node) const
+    {
+      return this->NodePositions[node];
+    }
+
+    const std::vector<Cell>& GetCells() const
+    {
+      return this->Cells;
+    }
+
+    /** The id of the cell that 'index' is in, or -1 if it is not in a cell. */
+    int GetCellId(const itk::Index<2>& index) const;
+
+    /** The id of the node at 'index', or -1 if there is none. */
+    int GetNodeId(const itk::Index<2>& index) const;
+
+    /** The corners of a cell of size s, in the order (0,0), (s,0), (0,s), (s,s). */
+    static itk::Index<2> GetCellCorner(const Cell& cell, const unsigned int corner);
+
+    /** The value of a pixel of a cell in terms of the nodes of its cell. */
+    Interpolation Interpolate(const itk::Index<2>& index) const;
+
+    /** The node ids of the corners of a cell larger than one pixel. */
+    void GetCornerNodes(const Cell& cell, int nodes[4]) const;
+
+  private:
+    unsigned int GetOffset(const itk::Index<2>& index) const;
+
+    void AddNode(const itk::Index<2>& index);
+
+    std::vector<Cell> Cells;
+
+    /** The bounding box of the cells. */
+    itk::ImageRegion<2> Region;
+
+    std::vector<int> NodeLookup;
+    std::vector<int> CellLookup;
+    std::vector<itk::Index<2> > NodePositions;
+  };
+
+  /** Cover the hole pixels of 'mask' inside 'imageRegion' with cells no larger than
+    * 'maximumCellSize' (a power of two). */
+  std::vector<Cell> BuildQuadtree(const Mask* const mask, const itk::ImageRegion<2>& imageRegion,
+                                  const unsigned int maximumCellSize);
+
+  /** Set 'result' to 'image' with the hole of 'mask' filled by a membrane. Returns the
+    * number of unknowns that were solved for. */
+  unsigned int FillImage(const ImageType* const image, const Mask* const mask, ImageType* const result,
+                         const unsigned int maximumCellSize = 16);
+}
+
+#endif
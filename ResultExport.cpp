@@ -0,0 +1,372 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "ResultExport.h"
+
+// Custom
+#include "Parallel.h"
+
+// ITK
+#include "itkImageFileWriter.h"
+#include "itkVersion.h"
+#include "itk_png.h"
+#include "itk_tiff.h"
+
+// Qt
+#include <QtConcurrentRun>
+
+// STL
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+namespace ResultExport
+{
+
+namespace
+{
+  /** The number of rows converted at a time for the row by row encoders. */
+  const unsigned int RowsPerBand = 64;
+
+  /** The rows of a band are converted in parallel in blocks of this many. */
+  const unsigned int RowsPerBlock = 8;
+
+  bool HasExtension(const std::string& fileName, const std::string& extension)
+  {
+    return fileName.size() >= extension.size() &&
+           fileName.compare(fileName.size() - extension.size(), extension.size(), extension) == 0;
+  }
+
+  unsigned char ToByte(const float value)
+  {
+    return static_cast<unsigned char>(std::min(255.0f, std::max(0.0f, value)));
+  }
+
+  /** Convert 'width' pixels to packed RGB. The number of channels is TNumberOfComponents,
+    * or 'numberOfComponents' if it is 0. One channel is written as gray. */
+  template <unsigned int TNumberOfComponents>
+  void ConvertPixels(const float* pixel, const unsigned int width, const unsigned int numberOfComponents,
+                     unsigned char* row)
+  {
+    const unsigned int components = TNumberOfComponents ? TNumberOfComponents : numberOfComponents;
+    for(unsigned int x = 0; x < width; ++x, pixel += components)
+    {
+      for(unsigned int channel = 0; channel < 3; ++channel)
+      {
+        row[3 * x + channel] = ToByte(pixel[std::min(channel, components - 1)]);
+      }
+    }
+  }
+
+  void ConvertPixels(const float* pixel, const unsigned int width, const unsigned int numberOfComponents,
+                     unsigned char* row)
+  {
+    switch(numberOfComponents)
+    {
+      case 1:
+        ConvertPixels<1>(pixel, width, numberOfComponents, row);
+        break;
+      case 3:
+        ConvertPixels<3>(pixel, width, numberOfComponents, row);
+        break;
+      case 4:
+        ConvertPixels<4>(pixel, width, numberOfComponents, row);
+        break;
+      default:
+        ConvertPixels<0>(pixel, width, numberOfComponents, row);
+    }
+  }
+
+  /** WriteFloat, with a failure turned into a message so that it can be reported from another thread. */
+  std::string WriteFloatNoThrow(const ImageType* const target, const ImageType* const result,
+                                const std::string& fileName, const Options& options)
+  {
+    try
+    {
+      WriteFloat(target, result, fileName, options);
+    }
+    catch(const std::exception& exception)
+    {
+      return exception.what();
+    }
+    return std::string();
+  }
+}
+
+void ConvertRows(const ImageType* const target, const ImageType* const result,
+                 const unsigned int firstRow, const unsigned int numberOfRows,
+                 std::vector<unsigned char>& rows)
+{
+  const itk::ImageRegion<2> targetRegion = target->GetLargestPossibleRegion();
+  const unsigned int width = targetRegion.GetSize()[0];
+  const unsigned int numberOfComponents = target->GetNumberOfComponentsPerPixel();
+  rows.resize(3 * width * numberOfRows);
+
+  itk::ImageRegion<2> resultRegion;
+  if(result)
+  {
+    resultRegion = result->GetBufferedRegion();
+  }
+
+  Parallel::ForBlocks(numberOfRows, RowsPerBlock, [&](const unsigned int begin, const unsigned int end)
+  {
+    for(unsigned int rowId = begin; rowId < end; ++rowId)
+    {
+      const itk::IndexValueType y = targetRegion.GetIndex()[1] + firstRow + rowId;
+      unsigned char* row = &rows[3 * width * rowId];
+
+      itk::Index<2> rowStart = {{targetRegion.GetIndex()[0], y}};
+      ConvertPixels(target->GetBufferPointer() + target->ComputeOffset(rowStart) * numberOfComponents,
+                    width, numberOfComponents, row);
+
+      // Overwrite the part of the row that the result covers.
+      if(result && y >= resultRegion.GetIndex()[1] &&
+         y < resultRegion.GetIndex()[1] + static_cast<itk::IndexValueType>(resultRegion.GetSize()[1]))
+      {
+        itk::Index<2> resultRowStart = {{resultRegion.GetIndex()[0], y}};
+        ConvertPixels(result->GetBufferPointer() + result->ComputeOffset(resultRowStart) * numberOfComponents,
+                      resultRegion.GetSize()[0], numberOfComponents,
+                      row + 3 * (resultRegion.GetIndex()[0] - targetRegion.GetIndex()[0]));
+      }
+    }
+  });
+}
+
+void WriteFloat(const ImageType* const target, const ImageType* const result,
+                const std::string& fileName, const Options& options)
+{
+  // Only paste when the result does not already cover the whole target.
+  const ImageType* image = target;
+  ImageType::Pointer composed;
+  if(result && result->GetBufferedRegion() == target->GetLargestPossibleRegion())
+  {
+    image = result;
+  }
+  else if(result)
+  {
+    const unsigned int numberOfComponents = target->GetNumberOfComponentsPerPixel();
+    const itk::ImageRegion<2> resultRegion = result->GetBufferedRegion();
+
+    composed = ImageType::New();
+    composed->SetNumberOfComponentsPerPixel(numberOfComponents);
+    composed->SetRegions(target->GetLargestPossibleRegion());
+    composed->Allocate();
+    std::memcpy(composed->GetBufferPointer(), target->GetBufferPointer(),
+                target->GetLargestPossibleRegion().GetNumberOfPixels() * numberOfComponents * sizeof(float));
+
+    for(unsigned int row = 0; row < resultRegion.GetSize()[1]; ++row)
+    {
+      itk::Index<2> rowStart = {{resultRegion.GetIndex()[0],
+                                 resultRegion.GetIndex()[1] + static_cast<itk::IndexValueType>(row)}};
+      std::memcpy(composed->GetBufferPointer() + composed->ComputeOffset(rowStart) * numberOfComponents,
+                  result->GetBufferPointer() + result->ComputeOffset(rowStart) * numberOfComponents,
+                  resultRegion.GetSize()[0] * numberOfComponents * sizeof(float));
+    }
+    image = composed;
+  }
+
+  typedef itk::ImageFileWriter<ImageType> WriterType;
+  WriterType::Pointer writer = WriterType::New();
+  writer->SetFileName(fileName);
+  writer->SetInput(image);
+  writer->SetUseCompression(options.CompressionLevel > 0);
+#if ITK_VERSION_MAJOR > 5 || (ITK_VERSION_MAJOR == 5 && ITK_VERSION_MINOR >= 1)
+  // Older ITK versions only switch compression on or off, at the default level of each format.
+  if(options.CompressionLevel > 0)
+  {
+    writer->SetCompressionLevel(std::min(9, options.CompressionLevel));
+  }
+#endif
+  writer->Update();
+}
+
+void WritePNG(const ImageType* const target, const ImageType* const result,
+              const std::string& fileName, const Options& options)
+{
+  const itk::Size<2> size = target->GetLargestPossibleRegion().GetSize();
+
+  FILE* file = fopen(fileName.c_str(), "wb");
+  if(!file)
+  {
+    throw std::runtime_error("Could not open " + fileName + " for writing.");
+  }
+
+  png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+  png_infop info = png ? png_create_info_struct(png) : nullptr;
+  std::vector<unsigned char> rows;
+
+  if(!info || setjmp(png_jmpbuf(png)))
+  {
+    png_destroy_write_struct(&png, &info);
+    fclose(file);
+    throw std::runtime_error("Could not write " + fileName + ".");
+  }
+
+  png_init_io(png, file);
+  png_set_IHDR(png, info, size[0], size[1], 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
+               PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+  png_set_compression_level(png, std::min(9, std::max(0, options.CompressionLevel)));
+  png_write_info(png, info);
+
+  for(unsigned int firstRow = 0; firstRow < size[1]; firstRow += RowsPerBand)
+  {
+    const unsigned int numberOfRows = std::min<unsigned int>(RowsPerBand, size[1] - firstRow);
+    ConvertRows(target, result, firstRow, numberOfRows, rows);
+    for(unsigned int rowId = 0; rowId < numberOfRows; ++rowId)
+    {
+      png_write_row(png, &rows[3 * size[0] * rowId]);
+    }
+  }
+
+  png_write_end(png, info);
+  png_destroy_write_struct(&png, &info);
+  fclose(file);
+}
+
+void WriteTIFF(const ImageType* const target, const ImageType* const result,
+               const std::string& fileName, const Options& options)
+{
+  const itk::Size<2> size = target->GetLargestPossibleRegion().GetSize();
+
+  TIFF* tiff = TIFFOpen(fileName.c_str(), "w");
+  if(!tiff)
+  {
+    throw std::runtime_error("Could not open " + fileName + " for writing.");
+  }
+
+  TIFFSetField(tiff, TIFFTAG_IMAGEWIDTH, static_cast<uint32>(size[0]));
+  TIFFSetField(tiff, TIFFTAG_IMAGELENGTH, static_cast<uint32>(size[1]));
+  TIFFSetField(tiff, TIFFTAG_SAMPLESPERPIXEL, 3);
+  TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, 8);
+  TIFFSetField(tiff, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
+  TIFFSetField(tiff, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+  if(options.CompressionLevel > 0)
+  {
+    TIFFSetField(tiff, TIFFTAG_COMPRESSION, COMPRESSION_ADOBE_DEFLATE);
+    TIFFSetField(tiff, TIFFTAG_ZIPQUALITY, std::min(9, options.CompressionLevel));
+  }
+  else
+  {
+    TIFFSetField(tiff, TIFFTAG_COMPRESSION, COMPRESSION_NONE);
+  }
+
+  std::vector<unsigned char> rows;
+  bool success = true;
+
+  if(options.TiledTIFF)
+  {
+    // Convert one row of tiles at a time and cut it into tiles; the tiles on the right and
+    // bottom edges are padded with black.
+    const unsigned int tileSize = options.TileSize;
+    TIFFSetField(tiff, TIFFTAG_TILEWIDTH, static_cast<uint32>(tileSize));
+    TIFFSetField(tiff, TIFFTAG_TILELENGTH, static_cast<uint32>(tileSize));
+
+    std::vector<unsigned char> tile(3 * tileSize * tileSize);
+    for(unsigned int firstRow = 0; firstRow < size[1] && success; firstRow += tileSize)
+    {
+      const unsigned int numberOfRows = std::min<unsigned int>(tileSize, size[1] - firstRow);
+      ConvertRows(target, result, firstRow, numberOfRows, rows);
+
+      for(unsigned int firstColumn = 0; firstColumn < size[0] && success; firstColumn += tileSize)
+      {
+        const unsigned int numberOfColumns = std::min<unsigned int>(tileSize, size[0] - firstColumn);
+        std::fill(tile.begin(), tile.end(), 0);
+        for(unsigned int rowId = 0; rowId < numberOfRows; ++rowId)
+        {
+          std::memcpy(&tile[3 * tileSize * rowId], &rows[3 * (size[0] * rowId + firstColumn)],
+                      3 * numberOfColumns);
+        }
+        success = TIFFWriteTile(tiff, &tile[0], firstColumn, firstRow, 0, 0) >= 0;
+      }
+    }
+  }
+  else
+  {
+    TIFFSetField(tiff, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(tiff, 0));
+    for(unsigned int firstRow = 0; firstRow < size[1] && success; firstRow += RowsPerBand)
+    {
+      const unsigned int numberOfRows = std::min<unsigned int>(RowsPerBand, size[1] - firstRow);
+      ConvertRows(target, result, firstRow, numberOfRows, rows);
+      for(unsigned int rowId = 0; rowId < numberOfRows && success; ++rowId)
+      {
+        success = TIFFWriteScanline(tiff, &rows[3 * size[0] * rowId], firstRow + rowId, 0) >= 0;
+      }
+    }
+  }
+
+  TIFFClose(tiff);
+
+  if(!success)
+  {
+    throw std::runtime_error("Could not write " + fileName + ".");
+  }
+}
+
+void Write(const ImageType* const target, const ImageType* const result,
+           const std::string& fileName, const Options& options)
+{
+  if(HasExtension(fileName, ".png"))
+  {
+    WritePNG(target, result, fileName, options);
+  }
+  else if(HasExtension(fileName, ".tif") || HasExtension(fileName, ".tiff"))
+  {
+    WriteTIFF(target, result, fileName, options);
+  }
+  else
+  {
+    WriteFloat(target, result, fileName, options);
+  }
+}
+
+std::string GetRGBFileName(const std::string& fileName, const Options& options)
+{
+  return fileName + (options.TiledTIFF ? ".tif" : ".png");
+}
+
+void Export(const ImageType* const target, const ImageType* const result,
+            const std::string& fileName, const Options& options)
+{
+  QFuture<std::string> floatFuture = QtConcurrent::run(WriteFloatNoThrow, target, result, fileName, options);
+
+  std::string rgbError;
+  try
+  {
+    if(options.TiledTIFF)
+    {
+      WriteTIFF(target, result, GetRGBFileName(fileName, options), options);
+    }
+    else
+    {
+      WritePNG(target, result, GetRGBFileName(fileName, options), options);
+    }
+  }
+  catch(const std::exception& exception)
+  {
+    rgbError = exception.what();
+  }
+
+  const std::string floatError = floatFuture.result();
+  if(!floatError.empty() || !rgbError.empty())
+  {
+    throw std::runtime_error(floatError.empty() ? rgbError : floatError);
+  }
+}
+
+} // end namespace
@@ -0,0 +1,83 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+/** These functions write a result to disk without holding up the GUI. The float image and
+  * an 8 bit RGB copy are written at the same time, and the 8 bit copy is converted and handed
+  * to the encoder a band of rows at a time, so it never exists as a whole. A result may cover
+  * only part of the target (see CloneLayers::ComputeResultRegion); it is pasted into the
+  * target as the rows are produced.
+  */
+
+#ifndef ResultExport_H
+#define ResultExport_H
+
+// ITK
+#include "itkVectorImage.h"
+
+// STL
+#include <string>
+#include <vector>
+
+namespace ResultExport
+{
+  typedef itk::VectorImage<float, 2> ImageType;
+
+  struct Options
+  {
+    /** 0 (none) to 9 (smallest file). Used by the PNG and TIFF encoders; the float writer
+      * uses it with ITK 5.1 or later, and only switches compression on or off before that. */
+    int CompressionLevel = 6;
+
+    /** Write the 8 bit copy as a tiled TIFF (fileName.tif) instead of a PNG (fileName.png). */
+    bool TiledTIFF = false;
+
+    /** The width and height of a TIFF tile. Must be a multiple of 16. */
+    unsigned int TileSize = 256;
+  };
+
+  /** Convert 'numberOfRows' rows starting at 'firstRow' of 'target', with 'result' pasted in,
+    * to packed 8 bit RGB. 'result' may be null. */
+  void ConvertRows(const ImageType* const target, const ImageType* const result,
+                   const unsigned int firstRow, const unsigned int numberOfRows,
+                   std::vector<unsigned char>& rows);
+
+  /** Write the float pixels of 'target' with 'result' pasted in to 'fileName'. */
+  void WriteFloat(const ImageType* const target, const ImageType* const result,
+                  const std::string& fileName, const Options& options);
+
+  void WritePNG(const ImageType* const target, const ImageType* const result,
+                const std::string& fileName, const Options& options);
+
+  /** Tiled if options.TiledTIFF is set, otherwise in strips. */
+  void WriteTIFF(const ImageType* const target, const ImageType* const result,
+                 const std::string& fileName, const Options& options);
+
+  /** Write 'fileName' and its 8 bit copy concurrently. Throws std::runtime_error if either fails. */
+  void Export(const ImageType* const target, const ImageType* const result,
+              const std::string& fileName, const Options& options);
+
+  /** Write only 'fileName', with the writer its extension asks for: .png and .tif/.tiff as
+    * 8 bit RGB, anything else as float. */
+  void Write(const ImageType* const target, const ImageType* const result,
+             const std::string& fileName, const Options& options);
+
+  /** The name of the 8 bit copy that Export writes next to 'fileName'. */
+  std::string GetRGBFileName(const std::string& fileName, const Options& options);
+}
+
+#endif
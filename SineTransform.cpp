@@ -0,0 +1,107 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "SineTransform.h"
+
+// Eigen
+#include <unsupported/Eigen/FFT>
+
+// STL
+#include <cmath>
+#include <complex>
+#include <vector>
+
+namespace
+{
+  /** Above this length the dense matrix is too slow and too large to be used by default. */
+  const unsigned int MaximumDenseLength = 512;
+}
+
+SineTransform::SineTransform(const unsigned int length) : Length(length)
+{
+  this->UseFFT = HasSmallPrimeFactors(length + 1);
+  if(this->UseFFT || length == 0)
+  {
+    return;
+  }
+
+  const double scale = M_PI / (length + 1);
+  this->Matrix.resize(length, length);
+  for(unsigned int row = 0; row < length; ++row)
+  {
+    for(unsigned int column = 0; column < length; ++column)
+    {
+      this->Matrix(row, column) = std::sin(scale * (row + 1) * (column + 1));
+    }
+  }
+}
+
+void SineTransform::TransformColumns(Eigen::MatrixXd& values) const
+{
+  if(!this->UseFFT)
+  {
+    values = this->Matrix * values;
+    return;
+  }
+
+  // Extend each column to the odd sequence (0, x, 0, -reversed x) of length 2(n+1). Its
+  // Fourier transform is -2i times the sine transform of x.
+  const unsigned int length = this->Length;
+  Eigen::FFT<double> fft;
+  std::vector<double> extended(2 * (length + 1), 0.0);
+  std::vector<std::complex<double> > spectrum;
+
+  for(unsigned int column = 0; column < values.cols(); ++column)
+  {
+    for(unsigned int row = 0; row < length; ++row)
+    {
+      extended[row + 1] = values(row, column);
+      extended[2 * length + 1 - row] = -values(row, column);
+    }
+
+    fft.fwd(spectrum, extended);
+
+    for(unsigned int row = 0; row < length; ++row)
+    {
+      values(row, column) = -0.5 * spectrum[row + 1].imag();
+    }
+  }
+}
+
+bool SineTransform::IsFast(const unsigned int length)
+{
+  return HasSmallPrimeFactors(length + 1) || length <= MaximumDenseLength;
+}
+
+bool SineTransform::HasSmallPrimeFactors(unsigned int value)
+{
+  if(value == 0)
+  {
+    return false;
+  }
+
+  const unsigned int primes[4] = {2, 3, 5, 7};
+  for(unsigned int primeId = 0; primeId < 4; ++primeId)
+  {
+    while(value % primes[primeId] == 0)
+    {
+      value /= primes[primeId];
+    }
+  }
+  return value == 1;
+}
@@ -0,0 +1,61 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+/** This class computes the type I discrete sine transform of length n,
+  * y_k = sum_j x_j sin(pi (j+1) (k+1) / (n+1)), which diagonalizes the 1D Laplacian
+  * with Dirichlet boundaries. Applying it twice scales by (n+1)/2. When n+1 only has
+  * small prime factors it is computed with an FFT of length 2(n+1), otherwise by
+  * multiplying with the dense transform matrix.
+  */
+
+#ifndef SineTransform_H
+#define SineTransform_H
+
+// Eigen
+#include <Eigen/Dense>
+
+class SineTransform
+{
+public:
+  SineTransform(const unsigned int length = 0);
+
+  unsigned int GetLength() const
+  {
+    return this->Length;
+  }
+
+  /** Transform every column of 'values', which must have GetLength() rows, in place. */
+  void TransformColumns(Eigen::MatrixXd& values) const;
+
+  /** Whether a transform of 'length' is cheap: the FFT can be used or the dense matrix is small. */
+  static bool IsFast(const unsigned int length);
+
+  /** Whether 'value' has no prime factors larger than 7. */
+  static bool HasSmallPrimeFactors(unsigned int value);
+
+protected:
+
+  unsigned int Length;
+
+  bool UseFFT;
+
+  /** The transform matrix, only used when UseFFT is false. */
+  Eigen::MatrixXd Matrix;
+};
+
+#endif
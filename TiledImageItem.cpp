@@ -0,0 +1,443 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "TiledImageItem.h"
+
+// Custom
+#include "Parallel.h"
+
+// Qt
+#include <QMetaObject>
+#include <QPainter>
+#include <QRunnable>
+#include <QStyleOptionGraphicsItem>
+
+// STL
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+  unsigned char ToByte(const float value)
+  {
+    return static_cast<unsigned char>(std::min(255.0f, std::max(0.0f, value)));
+  }
+
+  /** Renders one tile on the pool and hands it back to the item on the GUI thread. */
+  class TileRenderer : public QRunnable
+  {
+  public:
+    TileRenderer(TiledImageItem* const item, const TiledImageItem::ImageType* const image,
+                 const std::atomic<unsigned int>* const currentVersion, const unsigned int version,
+                 const unsigned int level, const int tileX, const int tileY) :
+      Item(item), Image(image), CurrentVersion(currentVersion), Version(version),
+      Level(level), TileX(tileX), TileY(tileY)
+    {
+    }
+
+    void run()
+    {
+      // The item was updated or replaced its image while this tile was queued.
+      if(*this->CurrentVersion != this->Version)
+      {
+        return;
+      }
+
+      QImage tile = TiledImageItem::RenderTile(this->Image, this->Level, this->TileX, this->TileY);
+      QMetaObject::invokeMethod(this->Item, "slot_tileRendered", Qt::QueuedConnection,
+                                Q_ARG(unsigned int, this->Level), Q_ARG(int, this->TileX),
+                                Q_ARG(int, this->TileY), Q_ARG(unsigned int, this->Version),
+                                Q_ARG(QImage, tile));
+    }
+
+  private:
+    TiledImageItem* Item;
+    const TiledImageItem::ImageType* Image;
+    const std::atomic<unsigned int>* CurrentVersion;
+    unsigned int Version;
+    unsigned int Level;
+    int TileX;
+    int TileY;
+  };
+}
+
+TiledImageItem::TiledImageItem(const ImageType* const image, QGraphicsItem* const parent) :
+  QGraphicsObject(parent), Version(0)
+{
+  // Only the exposed tiles are drawn, so paint() needs the exact exposed rectangle.
+  setFlag(QGraphicsItem::ItemUsesExtendedStyleOption, true);
+  this->TilePool.setMaxThreadCount(Parallel::GetNumberOfThreads());
+  SetImage(image);
+}
+
+TiledImageItem::~TiledImageItem()
+{
+  CancelTiles();
+}
+
+void TiledImageItem::SetImage(const ImageType* const image)
+{
+  CancelTiles();
+
+  this->Tiles.clear();
+  this->Lookup.clear();
+  this->MemoryUsage = 0;
+
+  prepareGeometryChange();
+  this->Image = image;
+  this->ImageSize = image ? QSize(image->GetBufferedRegion().GetSize()[0], image->GetBufferedRegion().GetSize()[1]) :
+                            QSize(0, 0);
+  update();
+}
+
+void TiledImageItem::BeginUpdate()
+{
+  if(this->UpdateDepth++ == 0)
+  {
+    CancelTiles();
+  }
+}
+
+void TiledImageItem::EndUpdate(const itk::ImageRegion<2>& changedRegion)
+{
+  if(this->UpdateDepth == 0)
+  {
+    throw std::runtime_error("TiledImageItem::EndUpdate() without BeginUpdate()!");
+  }
+  --this->UpdateDepth;
+
+  if(!this->Image)
+  {
+    return;
+  }
+
+  // A reallocated image of another size invalidates every tile.
+  const itk::ImageRegion<2> bufferedRegion = this->Image->GetBufferedRegion();
+  const QSize imageSize(bufferedRegion.GetSize()[0], bufferedRegion.GetSize()[1]);
+  if(imageSize != this->ImageSize)
+  {
+    SetImage(this->Image);
+    return;
+  }
+
+  const QRectF changedRect(changedRegion.GetIndex()[0] - bufferedRegion.GetIndex()[0],
+                           changedRegion.GetIndex()[1] - bufferedRegion.GetIndex()[1],
+                           changedRegion.GetSize()[0], changedRegion.GetSize()[1]);
+  if(changedRect.isEmpty())
+  {
+    return;
+  }
+
+  for(std::list<Tile>::iterator tile = this->Tiles.begin(); tile != this->Tiles.end(); ++tile)
+  {
+    if(GetTileRect(tile->Key).intersects(changedRect))
+    {
+      tile->Stale = true;
+    }
+  }
+
+  update(changedRect);
+}
+
+void TiledImageItem::SetMemoryBudget(const std::size_t memoryBudget)
+{
+  this->MemoryBudget = memoryBudget;
+  EnforceBudget();
+}
+
+std::size_t TiledImageItem::GetMemoryUsage() const
+{
+  return this->MemoryUsage;
+}
+
+QRectF TiledImageItem::boundingRect() const
+{
+  return QRectF(0, 0, this->ImageSize.width(), this->ImageSize.height());
+}
+
+void TiledImageItem::paint(QPainter* painter, const QStyleOptionGraphicsItem* option, QWidget*)
+{
+  if(!this->Image || this->ImageSize.isEmpty())
+  {
+    return;
+  }
+
+  // Use the coarsest level whose pixels are still no larger than a screen pixel.
+  const qreal levelOfDetail = QStyleOptionGraphicsItem::levelOfDetailFromTransform(painter->worldTransform());
+  const unsigned int numberOfLevels = GetNumberOfLevels();
+  unsigned int level = 0;
+  while(level + 1 < numberOfLevels && levelOfDetail * (1 << (level + 1)) <= 1.0)
+  {
+    ++level;
+  }
+
+  const QRectF exposedRect = option->exposedRect.intersected(boundingRect());
+  if(exposedRect.isEmpty())
+  {
+    return;
+  }
+
+  const qreal span = static_cast<qreal>(TileSize << level);
+  const int lastTileX = static_cast<int>(std::ceil(this->ImageSize.width() / span)) - 1;
+  const int lastTileY = static_cast<int>(std::ceil(this->ImageSize.height() / span)) - 1;
+  const int firstX = std::max(0, static_cast<int>(std::floor(exposedRect.left() / span)));
+  const int lastX = std::min(lastTileX, static_cast<int>(std::ceil(exposedRect.right() / span)) - 1);
+  const int firstY = std::max(0, static_cast<int>(std::floor(exposedRect.top() / span)));
+  const int lastY = std::min(lastTileY, static_cast<int>(std::ceil(exposedRect.bottom() / span)) - 1);
+
+  for(int tileY = firstY; tileY <= lastY; ++tileY)
+  {
+    for(int tileX = firstX; tileX <= lastX; ++tileX)
+    {
+      const TileKey key(level, tileX, tileY);
+      Tile* tile = FindTile(key);
+      if(tile)
+      {
+        DrawTile(painter, *tile, GetTileRect(key), QRectF());
+        if(tile->Stale)
+        {
+          RequestTile(key);
+        }
+      }
+      else
+      {
+        DrawFallback(painter, key);
+        RequestTile(key);
+      }
+    }
+  }
+
+  // Uploading pixmaps may have grown the cache.
+  EnforceBudget();
+}
+
+QImage TiledImageItem::RenderTile(const ImageType* const image, const unsigned int level,
+                                  const int tileX, const int tileY)
+{
+  const itk::ImageRegion<2> region = image->GetBufferedRegion();
+  const int imageWidth = region.GetSize()[0];
+  const int imageHeight = region.GetSize()[1];
+  const int scale = 1 << level;
+
+  // The size of the image at this level, and the part of it covered by the tile.
+  const int levelWidth = (imageWidth + scale - 1) / scale;
+  const int levelHeight = (imageHeight + scale - 1) / scale;
+  const int tileWidth = std::min<int>(TileSize, levelWidth - tileX * static_cast<int>(TileSize));
+  const int tileHeight = std::min<int>(TileSize, levelHeight - tileY * static_cast<int>(TileSize));
+  if(tileWidth <= 0 || tileHeight <= 0)
+  {
+    return QImage();
+  }
+
+  QImage tile(tileWidth, tileHeight, QImage::Format_RGB32);
+
+  const unsigned int numberOfComponents = image->GetNumberOfComponentsPerPixel();
+  const float* buffer = image->GetBufferPointer();
+  const int samplesPerAxis = std::min(scale, 4);
+  const float weight = 1.0f / (samplesPerAxis * samplesPerAxis);
+
+  // The image rows and columns that are sampled for every tile row and column.
+  std::vector<int> sampleOffsets(samplesPerAxis);
+  for(int sample = 0; sample < samplesPerAxis; ++sample)
+  {
+    sampleOffsets[sample] = (2 * sample + 1) * scale / (2 * samplesPerAxis);
+  }
+
+  for(int row = 0; row < tileHeight; ++row)
+  {
+    QRgb* scanLine = reinterpret_cast<QRgb*>(tile.scanLine(row));
+    const int blockY = (tileY * static_cast<int>(TileSize) + row) * scale;
+
+    for(int column = 0; column < tileWidth; ++column)
+    {
+      const int blockX = (tileX * static_cast<int>(TileSize) + column) * scale;
+
+      float sum[3] = {0.0f, 0.0f, 0.0f};
+      for(int sampleY = 0; sampleY < samplesPerAxis; ++sampleY)
+      {
+        const int y = std::min(imageHeight - 1, blockY + sampleOffsets[sampleY]);
+        for(int sampleX = 0; sampleX < samplesPerAxis; ++sampleX)
+        {
+          const int x = std::min(imageWidth - 1, blockX + sampleOffsets[sampleX]);
+          const float* pixel = buffer + (static_cast<std::size_t>(y) * imageWidth + x) * numberOfComponents;
+          if(numberOfComponents >= 3)
+          {
+            sum[0] += pixel[0];
+            sum[1] += pixel[1];
+            sum[2] += pixel[2];
+          }
+          else
+          {
+            sum[0] += pixel[0];
+            sum[1] += pixel[0];
+            sum[2] += pixel[0];
+          }
+        }
+      }
+
+      scanLine[column] = qRgb(ToByte(sum[0] * weight), ToByte(sum[1] * weight), ToByte(sum[2] * weight));
+    }
+  }
+
+  return tile;
+}
+
+void TiledImageItem::slot_tileRendered(unsigned int level, int tileX, int tileY, unsigned int version, QImage tile)
+{
+  if(version != this->Version)
+  {
+    return;
+  }
+
+  const TileKey key(level, tileX, tileY);
+  this->Pending.erase(key);
+  if(tile.isNull())
+  {
+    return;
+  }
+
+  std::map<TileKey, std::list<Tile>::iterator>::iterator lookupIterator = this->Lookup.find(key);
+  if(lookupIterator != this->Lookup.end())
+  {
+    this->MemoryUsage -= ComputeMemorySize(*lookupIterator->second);
+    this->Tiles.erase(lookupIterator->second);
+    this->Lookup.erase(lookupIterator);
+  }
+
+  Tile newTile;
+  newTile.Key = key;
+  newTile.Image = tile;
+  this->Tiles.push_front(newTile);
+  this->Lookup[key] = this->Tiles.begin();
+  this->MemoryUsage += ComputeMemorySize(newTile);
+
+  EnforceBudget();
+  update(GetTileRect(key));
+}
+
+TiledImageItem::Tile* TiledImageItem::FindTile(const TileKey& key)
+{
+  std::map<TileKey, std::list<Tile>::iterator>::iterator lookupIterator = this->Lookup.find(key);
+  if(lookupIterator == this->Lookup.end())
+  {
+    return nullptr;
+  }
+
+  // Move the tile to the front without invalidating the iterator held by Lookup.
+  this->Tiles.splice(this->Tiles.begin(), this->Tiles, lookupIterator->second);
+  return &*lookupIterator->second;
+}
+
+void TiledImageItem::RequestTile(const TileKey& key)
+{
+  if(this->UpdateDepth > 0 || this->Pending.count(key))
+  {
+    return;
+  }
+
+  this->Pending.insert(key);
+  this->TilePool.start(new TileRenderer(this, this->Image, &this->Version, this->Version,
+                                        std::get<0>(key), std::get<1>(key), std::get<2>(key)));
+}
+
+void TiledImageItem::DrawFallback(QPainter* const painter, const TileKey& key)
+{
+  const QRectF target = GetTileRect(key);
+  const unsigned int level = std::get<0>(key);
+
+  for(unsigned int coarseLevel = level + 1; coarseLevel < GetNumberOfLevels(); ++coarseLevel)
+  {
+    const unsigned int levelDifference = coarseLevel - level;
+    const TileKey coarseKey(coarseLevel, std::get<1>(key) >> levelDifference, std::get<2>(key) >> levelDifference);
+
+    // Look the tile up without touching the order; a fallback should not keep tiles alive.
+    std::map<TileKey, std::list<Tile>::iterator>::iterator lookupIterator = this->Lookup.find(coarseKey);
+    if(lookupIterator == this->Lookup.end())
+    {
+      continue;
+    }
+
+    // The part of the coarse tile under 'target', in pixels of the coarse tile.
+    const QRectF coarseRect = GetTileRect(coarseKey);
+    const qreal coarseScale = static_cast<qreal>(1 << coarseLevel);
+    const QRectF source((target.left() - coarseRect.left()) / coarseScale,
+                        (target.top() - coarseRect.top()) / coarseScale,
+                        target.width() / coarseScale, target.height() / coarseScale);
+    DrawTile(painter, *lookupIterator->second, target, source);
+    return;
+  }
+}
+
+void TiledImageItem::DrawTile(QPainter* const painter, Tile& tile, const QRectF& target, const QRectF& source)
+{
+  // Upload the tile the first time it is drawn; the QImage is not needed after that.
+  if(tile.Pixmap.isNull())
+  {
+    tile.Pixmap = QPixmap::fromImage(tile.Image);
+    tile.Image = QImage();
+  }
+
+  painter->drawPixmap(target, tile.Pixmap, source.isNull() ? QRectF(tile.Pixmap.rect()) : source);
+}
+
+void TiledImageItem::CancelTiles()
+{
+  ++this->Version;
+  this->TilePool.waitForDone();
+  this->Pending.clear();
+}
+
+void TiledImageItem::EnforceBudget()
+{
+  // Always keep the most recent tile, even if it is larger than the budget by itself.
+  while(this->MemoryUsage > this->MemoryBudget && this->Tiles.size() > 1)
+  {
+    const Tile& oldest = this->Tiles.back();
+    this->MemoryUsage -= ComputeMemorySize(oldest);
+    this->Lookup.erase(oldest.Key);
+    this->Tiles.pop_back();
+  }
+}
+
+std::size_t TiledImageItem::ComputeMemorySize(const Tile& tile)
+{
+  // RGB32 tiles and their pixmaps take four bytes per pixel.
+  return tile.Pixmap.isNull() ? 4 * tile.Image.width() * tile.Image.height() :
+                                4 * tile.Pixmap.width() * tile.Pixmap.height();
+}
+
+unsigned int TiledImageItem::GetNumberOfLevels() const
+{
+  const int largestSide = std::max(this->ImageSize.width(), this->ImageSize.height());
+  unsigned int numberOfLevels = 1;
+  while((static_cast<int>(TileSize) << (numberOfLevels - 1)) < largestSide)
+  {
+    ++numberOfLevels;
+  }
+  return numberOfLevels;
+}
+
+QRectF TiledImageItem::GetTileRect(const TileKey& key) const
+{
+  const int span = TileSize << std::get<0>(key);
+  const int x = std::get<1>(key) * span;
+  const int y = std::get<2>(key) * span;
+  return QRectF(x, y, std::min(span, this->ImageSize.width() - x), std::min(span, this->ImageSize.height() - y));
+}
@@ -0,0 +1,146 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+/** This item displays a float image in a QGraphicsScene without converting all of it.
+  * The image is cut into TileSize x TileSize tiles at every power-of-two level of
+  * detail. Only the tiles that are exposed at the current zoom are ever rendered; they
+  * are generated on a thread pool and kept in a least recently used cache. While a tile
+  * is being generated the coarser cached tile that covers it is drawn instead.
+  * The item keeps a reference to the image. Before the image is modified, call
+  * BeginUpdate(); EndUpdate() then regenerates the tiles of the changed region.
+  */
+
+#ifndef TiledImageItem_H
+#define TiledImageItem_H
+
+// ITK
+#include "itkVectorImage.h"
+
+// Qt
+#include <QGraphicsObject>
+#include <QImage>
+#include <QPixmap>
+#include <QThreadPool>
+
+// STL
+#include <atomic>
+#include <list>
+#include <map>
+#include <set>
+#include <tuple>
+
+class TiledImageItem : public QGraphicsObject
+{
+  Q_OBJECT
+public:
+  typedef itk::VectorImage<float, 2> ImageType;
+
+  /** The width and height of a tile in screen pixels. */
+  static const unsigned int TileSize = 256;
+
+  TiledImageItem(const ImageType* const image = nullptr, QGraphicsItem* const parent = nullptr);
+  ~TiledImageItem();
+
+  /** Display 'image' (or nothing if it is null). Its buffered region is placed at (0,0). */
+  void SetImage(const ImageType* const image);
+
+  /** Stop generating tiles and wait for the ones that are running, so that the image can be
+    * modified or reallocated. Cached tiles are still drawn. Calls may be nested. */
+  void BeginUpdate();
+
+  /** Mark the tiles that cover 'changedRegion' (in image coordinates) as stale and resume
+    * generating tiles. The image size may have changed since BeginUpdate(). */
+  void EndUpdate(const itk::ImageRegion<2>& changedRegion);
+
+  void SetMemoryBudget(const std::size_t memoryBudget);
+  std::size_t GetMemoryUsage() const;
+
+  QRectF boundingRect() const;
+  void paint(QPainter* painter, const QStyleOptionGraphicsItem* option, QWidget* widget);
+
+  /** Render tile (tileX, tileY) of 'level', where level L averages blocks of 2^L x 2^L
+    * pixels (sampled at most 4 x 4 times). The first three channels are used as RGB,
+    * a single channel as gray. */
+  static QImage RenderTile(const ImageType* const image, const unsigned int level,
+                           const int tileX, const int tileY);
+
+private slots:
+  void slot_tileRendered(unsigned int level, int tileX, int tileY, unsigned int version, QImage tile);
+
+private:
+  /** (level, tileX, tileY) */
+  typedef std::tuple<unsigned int, int, int> TileKey;
+
+  struct Tile
+  {
+    TileKey Key;
+
+    /** The rendered tile until it is first drawn, then the pixmap uploaded from it. */
+    QImage Image;
+    QPixmap Pixmap;
+
+    /** The image changed under the tile; it is drawn until its replacement arrives. */
+    bool Stale = false;
+  };
+
+  /** The cached tile for 'key', marked as the most recently used, or null. */
+  Tile* FindTile(const TileKey& key);
+
+  /** Queue the generation of 'key' unless it is already queued or tiles are frozen. */
+  void RequestTile(const TileKey& key);
+
+  /** Draw the part of the closest coarser cached tile that covers 'key'. */
+  void DrawFallback(QPainter* const painter, const TileKey& key);
+
+  void DrawTile(QPainter* const painter, Tile& tile, const QRectF& target, const QRectF& source);
+
+  /** Stop the queued tiles and wait for the running ones. */
+  void CancelTiles();
+
+  void EnforceBudget();
+
+  static std::size_t ComputeMemorySize(const Tile& tile);
+
+  /** The number of levels, so that the coarsest level fits into one tile. */
+  unsigned int GetNumberOfLevels() const;
+
+  /** The area of the image (in item coordinates) covered by a tile. */
+  QRectF GetTileRect(const TileKey& key) const;
+
+  ImageType::ConstPointer Image;
+  QSize ImageSize;
+
+  /** Most recently used first. */
+  std::list<Tile> Tiles;
+  std::map<TileKey, std::list<Tile>::iterator> Lookup;
+
+  /** Tiles that are queued or being generated. Only used by the GUI thread. */
+  std::set<TileKey> Pending;
+
+  std::size_t MemoryBudget = 128 * 1024 * 1024;
+  std::size_t MemoryUsage = 0;
+
+  unsigned int UpdateDepth = 0;
+
+  /** Incremented whenever queued tiles become obsolete; tiles of an old version are dropped. */
+  std::atomic<unsigned int> Version;
+
+  QThreadPool TilePool;
+};
+
+#endif